@@ -0,0 +1,446 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <sqlite3.h>
+#include <opencv2/highgui/highgui.hpp>
+#include "coarse_to_fine.h"
+#include "resource_planner.h"
+#include "tracing.h"
+
+// Image pairs sharing this many points of the coarse model are matched at high resolution
+static ulong const MIN_SHARED_POINTS = 15;
+// Features of an image are limited by COLMAP extractor (--SiftExtraction.max_num_features)
+static double const MAX_FEATURES = 8192;
+
+double CoarseToFine::Estimate::total() const {
+    return extraction + matching + mapping + densify;
+}
+
+CoarseToFine::CoarseToFine(fs::path const & image_dir, fs::path const & colmap_bin) :
+        input_dir(image_dir),
+        coarse_dir(image_dir.parent_path() / local_path::COARSE_TO_FINE_PATH / "coarse"),
+        fine_dir(image_dir.parent_path() / local_path::COARSE_TO_FINE_PATH / "fine")
+{
+    feature_extractor_path = colmap_bin / "feature_extractor";
+    sequential_matcher_path = colmap_bin / "sequential_matcher";
+    exhaustive_matcher_path = colmap_bin / "exhaustive_matcher";
+    mapper = colmap_bin / "mapper";
+    matches_importer_path = colmap_bin / "matches_importer";
+    point_triangulator_path = colmap_bin / "point_triangulator";
+    bundle_adjuster_path = colmap_bin / "bundle_adjuster";
+    image_undistorter_path = colmap_bin / "image_undistorter";
+    model_converter_path = colmap_bin / "model_converter";
+}
+
+void CoarseToFine::set_cancel_flag(std::atomic<bool> const * flag) {
+    cancel_flag = flag;
+}
+
+void CoarseToFine::set_sequential(bool const sequential_matching) {
+    sequential = sequential_matching;
+}
+
+void CoarseToFine::set_coarse_size(ulong const size) {
+    coarse_size = size;
+}
+
+void CoarseToFine::set_time_budget(double const seconds, double const ram_budget) {
+    time_budget = seconds;
+    ram_budget_mb = ram_budget;
+}
+
+// Previous step succeeded and the pipeline isn't cancelled
+bool CoarseToFine::proceed() const {
+    return success_on_previous_step && !(cancel_flag && cancel_flag->load());
+}
+
+// Images of directory by extension, size of the first one (images are processed to the same size)
+static ulong images_size(fs::path const & dir, int & width, int & height) {
+    std::vector<fs::path> paths;
+    std::error_code error;
+    for (auto const & entry : fs::directory_iterator(dir, error)) {
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if ((extension == ".jpg") || (extension == ".jpeg") || (extension == ".png")) {
+            paths.push_back(entry.path());
+        }
+    }
+    width = height = 0;
+    if (!paths.empty()) {
+        cv::Mat image = cv::imread(std::min_element(paths.begin(), paths.end())->string());
+        width = image.cols;
+        height = image.rows;
+    }
+    return paths.size();
+}
+
+// Matched pairs and mean keypoints per image of features database
+static bool database_statistics(fs::path const & database, ulong & pairs, double & features) {
+    sqlite3 * db = nullptr;
+    if (sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_stmt * statement = nullptr;
+    bool success = sqlite3_prepare_v2(db, "SELECT (SELECT count(*) FROM matches), "
+                                          "(SELECT avg(rows) FROM keypoints)", -1, &statement, nullptr) == SQLITE_OK;
+    success = success && (sqlite3_step(statement) == SQLITE_ROW);
+    if (success) {
+        pairs = (ulong)sqlite3_column_int64(statement, 0);
+        features = sqlite3_column_double(statement, 1);
+    }
+    sqlite3_finalize(statement);
+    sqlite3_close(db);
+    return success;
+}
+
+// Image and camera ids of every image name of features database
+static bool database_images(fs::path const & database, std::map<std::string, std::pair<long, long>> & images) {
+    sqlite3 * db = nullptr;
+    if (sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_stmt * statement = nullptr;
+    bool success = sqlite3_prepare_v2(db, "SELECT image_id, camera_id, name FROM images", -1, &statement,
+                                      nullptr) == SQLITE_OK;
+    while (success && (sqlite3_step(statement) == SQLITE_ROW)) {
+        std::string name = reinterpret_cast<char const *>(sqlite3_column_text(statement, 2));
+        images[name] = std::make_pair((long)sqlite3_column_int64(statement, 0),
+                                      (long)sqlite3_column_int64(statement, 1));
+    }
+    sqlite3_finalize(statement);
+    sqlite3_close(db);
+    return success;
+}
+
+// Lines of COLMAP text model file without comments
+static std::vector<std::string> model_lines(fs::path const & path, bool const keep_empty) {
+    std::vector<std::string> lines;
+    std::ifstream file(path.string());
+    std::string line;
+    while (std::getline(file, line)) {
+        if ((line.empty() && keep_empty) || (!line.empty() && (line[0] != '#'))) {
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+// Records of binary COLMAP model file (it starts with their number)
+static ulong model_records(fs::path const & path) {
+    std::ifstream binary(path.string(), std::ios::binary);
+    uint64_t count = 0;
+    binary.read(reinterpret_cast<char *>(&count), sizeof(count));
+    return binary ? count : 0;
+}
+
+// ----------- 1. Coarse model on downscaled images -----------
+void CoarseToFine::coarse_model() {
+    std::cout << "1. Coarse model" << std::endl;
+    TraceStage stage("Coarse model");
+    fs::path database = coarse_dir / local_path::DATABASE_PATH;
+    fs::path export_path = coarse_dir / "sparse";
+    fs::remove_all(coarse_dir);
+    fs::create_directories(export_path);
+    double peak_memory_mb = 0;
+
+    // Keypoints of downscaled images are stored in pixels of the processed images
+    std::string database_arg(" --database_path " + database.string());
+    std::string image_path_arg(" --image_path " + input_dir.string());
+    std::string extractor(feature_extractor_path.string() + image_path_arg + database_arg +
+                          " --ImageReader.single_camera 1 --use_gpu 1 --SiftExtraction.max_image_size " +
+                          std::to_string(coarse_size));
+    std::cout << "Run: " << extractor << std::endl;
+    success_on_previous_step = !run_measured(extractor, peak_memory_mb, extraction_seconds, cancel_flag);
+    if (proceed()) {
+        std::string matcher((sequential ? sequential_matcher_path : exhaustive_matcher_path).string() +
+                            database_arg + " --SiftMatching.num_threads 8");
+        std::cout << "Run: " << matcher << std::endl;
+        success_on_previous_step = !run_measured(matcher, peak_memory_mb, matching_seconds, cancel_flag);
+    }
+    if (proceed()) {
+        std::string mapping(mapper.string() + image_path_arg + database_arg + " --export_path " +
+                            export_path.string() + " --Mapper.num_threads 8");
+        std::cout << "Run: " << mapping << std::endl;
+        success_on_previous_step = !run_measured(mapping, peak_memory_mb, mapping_seconds, cancel_flag) &&
+                                   fs::is_directory(export_path / "0");
+    }
+    if (proceed()) {
+        success_on_previous_step = database_statistics(database, coarse_pairs, coarse_features);
+    }
+    stage.count("coarse_size", coarse_size);
+    stage.count("pairs", coarse_pairs);
+    stage.count("features_per_image", coarse_features);
+    stage.count("registered_images", model_records(export_path / "0/images.bin"));
+    stage.file("model", export_path);
+}
+
+// ----------- 2. Pairs of registered images sharing points of the coarse model -----------
+void CoarseToFine::find_guided_pairs() {
+    std::cout << "2. Guided pairs" << std::endl;
+    TraceStage stage("Guided pairs");
+    fs::path text_dir = coarse_dir / "text";
+    fs::create_directories(text_dir);
+    std::string converting(model_converter_path.string() + " --input_path " + (coarse_dir / "sparse/0").string() +
+                           " --output_path " + text_dir.string() + " --output_type TXT");
+    std::cout << "Run: " << converting << std::endl;
+    success_on_previous_step = !run_traced(converting, cancel_flag);
+    if (!proceed()) {
+        return;
+    }
+    // Image line: IMAGE_ID, QW, QX, QY, QZ, TX, TY, TZ, CAMERA_ID, NAME (then line of its points)
+    std::map<long, std::string> names;
+    std::vector<std::string> lines = model_lines(text_dir / "images.txt", true);
+    for (ulong i = 0; i < lines.size(); i += 2) {
+        std::istringstream words(lines[i]);
+        long id = 0;
+        std::string word, name;
+        words >> id;
+        for (int k = 0; k < 8; ++k) {
+            words >> word;
+        }
+        if (words >> name) {
+            names[id] = name;
+        }
+    }
+    // Point line: POINT3D_ID, X, Y, Z, R, G, B, ERROR, then (IMAGE_ID, POINT2D_IDX) pairs of the track
+    std::map<std::pair<long, long>, ulong> shared;
+    coarse_points = 0;
+    for (auto const & line : model_lines(text_dir / "points3D.txt", false)) {
+        std::istringstream words(line);
+        double value = 0;
+        for (int k = 0; k < 8; ++k) {
+            words >> value;
+        }
+        std::set<long> track;
+        long image_id = 0, point2d = 0;
+        while (words >> image_id >> point2d) {
+            track.insert(image_id);
+        }
+        for (auto a = track.begin(); a != track.end(); ++a) {
+            for (auto b = std::next(a); b != track.end(); ++b) {
+                ++shared[std::make_pair(*a, *b)];
+            }
+        }
+        ++coarse_points;
+    }
+    registered = names.size();
+    guided_pairs.clear();
+    std::string list;
+    for (auto const & pair : shared) {
+        if ((pair.second >= MIN_SHARED_POINTS) && names.count(pair.first.first) && names.count(pair.first.second)) {
+            guided_pairs.push_back(std::make_pair(names[pair.first.first], names[pair.first.second]));
+            list += guided_pairs.back().first + " " + guided_pairs.back().second + "\n";
+        }
+    }
+    fs::create_directories(fine_dir);
+    std::ofstream((fine_dir / "pairs.txt").string()) << list;
+    success_on_previous_step = !guided_pairs.empty();
+    printf("Coarse model: %lu of %lu images registered, %lu points, %lu guided pairs (%lu matched)\n", registered,
+           images, coarse_points, guided_pairs.size(), coarse_pairs);
+    stage.count("registered_images", registered);
+    stage.count("points", coarse_points);
+    stage.count("guided_pairs", guided_pairs.size());
+    stage.file("pairs", fine_dir / "pairs.txt");
+}
+
+// Fine steps at the resolution, from the coarse measurements
+CoarseToFine::Estimate CoarseToFine::estimate(ulong const size) const {
+    Estimate result;
+    result.size = size;
+    double const max_side = std::max(1, std::max(image_width, image_height));
+    double const coarse_side = std::min((double)coarse_size, max_side);
+    double const pixels_ratio = (size / coarse_side) * (size / coarse_side);
+    // Features grow with pixels up to the extractor limit, matching of a pair is quadratic in them
+    double features_ratio = pixels_ratio;
+    if (coarse_features > 0) {
+        features_ratio = std::max(1.0, std::min(MAX_FEATURES, coarse_features * pixels_ratio) / coarse_features);
+    }
+    result.extraction = extraction_seconds * pixels_ratio;
+    if (coarse_pairs > 0) {
+        result.matching = matching_seconds * guided_pairs.size() / coarse_pairs * features_ratio * features_ratio;
+    }
+    // Triangulation and bundle adjustment of more observations (no incremental registration: upper bound)
+    result.mapping = mapping_seconds * features_ratio;
+    double const scale = size / max_side;
+    ResourcePlanner planner(registered, image_width * image_height * scale * scale,
+                            ulong(coarse_points * features_ratio), ram_budget_mb);
+    result.densify = planner.plan_densify().seconds;
+    return result;
+}
+
+// ----------- 3. The largest resolution which fits the time budget -----------
+void CoarseToFine::choose_resolution(double const elapsed_seconds) {
+    std::cout << "3. Fine resolution" << std::endl;
+    TraceStage stage("Fine resolution");
+    // Processed size and sizes halved by sqrt(2) steps, not below the coarse one
+    std::vector<ulong> sizes;
+    ulong const max_side = (ulong)std::max(image_width, image_height);
+    for (double size = max_side; size >= std::min((double)coarse_size, (double)max_side); size /= std::sqrt(2.0)) {
+        sizes.push_back(ulong(std::round(size)));
+    }
+    double const left = time_budget - elapsed_seconds;
+    fine_size = sizes.back();
+    Estimate chosen = estimate(fine_size);
+    for (auto size : sizes) {
+        Estimate current = estimate(size);
+        printf("Size %lu: extraction %.0f sec, matching %.0f sec, mapping %.0f sec, densify %.0f sec, "
+               "total %.0f sec\n", size, current.extraction, current.matching, current.mapping, current.densify,
+               current.total());
+        if ((time_budget <= 0) || (current.total() <= left)) {
+            fine_size = size;
+            chosen = current;
+            break;
+        }
+    }
+    if (time_budget > 0) {
+        printf("Fine size %lu of %lu: estimated %.0f sec, %.0f sec of %.0f sec budget left\n", fine_size, max_side,
+               chosen.total(), left, time_budget);
+    }
+    stage.count("fine_size", fine_size);
+    stage.count("estimated_seconds", chosen.total());
+    stage.count("budget_left_seconds", left);
+}
+
+// ----------- 4. Features of the chosen resolution, matches of guided pairs -----------
+void CoarseToFine::fine_matching() {
+    std::cout << "4. Fine features and guided matching" << std::endl;
+    TraceStage stage("Fine matching");
+    fs::path database = fine_dir / local_path::DATABASE_PATH;
+    fs::remove(database);
+    std::string database_arg(" --database_path " + database.string());
+    std::string extractor(feature_extractor_path.string() + " --image_path " + input_dir.string() + database_arg +
+                          " --ImageReader.single_camera 1 --use_gpu 1 --SiftExtraction.max_image_size " +
+                          std::to_string(fine_size));
+    std::cout << "Run: " << extractor << std::endl;
+    success_on_previous_step = !run_traced(extractor, cancel_flag);
+    if (proceed()) {
+        std::string matcher(matches_importer_path.string() + database_arg + " --match_list_path " +
+                            (fine_dir / "pairs.txt").string() + " --match_type pairs --SiftMatching.num_threads 8");
+        std::cout << "Run: " << matcher << std::endl;
+        success_on_previous_step = !run_traced(matcher, cancel_flag);
+    }
+    stage.count("pairs", guided_pairs.size());
+    stage.file("database", database);
+}
+
+// ----------- 5. Triangulation with the coarse poses and bundle adjustment -----------
+void CoarseToFine::refine_poses() {
+    std::cout << "5. Pose refinement" << std::endl;
+    TraceStage stage("Pose refinement");
+    std::map<std::string, std::pair<long, long>> fine_images;
+    if (!database_images(fine_dir / local_path::DATABASE_PATH, fine_images)) {
+        success_on_previous_step = false;
+        return;
+    }
+    // Coarse poses with ids of the fine database and without points
+    fs::path known_dir = fine_dir / "known";
+    fs::create_directories(known_dir);
+    std::map<long, long> camera_ids;
+    std::string images_text;
+    std::vector<std::string> lines = model_lines(coarse_dir / "text/images.txt", true);
+    for (ulong i = 0; i < lines.size(); i += 2) {
+        std::istringstream words(lines[i]);
+        std::vector<std::string> fields;
+        std::string word;
+        while (words >> word) {
+            fields.push_back(word);
+        }
+        if ((fields.size() < 10) || !fine_images.count(fields[9])) {
+            continue;
+        }
+        std::pair<long, long> const & ids = fine_images[fields[9]];
+        camera_ids[std::stol(fields[8])] = ids.second;
+        images_text += std::to_string(ids.first);
+        for (int k = 1; k < 8; ++k) {
+            images_text += " " + fields[k];
+        }
+        images_text += " " + std::to_string(ids.second) + " " + fields[9] + "\n\n";
+    }
+    // Camera line: CAMERA_ID, MODEL, WIDTH, HEIGHT, PARAMS (refined by the coarse model, in processed pixels)
+    std::string cameras_text;
+    for (auto const & line : model_lines(coarse_dir / "text/cameras.txt", false)) {
+        std::istringstream words(line);
+        long id = 0;
+        std::string rest;
+        words >> id;
+        std::getline(words, rest);
+        if (camera_ids.count(id)) {
+            cameras_text += std::to_string(camera_ids[id]) + rest + "\n";
+        }
+    }
+    std::ofstream((known_dir / "images.txt").string()) << images_text;
+    std::ofstream((known_dir / "cameras.txt").string()) << cameras_text;
+    std::ofstream((known_dir / "points3D.txt").string());
+
+    fs::path model_dir = fine_dir / "sparse/0";
+    fs::create_directories(model_dir);
+    std::string triangulator(point_triangulator_path.string() + " --database_path " +
+                             (fine_dir / local_path::DATABASE_PATH).string() + " --image_path " +
+                             input_dir.string() + " --input_path " + known_dir.string() + " --output_path " +
+                             model_dir.string());
+    std::cout << "Run: " << triangulator << std::endl;
+    success_on_previous_step = !images_text.empty() && !run_traced(triangulator, cancel_flag);
+    if (proceed()) {
+        std::string adjuster(bundle_adjuster_path.string() + " --input_path " + model_dir.string() +
+                             " --output_path " + model_dir.string());
+        std::cout << "Run: " << adjuster << std::endl;
+        success_on_previous_step = !run_traced(adjuster, cancel_flag);
+    }
+    stage.count("registered_images", model_records(model_dir / "images.bin"));
+    stage.count("sparse_points", model_records(model_dir / "points3D.bin"));
+    stage.file("model", model_dir);
+}
+
+// ----------- 6. Undistorted images of the chosen resolution and NVM model -----------
+fs::path CoarseToFine::dense_input() {
+    std::cout << "6. Image undistorter and model converter" << std::endl;
+    TraceStage stage("Image undistortion");
+    fs::path dense_dir = fine_dir / "dense";
+    fs::create_directories(dense_dir);
+    std::string undistorting(image_undistorter_path.string() + " --image_path " + input_dir.string() +
+                             " --input_path " + (fine_dir / "sparse/0").string() + " --output_path " +
+                             dense_dir.string() + " --output_type COLMAP --max_image_size " +
+                             std::to_string(fine_size));
+    std::cout << "Run: " << undistorting << std::endl;
+    success_on_previous_step = !run_traced(undistorting, cancel_flag);
+    // Cameras of the undistorted model are scaled to the undistorted images
+    fs::path nvm_path = dense_dir / "images/model.nvm";
+    if (proceed()) {
+        std::string converting(model_converter_path.string() + " --input_path " + (dense_dir / "sparse").string() +
+                               " --output_path " + nvm_path.string() + " --output_type nvm");
+        std::cout << "Run: " << converting << std::endl;
+        success_on_previous_step = !run_traced(converting, cancel_flag);
+    }
+    stage.count("size", fine_size);
+    stage.file("nvm", nvm_path);
+    return proceed() ? nvm_path : fs::path();
+}
+
+// Whole coarse-to-fine SfM: path to NVM model (empty on failure)
+fs::path CoarseToFine::run() {
+    auto start = std::chrono::steady_clock::now();
+    success_on_previous_step = true;
+    images = images_size(input_dir, image_width, image_height);
+    if ((images < 2) || (image_width == 0)) {
+        std::cerr << "Coarse-to-fine: no images in " << input_dir << std::endl;
+        return fs::path();
+    }
+    if (proceed()) coarse_model();
+    if (proceed()) find_guided_pairs();
+    if (proceed()) {
+        choose_resolution(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    if (proceed()) fine_matching();
+    if (proceed()) refine_poses();
+    if (proceed()) return dense_input();
+    return fs::path();
+}
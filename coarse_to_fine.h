@@ -0,0 +1,119 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_COARSE_TO_FINE_H
+#define RECONSTRUCTION_COARSE_TO_FINE_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+// Coarse-to-fine SfM: poses at low resolution, then refined at the resolution the time budget allows
+//
+// 1. Coarse model: COLMAP extraction on heavily downscaled images (--SiftExtraction.max_image_size, keypoints
+//    are in pixels of the full images), sequential or exhaustive matching and mapping. It is a fast pose estimate.
+// 2. Guided pairs: pairs of registered images which share enough points of the coarse model. Only they are
+//    matched at high resolution.
+// 3. Resolution: the largest side (the processed size and sizes halved by sqrt(2) steps) whose estimated time
+//    of fine extraction, matching, triangulation and densifying fits the budget left after the coarse model.
+//    Estimates are the measured coarse steps scaled by pixels and features (see Estimate), densifying is
+//    planned by ResourcePlanner.
+// 4. Fine features of the chosen size into a new database, guided pairs are matched by matches_importer.
+// 5. Poses: the coarse model with empty tracks (ids of the new database) is triangulated by point_triangulator,
+//    then poses, intrinsics and points are refined by bundle_adjuster.
+// 6. Undistorted images of the chosen size and NVM model of the undistorted cameras for OpenMVS.
+//
+// Images the coarse model doesn't register are left out. Without budget the processed size is chosen.
+
+class CoarseToFine {
+public:
+    // Estimated seconds of the fine steps at one resolution (larger image side)
+    struct Estimate {
+        ulong size = 0;
+        double extraction = 0;
+        double matching = 0;
+        double mapping = 0;
+        double densify = 0;
+
+        double total() const;
+    };
+private:
+    fs::path input_dir;
+    fs::path coarse_dir;
+    fs::path fine_dir;
+    fs::path feature_extractor_path;
+    fs::path sequential_matcher_path;
+    fs::path exhaustive_matcher_path;
+    fs::path mapper;
+    fs::path matches_importer_path;
+    fs::path point_triangulator_path;
+    fs::path bundle_adjuster_path;
+    fs::path image_undistorter_path;
+    fs::path model_converter_path;
+    bool sequential = false;
+    ulong coarse_size = 640;
+    double time_budget = 0;
+    double ram_budget_mb = 0;
+    bool success_on_previous_step = true;
+    std::atomic<bool> const * cancel_flag = nullptr;
+    // Measured by the coarse model
+    double extraction_seconds = 0;
+    double matching_seconds = 0;
+    double mapping_seconds = 0;
+    ulong coarse_pairs = 0;
+    double coarse_features = 0;
+    ulong coarse_points = 0;
+    ulong registered = 0;
+    // Processed images
+    ulong images = 0;
+    int image_width = 0;
+    int image_height = 0;
+    std::vector<std::pair<std::string, std::string>> guided_pairs;
+    ulong fine_size = 0;
+
+    // Previous step succeeded and the pipeline isn't cancelled
+    bool proceed() const;
+
+    // 1. Extraction, matching and mapping on downscaled images
+    void coarse_model();
+
+    // 2. Pairs of registered images sharing points of the coarse model
+    void find_guided_pairs();
+
+    // 3. The largest resolution which fits the time budget
+    void choose_resolution(double const elapsed_seconds);
+
+    // 4. Features of the chosen resolution, matches of guided pairs
+    void fine_matching();
+
+    // 5. Triangulation with the coarse poses and bundle adjustment
+    void refine_poses();
+
+    // 6. Undistorted images of the chosen resolution and NVM model: path to NVM model
+    fs::path dense_input();
+public:
+    explicit CoarseToFine(fs::path const & image_dir, fs::path const & colmap_bin);
+
+    // Running tool is terminated and no further step is started once the flag is set
+    void set_cancel_flag(std::atomic<bool> const * flag);
+
+    // Matching of the coarse model, exhaustive by default
+    void set_sequential(bool const sequential_matching);
+
+    // Larger side of coarse images (640 by default)
+    void set_coarse_size(ulong const size);
+
+    // Seconds for the coarse model, fine SfM and densifying (0 - the processed resolution). RAM budget of
+    // densifying in MB (0 - 75% of physical memory)
+    void set_time_budget(double const seconds, double const ram_budget);
+
+    // Fine steps at the resolution, from the coarse measurements
+    Estimate estimate(ulong const size) const;
+
+    // Whole coarse-to-fine SfM: path to NVM model (empty on failure)
+    fs::path run();
+};
+
+#endif //RECONSTRUCTION_COARSE_TO_FINE_H
@@ -2,7 +2,12 @@
 // Created by user on 8/6/17.
 //
 
+#include <algorithm>
+#include <fstream>
+#include <sstream>
 #include "colmap.h"
+#include "sharded_matching.h"
+#include "tracing.h"
 
 // Constructor
 Colmap::Colmap(std::string const & image_dir, std::string const & colmap_bin_dir) :
@@ -18,6 +23,70 @@ Colmap::Colmap(std::string const & image_dir, std::string const & colmap_bin_dir
     mapper = colmap_bin / "mapper";
     image_undistorter_path = colmap_bin / "image_undistorter";
     model_converter_path = colmap_bin / "model_converter";
+    vocab_tree_matcher_path = colmap_bin / "vocab_tree_matcher";
+    matches_importer_path = colmap_bin / "matches_importer";
+}
+
+void Colmap::set_cancel_flag(std::atomic<bool> const * flag) {
+    cancel_flag = flag;
+}
+
+// Retrieval-based matching (vocab_tree_matcher) with this vocabulary tree instead of exhaustive matching
+void Colmap::set_vocab_tree(fs::path const & path) {
+    vocab_tree = path;
+}
+
+// Features are already in the database (in-process extraction): extraction step only gives the database to the runs
+void Colmap::set_features_in_database(bool const in_database) {
+    features_in_database = in_database;
+}
+
+// Exhaustive matching is sharded over this many local worker processes (0 - exhaustive_matcher)
+void Colmap::set_match_workers(ulong const workers, fs::path const & executable) {
+    match_workers = workers;
+    match_worker_executable = executable;
+}
+
+fs::path Colmap::run_dir(bool const sequential) const {
+    return sequential ? sequential_dir : exhaustive_dir;
+}
+
+// Previous step succeeded and the pipeline isn't cancelled
+bool Colmap::proceed() const {
+    return success_on_previous_step && !(cancel_flag && cancel_flag->load());
+}
+
+// Images of directory by extension (database and other files are skipped)
+static ulong images_count(fs::path const & dir) {
+    ulong count = 0;
+    std::error_code error;
+    for (auto const & entry : fs::directory_iterator(dir, error)) {
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if ((extension == ".jpg") || (extension == ".jpeg") || (extension == ".png") || (extension == ".tif") ||
+            (extension == ".tiff") || (extension == ".bmp")) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+// Records of COLMAP model ("cameras", "images", "points3D"): binary file starts with their number,
+// text file has a line per record (two per image) after comments
+static ulong model_records_count(fs::path const & model_dir, std::string const & name) {
+    std::ifstream binary((model_dir / (name + ".bin")).string(), std::ios::binary);
+    uint64_t count = 0;
+    if (binary.read(reinterpret_cast<char *>(&count), sizeof(count))) {
+        return count;
+    }
+    std::ifstream text((model_dir / (name + ".txt")).string());
+    std::string line;
+    while (std::getline(text, line)) {
+        if (!line.empty() && (line[0] != '#')) {
+            ++count;
+        }
+    }
+    return (name == "images") ? count / 2 : count;
 }
 
 // COLMAP SFM pipeline (https://colmap.github.io/tutorial.html#structure-from-motion)
@@ -30,6 +99,8 @@ Colmap::Colmap(std::string const & image_dir, std::string const & colmap_bin_dir
 // ----------- 1. Perform feature extraction for a set of images. -----------
 void Colmap::extract_features() {
     std::cout << "1. Extract features" << std::endl;
+    TraceStage stage("Extract features");
+    stage.count("images", images_count(input_dir));
 
     // Prepare args for feature extractor
     std::string database_arg(" --database_path " + database.string());
@@ -40,8 +111,15 @@ void Colmap::extract_features() {
     // Run colmap feature extractor
     std::string feature_extractor(feature_extractor_path.string() +
                                           image_path_arg + database_arg + single_camera_arg + use_gpu_arg);
-    std::cout << "Run: " << feature_extractor << std::endl;
-    success_on_previous_step = !system(feature_extractor.c_str());
+    if (features_in_database) {
+        std::cout << "Features are extracted in process" << std::endl;
+        success_on_previous_step = fs::exists(database);
+    } else {
+        std::cout << "Run: " << feature_extractor << std::endl;
+        success_on_previous_step = !run_traced(feature_extractor, cancel_flag);
+    }
+    features_extracted = success_on_previous_step;
+    stage.file("database", database);
 
     // Copy features database to sequential and exhaustive dirs
     fs::copy(database, sequential_dir / local_path::DATABASE_PATH, fs::copy_options::overwrite_existing);
@@ -51,11 +129,28 @@ void Colmap::extract_features() {
 // ----------- 2. Perform feature matching after performing feature extraction. -----------
 void Colmap::feature_matching(bool const sequential) {
     std::cout << "2. Matching" << std::endl;
+    bool retrieval = !sequential && !vocab_tree.empty();
+    if (!sequential && !retrieval && (match_workers > 0)) {
+        // Blocks of pairs are matched by worker processes, their matches are merged into the database
+        TraceStage stage("Sharded matching");
+        fs::path current_database = exhaustive_dir / local_path::DATABASE_PATH;
+        ShardedMatching sharded(current_database, exhaustive_dir / "shards", matches_importer_path,
+                                match_worker_executable, match_workers);
+        sharded.set_cancel_flag(cancel_flag);
+        success_on_previous_step = sharded.run();
+        stage.file("database", current_database);
+        return;
+    }
+    TraceStage stage(sequential ? "Sequential matching" : (retrieval ? "Retrieval matching" : "Exhaustive matching"));
     fs::path current_database;
     std::string matcher;
     if (sequential) {
         current_database = sequential_dir / local_path::DATABASE_PATH;
         matcher = sequential_matcher_path.string();
+    } else if (retrieval) {
+        // Every image is matched to its nearest images by vocabulary tree instead of all of them
+        current_database = exhaustive_dir / local_path::DATABASE_PATH;
+        matcher = vocab_tree_matcher_path.string() + " --VocabTreeMatching.vocab_tree_path " + vocab_tree.string();
     } else {
         current_database = exhaustive_dir / local_path::DATABASE_PATH;
         matcher = exhaustive_matcher_path.string();
@@ -68,13 +163,15 @@ void Colmap::feature_matching(bool const sequential) {
     // Run colmap sequential matcher
     matcher += (database_arg + num_threads);
     std::cout << "Run: " << matcher << std::endl;
-    success_on_previous_step = !system(matcher.c_str());
+    success_on_previous_step = !run_traced(matcher, cancel_flag);
+    stage.file("database", current_database);
 }
 
 // ----------- 3. Sparse 3D reconstruction / mapping of the dataset using SfM
 //                             after performing feature extraction and matching. -----------
 void Colmap::sparse_reconstruction(fs::path const & working_dir) {
     std::cout << "3. Sparse reconstruction" << std::endl;
+    TraceStage stage("Sparse reconstruction");
     fs::path current_database;
     current_database = working_dir / local_path::DATABASE_PATH;
 
@@ -90,12 +187,17 @@ void Colmap::sparse_reconstruction(fs::path const & working_dir) {
     // Run colmap sparse reconstruction
     std::string sparse_reconstructor(mapper.string() + image_path_arg + database_arg + export_path_arg + num_threads);
     std::cout << "Run: " << sparse_reconstructor << std::endl;
-    success_on_previous_step = !system(sparse_reconstructor.c_str()) && !fs::is_empty(export_path);
+    success_on_previous_step = !run_traced(sparse_reconstructor, cancel_flag) && !fs::is_empty(export_path);
+    // The first (largest) model is the one used further
+    stage.count("registered_images", model_records_count(export_path / "0", "images"));
+    stage.count("sparse_points", model_records_count(export_path / "0", "points3D"));
+    stage.file("model", export_path);
 }
 
 // ----------- 4. Remove the distortion from images -----------
 void Colmap::image_undistorting(fs::path const & working_dir) {
     std::cout << "4. Image undistorter" << std::endl;
+    TraceStage stage("Image undistortion");
 
     // Prepare args for image undistorting
     std::string image_path_arg(" --image_path " + input_dir.string());
@@ -108,12 +210,15 @@ void Colmap::image_undistorting(fs::path const & working_dir) {
     std::string undistorting(image_undistorter_path.string() +
                                      image_path_arg + input_path_arg + output_path_arg + output_type_arg);
     std::cout << "Run: " << undistorting << std::endl;
-    success_on_previous_step = !system(undistorting.c_str());
+    success_on_previous_step = !run_traced(undistorting, cancel_flag);
+    stage.count("images", images_count(working_dir / "dense/images"));
+    stage.file("dense", working_dir / "dense");
 }
 
 // ----------- 5. Convert COLMAP model to OpenVMS format -----------
 fs::path Colmap::model_converting(fs::path const & working_dir) {
     std::cout << "5. Model converter" << std::endl;
+    TraceStage stage("Model conversion");
 
     // Prepare args model converting from NVM to MVS
     std::string input_path_arg(" --input_path " + working_dir.string() + "/sparse/0");
@@ -123,26 +228,107 @@ fs::path Colmap::model_converting(fs::path const & working_dir) {
     // Run colmap model converting
     std::string converting(model_converter_path.string() + input_path_arg + nvm_model_path + output_type_arg);
     std::cout << "Run: " << converting << std::endl;
-    success_on_previous_step = !system(converting.c_str());
+    success_on_previous_step = !run_traced(converting, cancel_flag);
+    stage.file("nvm", working_dir / "dense/images/model.nvm");
     return working_dir / "dense/images/model.nvm";
 }
 
 
-// ----------- Structure from Motion pipeline -----------
-fs::path Colmap::sfm(bool sequential) {
-    if (success_on_previous_step) extract_features();
-    if (success_on_previous_step) feature_matching(sequential);
-    fs::path working_dir;
-    if (sequential) {
-        working_dir = sequential_dir;
-    } else {
-        working_dir = exhaustive_dir;
+// Points of COLMAP model: their number, sum of mean reprojection errors and of track lengths.
+// Binary record: id, xyz, rgb, error, track length and (image id, point2D index) pairs of the track.
+// Text line: id, x, y, z, r, g, b, error and the pairs
+static bool points_statistics(fs::path const & model_dir, ulong & points, double & error_sum, double & track_sum) {
+    points = 0;
+    error_sum = track_sum = 0;
+    std::ifstream binary((model_dir / "points3D.bin").string(), std::ios::binary);
+    uint64_t count = 0;
+    if (binary.read(reinterpret_cast<char *>(&count), sizeof(count))) {
+        for (uint64_t i = 0; i < count; ++i) {
+            double error = 0;
+            uint64_t track_length = 0;
+            binary.seekg(sizeof(uint64_t) + 3 * sizeof(double) + 3, std::ios::cur);
+            binary.read(reinterpret_cast<char *>(&error), sizeof(error));
+            binary.read(reinterpret_cast<char *>(&track_length), sizeof(track_length));
+            binary.seekg(track_length * 2 * sizeof(uint32_t), std::ios::cur);
+            if (!binary) {
+                return false;
+            }
+            ++points;
+            error_sum += error;
+            track_sum += track_length;
+        }
+        return true;
+    }
+    std::ifstream text((model_dir / "points3D.txt").string());
+    std::string line;
+    while (std::getline(text, line)) {
+        if (line.empty() || (line[0] == '#')) {
+            continue;
+        }
+        std::istringstream words(line);
+        double value = 0, error = 0;
+        for (int k = 0; k < 7; ++k) {
+            words >> value;
+        }
+        words >> error;
+        ulong values = 0;
+        while (words >> value) {
+            ++values;
+        }
+        ++points;
+        error_sum += error;
+        track_sum += values / 2;
+    }
+    return bool(text.eof());
+}
+
+// Quality of the sparse model of the matching (the largest one, zero score if there is none)
+Colmap::ModelQuality Colmap::model_quality(bool const sequential) const {
+    ModelQuality quality;
+    fs::path model_dir = run_dir(sequential) / "sparse/0";
+    quality.images = images_count(input_dir);
+    double error_sum = 0, track_sum = 0;
+    if (!fs::is_directory(model_dir) || (quality.images == 0) ||
+        !points_statistics(model_dir, quality.points, error_sum, track_sum) || (quality.points == 0)) {
+        return quality;
     }
-    if (success_on_previous_step) sparse_reconstruction(working_dir);
-    if (success_on_previous_step) image_undistorting(working_dir);
-    if (success_on_previous_step) {
+    quality.registered = model_records_count(model_dir, "images");
+    quality.registered_ratio = std::min(1.0, (double)quality.registered / quality.images);
+    quality.reprojection_error = error_sum / quality.points;
+    quality.track_length = track_sum / quality.points;
+    double error_term = std::min(1.0, std::max(0.0, (3.0 - quality.reprojection_error) / 2.0));
+    double track_term = std::min(1.0, std::max(0.0, (quality.track_length - 2.0) / 2.0));
+    quality.score = quality.registered_ratio * (0.6 + 0.2 * error_term + 0.2 * track_term);
+    return quality;
+}
+
+// ----------- Steps 1-3: features (once) and sparse model of the matching -----------
+bool Colmap::sparse_model(bool const sequential) {
+    // Failed matching of another run doesn't stop this one
+    success_on_previous_step = true;
+    if (!features_extracted && proceed()) extract_features();
+    if (proceed()) feature_matching(sequential);
+    if (proceed()) sparse_reconstruction(run_dir(sequential));
+    return proceed();
+}
+
+// ----------- Steps 4-5 for the sparse model of the matching -----------
+fs::path Colmap::dense_model(bool const sequential) {
+    fs::path working_dir = run_dir(sequential);
+    success_on_previous_step = fs::is_directory(working_dir / "sparse/0");
+    if (proceed()) image_undistorting(working_dir);
+    if (proceed()) {
         return model_converting(working_dir);
     } else {
         return fs::path();
     }
 }
+
+// ----------- Structure from Motion pipeline -----------
+fs::path Colmap::sfm(bool sequential) {
+    TraceStage stage("COLMAP");
+    if (!sparse_model(sequential)) {
+        return fs::path();
+    }
+    return dense_model(sequential);
+}
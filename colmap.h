@@ -5,6 +5,7 @@
 #ifndef RECONSTRUCTION_COLMAP_H
 #define RECONSTRUCTION_COLMAP_H
 
+#include <atomic>
 #include "utils.h"
 
 // COLMAP SFM pipeline (https://colmap.github.io/tutorial.html#structure-from-motion)
@@ -13,8 +14,25 @@
 // 3. Sparse reconstruction (camera positions, sparse point cloud, 2D-3D projections)
 // 4. Image undistortion for correct dense reconstruction
 // 5. Convert COLMAP data to NVM format. Then convert NVM to MVS format.
+//
+// Steps 1-3 (sparse model) and 4-5 (input of dense reconstruction) can run apart, so the sparse model of one
+// matching can be scored and another matching tried before one model goes further. Features are extracted once.
 
 class Colmap {
+public:
+    // Sparse model quality. Score (0..1) is the registered images ratio lowered by up to 20% for mean
+    // reprojection error (1 px and less - full, 3 px and more - none) and up to 20% for mean track length
+    // (4 images and more - full, 2 - none)
+    struct ModelQuality {
+        ulong images = 0;
+        ulong registered = 0;
+        ulong points = 0;
+        double registered_ratio = 0;
+        double reprojection_error = 0;
+        double track_length = 0;
+        double score = 0;
+    };
+private:
     fs::path input_dir;
     fs::path database;
     fs::path sequential_dir;
@@ -25,7 +43,18 @@ class Colmap {
     fs::path mapper;
     fs::path image_undistorter_path;
     fs::path model_converter_path;
+    fs::path vocab_tree_matcher_path;
+    fs::path matches_importer_path;
+    fs::path vocab_tree;
+    ulong match_workers = 0;
+    fs::path match_worker_executable;
+    bool features_extracted = false;
+    bool features_in_database = false;
     bool success_on_previous_step = true;
+    std::atomic<bool> const * cancel_flag = nullptr;
+
+    // Previous step succeeded and the pipeline isn't cancelled
+    bool proceed() const;
 
     // 1. Perform feature extraction for a set of images.
     void extract_features();
@@ -41,12 +70,37 @@ class Colmap {
 
     // 5. Convert COLMAP model to OpenVMS format
     fs::path model_converting(fs::path const & working_dir);
+
+    fs::path run_dir(bool const sequential) const;
 public:
     // Constructor
     explicit Colmap(std::string const & image_dir, std::string const & colmap_bin_dir);
 
+    // Running tool is terminated and no further step is started once the flag is set
+    void set_cancel_flag(std::atomic<bool> const * flag);
+
+    // Retrieval-based matching (vocab_tree_matcher) with this vocabulary tree instead of exhaustive matching
+    void set_vocab_tree(fs::path const & path);
+
+    // Features are already in the database (in-process extraction, see sift_extractor.h): extraction step only
+    // gives the database to the runs
+    void set_features_in_database(bool const in_database);
+
+    // Exhaustive matching is sharded over this many local worker processes (0 - exhaustive_matcher) of the
+    // Reconstruction executable, see sharded_matching.h
+    void set_match_workers(ulong const workers, fs::path const & executable);
+
     // Structure from Motion pipeline
     fs::path sfm(bool const sequential);
+
+    // Steps 1-3: features (once) and sparse model of the matching. False if there is no model
+    bool sparse_model(bool const sequential);
+
+    // Steps 4-5 for the sparse model of the matching: path to NVM model (empty on failure)
+    fs::path dense_model(bool const sequential);
+
+    // Quality of the sparse model of the matching (the largest one, zero score if there is none)
+    ModelQuality model_quality(bool const sequential) const;
 };
 
 #endif //RECONSTRUCTION_COLMAP_H
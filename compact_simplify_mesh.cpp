@@ -0,0 +1,562 @@
+//
+// Created by user on 10/18/26.
+//
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include "compact_simplify_mesh.h"
+
+CompactMeshSimplify::CompactMeshSimplify(ulong const v_count, ulong const t_count) {
+    points.reserve(v_count);
+    faces.reserve(t_count);
+}
+
+// Work directly on external arrays of 3 floats per vertex and 3 indices per face
+void CompactMeshSimplify::attach(Point * vertices, ulong const v_count, Face * triangles, ulong const t_count) {
+    points.attach(vertices, v_count);
+    faces.attach(triangles, t_count);
+}
+
+// Bytes of owned mesh arrays and of working arrays of the last simplification
+ulong CompactMeshSimplify::memory_usage() const {
+    return points.capacity() * sizeof(Point) + faces.capacity() * sizeof(Face) + working_memory;
+}
+
+// Bytes of working arrays for a mesh of this size
+ulong CompactMeshSimplify::working_memory_estimate(ulong const v_count, ulong const t_count) {
+    return v_count * (sizeof(Adjacency) + sizeof(uint8_t) + sizeof(SymmetricMatrix)) +
+           t_count * (sizeof(Errors) + sizeof(uint8_t) + sizeof(Point)) +
+           (t_count * 3 + t_count * 3 / 4 + 1024) * sizeof(uint32_t);
+}
+
+// Working arrays of the next simplification and owned positions and faces are memory mapped files
+// in this directory (empty - RAM)
+void CompactMeshSimplify::set_scratch_directory(std::string const & directory) {
+    scratch_directory = directory;
+    points.set_directory(directory);
+    faces.set_directory(directory);
+}
+
+// Interleaved bits of 10-bit coordinates: position on Z-order curve
+static uint64_t morton_code(uint32_t const x, uint32_t const y, uint32_t const z) {
+    uint64_t code = 0;
+    for (int bit = 0; bit < 10; ++bit) {
+        code |= (uint64_t((x >> bit) & 1) << (3 * bit)) | (uint64_t((y >> bit) & 1) << (3 * bit + 1)) |
+                (uint64_t((z >> bit) & 1) << (3 * bit + 2));
+    }
+    return code;
+}
+
+// Vertices and faces in Morton order of positions
+void CompactMeshSimplify::spatial_sort() {
+    long const v_count = points.size();
+    if (v_count == 0) {
+        return;
+    }
+    float min_x = points[0].x, min_y = points[0].y, min_z = points[0].z;
+    float max_x = min_x, max_y = min_y, max_z = min_z;
+    #pragma omp parallel for reduction(min: min_x, min_y, min_z) reduction(max: max_x, max_y, max_z)
+    for (long i = 0; i < v_count; ++i) {
+        min_x = std::min(min_x, points[i].x); max_x = std::max(max_x, points[i].x);
+        min_y = std::min(min_y, points[i].y); max_y = std::max(max_y, points[i].y);
+        min_z = std::min(min_z, points[i].z); max_z = std::max(max_z, points[i].z);
+    }
+    double extent = std::max(max_x - min_x, std::max(max_y - min_y, max_z - min_z));
+    double scale = 1023.0 / std::max(1e-30, extent);
+
+    // Morton code in high bits, old index in low 32 bits
+    Array<uint64_t> order = make_array<uint64_t>();
+    order.resize(v_count);
+    #pragma omp parallel for
+    for (long i = 0; i < v_count; ++i) {
+        uint64_t code = morton_code(uint32_t((points[i].x - min_x) * scale),
+                                    uint32_t((points[i].y - min_y) * scale),
+                                    uint32_t((points[i].z - min_z) * scale));
+        order[i] = (code << 32) | uint64_t(i);
+    }
+    std::sort(order.begin(), order.end());
+
+    // Points are moved through a copy, new index of every old one is kept for faces
+    Array<uint32_t> new_index = make_array<uint32_t>();
+    new_index.resize(v_count);
+    {
+        Array<Point> sorted = make_array<Point>();
+        sorted.resize(v_count);
+        #pragma omp parallel for
+        for (long i = 0; i < v_count; ++i) {
+            uint32_t old = uint32_t(order[i] & 0xffffffffu);
+            sorted[i] = points[old];
+            new_index[old] = i;
+        }
+        std::copy(sorted.begin(), sorted.end(), points.begin());
+    }
+    order = make_array<uint64_t>();
+
+    // Faces in order of their first vertex
+    long const t_count = faces.size();
+    #pragma omp parallel for
+    for (long i = 0; i < t_count; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            faces[i].v[j] = new_index[faces[i].v[j]];
+        }
+    }
+    std::sort(faces.begin(), faces.end(), [](Face const & a, Face const & b) {
+        return std::min(a.v[0], std::min(a.v[1], a.v[2])) < std::min(b.v[0], std::min(b.v[1], b.v[2]));
+    });
+}
+
+//
+// Main simplification function
+//
+// target_count  : target nr. of triangles
+// agressiveness : sharpness to increase the threshold.
+//                 5..8 are good numbers
+//                 more iterations yield higher quality
+//
+void CompactMeshSimplify::simplify_mesh(ulong const target_count, double const agressiveness = 7,
+                                        bool const verbose = false)
+{
+    // Out-of-core: neighbours in mesh should be neighbours in memory
+    if (!scratch_directory.empty()) {
+        spatial_sort();
+    }
+    // init
+    adjacency = make_array<Adjacency>();
+    vertex_flags = make_array<uint8_t>();
+    quadrics = make_array<SymmetricMatrix>();
+    errors = make_array<Errors>();
+    face_flags = make_array<uint8_t>();
+    normals = make_array<Point>();
+    refs = make_array<uint32_t>();
+    face_flags.assign(faces.size(), 0);
+    errors.resize(faces.size());
+    normals.resize(faces.size());
+    adjacency.resize(points.size());
+    vertex_flags.assign(points.size(), 0);
+    quadrics.resize(points.size());
+    refs_capacity = faces.size() * 3 + faces.size() * 3 / 4 + 1024;
+    refs.reserve(refs_capacity);
+
+    // main iteration loop
+    ulong deleted_triangles = 0;
+    std::vector<uint8_t> deleted0, deleted1;
+    ulong const triangle_count = faces.size();
+    // triangles deleted by the previous iteration
+    ulong iteration_deleted = 1;
+
+    for (int iteration = 0; iteration < 100; ++iteration) {
+        if (triangle_count - deleted_triangles <= target_count) {
+            break;
+        }
+        // update mesh once in a while
+        if (iteration % 5 == 0) {
+            update_mesh(iteration);
+        }
+        // clear dirty flag
+        for (ulong i = 0; i < faces.size(); ++i) {
+            face_flags[i] &= ~DIRTY;
+        }
+        // All triangles with edges below the threshold will be removed
+        double threshold = 0.000000001 * pow(double(iteration + 3), agressiveness);
+        // error bound reached and nothing is collapsed below it anymore ? Then break
+        if ((max_error > 0) && (threshold >= max_error * max_error)) {
+            if (iteration_deleted == 0) {
+                break;
+            }
+            threshold = max_error * max_error;
+        }
+        ulong deleted_before = deleted_triangles;
+        if ((verbose) && (iteration % 5 == 0)) {
+            printf("iteration %d - triangles %lu threshold %g\n", iteration, triangle_count - deleted_triangles, threshold);
+        }
+        // remove vertices & mark deleted triangles
+        for (ulong i = 0; i < faces.size(); ++i) {
+            if ((errors[i].e[3] > threshold) || face_flags[i]) {
+                continue;
+            }
+            for (int j = 0; j < 3; ++j) {
+                if (errors[i].e[j] < threshold) {
+                    uint32_t i0 = faces[i].v[j];
+                    uint32_t i1 = faces[i].v[(j + 1) % 3];
+                    // Border check
+                    if ((vertex_flags[i0] & BORDER) != (vertex_flags[i1] & BORDER)) {
+                        continue;
+                    }
+                    // Compute vertex to collapse to
+                    vec3f p;
+                    calculate_error(i0, i1, p);
+                    if (!try_collapse(i0, i1, p, deleted0, deleted1, deleted_triangles)) {
+                        continue;
+                    }
+                    break;
+                }
+            }
+            // done?
+            if (triangle_count - deleted_triangles <= target_count) {
+                break;
+            }
+        }
+        iteration_deleted = deleted_triangles - deleted_before;
+    }
+
+    working_memory = adjacency.capacity() * sizeof(Adjacency) + vertex_flags.capacity() +
+                     quadrics.capacity() * sizeof(SymmetricMatrix) + errors.capacity() * sizeof(Errors) +
+                     face_flags.capacity() + normals.capacity() * sizeof(Point) + refs.capacity() * sizeof(uint32_t);
+
+    // clean up mesh
+    compact_mesh();
+}
+
+// Collapse edge (i0, i1) to p if no triangle flips
+bool CompactMeshSimplify::try_collapse(uint32_t const i0, uint32_t const i1, vec3f const & p,
+                                       std::vector<uint8_t> & deleted0, std::vector<uint8_t> & deleted1,
+                                       ulong & deleted_triangles)
+{
+    // Arena is full: pack references of alive triangles
+    if (refs.size() + adjacency[i0].tcount + adjacency[i1].tcount > refs_capacity) {
+        rebuild_refs();
+    }
+    deleted0.resize(adjacency[i0].tcount);
+    deleted1.resize(adjacency[i1].tcount);
+
+    // don't remove if flipped
+    if (flipped(p, i1, i0, deleted0) || flipped(p, i0, i1, deleted1)) {
+        return false;
+    }
+
+    // not flipped, so remove edge
+    points[i0].x = p.x;
+    points[i0].y = p.y;
+    points[i0].z = p.z;
+    quadrics[i0] += quadrics[i1];
+    uint32_t tstart = refs.size();
+
+    update_triangles(i0, adjacency[i0], deleted0, deleted_triangles);
+    update_triangles(i0, adjacency[i1], deleted1, deleted_triangles);
+
+    uint32_t tcount = refs.size() - tstart;
+    Adjacency & a = adjacency[i0];
+    if (tcount <= a.tcount) {
+        // reuse the old range, the arena shrinks back
+        if (tcount) {
+            memcpy(&refs[a.tstart], &refs[tstart], tcount * sizeof(uint32_t));
+        }
+        refs.resize(tstart);
+    } else {
+        // append
+        a.tstart = tstart;
+    }
+    a.tcount = tcount;
+    return true;
+}
+
+// Check if a triangle flips when this edge is removed
+bool CompactMeshSimplify::flipped(vec3f const & p, uint32_t const i1, uint32_t const i0,
+                                  std::vector<uint8_t> & deleted) const
+{
+    Adjacency const & a = adjacency[i0];
+    for (uint32_t k = 0; k < a.tcount; ++k) {
+        uint32_t r = refs[a.tstart + k];
+        uint32_t tid = r >> 2;
+        if (face_flags[tid] & DELETED) {
+            continue;
+        }
+        int s = r & 3;
+        uint32_t id1 = faces[tid].v[(s + 1) % 3];
+        uint32_t id2 = faces[tid].v[(s + 2) % 3];
+
+        if (id1 == i1 || id2 == i1) {  // delete ?
+            deleted[k] = 1;
+            continue;
+        }
+        vec3f d1 = position(id1) - p;
+        d1.normalize();
+        vec3f d2 = position(id2) - p;
+        d2.normalize();
+        if (fabs(d1.dot(d2)) > 0.999) {
+            return true;
+        }
+        vec3f n;
+        n.cross(d1, d2);
+        n.normalize();
+        deleted[k] = 0;
+        if (n.dot(vec3f(normals[tid].x, normals[tid].y, normals[tid].z)) < 0.2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Update triangle connections and edge error after a edge is collapsed
+void CompactMeshSimplify::update_triangles(uint32_t const i0, Adjacency const & a,
+                                           std::vector<uint8_t> const & deleted, ulong & deleted_triangles)
+{
+    // Edges of updated triangles are evaluated together, quadrics don't change meanwhile
+    updated_faces.clear();
+    for (uint32_t k = 0; k < a.tcount; ++k) {
+        uint32_t r = refs[a.tstart + k];
+        uint32_t tid = r >> 2;
+        if (face_flags[tid] & DELETED) {
+            continue;
+        }
+        if (deleted[k]) {
+            face_flags[tid] |= DELETED;
+            ++deleted_triangles;
+            continue;
+        }
+        Face & t = faces[tid];
+        t.v[r & 3] = i0;
+        face_flags[tid] |= DIRTY;
+        updated_faces.push_back(tid);
+        refs.push_back(r);
+    }
+    for (ulong first = 0; first < updated_faces.size(); first += EdgeErrorBatch::SIZE / 3) {
+        ulong last = std::min<ulong>(first + EdgeErrorBatch::SIZE / 3, updated_faces.size());
+        edge_batch.clear();
+        for (ulong i = first; i < last; ++i) {
+            add_edges(edge_batch, faces[updated_faces[i]]);
+        }
+        edge_batch.evaluate();
+        for (ulong i = first; i < last; ++i) {
+            set_edge_errors(errors[updated_faces[i]], edge_batch, 3 * (i - first));
+        }
+    }
+}
+
+// Three edges of triangle to the batch
+void CompactMeshSimplify::add_edges(EdgeErrorBatch & batch, Face const & t) const {
+    for (int j = 0; j < 3; ++j) {
+        uint32_t v1 = t.v[j], v2 = t.v[(j + 1) % 3];
+        batch.add(quadrics[v1], quadrics[v2], position(v1), position(v2),
+                  vertex_flags[v1] & vertex_flags[v2] & BORDER);
+    }
+}
+
+// Errors of triangle edges added to the batch at first
+void CompactMeshSimplify::set_edge_errors(Errors & e, EdgeErrorBatch const & batch, int const first) {
+    for (int j = 0; j < 3; ++j) {
+        e.e[j] = batch.error[first + j];
+    }
+    e.e[3] = fmin(e.e[0], fmin(e.e[1], e.e[2]));
+}
+
+// References of alive triangles, written packed from the beginning of the arena
+void CompactMeshSimplify::rebuild_refs() {
+    for (ulong i = 0; i < adjacency.size(); ++i) {
+        adjacency[i].tstart = 0;
+        adjacency[i].tcount = 0;
+    }
+    for (ulong i = 0; i < faces.size(); ++i) {
+        if (face_flags[i] & DELETED) {
+            continue;
+        }
+        for (int j = 0; j < 3; ++j) {
+            ++adjacency[faces[i].v[j]].tcount;
+        }
+    }
+    uint32_t tstart = 0;
+    for (ulong i = 0; i < adjacency.size(); ++i) {
+        adjacency[i].tstart = tstart;
+        tstart += adjacency[i].tcount;
+        adjacency[i].tcount = 0;
+    }
+    refs.resize(tstart);
+    for (ulong i = 0; i < faces.size(); ++i) {
+        if (face_flags[i] & DELETED) {
+            continue;
+        }
+        for (int j = 0; j < 3; ++j) {
+            Adjacency & a = adjacency[faces[i].v[j]];
+            refs[a.tstart + a.tcount] = uint32_t(i << 2) | j;
+            ++a.tcount;
+        }
+    }
+}
+
+// compact triangles, compute edge error and build reference list
+void CompactMeshSimplify::update_mesh(int const iteration) {
+    if (iteration > 0) { // compact triangles, every array of them
+        ulong dst = 0;
+        for (ulong i = 0; i < faces.size(); ++i) {
+            if (!(face_flags[i] & DELETED)) {
+                faces[dst] = faces[i];
+                errors[dst] = errors[i];
+                normals[dst] = normals[i];
+                face_flags[dst] = face_flags[i];
+                ++dst;
+            }
+        }
+        faces.resize(dst);
+        errors.resize(dst);
+        normals.resize(dst);
+        face_flags.resize(dst);
+    }
+    // Init Reference ID list
+    rebuild_refs();
+
+    //
+    // Init Quadrics by Plane & Edge Errors
+    //
+    // required at the beginning ( iteration == 0 ). Passes are parallel, every one writes its own elements
+    //
+    if (iteration == 0) {
+        long const t_count = faces.size();
+        long const v_count = points.size();
+        #pragma omp parallel for
+        for (long i = 0; i < t_count; ++i) {
+            Face const & t = faces[i];
+            vec3f n;
+            n.cross(position(t.v[1]) - position(t.v[0]), position(t.v[2]) - position(t.v[0]));
+            n.normalize();
+            normals[i].x = n.x;
+            normals[i].y = n.y;
+            normals[i].z = n.z;
+        }
+
+        // Quadric of vertex is the sum of planes of its triangles, in order of triangles
+        #pragma omp parallel for schedule(dynamic, 4096)
+        for (long i = 0; i < v_count; ++i) {
+            Adjacency const & a = adjacency[i];
+            SymmetricMatrix q(0.0);
+            for (uint32_t k = 0; k < a.tcount; ++k) {
+                // normal again in double precision, stored ones are float
+                Face const & t = faces[refs[a.tstart + k] >> 2];
+                vec3f n, p0 = position(t.v[0]);
+                n.cross(position(t.v[1]) - p0, position(t.v[2]) - p0);
+                n.normalize();
+                q += SymmetricMatrix(n.x, n.y, n.z, -n.dot(p0));
+            }
+            quadrics[i] = q;
+        }
+
+        // Calc Edge Error, by batches of triangles
+        long const batch_triangles = EdgeErrorBatch::SIZE / 3;
+        #pragma omp parallel
+        {
+            EdgeErrorBatch batch;
+            #pragma omp for
+            for (long first = 0; first < t_count; first += batch_triangles) {
+                long last = std::min(first + batch_triangles, t_count);
+                batch.clear();
+                for (long i = first; i < last; ++i) {
+                    add_edges(batch, faces[i]);
+                }
+                batch.evaluate();
+                for (long i = first; i < last; ++i) {
+                    set_edge_errors(errors[i], batch, 3 * (i - first));
+                }
+            }
+        }
+
+        // Identify boundary : edge of only one triangle is border, both its vertices are marked.
+        // Edge is counted once, by its smaller vertex: neighbours of the fan are sorted and equal ones counted
+        #pragma omp parallel
+        {
+            std::vector<uint32_t> neighbours;
+            #pragma omp for schedule(dynamic, 4096)
+            for (long i = 0; i < v_count; ++i) {
+                Adjacency const & a = adjacency[i];
+                neighbours.clear();
+                for (uint32_t k = 0; k < a.tcount; ++k) {
+                    uint32_t r = refs[a.tstart + k];
+                    Face const & t = faces[r >> 2];
+                    for (int j = 1; j < 3; ++j) {
+                        uint32_t id = t.v[((r & 3) + j) % 3];
+                        if (id > i) {
+                            neighbours.push_back(id);
+                        }
+                    }
+                }
+                std::sort(neighbours.begin(), neighbours.end());
+                for (ulong j = 0; j < neighbours.size();) {
+                    ulong next = j + 1;
+                    while ((next < neighbours.size()) && (neighbours[next] == neighbours[j])) {
+                        ++next;
+                    }
+                    if (next - j == 1) {
+                        #pragma omp atomic update
+                        vertex_flags[i] |= BORDER;
+                        #pragma omp atomic update
+                        vertex_flags[neighbours[j]] |= BORDER;
+                    }
+                    j = next;
+                }
+            }
+        }
+    }
+}
+
+// Finally compact mesh and release working arrays
+void CompactMeshSimplify::compact_mesh() {
+    // adjacency.tstart is reused as new vertex index, tcount as used mark
+    for (ulong i = 0; i < adjacency.size(); ++i) {
+        adjacency[i].tcount = 0;
+    }
+    ulong dst = 0;
+    for (ulong i = 0; i < faces.size(); ++i) {
+        if (!(face_flags[i] & DELETED)) {
+            faces[dst++] = faces[i];
+            for (int j = 0; j < 3; ++j) {
+                adjacency[faces[i].v[j]].tcount = 1;
+            }
+        }
+    }
+    faces.resize(dst);
+    dst = 0;
+    for (ulong i = 0; i < points.size(); ++i) {
+        if (adjacency[i].tcount) {
+            adjacency[i].tstart = dst;
+            points[dst++] = points[i];
+        }
+    }
+    points.resize(dst);
+    for (ulong i = 0; i < faces.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            faces[i].v[j] = adjacency[faces[i].v[j]].tstart;
+        }
+    }
+    adjacency = Array<Adjacency>();
+    vertex_flags = Array<uint8_t>();
+    quadrics = Array<SymmetricMatrix>();
+    errors = Array<Errors>();
+    face_flags = Array<uint8_t>();
+    normals = Array<Point>();
+    refs = Array<uint32_t>();
+}
+
+// Error between vertex and Quadric
+double CompactMeshSimplify::vertex_error(SymmetricMatrix const & q, double const x, double const y,
+                                         double const z) const
+{
+    return   (q[0] * x * x) + (2 * q[1] * x * y) + (2 * q[2] * x * z) + (2 * q[3] * x) + (q[4] * y * y)
+             + (2 * q[5] * y * z) + (2 * q[6] * y) + (q[7] * z * z) + (2 * q[8] * z) + q[9];
+}
+
+// Error for one edge
+double CompactMeshSimplify::calculate_error(uint32_t const id_v1, uint32_t const id_v2, vec3f & p_result) const {
+    // compute interpolated vertex
+    SymmetricMatrix q = quadrics[id_v1] + quadrics[id_v2];
+    bool border = vertex_flags[id_v1] & vertex_flags[id_v2] & BORDER;
+    double error = 0;
+    double det = q.det(0, 1, 2, 1, 4, 5, 2, 5, 7);
+    if ((det != 0) && (!border)) {
+        // q_delta is invertible
+        p_result.x = -1 / det * (q.det(1, 2, 3, 4, 5, 6, 5, 7, 8));	// vx = A41/det(q_delta)
+        p_result.y =  1 / det * (q.det(0, 2, 3, 1, 5, 6, 2, 7, 8));	// vy = A42/det(q_delta)
+        p_result.z = -1 / det * (q.det(0, 1, 3, 1, 4, 6, 2, 5,  8));	// vz = A43/det(q_delta)
+        error = vertex_error(q, p_result.x, p_result.y, p_result.z);
+    } else {
+        // det = 0 -> try to find best result
+        vec3f p1 = position(id_v1);
+        vec3f p2 = position(id_v2);
+        vec3f p3 = (p1 + p2) / 2;
+        double error1 = vertex_error(q, p1.x, p1.y, p1.z);
+        double error2 = vertex_error(q, p2.x, p2.y, p2.z);
+        double error3 = vertex_error(q, p3.x, p3.y, p3.z);
+        error = fmin(error1, fmin(error2, error3));
+        if (error1 == error) p_result = p1;
+        if (error2 == error) p_result = p2;
+        if (error3 == error) p_result = p3;
+    }
+    return error;
+}
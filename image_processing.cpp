@@ -2,8 +2,9 @@
 // Created by user on 8/4/17.
 //
 #include "image_processing.h"
+#include "tracing.h"
 
-// Resize image to to 3:4 format: 1920x1440 (WxH)
+// Resize image to to 3:4 format: 1920x1440 (WxH) by default, max_side x 3/4 max_side if it is set
 cv::Mat ImageProcessing::scale_image(cv::Mat & img) {
     // 2560x1920 - 5 Megapixel - consume a lot of time
     // 2240x1680 - 4 Megapixel - consume a lot of time
@@ -14,15 +15,16 @@ cv::Mat ImageProcessing::scale_image(cv::Mat & img) {
     int height = img.rows;
     int min_size = std::min(height, width);
     int max_size = std::max(height, width);
-    // Scale image to 1920x1440
-    if ((min_size > 1440) || (max_size > 1920)) {
+    double const long_side = max_side, short_side = max_side * 3.0 / 4;
+    // Scale image to 1920x1440 (max_side x 3/4 max_side)
+    if ((min_size > short_side) || (max_size > long_side)) {
         double h_multi = 0.0, w_multi = 0.0;
         if (height > width) {
-            h_multi = 1920.0 / height;
-            w_multi = 1440.0 / width;
+            h_multi = long_side / height;
+            w_multi = short_side / width;
         } else {
-            h_multi = 1440.0 / height;
-            w_multi = 1920.0 / width;
+            h_multi = short_side / height;
+            w_multi = long_side / width;
         }
         cv::resize(img, img, cv::Size(0, 0), w_multi, h_multi, cv::INTER_CUBIC);
     }
@@ -155,10 +157,9 @@ void ImageProcessing::apply_mask(cv::Mat & image, cv::Mat const & mask) {
     }
 }
 
-// Detect object on image and fill background with black color
-void ImageProcessing::object_detection(cv::Mat & img, std::string const & image_filename, fs::path const & write_path) {
-    img = scale_image(img);
-
+// Fill background of the image with black pixels in place (no scaling, nothing is written).
+// Mask of the object: CV_16S, 255 - object, 0 - background
+cv::Mat ImageProcessing::remove_background(cv::Mat & img) {
     // STEP 1. Edge detection. Blurring image
     cv::Mat blurred;
     cv::GaussianBlur(img, blurred, cv::Size(9, 9), 0);
@@ -194,12 +195,22 @@ void ImageProcessing::object_detection(cv::Mat & img, std::string const & image_
 
     // Finally remove the background
     apply_mask(img, mask);
+    return mask;
+}
 
+// Detect object on image and fill background with black color
+void ImageProcessing::object_detection(cv::Mat & img, std::string const & image_filename, fs::path const & write_path) {
+    img = scale_image(img);
+    remove_background(img);
 
     // Save image
-    std::string output_image_path = write_path.string() + "/" + image_filename.substr(0, image_filename.size() - 3) + "jpg";
+    std::string output_image_name = image_filename.substr(0, image_filename.size() - 3) + "jpg";
+    std::string output_image_path = write_path.string() + "/" + output_image_name;
 //    std::cout << write_path.c_str() << std::endl;
     imwrite(output_image_path, img);
+    if (image_handler) {
+        image_handler(output_image_name, img);
+    }
 }
 
 // Create directory tree
@@ -215,21 +226,41 @@ fs::path ImageProcessing::create_dir_structure(fs::path const & path) {
 
 ImageProcessing::ImageProcessing(fs::path & path) : working_dir(create_dir_structure(path)) {};
 
+// In-memory processing only (remove_background): no directory tree is created
+ImageProcessing::ImageProcessing() {}
+
+// Larger side of processed images (1920 by default). Coarse-to-fine SfM chooses its resolution up to it
+void ImageProcessing::set_max_side(int const side) {
+    max_side = side;
+}
+
+// Called with file name and pixels of every written image (e.g. feature extraction while the next is processed)
+void ImageProcessing::set_image_handler(std::function<void(std::string const &, cv::Mat const &)> const & handler) {
+    image_handler = handler;
+}
+
 // Read files, try open them as images and object detection
 void ImageProcessing::start() {
+    TraceStage stage("Image processing");
     fs::path image_path = working_dir.parent_path().parent_path();
     std::cout << image_path << std::endl;
+    ulong images = 0, skipped = 0;
     for (auto &p : fs::directory_iterator(image_path)) {
         if (p.path().has_extension()) {
             std::cout << "Process image " + p.path().string() << std::endl;
             cv::Mat img = cv::imread(p.path().string());
             if (!img.data) {
                 std::cout << "Can't open " + p.path().string() + " as image." << std::endl;
+                ++skipped;
             } else {
                 object_detection(img, p.path().filename(), working_dir);
+                ++images;
             }
         }
     }
+    stage.count("images", images);
+    stage.count("skipped_files", skipped);
+    stage.file("images", working_dir);
 }
 
 std::string ImageProcessing::get_working_dir() const {
@@ -7,6 +7,7 @@
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <functional>
 #include "utils.h"
 
 
@@ -18,8 +19,10 @@ class ImageProcessing {
     typedef std::pair <Vector<cv::Point>, int> contour_with_area;
 
     fs::path working_dir;
+    std::function<void(std::string const &, cv::Mat const &)> image_handler;
+    int max_side = 1920;
 
-    // Resize image to to 3:4 format: 1920x1440 (WxH)
+    // Resize image to to 3:4 format: 1920x1440 (WxH) by default, max_side x 3/4 max_side if it is set
     cv::Mat scale_image(cv::Mat & img);
 
     // Get the magnitude of gradients
@@ -49,6 +52,19 @@ class ImageProcessing {
 public:
     explicit ImageProcessing(fs::path & path);
 
+    // In-memory processing only (remove_background): no directory tree is created
+    ImageProcessing();
+
+    // Fill background of the image with black pixels in place (no scaling, nothing is written).
+    // Mask of the object: CV_16S, 255 - object, 0 - background
+    cv::Mat remove_background(cv::Mat & img);
+
+    // Larger side of processed images (1920 by default). Coarse-to-fine SfM chooses its resolution up to it
+    void set_max_side(int const side);
+
+    // Called with file name and pixels of every written image (e.g. feature extraction while the next is processed)
+    void set_image_handler(std::function<void(std::string const &, cv::Mat const &)> const & handler);
+
     // Read files, try open them as images and object detection
     void start();
 
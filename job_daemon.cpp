@@ -0,0 +1,464 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <poll.h>
+#include <sched.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "job_daemon.h"
+#include "reconstruction.h"
+#include "resource_planner.h"
+#include "tracing.h"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+static char const * state_name(JobDaemon::State const state) {
+    switch (state) {
+        case JobDaemon::QUEUED: return "queued";
+        case JobDaemon::RUNNING: return "running";
+        case JobDaemon::DONE: return "done";
+        case JobDaemon::FAILED: return "failed";
+        default: return "cancelled";
+    }
+}
+
+// "key=value" pairs separated by whitespace or new lines
+std::map<std::string, std::string> parse_job_params(std::string const & text) {
+    std::map<std::string, std::string> params;
+    std::stringstream stream(text);
+    std::string item;
+    while (stream >> item) {
+        size_t separator = item.find('=');
+        if ((separator != std::string::npos) && (separator > 0)) {
+            params[item.substr(0, separator)] = item.substr(separator + 1);
+        }
+    }
+    return params;
+}
+
+JobDaemon::JobDaemon(fs::path const & spool, fs::path const & executable, ulong const cores,
+                     double const memory_mb) :
+        spool_dir(fs::absolute(spool)), executable(executable),
+        memory_budget_mb(memory_mb > 0 ? memory_mb : 0.75 * physical_memory_mb())
+{
+    // Only CPUs the daemon itself is allowed to run on are given to jobs
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && ((cores == 0) || (cpus.size() < cores))) {
+            cpus.push_back(cpu);
+        }
+    }
+    cpu_free.assign(cpus.size(), true);
+    fs::create_directories(spool_dir / "inbox");
+    fs::create_directories(spool_dir / "jobs");
+}
+
+JobDaemon::~JobDaemon() {
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink((spool_dir / "daemon.sock").c_str());
+    }
+}
+
+void JobDaemon::set_tool_paths(fs::path const & colmap, fs::path const & openmvs) {
+    colmap_bin = colmap;
+    openmvs_bin = openmvs;
+}
+
+fs::path JobDaemon::job_dir(Job const & job) const {
+    return spool_dir / "jobs" / std::to_string(job.id);
+}
+
+// Keys of the job for the daemon itself, the others are options of the run
+static bool is_daemon_param(std::string const & key) {
+    return (key == "images") || (key == "priority") || (key == "cores") || (key == "memory_mb");
+}
+
+// Job from "key=value" pairs, false with error if it isn't valid
+bool JobDaemon::make_job(std::map<std::string, std::string> const & params, Job & job, std::string & error) const {
+    auto images = params.find("images");
+    if ((images == params.end()) || !fs::is_directory(images->second)) {
+        error = "images directory is required";
+        return false;
+    }
+    // The pipeline writes results next to images: one job per images directory at a time
+    for (auto const & other : jobs) {
+        if (((other.state == QUEUED) || (other.state == RUNNING)) && (other.params.at("images") == images->second)) {
+            error = "images directory is already queued as job " + std::to_string(other.id);
+            return false;
+        }
+    }
+    // Options of the run are checked as the child checks them: invalid ones would only fail it
+    ReconstructionConfig config;
+    for (auto const & param : params) {
+        if (!is_daemon_param(param.first) && !set_config_option(config, param.first, param.second, error)) {
+            return false;
+        }
+    }
+    error = config_conflicts(config);
+    if (!error.empty()) {
+        return false;
+    }
+    job.params = params;
+    job.priority = params.count("priority") ? atoi(params.at("priority").c_str()) : 0;
+    // Shares are limited by the budgets, otherwise the job would never start
+    long cores = params.count("cores") ? atol(params.at("cores").c_str()) : (long)(cpus.size() + 1) / 2;
+    job.cores = std::min<ulong>(std::max(1L, cores), cpus.size());
+    double memory_mb = params.count("memory_mb") ? atof(params.at("memory_mb").c_str()) : memory_budget_mb / 2;
+    job.memory_mb = std::min(memory_budget_mb, memory_mb > 0 ? memory_mb : memory_budget_mb / 2);
+    return true;
+}
+
+ulong JobDaemon::submit(Job job) {
+    if (job.id == 0) {
+        job.id = next_id;
+    }
+    next_id = std::max(next_id, job.id + 1);
+    job.state = QUEUED;
+    job.submitted = time(nullptr);
+    fs::create_directories(job_dir(job));
+    std::ofstream spec((job_dir(job) / "job").string());
+    for (auto const & param : job.params) {
+        spec << param.first << "=" << param.second << "\n";
+    }
+    spec.close();
+    write_status(job);
+    jobs.push_back(job);
+    printf("Job %lu queued: %s (priority %d, %lu cores, %.0f MB)\n", job.id, job.params["images"].c_str(),
+           job.priority, job.cores, job.memory_mb);
+    return job.id;
+}
+
+std::string JobDaemon::status_json(Job const & job) const {
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "{\"id\": %lu, \"state\": \"%s\", \"priority\": %d, \"cores\": %lu, "
+             "\"memory_mb\": %.0f, \"pid\": %d, \"exit_code\": %d, \"submitted\": %.0f, \"started\": %.0f, "
+             "\"finished\": %.0f, ", job.id, state_name(job.state), job.priority, job.cores, job.memory_mb,
+             (int)job.pid, job.exit_code, job.submitted, job.started, job.finished);
+    std::string json = buffer;
+    json += "\"cpus\": [";
+    for (ulong i = 0; i < job.cpus.size(); ++i) {
+        json += (i ? ", " : "") + std::to_string(job.cpus[i]);
+    }
+    fs::path images = job.params.at("images");
+    json += "], \"images\": " + json_string(images.string()) +
+            ", \"result\": " + json_string((images / local_path::WORKING_PATH.relative_path()).string()) +
+            ", \"log\": " + json_string((job_dir(job) / "log").string()) + "}";
+    return json;
+}
+
+void JobDaemon::write_status(Job const & job) const {
+    std::ofstream status((job_dir(job) / "status.json").string());
+    status << status_json(job) << "\n";
+}
+
+// ----------- 1. Unfinished jobs of the previous daemon are queued again -----------
+void JobDaemon::restore_jobs() {
+    std::vector<Job> restored;
+    for (auto const & entry : fs::directory_iterator(spool_dir / "jobs")) {
+        std::ifstream spec((entry.path() / "job").string());
+        std::stringstream params;
+        params << spec.rdbuf();
+        Job job;
+        job.id = strtoul(entry.path().filename().c_str(), nullptr, 10);
+        job.params = parse_job_params(params.str());
+        if ((job.id == 0) || !job.params.count("images")) {
+            continue;
+        }
+        next_id = std::max(next_id, job.id + 1);
+        std::ifstream status_file((entry.path() / "status.json").string());
+        std::stringstream status;
+        status << status_file.rdbuf();
+        // Finished jobs stay in the status list
+        bool finished = false;
+        for (State state : {DONE, FAILED, CANCELLED}) {
+            if (status.str().find("\"state\": \"" + std::string(state_name(state)) + "\"") != std::string::npos) {
+                job.state = state;
+                finished = true;
+            }
+        }
+        if (finished) {
+            jobs.push_back(job);
+        } else {
+            restored.push_back(job);
+        }
+    }
+    std::sort(restored.begin(), restored.end(), [](Job const & a, Job const & b) { return a.id < b.id; });
+    for (auto const & job : restored) {
+        Job queued;
+        std::string error;
+        if (make_job(job.params, queued, error)) {
+            queued.id = job.id;
+            submit(queued);
+        }
+    }
+}
+
+// ----------- 2. Job files of the inbox -----------
+void JobDaemon::scan_inbox() {
+    std::error_code error;
+    for (auto const & entry : fs::directory_iterator(spool_dir / "inbox", error)) {
+        fs::path path = entry.path();
+        if ((path.extension() != ".job") || !fs::is_regular_file(path)) {
+            continue;
+        }
+        // File written just now may be incomplete
+        auto age = fs::file_time_type::clock::now() - fs::last_write_time(path, error);
+        if (error || (age < std::chrono::seconds(1))) {
+            continue;
+        }
+        std::ifstream file(path.string());
+        std::stringstream text;
+        text << file.rdbuf();
+        Job job;
+        std::string reason;
+        if (make_job(parse_job_params(text.str()), job, reason)) {
+            submit(job);
+            fs::remove(path, error);
+        } else {
+            std::cerr << "Job " << path << " is rejected: " << reason << std::endl;
+            fs::rename(path, fs::path(path).replace_extension(".rejected"), error);
+        }
+    }
+}
+
+// ----------- 3. Commands of socket clients -----------
+void JobDaemon::accept_clients() {
+    while (true) {
+        int client = accept(listen_fd, nullptr, nullptr);
+        if (client < 0) {
+            return;
+        }
+        // Slow client can't stop the scheduler for long
+        struct timeval timeout = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string line;
+        char buffer[1024];
+        ssize_t n;
+        while ((line.find('\n') == std::string::npos) && (line.size() < 65536) &&
+               ((n = read(client, buffer, sizeof(buffer))) > 0)) {
+            line.append(buffer, n);
+        }
+        std::string reply = handle_command(line.substr(0, line.find('\n'))) + "\n";
+        ssize_t written = write(client, reply.data(), reply.size());
+        (void)written;
+        close(client);
+    }
+}
+
+std::string JobDaemon::handle_command(std::string const & line) {
+    std::stringstream stream(line);
+    std::string command;
+    stream >> command;
+    if (command == "submit") {
+        std::string rest;
+        std::getline(stream, rest);
+        Job job;
+        std::string error;
+        if (!make_job(parse_job_params(rest), job, error)) {
+            return "error " + error;
+        }
+        return "id " + std::to_string(submit(job));
+    }
+    ulong id = 0;
+    bool has_id = bool(stream >> id);
+    if (command == "status") {
+        std::string reply = "[";
+        for (auto const & job : jobs) {
+            if (!has_id || (job.id == id)) {
+                reply += ((reply.size() > 1) ? ", " : "") + status_json(job);
+            }
+        }
+        return reply + "]";
+    }
+    if ((command == "cancel") && has_id) {
+        for (auto & job : jobs) {
+            if ((job.id == id) && ((job.state == QUEUED) || (job.state == RUNNING))) {
+                cancel(job);
+                return "cancelled " + std::to_string(id);
+            }
+        }
+        return "error no queued or running job " + std::to_string(id);
+    }
+    return "error commands: submit key=value..., status [id], cancel id";
+}
+
+// ----------- 4. Finished children release their cores and memory -----------
+void JobDaemon::reap_children() {
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (auto & job : jobs) {
+            if ((job.state != RUNNING) || (job.pid != pid)) {
+                continue;
+            }
+            job.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            job.state = job.cancel_requested ? CANCELLED : (job.exit_code == 0 ? DONE : FAILED);
+            job.finished = time(nullptr);
+            for (int cpu : job.cpus) {
+                cpu_free[std::find(cpus.begin(), cpus.end(), cpu) - cpus.begin()] = true;
+            }
+            memory_used_mb -= job.memory_mb;
+            write_status(job);
+            printf("Job %lu %s (exit code %d, %.0f sec)\n", job.id, state_name(job.state), job.exit_code,
+                   job.finished - job.started);
+        }
+    }
+}
+
+// ----------- 5. Queued jobs are started by priority while they fit -----------
+// Higher priority first, then older. Job which doesn't fit now is skipped, so smaller ones use the rest
+void JobDaemon::schedule() {
+    std::vector<Job *> queued;
+    for (auto & job : jobs) {
+        if (job.state == QUEUED) {
+            queued.push_back(&job);
+        }
+    }
+    std::sort(queued.begin(), queued.end(), [](Job const * a, Job const * b) {
+        return (a->priority != b->priority) ? (a->priority > b->priority) : (a->id < b->id);
+    });
+    for (Job * job : queued) {
+        ulong free_cores = std::count(cpu_free.begin(), cpu_free.end(), true);
+        if ((job->cores <= free_cores) && (memory_used_mb + job->memory_mb <= memory_budget_mb + 1e-6)) {
+            start(*job);
+        }
+    }
+}
+
+// Child runs this executable in automatic mode, pinned to its cores, with memory share as RAM budget
+void JobDaemon::start(Job & job) {
+    job.cpus.clear();
+    for (ulong i = 0; (i < cpus.size()) && (job.cpus.size() < job.cores); ++i) {
+        if (cpu_free[i]) {
+            cpu_free[i] = false;
+            job.cpus.push_back(cpus[i]);
+        }
+    }
+    memory_used_mb += job.memory_mb;
+    // Options of the run are command line options: ram_budget is the memory share of the job
+    std::vector<std::string> args = {executable.string(), job.params.at("images"), "1",
+                                     colmap_bin.string(), openmvs_bin.string(),
+                                     "--ram-budget", std::to_string(job.memory_mb)};
+    for (auto const & param : job.params) {
+        if (!is_daemon_param(param.first) && (param.first != "ram_budget")) {
+            std::string option = "--" + param.first;
+            std::replace(option.begin(), option.end(), '_', '-');
+            args.push_back(option);
+            args.push_back(param.second);
+        }
+    }
+    std::string log = (job_dir(job) / "log").string();
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Own process group: cancel stops COLMAP and OpenMVS tools of the job too
+        setpgid(0, 0);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : job.cpus) {
+            CPU_SET(cpu, &set);
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+        setenv("OMP_NUM_THREADS", std::to_string(job.cpus.size()).c_str(), 1);
+        int in = open("/dev/null", O_RDONLY);
+        int out = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        dup2(in, 0);
+        dup2(out, 1);
+        dup2(out, 2);
+        std::vector<char *> argv;
+        for (auto & arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    if (pid < 0) {
+        perror("Can't start job");
+        for (int cpu : job.cpus) {
+            cpu_free[std::find(cpus.begin(), cpus.end(), cpu) - cpus.begin()] = true;
+        }
+        job.cpus.clear();
+        memory_used_mb -= job.memory_mb;
+        return;
+    }
+    setpgid(pid, pid);
+    job.pid = pid;
+    job.state = RUNNING;
+    job.started = time(nullptr);
+    write_status(job);
+    printf("Job %lu started: pid %d, %lu cores, %.0f MB\n", job.id, (int)pid, job.cpus.size(), job.memory_mb);
+}
+
+void JobDaemon::cancel(Job & job) {
+    if (job.state == RUNNING) {
+        job.cancel_requested = true;
+        kill(-job.pid, SIGTERM);
+    } else {
+        job.state = CANCELLED;
+        job.finished = time(nullptr);
+        write_status(job);
+    }
+}
+
+// Main loop until SIGINT/SIGTERM
+int JobDaemon::run() {
+    fs::path socket_path = spool_dir / "daemon.sock";
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.string().size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is too long: " << socket_path << std::endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if ((listen_fd < 0) || (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0) ||
+        (listen(listen_fd, 16) != 0)) {
+        perror("Can't listen on daemon socket");
+        return 1;
+    }
+    // Daemon output usually goes to a file: a line per event
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+    printf("Daemon: %s, %zu cores, %.0f MB\n", spool_dir.c_str(), cpus.size(), memory_budget_mb);
+
+    restore_jobs();
+    while (!stop_requested) {
+        struct pollfd listener = {listen_fd, POLLIN, 0};
+        if (poll(&listener, 1, 1000) > 0) {
+            accept_clients();
+        }
+        reap_children();
+        scan_inbox();
+        schedule();
+    }
+
+    // Running jobs are stopped and stay queued for the next start
+    for (auto & job : jobs) {
+        if (job.state == RUNNING) {
+            kill(-job.pid, SIGTERM);
+            waitpid(job.pid, nullptr, 0);
+            job.state = QUEUED;
+            job.pid = 0;
+            write_status(job);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_JOB_DAEMON_H
+#define RECONSTRUCTION_JOB_DAEMON_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "utils.h"
+
+// Local scheduling daemon for many datasets (./Reconstruction --daemon spool_dir [cores] [memory_mb])
+//
+// Jobs come from two places, both inside the spool directory:
+// 1. Inbox: every "spool/inbox/*.job" file is a job. It is taken and removed when complete
+//    (write it under another name and rename, or close it before the next poll).
+// 2. Unix socket "spool/daemon.sock", one command line per connection and one reply line:
+//       submit images=/data/capture1 priority=5 cores=4 memory_mb=8000   -> "id 7"
+//       status [id]                                                       -> JSON of jobs
+//       cancel id                                                         -> "cancelled 7"
+// Job is "key=value" pairs (lines of the file or words of the command):
+//    images (required), priority (higher first, 0), cores, memory_mb (share of the budgets, half of them),
+//    lod_ratios, tiles, engine, max_error, matching, adaptive_threshold, vocab_tree, match_workers, cpu_features,
+//    view_selection, roi_cropping, time_budget, max_image_side (options of Reconstruction command line without dashes,
+//    see set_config_option; ram_budget is the memory share). Jobs with unknown or invalid options and options
+//    which can't be combined (see config_conflicts) are rejected.
+//
+// Every job is a child process running this executable in automatic mode with its own arguments. Jobs are
+// started in priority order (then submission order) while their cores and memory fit the global budget:
+// the child is pinned to its cores, memory share is the RAM budget its pipeline plans resolution for.
+// State of every job is written to "spool/jobs/<id>/status.json", output to "spool/jobs/<id>/log".
+// On SIGINT/SIGTERM running jobs are stopped, unfinished jobs are queued again on the next start.
+
+class JobDaemon {
+public:
+    enum State { QUEUED, RUNNING, DONE, FAILED, CANCELLED };
+
+    struct Job {
+        ulong id = 0;
+        std::map<std::string, std::string> params;
+        int priority = 0;
+        ulong cores = 0;
+        double memory_mb = 0;
+        State state = QUEUED;
+        pid_t pid = 0;
+        std::vector<int> cpus;
+        int exit_code = 0;
+        bool cancel_requested = false;
+        double submitted = 0, started = 0, finished = 0;
+    };
+private:
+    fs::path spool_dir;
+    fs::path executable;
+    fs::path colmap_bin = local_path::COLMAP_BIN;
+    fs::path openmvs_bin = local_path::OPENMVS_BIN;
+    // CPUs the daemon may use and which of them are free
+    std::vector<int> cpus;
+    std::vector<bool> cpu_free;
+    double memory_budget_mb = 0;
+    double memory_used_mb = 0;
+    std::vector<Job> jobs;
+    ulong next_id = 1;
+    int listen_fd = -1;
+
+    fs::path job_dir(Job const & job) const;
+
+    // Job from "key=value" pairs, empty error if it is valid
+    bool make_job(std::map<std::string, std::string> const & params, Job & job, std::string & error) const;
+
+    ulong submit(Job job);
+
+    void write_status(Job const & job) const;
+
+    std::string status_json(Job const & job) const;
+
+    // 1. Unfinished jobs of the previous daemon are queued again
+    void restore_jobs();
+
+    // 2. Job files of the inbox
+    void scan_inbox();
+
+    // 3. Commands of socket clients
+    void accept_clients();
+
+    std::string handle_command(std::string const & line);
+
+    // 4. Finished children release their cores and memory
+    void reap_children();
+
+    // 5. Queued jobs are started by priority while they fit
+    void schedule();
+
+    void start(Job & job);
+
+    void cancel(Job & job);
+public:
+    // cores == 0: all CPUs of the process, memory_mb == 0: 75% of physical memory
+    JobDaemon(fs::path const & spool, fs::path const & executable, ulong const cores, double const memory_mb);
+
+    ~JobDaemon();
+
+    // COLMAP and OpenMVS binaries given to every job
+    void set_tool_paths(fs::path const & colmap, fs::path const & openmvs);
+
+    // Main loop until SIGINT/SIGTERM
+    int run();
+};
+
+// "key=value" pairs separated by whitespace or new lines
+std::map<std::string, std::string> parse_job_params(std::string const & text);
+
+#endif //RECONSTRUCTION_JOB_DAEMON_H
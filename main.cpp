@@ -1,5 +1,6 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 // Compiling from sources:
 // 1) OpenMVS (https://github.com/cdcseacave/openMVS/wiki/Building)
@@ -9,55 +10,132 @@
 // 1) Eigen 3.2.10 (3.3._ doesn't works)
 // 2) Ceres-solver (http://ceres-solver.org/installation.html)
 
-#include "image_processing.h"
-#include "colmap.h"
-#include "openmvs.h"
-
-void reconstruction_pipeline(std::string const & working_dir, bool is_sequential, bool automatic = true) {
-    TD_TIMER_START();
-    // Run sequential SfM
-    Colmap colmap(working_dir, local_path::COLMAP_BIN);
-    fs::path const path_to_nvm_model = colmap.sfm(is_sequential);
-    if (path_to_nvm_model.empty()) {
-        std::cerr << "Reconstruction field!" << std::endl;
-        return;
-    }
-    OpenMVS mvs(path_to_nvm_model, automatic);
-    mvs.build_model_from_sparse_point_cloud();
-    if (!mvs.get_status()) {
-        std::cerr << "Reconstruction field!" << std::endl;
-        return;
-    }
-    printf("Reconstruction consumed: %s\n", TD_TIMER_GET_FMT().c_str());
+#include "reconstruction.h"
+#include "job_daemon.h"
+#include "sharded_matching.h"
+
+// Usage of the command line
+void print_usage() {
+    std::cout << "Using example:\n "
+            "$./Reconstruction full_path_to_images(reqiued) "
+            "automatic (1 or 0. If 0 you will choose params for mesh simplifying) "
+            "full_path_colmap(optional, default '/usr/local/bin') "
+            "full_path_openmvs(optional, default '/usr/local/bin/OpenMVS') [options]\n"
+            "Options:\n"
+            "  --lod-ratios r1,r2,...   simplify ratios of levels of detail in (0, 1), e.g. '0.5,0.2,0.05'\n"
+            "  --tiles 0|1              textured mesh is also written as streamable tileset\n"
+            "  --ram-budget mb          RAM budget, default 75% of physical memory\n"
+            "  --engine name            simplification engine: 'threshold' (default), 'queue', 'compact' or "
+            "'compare'. Suffix '-parallel', e.g. 'queue-parallel', simplifies spatial partitions concurrently\n"
+            "  --max-error error        simplify until this deviation in scene units and report the deviation\n"
+            "  --matching name          'both' (default), 'sequential', 'exhaustive', 'adaptive' or 'coarse_to_fine'. "
+            "Adaptive runs exhaustive matching only if the sequential sparse model is poor, 'coarse_to_fine' "
+            "refines poses of downscaled images at the resolution which fits time budget, it can't be combined "
+            "with --vocab-tree, --match-workers and --cpu-features\n"
+            "  --adaptive-threshold s   adaptive matching escalates below this sparse model score in (0, 1], "
+            "default 0.8\n"
+            "  --vocab-tree path        COLMAP vocabulary tree: retrieval-based matching instead of exhaustive\n"
+            "  --match-workers count    exhaustive matching sharded over this many worker processes\n"
+            "  --cpu-features 0|1       SIFT is extracted in process on CPU while images are processed\n"
+            "  --view-selection 0|1     only a minimal subset of views is densified and textured\n"
+            "  --roi-cropping 0|1       densifying and meshing are cropped to the object\n"
+            "  --time-budget seconds    coarse-to-fine SfM and densifying, default 0 - full resolution\n"
+            "  --max-image-side pixels  larger side of processed images (at least 640), default 1920\n"
+            "Daemon mode for many datasets (see job_daemon.h):\n "
+            "$./Reconstruction --daemon spool_dir(reqiued) cores(optional, default all) "
+            "memory_mb(optional, default 75% of physical memory) "
+            "full_path_colmap(optional) full_path_openmvs(optional)\n"
+            "Worker of sharded matching on another node with the same filesystem (see sharded_matching.h):\n "
+            "$./Reconstruction --match-worker shards_dir(reqiued) full_path_colmap(optional) "
+            "threads(optional, default all)" << std::endl;
 }
 
+// Positional arguments and "--name value" (or "--name=value") options into config, false with error
+bool parse_arguments(int const args, char * argv[], ReconstructionConfig & config, std::string & error) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < args; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            positional.push_back(arg);
+            continue;
+        }
+        // Option names are the keys of daemon jobs with dashes: --ram-budget is ram_budget
+        std::string name = arg.substr(2), value;
+        size_t separator = name.find('=');
+        if (separator != std::string::npos) {
+            value = name.substr(separator + 1);
+            name = name.substr(0, separator);
+        } else if (i + 1 < args) {
+            value = argv[++i];
+        } else {
+            error = "option " + arg + " needs a value";
+            return false;
+        }
+        std::replace(name.begin(), name.end(), '-', '_');
+        if (!set_config_option(config, name, value, error)) {
+            return false;
+        }
+    }
+    if (positional.empty() || (positional.size() > 4)) {
+        error = positional.empty() ? "images directory is required" : "unexpected argument " + positional[4];
+        return false;
+    }
+    config.images_dir = positional[0];
+    // This flag free from openmvs-dialog (see build_model_from_sparse_point_cloud(...) in openmvs.cpp)
+    if (positional.size() > 1) {
+        if ((positional[1] != "0") && (positional[1] != "1")) {
+            error = "invalid automatic '" + positional[1] + "'";
+            return false;
+        }
+        config.automatic = positional[1] == "1";
+    }
+    if (positional.size() > 2) {
+        config.colmap_bin = fs::path(positional[2]);
+    }
+    if (positional.size() > 3) {
+        config.openmvs_bin = fs::path(positional[3]);
+    }
+    error = config_conflicts(config);
+    return error.empty();
+}
 
 int main(int args, char* argv[]) {
     if (args < 2) {
-        std::cout << "Using example:\n "
-                "$./Reconstruction full_path_to_images(reqiued) "
-                "automatic (1 or 0. If 0 you will choose params for mesh simplifying) "
-                "full_path_colmap(optional, default '/usr/local/bin') "
-                "full_path_openmvs(optional, default '/usr/local/bin/OpenMVS')" << std::endl;
+        print_usage();
         return 0;
     }
-    fs::path input_dir = std::string(argv[1]);
-    // This flag free from openmvs-dialog (see build_model_from_sparse_point_cloud(...) in openmvs.cpp)
-    bool flag_automatic_execution = (bool)atoi(argv[2]);
-
-    if (argv[3]) {
-        local_path::COLMAP_BIN = fs::path(argv[3]);
+    if ((std::string(argv[1]) == "--daemon") && (args > 2)) {
+        // Jobs run this executable with their own arguments
+        JobDaemon daemon(argv[2], fs::read_symlink("/proc/self/exe"), (args > 3) ? strtoul(argv[3], nullptr, 10) : 0,
+                         (args > 4) ? atof(argv[4]) : 0);
+        daemon.set_tool_paths((args > 5) ? fs::path(argv[5]) : local_path::COLMAP_BIN,
+                              (args > 6) ? fs::path(argv[6]) : local_path::OPENMVS_BIN);
+        return daemon.run();
+    }
+    if ((std::string(argv[1]) == "--match-worker") && (args > 2)) {
+        fs::path colmap_bin = (args > 3) ? fs::path(argv[3]) : local_path::COLMAP_BIN;
+        return run_match_worker(argv[2], colmap_bin / "matches_importer",
+                                (args > 4) ? strtoul(argv[4], nullptr, 10) : 0);
     }
-    if (argv[4]) {
-        local_path::OPENMVS_BIN = fs::path(argv[4]);
+    // Local match workers run this executable
+    ReconstructionConfig config;
+    config.reconstruction_bin = fs::read_symlink("/proc/self/exe");
+    std::string error;
+    if (!parse_arguments(args, argv, config, error)) {
+        std::cerr << error << "\n" << std::endl;
+        print_usage();
+        return 1;
     }
 
-    // Image processing
-    ImageProcessing processing(input_dir);
-    processing.start();
-    std::string working_dir = processing.get_working_dir();
+    // Image processing, then sequential and exhaustive (or adaptive) runs. Questions of interactive mode go to console
+    ReconstructionPipeline pipeline(config);
+    bool success = pipeline.run();
 
-    reconstruction_pipeline(working_dir, 1, flag_automatic_execution);
-    reconstruction_pipeline(working_dir, 0, flag_automatic_execution);
-    return 0;
+    // Stages of both runs: Chrome/Perfetto trace and summary next to the results
+    if (pipeline.write_trace()) {
+        printf("Trace: %s, summary: %s\n", (pipeline.result_dir() / "trace.json").c_str(),
+               (pipeline.result_dir() / "trace_summary.json").c_str());
+    }
+    // Failed only if neither matching gave a model (status of daemon jobs)
+    return success ? 0 : 1;
 }
\ No newline at end of file
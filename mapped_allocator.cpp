@@ -0,0 +1,44 @@
+//
+// Created by user on 10/18/26.
+//
+#include <cstdio>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "mapped_allocator.h"
+
+// Memory of scratch file in directory, nullptr if file can't be created or mapped
+void * map_scratch(std::string const & directory, std::size_t const bytes) {
+    if (bytes == 0) {
+        return nullptr;
+    }
+    std::string pattern = directory + "/simplify_scratch_XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+        perror("Can't create scratch file");
+        return nullptr;
+    }
+    // Name isn't needed: the mapping keeps the file alive
+    unlink(path.data());
+    if (ftruncate(fd, bytes) != 0) {
+        perror("Can't resize scratch file");
+        close(fd);
+        return nullptr;
+    }
+    void * data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Can't map scratch file");
+        return nullptr;
+    }
+    return data;
+}
+
+void unmap_scratch(void * data, std::size_t const bytes) {
+    if (data) {
+        munmap(data, bytes);
+    }
+}
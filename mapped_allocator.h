@@ -0,0 +1,73 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_MAPPED_ALLOCATOR_H
+#define RECONSTRUCTION_MAPPED_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <type_traits>
+
+// Memory of scratch file in directory: the file is created, unlinked at once and mapped shared,
+// so kernel writes pages back to it instead of swap and the file disappears with the mapping.
+// Returns nullptr if file can't be created or mapped
+void * map_scratch(std::string const & directory, std::size_t const bytes);
+
+void unmap_scratch(void * data, std::size_t const bytes);
+
+// Allocator of std::vector for out-of-core arrays. With empty directory it is the usual heap allocator,
+// otherwise every allocation is a memory mapped scratch file in the directory.
+// Allocator follows array on move and swap: arrays are re-created with another directory by assignment
+template <class T>
+class MappedAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    std::string directory;
+
+    MappedAllocator() {}
+
+    explicit MappedAllocator(std::string const & dir) : directory(dir) {}
+
+    template <class U>
+    MappedAllocator(MappedAllocator<U> const & other) : directory(other.directory) {}
+
+    T * allocate(std::size_t const n) {
+        if (n == 0) {
+            return nullptr;
+        }
+        if (directory.empty()) {
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        void * data = map_scratch(directory, n * sizeof(T));
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(data);
+    }
+
+    void deallocate(T * data, std::size_t const n) {
+        if (directory.empty()) {
+            ::operator delete(data);
+        } else {
+            unmap_scratch(data, n * sizeof(T));
+        }
+    }
+};
+
+template <class T, class U>
+bool operator==(MappedAllocator<T> const & a, MappedAllocator<U> const & b) {
+    return a.directory == b.directory;
+}
+
+template <class T, class U>
+bool operator!=(MappedAllocator<T> const & a, MappedAllocator<U> const & b) {
+    return a.directory != b.directory;
+}
+
+#endif //RECONSTRUCTION_MAPPED_ALLOCATOR_H
@@ -0,0 +1,211 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include "mesh_deviation.h"
+
+// Surface to measure distance to: 3 floats per vertex, 3 indices per face. Arrays are not copied
+MeshDeviation::MeshDeviation(float const * vertices, ulong const v_count, uint32_t const * faces,
+                             ulong const f_count) :
+        vertices(vertices), faces(faces), faces_count(f_count)
+{
+    if ((v_count == 0) || (f_count == 0)) {
+        cell_start.assign(2, 0);
+        faces_count = 0;
+        return;
+    }
+    // Grid over bounding box, cells of surface have a few faces
+    vec3f min = vertex(0), max = vertex(0);
+    for (ulong i = 1; i < v_count; ++i) {
+        vec3f p = vertex(i);
+        min = vec3f(fmin(min.x, p.x), fmin(min.y, p.y), fmin(min.z, p.z));
+        max = vec3f(fmax(max.x, p.x), fmax(max.y, p.y), fmax(max.z, p.z));
+    }
+    double area = 0;
+    #pragma omp parallel for reduction(+: area)
+    for (long f = 0; f < (long)f_count; ++f) {
+        vec3f a = vertex(faces[f * 3]);
+        vec3f n;
+        n.cross(vertex(faces[f * 3 + 1]) - a, vertex(faces[f * 3 + 2]) - a);
+        area += sqrt(n.dot(n)) / 2;
+    }
+    vec3f size = max - min;
+    cell = fmax(sqrt(2 * area / f_count), 1e-12);
+    // Empty cells of the volume are limited to several per face
+    while ((size.x / cell + 1) * (size.y / cell + 1) * (size.z / cell + 1) > 16.0 * f_count + 4096) {
+        cell *= 1.25;
+    }
+    origin = min;
+    dims[0] = std::max(1L, (long)ceil(size.x / cell));
+    dims[1] = std::max(1L, (long)ceil(size.y / cell));
+    dims[2] = std::max(1L, (long)ceil(size.z / cell));
+
+    // Every face is put into all cells overlapped by its bounding box: counts, offsets, then face ids
+    auto cell_range = [this](ulong const f, long lo[3], long hi[3]) {
+        vec3f p[3] = {vertex(this->faces[f * 3]), vertex(this->faces[f * 3 + 1]), vertex(this->faces[f * 3 + 2])};
+        double low[3] = {fmin(p[0].x, fmin(p[1].x, p[2].x)), fmin(p[0].y, fmin(p[1].y, p[2].y)),
+                         fmin(p[0].z, fmin(p[1].z, p[2].z))};
+        double high[3] = {fmax(p[0].x, fmax(p[1].x, p[2].x)), fmax(p[0].y, fmax(p[1].y, p[2].y)),
+                          fmax(p[0].z, fmax(p[1].z, p[2].z))};
+        double o[3] = {origin.x, origin.y, origin.z};
+        for (int k = 0; k < 3; ++k) {
+            lo[k] = std::min(dims[k] - 1, std::max(0L, (long)floor((low[k] - o[k]) / cell)));
+            hi[k] = std::min(dims[k] - 1, std::max(0L, (long)floor((high[k] - o[k]) / cell)));
+        }
+    };
+    cell_start.assign(dims[0] * dims[1] * dims[2] + 1, 0);
+    long lo[3], hi[3];
+    for (ulong f = 0; f < f_count; ++f) {
+        cell_range(f, lo, hi);
+        for (long z = lo[2]; z <= hi[2]; ++z)
+            for (long y = lo[1]; y <= hi[1]; ++y)
+                for (long x = lo[0]; x <= hi[0]; ++x)
+                    ++cell_start[(z * dims[1] + y) * dims[0] + x + 1];
+    }
+    for (ulong c = 1; c < cell_start.size(); ++c) {
+        cell_start[c] += cell_start[c - 1];
+    }
+    cell_faces.resize(cell_start.back());
+    std::vector<uint32_t> filled(cell_start.begin(), cell_start.end() - 1);
+    for (ulong f = 0; f < f_count; ++f) {
+        cell_range(f, lo, hi);
+        for (long z = lo[2]; z <= hi[2]; ++z)
+            for (long y = lo[1]; y <= hi[1]; ++y)
+                for (long x = lo[0]; x <= hi[0]; ++x)
+                    cell_faces[filled[(z * dims[1] + y) * dims[0] + x]++] = f;
+    }
+}
+
+// Squared distance from p to triangle f (closest point by Voronoi regions of the triangle, Ericson 2005)
+double MeshDeviation::triangle_distance(vec3f const & p, ulong const f) const {
+    vec3f a = vertex(faces[f * 3]), b = vertex(faces[f * 3 + 1]), c = vertex(faces[f * 3 + 2]);
+    vec3f ab = b - a, ac = c - a, ap = p - a;
+    vec3f closest;
+    double d1 = ab.dot(ap), d2 = ac.dot(ap);
+    vec3f bp = p - b;
+    double d3 = ab.dot(bp), d4 = ac.dot(bp);
+    vec3f cp = p - c;
+    double d5 = ab.dot(cp), d6 = ac.dot(cp);
+    double vc = d1 * d4 - d3 * d2, vb = d5 * d2 - d1 * d6, va = d3 * d6 - d5 * d4;
+    if ((d1 <= 0) && (d2 <= 0)) {
+        closest = a;
+    } else if ((d3 >= 0) && (d4 <= d3)) {
+        closest = b;
+    } else if ((vc <= 0) && (d1 >= 0) && (d3 <= 0)) {
+        closest = a + ab * (d1 / (d1 - d3));
+    } else if ((d6 >= 0) && (d5 <= d6)) {
+        closest = c;
+    } else if ((vb <= 0) && (d2 >= 0) && (d6 <= 0)) {
+        closest = a + ac * (d2 / (d2 - d6));
+    } else if ((va <= 0) && ((d4 - d3) >= 0) && ((d5 - d6) >= 0)) {
+        closest = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    } else {
+        double denom = va + vb + vc;
+        if (fabs(denom) < 1e-30) {
+            closest = a;
+        } else {
+            closest = a + ab * (vb / denom) + ac * (vc / denom);
+        }
+    }
+    vec3f d = p - closest;
+    return d.dot(d);
+}
+
+// Distance from p to the nearest point of the surface
+double MeshDeviation::distance(vec3f const & p) const {
+    if (faces_count == 0) {
+        return 0;
+    }
+    double o[3] = {origin.x, origin.y, origin.z}, q[3] = {p.x, p.y, p.z};
+    long center[3];
+    for (int k = 0; k < 3; ++k) {
+        center[k] = std::min(dims[k] - 1, std::max(0L, (long)floor((q[k] - o[k]) / cell)));
+    }
+    double best = 1e300;
+    long max_shell = std::max(dims[0], std::max(dims[1], dims[2]));
+    for (long shell = 0; shell <= max_shell; ++shell) {
+        for (long z = center[2] - shell; z <= center[2] + shell; ++z) {
+            if ((z < 0) || (z >= dims[2])) continue;
+            for (long y = center[1] - shell; y <= center[1] + shell; ++y) {
+                if ((y < 0) || (y >= dims[1])) continue;
+                for (long x = center[0] - shell; x <= center[0] + shell; ++x) {
+                    if ((x < 0) || (x >= dims[0])) continue;
+                    // Only the surface of the shell is new
+                    if ((std::abs(x - center[0]) != shell) && (std::abs(y - center[1]) != shell) &&
+                        (std::abs(z - center[2]) != shell)) {
+                        continue;
+                    }
+                    long c = (z * dims[1] + y) * dims[0] + x;
+                    for (uint32_t i = cell_start[c]; i < cell_start[c + 1]; ++i) {
+                        best = std::min(best, triangle_distance(p, cell_faces[i]));
+                    }
+                }
+            }
+        }
+        // Any cell beyond this shell is behind one of its walls: nearest wall with cells behind bounds the distance
+        double reach = 1e300;
+        for (int k = 0; k < 3; ++k) {
+            if (center[k] - shell > 0) {
+                reach = std::min(reach, q[k] - (o[k] + (center[k] - shell) * cell));
+            }
+            if (center[k] + shell < dims[k] - 1) {
+                reach = std::min(reach, o[k] + (center[k] + shell + 1) * cell - q[k]);
+            }
+        }
+        if ((best < 1e300) && ((reach == 1e300) || (best <= reach * reach))) {
+            break;
+        }
+    }
+    return sqrt(best);
+}
+
+// One-sided deviation: from vertices and face centroids of the other mesh to this surface
+MeshDeviation::Report MeshDeviation::measure(float const * other_vertices, ulong const other_v_count,
+                                             uint32_t const * other_faces, ulong const other_f_count) const
+{
+    Report report;
+    long const samples = other_v_count + other_f_count;
+    double max = 0, sum = 0, sum2 = 0;
+    #pragma omp parallel for schedule(dynamic, 1024) reduction(max: max) reduction(+: sum, sum2)
+    for (long i = 0; i < samples; ++i) {
+        vec3f p;
+        if (i < (long)other_v_count) {
+            p = vec3f(other_vertices[i * 3], other_vertices[i * 3 + 1], other_vertices[i * 3 + 2]);
+        } else {
+            uint32_t const * f = other_faces + (i - other_v_count) * 3;
+            p = vec3f(0, 0, 0);
+            for (int k = 0; k < 3; ++k) {
+                p = p + vec3f(other_vertices[f[k] * 3], other_vertices[f[k] * 3 + 1], other_vertices[f[k] * 3 + 2]);
+            }
+            p = p / 3.0;
+        }
+        double d = distance(p);
+        max = std::max(max, d);
+        sum += d;
+        sum2 += d * d;
+    }
+    report.samples = samples;
+    report.hausdorff = max;
+    report.mean = samples ? sum / samples : 0;
+    report.rms = samples ? sqrt(sum2 / samples) : 0;
+    return report;
+}
+
+// Symmetric deviation between two meshes, both are given as 3 floats per vertex and 3 indices per face
+MeshDeviation::Report mesh_deviation(float const * a_vertices, ulong const a_v_count, uint32_t const * a_faces,
+                                     ulong const a_f_count, float const * b_vertices, ulong const b_v_count,
+                                     uint32_t const * b_faces, ulong const b_f_count)
+{
+    MeshDeviation::Report ab = MeshDeviation(b_vertices, b_v_count, b_faces, b_f_count).measure(
+            a_vertices, a_v_count, a_faces, a_f_count);
+    MeshDeviation::Report ba = MeshDeviation(a_vertices, a_v_count, a_faces, a_f_count).measure(
+            b_vertices, b_v_count, b_faces, b_f_count);
+    MeshDeviation::Report report;
+    report.samples = ab.samples + ba.samples;
+    report.hausdorff = std::max(ab.hausdorff, ba.hausdorff);
+    if (report.samples) {
+        report.mean = (ab.mean * ab.samples + ba.mean * ba.samples) / report.samples;
+        report.rms = sqrt((ab.rms * ab.rms * ab.samples + ba.rms * ba.rms * ba.samples) / report.samples);
+    }
+    return report;
+}
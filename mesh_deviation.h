@@ -0,0 +1,61 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_MESH_DEVIATION_H
+#define RECONSTRUCTION_MESH_DEVIATION_H
+
+#include <cstdint>
+#include <vector>
+#include "simplify_mesh.h"
+
+// Geometric deviation between two meshes
+//
+// Distances are measured from sample points (vertices and face centroids) of one mesh to the surface
+// of the other one and in the opposite direction. Hausdorff distance is the largest of them, RMS is
+// taken over all samples. Nearest triangles are searched in a uniform grid of the surface: cells around
+// the point are visited shell by shell until no closer triangle can be found. Samples are measured in parallel.
+
+class MeshDeviation {
+public:
+    struct Report {
+        double hausdorff = 0;
+        double rms = 0;
+        double mean = 0;
+        ulong samples = 0;
+    };
+private:
+    float const * vertices;
+    uint32_t const * faces;
+    ulong faces_count;
+    vec3f origin = vec3f(0, 0, 0);
+    double cell = 1;
+    long dims[3] = {1, 1, 1};
+    // Triangles of every cell: cell_start[c] .. cell_start[c + 1] in cell_faces
+    std::vector<uint32_t> cell_start;
+    std::vector<uint32_t> cell_faces;
+
+    vec3f vertex(uint32_t const id) const {
+        return vec3f(vertices[id * 3], vertices[id * 3 + 1], vertices[id * 3 + 2]);
+    }
+
+    // Squared distance from p to triangle f
+    double triangle_distance(vec3f const & p, ulong const f) const;
+public:
+    // Surface to measure distance to: 3 floats per vertex, 3 indices per face. Arrays are not copied
+    MeshDeviation(float const * vertices, ulong const v_count, uint32_t const * faces, ulong const f_count);
+
+    // Distance from p to the nearest point of the surface
+    double distance(vec3f const & p) const;
+
+    // One-sided deviation: from vertices and face centroids of the other mesh to this surface
+    Report measure(float const * other_vertices, ulong const other_v_count, uint32_t const * other_faces,
+                   ulong const other_f_count) const;
+};
+
+// Symmetric deviation between two meshes, both are given as 3 floats per vertex and 3 indices per face
+MeshDeviation::Report mesh_deviation(float const * a_vertices, ulong const a_v_count, uint32_t const * a_faces,
+                                     ulong const a_f_count, float const * b_vertices, ulong const b_v_count,
+                                     uint32_t const * b_faces, ulong const b_f_count);
+
+#endif //RECONSTRUCTION_MESH_DEVIATION_H
@@ -1,8 +1,14 @@
 //
 // Created by user on 8/6/17.
 //
+#include <chrono>
 #include "simplify_mesh.h"
+#include "tileset.h"
+#include "vertex_clustering.h"
+#include "mesh_deviation.h"
 #include "openmvs.h"
+#include "tracing.h"
+#include "view_selection.h"
 
 // Convert double to string with 2 sign after comma: 0.00
 std::string double_to_string(double val) {
@@ -10,45 +16,193 @@ std::string double_to_string(double val) {
     return std::to_string(val).substr(0, 4);
 }
 
+// Two decimals as before ("0.50"), more while the ratio isn't exact: 0.05 and 0.1 don't name the same files
+std::string ratio_to_string(double ratio) {
+    char text[32];
+    for (int decimals = 2; ; ++decimals) {
+        snprintf(text, sizeof(text), "%.*f", decimals, ratio);
+        if ((decimals == 6) || (std::fabs(atof(text) - ratio) < 1e-9)) {
+            return text;
+        }
+    }
+}
+
+// Wall time since start in seconds
+static double seconds_since(std::chrono::steady_clock::time_point const & start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 // Constructor
-OpenMVS::OpenMVS(fs::path const & dir, bool set_automatic_execution = true) :
-        reconstruction_dir(dir.parent_path()), automatic_execution(set_automatic_execution)
+OpenMVS::OpenMVS(fs::path const & dir, bool set_automatic_execution = true,
+                 fs::path const & openmvs_bin = local_path::OPENMVS_BIN) :
+        reconstruction_dir(dir.parent_path()), automatic_execution(set_automatic_execution), planner(0, 0, 0, 0)
 {
-    densify_path = local_path::OPENMVS_BIN / "DensifyPointCloud ";
-    mesh_reconstruction_path = local_path::OPENMVS_BIN / "ReconstructMesh ";
-    mesh_refinement_path = local_path::OPENMVS_BIN / "RefineMesh ";
-    mesh_texture_path = local_path::OPENMVS_BIN / "TextureMesh ";
-    interface_mvs_path = local_path::OPENMVS_BIN / "InterfaceVisualSFM ";
+    densify_path = openmvs_bin / "DensifyPointCloud ";
+    mesh_reconstruction_path = openmvs_bin / "ReconstructMesh ";
+    mesh_refinement_path = openmvs_bin / "RefineMesh ";
+    mesh_texture_path = openmvs_bin / "TextureMesh ";
+    interface_mvs_path = openmvs_bin / "InterfaceVisualSFM ";
     scene = MVS::Scene(8);
 }
 
 bool OpenMVS::get_status() const {
-    return success_on_previous_step;
+    return proceed();
+}
+
+// Previous step succeeded and the pipeline isn't cancelled
+bool OpenMVS::proceed() const {
+    return success_on_previous_step && !(cancel_flag && cancel_flag->load());
+}
+
+void OpenMVS::set_lod_ratios(std::vector<double> const & ratios) {
+    lod_ratios = ratios;
+}
+
+void OpenMVS::set_ram_budget(double const budget_mb) {
+    ram_budget_mb = budget_mb;
+}
+
+// Planned resources next to the measured ones
+void log_resources(std::string const & stage, ResourcePlanner::Estimate const & estimate,
+                   double const peak_memory_mb, double const seconds, double const budget_mb)
+{
+    printf("%s: resolution level %u, estimated %.0f MB / %.0f sec, measured peak %.0f MB / %.0f sec "
+           "(budget %.0f MB)\n", stage.c_str(), estimate.resolution_level, estimate.memory_mb, estimate.seconds,
+           peak_memory_mb, seconds, budget_mb);
+}
+
+void OpenMVS::set_simplify_engine(MeshSimplify::Engine const engine, bool const compare, bool const parallel) {
+    simplify_engine = engine;
+    compare_engines = compare;
+    parallel_simplify = parallel;
+}
+
+void OpenMVS::set_compact_layout(bool const compact) {
+    compact_layout = compact;
+}
+
+void OpenMVS::set_max_error(double const error) {
+    max_error = error;
+}
+
+void OpenMVS::set_view_selection(bool const selection) {
+    view_selection = selection;
+}
+
+void OpenMVS::set_roi_cropping(bool const cropping) {
+    roi_cropping = cropping;
+}
+
+void OpenMVS::set_tiled_output(bool const tiles) {
+    tiled_output = tiles;
+}
+
+void OpenMVS::set_cancel_flag(std::atomic<bool> const * flag) {
+    cancel_flag = flag;
+}
+
+void OpenMVS::set_question_handler(Question const & handler) {
+    question_handler = handler;
 }
 
 // ----------- 0. Convert colmap NVM format to OpenMVS MVS format -----------
 void OpenMVS::convert_from_nvm_to_mvs() {
     std::cout << "6. Convert model.nvm to scene.mvs" << std::endl;
+    TraceStage stage("Convert NVM to MVS");
     // Prepare args
     std::string working_dir_arg(" -w " + reconstruction_dir.string());
     std::string input_file_arg(" -i model.nvm");
     std::string output_dir_arg(" -o scene.mvs");
     // Run
     std::string converting(interface_mvs_path.string() + working_dir_arg + input_file_arg + output_dir_arg);
-    success_on_previous_step = !system(converting.c_str());
+    success_on_previous_step = !run_traced(converting, cancel_flag);
+    stage.file("scene", reconstruction_dir / "scene.mvs");
+}
+
+// ----------- 0. Crop the scene to the object -----------
+void OpenMVS::crop_to_object() {
+    std::cout << "6. Crop scene.mvs to the object" << std::endl;
+    TraceStage stage("Crop to object");
+    TD_TIMER_START();
+    fs::path scene_path = reconstruction_dir / "scene.mvs";
+    scene.Load(scene_path.string());
+    if (scene.IsEmpty()) {
+        success_on_previous_step = false;
+        return;
+    }
+    ulong object_points = 0;
+    roi = RegionOfInterest::from_silhouettes(scene, reconstruction_dir, object_points);
+    stage.count("points_in", scene.pointcloud.points.size());
+    stage.count("object_points", object_points);
+    if (!roi.is_valid()) {
+        // Nothing is cropped, the whole volume is reconstructed
+        std::cout << "Region of interest isn't found: " << object_points << " points on silhouettes" << std::endl;
+        scene.Release();
+        return;
+    }
+    ulong removed = roi.crop(scene.pointcloud);
+    stage.count("points_out", scene.pointcloud.points.size());
+    stage.count("roi_volume", roi.volume());
+    if (removed > 0) {
+        success_on_previous_step = scene.Save(scene_path.string());
+    }
+    Eigen::Vector3d center = roi.get_center(), size = roi.get_size();
+    printf("Region of interest: center (%.3f, %.3f, %.3f), size %.3f x %.3f x %.3f, %lu sparse points removed "
+           "(%s)\n", center[0], center[1], center[2], size[0], size[1], size[2], removed,
+           TD_TIMER_GET_FMT().c_str());
+    scene.Release();
+}
+
+// ----------- 0. Select views for densifying and texturing -----------
+void OpenMVS::select_views() {
+    std::cout << "6. Select views of scene.mvs" << std::endl;
+    TraceStage stage("Select views");
+    TD_TIMER_START();
+    fs::path scene_path = reconstruction_dir / "scene.mvs";
+    scene.Load(scene_path.string());
+    if (scene.IsEmpty()) {
+        success_on_previous_step = false;
+        return;
+    }
+    ViewSelection::Result result = ViewSelection(scene).run();
+    stage.count("views_in", result.views);
+    stage.count("views_out", result.selected);
+    stage.count("points_in", result.points);
+    stage.count("points_out", result.points_kept);
+    // The whole scene is kept next to the pruned one
+    if (result.selected < result.views) {
+        fs::copy_file(scene_path, reconstruction_dir / "scene_all.mvs", fs::copy_options::overwrite_existing);
+        success_on_previous_step = scene.Save(scene_path.string());
+    }
+    printf("Views selected: %lu of %lu, sparse points: %lu of %lu (%s)\n", result.selected, result.views,
+           result.points_kept, result.points, TD_TIMER_GET_FMT().c_str());
+    scene.Release();
 }
 
 // ----------- 1. Sparse point cloud densifying -----------
 void OpenMVS::densify_point_cloud() {
     std::cout << "7. Densify point cloud" << std::endl;
+    TraceStage stage("Densify point cloud");
+    // Resolution level is planned from images and sparse points of the scene
+    scene.Load(reconstruction_dir.string() + "/scene.mvs");
+    stage.count("images", scene.images.size());
+    stage.count("sparse_points", scene.pointcloud.points.size());
+    planner = ResourcePlanner::from_scene(scene, reconstruction_dir, ram_budget_mb);
+    scene.Release();
+    ResourcePlanner::Estimate estimate = planner.plan_densify();
     // Prepare args
     std::string working_path_arg(" -w " + reconstruction_dir.string());
     std::string input_path_arg(" -i scene.mvs");
     std::string output_path_arg(" -o scene_dense.mvs");
-    std::string params(" --process-priority 1 --resolution-level 1");
+    std::string params(" --process-priority 1 --resolution-level " + std::to_string(estimate.resolution_level));
     // Run
     std::string densifying(densify_path.string() + working_path_arg + input_path_arg + output_path_arg + params);
-    success_on_previous_step = !system(densifying.c_str());
+    double peak_memory_mb = 0, seconds = 0;
+    success_on_previous_step = !run_measured(densifying, peak_memory_mb, seconds, cancel_flag);
+    log_resources("DensifyPointCloud", estimate, peak_memory_mb, seconds, planner.get_ram_budget());
+    stage.count("resolution_level", estimate.resolution_level);
+    stage.count("estimated_memory_mb", estimate.memory_mb);
+    stage.file("dense_scene", reconstruction_dir / "scene_dense.mvs");
 }
 
 // ----------- 2. Remove NAN points after densifying -----------
@@ -65,6 +219,7 @@ void remove_nan_values(MVS::PointCloud::PointArr & cloud) {
 }
 
 void OpenMVS::remove_nan_points() {
+    TraceStage stage("Remove NaN points");
     // Load dense scene
     std::string input_file_arg(reconstruction_dir.string() + "/scene_dense.mvs");
     scene.Load(input_file_arg);
@@ -74,7 +229,14 @@ void OpenMVS::remove_nan_points() {
     }
     std::cout << "8. Removing NAN values from dense point cloud " << std::endl;
     // Removing NAN values from dense cloud, save it and scene
+    stage.count("points_in", scene.pointcloud.points.size());
+    if (roi.is_valid()) {
+        // NaN points are outside too, views and colors of the points are removed with them
+        stage.count("points_outside_roi", roi.crop(scene.pointcloud));
+    }
     remove_nan_values(scene.pointcloud.points);
+    stage.count("points_out", scene.pointcloud.points.size());
+    dense_points_count = scene.pointcloud.points.size();
     success_on_previous_step = !scene.pointcloud.points.IsEmpty(); // success if vector is NOT empty
     std::string path_to_output_scene = reconstruction_dir.string() + "/scene_dense.mvs";
     std::string path_to_output_cloud = reconstruction_dir.string() + "/scene_dense_without_nan.ply";
@@ -87,6 +249,7 @@ void OpenMVS::remove_nan_points() {
 // ----------- 3. Mesh reconstruction -----------
 void OpenMVS::reconstruct_mesh(double const dist = 7.0) {
     std::cout << "9. Reconstruct the mesh " << std::endl;
+    TraceStage stage("Reconstruct mesh");
     std::string distance = double_to_string(dist);
     // Prepare args
     std::string input_file_arg(" -i scene_dense.mvs");
@@ -95,7 +258,9 @@ void OpenMVS::reconstruct_mesh(double const dist = 7.0) {
     std::string params(" -d " + distance + " --process-priority 1 --thickness-factor 1.0 --quality-factor 2.5 --close-holes 30 --smooth 3");
     // Run
     std::string reconstruction(mesh_reconstruction_path.string() + working_dir + input_file_arg + output_file_arg + params);
-    success_on_previous_step = !system(reconstruction.c_str());
+    success_on_previous_step = !run_traced(reconstruction, cancel_flag);
+    stage.count("faces_out", ply_faces_count(reconstruction_dir / ("dense_mesh_" + distance + ".ply")));
+    stage.file("mesh", reconstruction_dir / ("dense_mesh_" + distance + ".mvs"));
     common_distance_param = distance;
     common_simplify_ratio_param = "";
 }
@@ -103,100 +268,383 @@ void OpenMVS::reconstruct_mesh(double const dist = 7.0) {
 // ----------- 4. Mesh refinement -----------
 void OpenMVS::refining_mesh() {
     std::cout << "10. Refine the mesh " << std::endl;
+    TraceStage stage("Refine mesh");
+    // Resolution level is planned from images and faces of reconstructed mesh
+    ulong faces = ply_faces_count(reconstruction_dir / ("dense_mesh_" + common_distance_param + ".ply"));
+    if (faces == 0) {
+        faces = 2 * dense_points_count;
+    }
+    ResourcePlanner::Estimate estimate = planner.plan_refine(faces);
+    stage.count("faces_in", faces);
     // Prepare args
     std::string input_file_arg(" -i dense_mesh_" + common_distance_param + ".mvs");
     std::string working_dir(" -w " + reconstruction_dir.string());
-    std::string params(" --process-priority 1 --resolution-level 0 --ensure-edge-size 2 --close-holes 30");
+    std::string params(" --process-priority 1 --resolution-level " + std::to_string(estimate.resolution_level) +
+                       " --ensure-edge-size 2 --close-holes 30");
     // Run
     std::string refinement(mesh_refinement_path.string() + working_dir + input_file_arg + params);
-    success_on_previous_step = !system(refinement.c_str());
+    double peak_memory_mb = 0, seconds = 0;
+    success_on_previous_step = !run_measured(refinement, peak_memory_mb, seconds, cancel_flag);
+    log_resources("RefineMesh", estimate, peak_memory_mb, seconds, planner.get_ram_budget());
+    stage.count("resolution_level", estimate.resolution_level);
+    stage.count("estimated_memory_mb", estimate.memory_mb);
+    ulong refined_faces = ply_faces_count(reconstruction_dir / ("dense_mesh_" + common_distance_param + "_refine.ply"));
+    if (refined_faces > 0) {
+        stage.count("faces_out", refined_faces);
+    }
+    stage.file("mesh", reconstruction_dir / ("dense_mesh_" + common_distance_param + "_refine.mvs"));
 }
 
 // ----------- 5. Resize the mesh -----------
-// Push scene vertices and triangles to refined_mesh
-template <class L, class R>
-void fill_simplify_mesh(L const & from, std::vector<R> & to) {
-    R tmp; // create Vertex or Triangle
-    for (auto it = from.cbegin(); it != from.cend(); ++it) {
-        tmp.update(it->x, it->y, it->z);
-        to.push_back(tmp); // push vertex or triangle to vector for mesh refinement
-    }
-};
+// Simplified mesh is never smaller than this
+static ulong const MIN_TARGET_FACES = 2000;
 
-// Calculate target faces count for refined mesh
-ulong calc_target_faces_count(std::vector<MeshSimplify::Vertex> const & simplified_mesh_vertices,
-                              std::vector<MeshSimplify::Triangle> const & simplified_mesh_faces,
-                              double ratio)
-{
-    if ((simplified_mesh_faces.size() < 3) || (simplified_mesh_vertices.size() < 3)) {
+// Target faces count for refined mesh of this size
+static ulong target_faces_count(ulong const v_count, ulong const f_count, double const ratio) {
+    if ((f_count < 3) || (v_count < 3)) {
         return 0;
     }
-    ulong target_count = (ulong)round((double)simplified_mesh_faces.size() * ratio);
+    // Mesh keeps at least 2000 faces. Ratio 0 leaves the target to the error bound (see set_max_error)
+    return std::max<ulong>((ulong)round((double)f_count * ratio), std::min<ulong>(MIN_TARGET_FACES, f_count));
+}
 
-    while (target_count < 2000) {
-        std::cout << "New mesh will contain " << target_count << " faces. "
-                "We can't allow this. It should contain at least 2000 faces.\n";
-        std::cout << "Min param value: " << 2000.0 / (double)simplified_mesh_faces.size() << std::endl;
-        std::cout << "Please input param from 0 to 1. For example 0.2 will decimate 80% of triangles:" << std::endl;
-        std::cin >> ratio;
-        target_count = calc_target_faces_count(simplified_mesh_vertices, simplified_mesh_faces, ratio);
+// Calculate target faces count for refined mesh of this size
+ulong calc_target_faces_count(ulong const v_count, ulong const f_count, double const ratio) {
+    ulong target_count = target_faces_count(v_count, f_count, ratio);
+    if ((ratio > 0) && (target_count > (ulong)round((double)f_count * ratio))) {
+        printf("Ratio %f leaves less than %lu faces, target is raised to %lu\n",
+               ratio, MIN_TARGET_FACES, target_count);
+    }
+    if (target_count == 0) {
+        return 0;
     }
-    printf("Input: %zu vertices, %zu triangles (target %lu)\n",
-           simplified_mesh_vertices.size(), simplified_mesh_faces.size(), target_count);
+    printf("Input: %lu vertices, %lu triangles (target %lu)\n", v_count, f_count, target_count);
     return target_count;
 }
 
-// Push vertices and triangles after mesh refinement to scene back
-template <class L, class R, class Elem>
-void fill_scene_mesh(std::vector<L> const & from, R & to) {
-    to.Reset();
-    for (auto it = from.cbegin(); it != from.cend(); ++it) {
-        float x, y, z;
-        std::tie(x, y, z) = it->get_coord();
-        to.push_back(Elem(x, y, z));
+// Calculate target faces count for refined mesh
+template <class V, class T>
+ulong calc_target_faces_count(V const & simplified_mesh_vertices, T const & simplified_mesh_faces, double ratio) {
+    return calc_target_faces_count((ulong)simplified_mesh_vertices.size(), (ulong)simplified_mesh_faces.size(),
+                                   ratio);
+}
+
+// Runtime of both collapse engines side by side, serial and partitioned, each on its own copy of the mesh
+void compare_simplify_engines(MeshSimplify const & mesh, ulong const target_count, double const aggressiveness) {
+    MeshSimplify::Engine engines[] = {MeshSimplify::THRESHOLD, MeshSimplify::PRIORITY_QUEUE};
+    char const * names[] = {"threshold", "priority queue"};
+    printf("%-16s %10s %10s %12s %12s\n", "engine", "mode", "seconds", "triangles", "target");
+    for (int i = 0; i < 4; ++i) {
+        MeshSimplify copy(mesh);
+        copy.engine = engines[i / 2];
+        bool parallel = (i % 2) == 1;
+        auto start = std::chrono::steady_clock::now();
+        if (parallel) {
+            copy.simplify_mesh_parallel(target_count, aggressiveness, false);
+        } else {
+            copy.simplify_mesh(target_count, aggressiveness, false);
+        }
+        double seconds = seconds_since(start);
+        printf("%-16s %10s %10.3f %12zu %12lu\n", names[i / 2], parallel ? "parallel" : "serial", seconds,
+               copy.triangles.size(), target_count);
     }
-};
+}
 
-// main function for mesh simplifying
-void OpenMVS::simplify_mesh(double ratio = 0.5, double const aggressiveness = 7.0) {
-    clock_t start = clock();
-    // Load refined mesh
-    scene.Load(reconstruction_dir.string() + "/dense_mesh_" + common_distance_param + "_refine.mvs");
-    if (scene.IsEmpty()) {
-        success_on_previous_step = false;
+// Bytes of MeshSimplify working set for a mesh of this size: vertices, triangles and references,
+// which grow by the references of every collapse (about twice the initial ones)
+static double simplify_memory_estimate(ulong const v_count, ulong const t_count) {
+    return (double)v_count * sizeof(MeshSimplify::Vertex) + (double)t_count * sizeof(MeshSimplify::Triangle) +
+           (double)t_count * 3 * 2 * 2 * sizeof(int);
+}
+
+// Bytes of CompactMeshSimplify for a mesh of this size: positions, faces and working arrays
+static double compact_memory_estimate(ulong const v_count, ulong const t_count) {
+    return (double)v_count * sizeof(CompactMeshSimplify::Point) + (double)t_count * sizeof(CompactMeshSimplify::Face) +
+           (double)CompactMeshSimplify::working_memory_estimate(v_count, t_count);
+}
+
+// Vertex clustering pre-pass is used for meshes of at least this size,
+// it leaves several times the target faces count for the precise simplification
+static ulong const CLUSTERING_MIN_FACES = 2000000;
+static ulong const CLUSTERING_MARGIN = 4;
+
+// Mesh is pre-decimated by vertex clustering for this target
+static bool clustering_applies(ulong const f_count, ulong const target_count) {
+    return (f_count >= CLUSTERING_MIN_FACES) && (target_count > 0) && (target_count * CLUSTERING_MARGIN < f_count);
+}
+
+// Vertex clustering brings huge mesh of the loaded scene close to the target in linear time
+void OpenMVS::pre_decimate_mesh(ulong const target_count) {
+    MVS::Mesh::VertexArr & scene_vertices = scene.mesh.vertices;
+    MVS::Mesh::FaceArr & scene_faces = scene.mesh.faces;
+    if (!clustering_applies(scene_faces.size(), target_count)) {
         return;
     }
-    printf("Mesh Simplification (C)2014 by Sven Forstmann in 2014, MIT License (%zu-bit)\n", sizeof(size_t) * 8);
-    // Get vertices and faces from scene
-    ulong v_count = scene.mesh.vertices.size();
-    ulong f_count = scene.mesh.faces.size();
+    VertexClustering clustering(target_count * CLUSTERING_MARGIN);
+    if (!clustering.cluster(reinterpret_cast<float const *>(scene_vertices.Begin()), scene_vertices.size(),
+                            reinterpret_cast<uint32_t const *>(scene_faces.Begin()), scene_faces.size())) {
+        return;
+    }
+    // Clustered mesh is smaller: it's written to the beginning of scene arrays
+    std::copy(clustering.points.begin(), clustering.points.end(),
+              reinterpret_cast<CompactMeshSimplify::Point *>(scene_vertices.Begin()));
+    scene_vertices.Resize(clustering.points.size());
+    std::copy(clustering.faces.begin(), clustering.faces.end(),
+              reinterpret_cast<CompactMeshSimplify::Face *>(scene_faces.Begin()));
+    scene_faces.Resize(clustering.faces.size());
+}
+
+// Scene of the refined mesh without loading it: views of the interface scene (the refined scene has
+// the same ones, the sparse points aren't needed) and this mesh
+bool OpenMVS::load_views_with_mesh(CompactMeshSimplify::Point const * points, ulong const v_count,
+                                   CompactMeshSimplify::Face const * faces, ulong const f_count)
+{
+    scene.Load(reconstruction_dir.string() + "/scene.mvs");
+    scene.pointcloud.Release();
+    scene.mesh.Release();
+    scene.mesh.vertices.Resize(v_count);
+    std::copy(points, points + v_count, reinterpret_cast<CompactMeshSimplify::Point *>(scene.mesh.vertices.Begin()));
+    scene.mesh.faces.Resize(f_count);
+    std::copy(faces, faces + f_count, reinterpret_cast<CompactMeshSimplify::Face *>(scene.mesh.faces.Begin()));
+    return !scene.IsEmpty();
+}
+
+// Load refined mesh with its scene. Without error bound, mesh of at least CLUSTERING_MIN_FACES faces is clustered
+// from its PLY file instead: the full mesh is never loaded, cameras and images come from the interface scene.
+// Counts of the refined mesh and target faces count of every ratio are returned
+bool OpenMVS::load_refined_mesh(std::vector<double> const & ratios, ulong & v_count, ulong & f_count,
+                                std::vector<ulong> & target_counts)
+{
+    target_counts.clear();
+    fs::path refined_path = reconstruction_dir / ("dense_mesh_" + common_distance_param + "_refine.mvs");
+    fs::path refined_ply = fs::path(refined_path).replace_extension(".ply");
+    PlyLayout layout;
+    if ((max_error == 0) && read_ply_layout(refined_ply, layout) && (layout.t_count >= CLUSTERING_MIN_FACES)) {
+        for (auto ratio : ratios) {
+            target_counts.push_back(calc_target_faces_count(layout.v_count, layout.t_count, ratio));
+        }
+        ulong target_count = target_counts.empty() ? 0 :
+                             *std::max_element(target_counts.begin(), target_counts.end());
+        VertexClustering clustering(target_count * CLUSTERING_MARGIN);
+        if (clustering_applies(layout.t_count, target_count) && clustering.cluster_ply(refined_ply)) {
+            v_count = layout.v_count;
+            f_count = layout.t_count;
+            return load_views_with_mesh(clustering.points.data(), clustering.points.size(),
+                                        clustering.faces.data(), clustering.faces.size());
+        }
+    }
+    scene.Load(refined_path.string());
+    if (scene.IsEmpty()) {
+        return false;
+    }
+    v_count = scene.mesh.vertices.size();
+    f_count = scene.mesh.faces.size();
+    if (target_counts.empty()) {
+        for (auto ratio : ratios) {
+            target_counts.push_back(calc_target_faces_count(scene.mesh.vertices, scene.mesh.faces, ratio));
+        }
+    }
+    // Mesh in other PLY layout is clustered in memory
+    if ((max_error == 0) && !target_counts.empty()) {
+        pre_decimate_mesh(*std::max_element(target_counts.begin(), target_counts.end()));
+    }
+    return true;
+}
+
+// Input mesh of error-bounded simplification, the result is measured against it.
+// The copy is a memory mapped scratch file if the directory is set
+struct ReferenceMesh {
+    std::vector<float, MappedAllocator<float>> vertices;
+    std::vector<uint32_t, MappedAllocator<uint32_t>> faces;
+
+    explicit ReferenceMesh(std::string const & scratch_directory = "") :
+            vertices(MappedAllocator<float>(scratch_directory)), faces(MappedAllocator<uint32_t>(scratch_directory))
+    {}
+
+    // 3 floats per vertex, 3 indices per face
+    void assign(float const * v, ulong const v_count, uint32_t const * f, ulong const f_count) {
+        vertices.assign(v, v + v_count * 3);
+        faces.assign(f, f + f_count * 3);
+    }
+
+    void assign(MVS::Mesh const & mesh) {
+        assign(reinterpret_cast<float const *>(mesh.vertices.Begin()), mesh.vertices.size(),
+               reinterpret_cast<uint32_t const *>(mesh.faces.Begin()), mesh.faces.size());
+    }
+
+    // Symmetric deviation of the simplified mesh from this one
+    void report(MVS::Mesh const & mesh, double const max_error) const {
+        auto start = std::chrono::steady_clock::now();
+        MeshDeviation::Report deviation = mesh_deviation(
+                vertices.data(), vertices.size() / 3, faces.data(), faces.size() / 3,
+                reinterpret_cast<float const *>(mesh.vertices.Begin()), mesh.vertices.size(),
+                reinterpret_cast<uint32_t const *>(mesh.faces.Begin()), mesh.faces.size());
+        printf("Deviation: Hausdorff %g, RMS %g, mean %g (max error %g; %lu samples; %.4f sec)\n",
+               deviation.hausdorff, deviation.rms, deviation.mean, max_error, deviation.samples,
+               seconds_since(start));
+        Trace::current().count("hausdorff", deviation.hausdorff);
+        Trace::current().count("rms", deviation.rms);
+    }
+};
+
+// Simplify mesh of the loaded scene in compact layout (32-bit indices, struct of arrays).
+// Out-of-core: working arrays are scratch files in reconstruction directory
+void OpenMVS::simplify_mesh_compact(ulong const target_count, double const aggressiveness, bool const out_of_core) {
     MVS::Mesh::VertexArr & scene_vertices = scene.mesh.vertices;
     MVS::Mesh::FaceArr & scene_faces = scene.mesh.faces;
+    // Scene arrays have the same layout: they are decimated in place, without copies
+    static_assert(sizeof(MVS::Mesh::Vertex) == sizeof(CompactMeshSimplify::Point), "vertex layout");
+    static_assert(sizeof(MVS::Mesh::Face) == sizeof(CompactMeshSimplify::Face), "face layout");
+    CompactMeshSimplify mesh(0, 0);
+    mesh.max_error = max_error;
+    if (out_of_core) {
+        mesh.set_scratch_directory(reconstruction_dir.string());
+    }
+    mesh.attach(reinterpret_cast<CompactMeshSimplify::Point *>(scene_vertices.Begin()), scene_vertices.size(),
+                reinterpret_cast<CompactMeshSimplify::Face *>(scene_faces.Begin()), scene_faces.size());
+    mesh.simplify_mesh(target_count, aggressiveness, true);
+    printf("Compact layout: %.1f MB besides the scene mesh\n", mesh.memory_usage() / (1024.0 * 1024.0));
 
-    // Push vertices and triangles from scene to temporary mesh for simplifying
-    MeshSimplify mesh(v_count, f_count);
-    std::vector<MeshSimplify::Triangle> & simplified_mesh_faces = mesh.triangles;
-    std::vector<MeshSimplify::Vertex> & simplified_mesh_vertices = mesh.vertices;
-    fill_simplify_mesh<MVS::Mesh::VertexArr, MeshSimplify::Vertex>(scene_vertices, simplified_mesh_vertices);
-    fill_simplify_mesh<MVS::Mesh::FaceArr, MeshSimplify::Triangle>(scene_faces, simplified_mesh_faces);
+    // Result is at the beginning of scene arrays
+    scene_vertices.Resize(mesh.points.size());
+    scene_faces.Resize(mesh.faces.size());
+}
 
-    // Reduce mesh faces(triangles) from initial to target count
-    ulong target_count = calc_target_faces_count(simplified_mesh_vertices, simplified_mesh_faces, ratio);
+// Simplify refined mesh of the PLY file in compact layout on scratch files in reconstruction directory:
+// the mesh is read into memory mapped arrays and never loaded whole, the reference of error-bounded
+// simplification is a scratch file too. The result goes to the scene (false if PLY can't be read in place)
+bool OpenMVS::simplify_ply_out_of_core(fs::path const & ply_path, ulong const target_count,
+                                       double const aggressiveness, ReferenceMesh & reference)
+{
+    MappedPly ply(ply_path);
+    if (!ply.is_open() || (ply.polygons_count() > 0)) {
+        return false;
+    }
+    long const v_count = ply.layout.v_count, t_count = ply.layout.t_count;
+    CompactMeshSimplify mesh(0, 0);
+    mesh.max_error = max_error;
+    mesh.set_scratch_directory(reconstruction_dir.string());
+    mesh.points.resize(v_count);
+    mesh.faces.resize(t_count);
+    #pragma omp parallel for
+    for (long i = 0; i < v_count; ++i) {
+        ply.vertex(i, reinterpret_cast<float *>(&mesh.points[i]));
+    }
+    #pragma omp parallel for
+    for (long i = 0; i < t_count; ++i) {
+        ply.face(i, mesh.faces[i].v);
+    }
+    if (max_error > 0) {
+        reference.assign(reinterpret_cast<float const *>(mesh.points.data()), v_count,
+                         reinterpret_cast<uint32_t const *>(mesh.faces.data()), t_count);
+    }
     mesh.simplify_mesh(target_count, aggressiveness, true);
+    printf("Compact layout: %.1f MB in scratch files\n", mesh.memory_usage() / (1024.0 * 1024.0));
+    return load_views_with_mesh(mesh.points.data(), mesh.points.size(), mesh.faces.data(), mesh.faces.size());
+}
 
-    // Push vertices and triangles to scene from temporary mesh after simplifying
-    fill_scene_mesh<MeshSimplify::Vertex, MVS::Mesh::VertexArr, MVS::Mesh::Vertex>(simplified_mesh_vertices, scene_vertices);
-    fill_scene_mesh<MeshSimplify::Triangle, MVS::Mesh::FaceArr, MVS::Mesh::Face>(simplified_mesh_faces, scene_faces);
+// main function for mesh simplifying
+void OpenMVS::simplify_mesh(double ratio = 0.5, double const aggressiveness = 7.0) {
+    TraceStage stage("Simplify mesh");
+    auto start = std::chrono::steady_clock::now();
+    printf("Mesh Simplification (C)2014 by Sven Forstmann in 2014, MIT License (%zu-bit)\n", sizeof(size_t) * 8);
+    // Refined mesh whose compact simplification doesn't fit in RAM budget (and isn't clustered) is simplified
+    // from its PLY file on scratch files without loading it. Otherwise it's loaded, huge mesh comes already
+    // clustered close to the target
+    // Compact layout is the serial threshold engine. It replaces MeshSimplify over RAM budget only if no other
+    // engine, partitioned decimation or comparison was asked for: these are kept even over the budget
+    bool const engine_requested = (simplify_engine != MeshSimplify::THRESHOLD) || parallel_simplify || compare_engines;
+    fs::path refined_ply = reconstruction_dir / ("dense_mesh_" + common_distance_param + "_refine.ply");
+    PlyLayout layout;
+    double const mb = 1024.0 * 1024.0;
+    bool const ply_out_of_core = (compact_layout || !engine_requested) && read_ply_layout(refined_ply, layout) &&
+            ((max_error > 0) ||
+             !clustering_applies(layout.t_count, target_faces_count(layout.v_count, layout.t_count, ratio))) &&
+            (compact_memory_estimate(layout.v_count, layout.t_count) / mb > planner.get_ram_budget());
+    // Error-bounded simplification is measured against the input, clustering doesn't keep the bound
+    ReferenceMesh reference(ply_out_of_core ? reconstruction_dir.string() : "");
+    ulong v_count_in = 0, f_count = 0, target_count = 0;
+    bool simplified_from_file = false;
+    if (ply_out_of_core) {
+        v_count_in = layout.v_count;
+        f_count = layout.t_count;
+        target_count = calc_target_faces_count(v_count_in, f_count, ratio);
+        printf("Compact simplification needs about %.0f MB, RAM budget is %.0f MB: mesh is read to scratch files\n",
+               compact_memory_estimate(v_count_in, f_count) / mb, planner.get_ram_budget());
+        simplified_from_file = simplify_ply_out_of_core(refined_ply, target_count, aggressiveness, reference);
+    }
+    if (!simplified_from_file) {
+        std::vector<ulong> target_counts;
+        if (!load_refined_mesh(std::vector<double>(1, ratio), v_count_in, f_count, target_counts)) {
+            success_on_previous_step = false;
+            return;
+        }
+        target_count = target_counts[0];
+        if (max_error > 0) {
+            reference.assign(scene.mesh);
+        }
+    }
+    MVS::Mesh::VertexArr & scene_vertices = scene.mesh.vertices;
+    MVS::Mesh::FaceArr & scene_faces = scene.mesh.faces;
+    stage.count("vertices_in", v_count_in);
+    stage.count("faces_in", f_count);
+    stage.count("target_faces", target_count);
+    // Working set of loaded mesh doesn't fit in RAM budget: compact layout, then scratch files
+    if (!simplified_from_file) {
+        ulong v_count = scene_vertices.size();
+        double scene_mb = (v_count * sizeof(MVS::Mesh::Vertex) + scene_faces.size() * sizeof(MVS::Mesh::Face)) / mb;
+        double simplify_mb = scene_mb + simplify_memory_estimate(v_count, scene_faces.size()) / mb;
+        double compact_mb = scene_mb + CompactMeshSimplify::working_memory_estimate(v_count, scene_faces.size()) / mb;
+        bool out_of_core = compact_mb > planner.get_ram_budget();
+        bool over_budget = !compact_layout && (simplify_mb > planner.get_ram_budget());
+        if (over_budget && engine_requested) {
+            printf("Simplification needs about %.0f MB, RAM budget is %.0f MB: requested engine is kept, "
+                   "compact layout (serial threshold engine) isn't used\n", simplify_mb, planner.get_ram_budget());
+        } else if (over_budget) {
+            printf("Simplification needs about %.0f MB, RAM budget is %.0f MB: compact layout%s is used\n",
+                   simplify_mb, planner.get_ram_budget(), out_of_core ? " with scratch files" : "");
+        }
+        if (compact_layout || (over_budget && !engine_requested)) {
+            simplify_mesh_compact(target_count, aggressiveness, out_of_core);
+        } else {
+            // Push vertices and triangles from scene to temporary mesh for simplifying
+            MeshSimplify mesh(scene_vertices.size(), scene_faces.size());
+            mesh.engine = simplify_engine;
+            mesh.max_error = max_error;
+            std::vector<MeshSimplify::Triangle> & simplified_mesh_faces = mesh.triangles;
+            std::vector<MeshSimplify::Vertex> & simplified_mesh_vertices = mesh.vertices;
+            fill_simplify_mesh<MVS::Mesh::VertexArr, MeshSimplify::Vertex>(scene_vertices, simplified_mesh_vertices);
+            fill_simplify_mesh<MVS::Mesh::FaceArr, MeshSimplify::Triangle>(scene_faces, simplified_mesh_faces);
+
+            if (compare_engines) {
+                compare_simplify_engines(mesh, target_count, aggressiveness);
+            }
+            if (parallel_simplify) {
+                mesh.simplify_mesh_parallel(target_count, aggressiveness, true);
+            } else {
+                mesh.simplify_mesh(target_count, aggressiveness, true);
+            }
+
+            // Push vertices and triangles to scene from temporary mesh after simplifying
+            fill_scene_mesh<MeshSimplify::Vertex, MVS::Mesh::VertexArr, MVS::Mesh::Vertex>(simplified_mesh_vertices, scene_vertices);
+            fill_scene_mesh<MeshSimplify::Triangle, MVS::Mesh::FaceArr, MVS::Mesh::Face>(simplified_mesh_faces, scene_faces);
+        }
+    }
 
     // Save simplified mesh to scene for texture and to ply format
-    std::string simplify_ratio = double_to_string(ratio);
+    std::string simplify_ratio = ratio_to_string(ratio);
     scene.Save(reconstruction_dir.string() +
                        "/dense_mesh_" + common_distance_param + "_refine_" + simplify_ratio + "_resized.mvs");
     scene.mesh.Save(reconstruction_dir.string() +
                             "/dense_mesh_" + common_distance_param + "_refine_" + simplify_ratio + "_resized.ply");
     printf("Output: %zu vertices, %zu triangles (%f reduction; %.4f sec)\n",
-           simplified_mesh_vertices.size(), simplified_mesh_faces.size(),
-           (float)simplified_mesh_faces.size() / (float) scene_faces.size(), ((float)(clock() -start))  / CLOCKS_PER_SEC);
+           scene_vertices.size(), scene_faces.size(),
+           (float)scene_faces.size() / (float) f_count, seconds_since(start));
+    stage.count("vertices_out", scene_vertices.size());
+    stage.count("faces_out", scene_faces.size());
+    if (max_error > 0) {
+        reference.report(scene.mesh, max_error);
+    }
 
     // Reset scene: clean vertices and faces. Remember simplify_ratio for texture step (input file has ration in filename)
     scene.Release();
@@ -205,9 +653,144 @@ void OpenMVS::simplify_mesh(double ratio = 0.5, double const aggressiveness = 7.
     simplified = true;
 }
 
+// Several levels of detail from one simplification pass. Each level is saved as a separate resized scene
+void OpenMVS::simplify_mesh_lod(std::vector<double> const & ratios, double const aggressiveness = 7.0) {
+    TraceStage stage("Simplify levels of detail");
+    auto start = std::chrono::steady_clock::now();
+    printf("Mesh Simplification (C)2014 by Sven Forstmann in 2014, MIT License (%zu-bit)\n", sizeof(size_t) * 8);
+    // Load refined mesh with target faces count for every level,
+    // huge mesh is brought close to the finest one by vertex clustering
+    ulong v_count_in = 0, f_count = 0;
+    std::vector<ulong> target_counts;
+    if (!load_refined_mesh(ratios, v_count_in, f_count, target_counts)) {
+        success_on_previous_step = false;
+        return;
+    }
+    MVS::Mesh::VertexArr & scene_vertices = scene.mesh.vertices;
+    MVS::Mesh::FaceArr & scene_faces = scene.mesh.faces;
+
+    stage.count("vertices_in", v_count_in);
+    stage.count("faces_in", f_count);
+    ReferenceMesh reference;
+    if (max_error > 0) {
+        reference.assign(scene.mesh);
+    }
+
+    // Push vertices and triangles from scene to temporary mesh for simplifying
+    MeshSimplify mesh(scene_vertices.size(), scene_faces.size());
+    mesh.engine = simplify_engine;
+    mesh.max_error = max_error;
+    fill_simplify_mesh<MVS::Mesh::VertexArr, MeshSimplify::Vertex>(scene_vertices, mesh.vertices);
+    fill_simplify_mesh<MVS::Mesh::FaceArr, MeshSimplify::Triangle>(scene_faces, mesh.triangles);
+
+    // Every snapshot replaces mesh of the scene and is saved with its own ratio in filename
+    if (compare_engines && !target_counts.empty()) {
+        compare_simplify_engines(mesh, *std::min_element(target_counts.begin(), target_counts.end()), aggressiveness);
+    }
+    // The finest level is reached by partitioned decimation, the coarser ones continue from it
+    if (parallel_simplify && !target_counts.empty()) {
+        mesh.simplify_mesh_parallel(*std::max_element(target_counts.begin(), target_counts.end()), aggressiveness, true);
+    }
+    mesh.simplify_mesh_lod(target_counts, aggressiveness, true,
+        [&](ulong const level, std::vector<MeshSimplify::Vertex> const & vertices,
+            std::vector<MeshSimplify::Triangle> const & triangles, std::vector<MeshSimplify::UV> const & uvs)
+    {
+        fill_scene_mesh<MeshSimplify::Vertex, MVS::Mesh::VertexArr, MVS::Mesh::Vertex>(vertices, scene_vertices);
+        fill_scene_mesh<MeshSimplify::Triangle, MVS::Mesh::FaceArr, MVS::Mesh::Face>(triangles, scene_faces);
+        std::string simplify_ratio = ratio_to_string(ratios[level]);
+        scene.Save(reconstruction_dir.string() +
+                           "/dense_mesh_" + common_distance_param + "_refine_" + simplify_ratio + "_resized.mvs");
+        scene.mesh.Save(reconstruction_dir.string() +
+                                "/dense_mesh_" + common_distance_param + "_refine_" + simplify_ratio + "_resized.ply");
+        printf("LOD %s: %zu vertices, %zu triangles (%f reduction; %.4f sec)\n", simplify_ratio.c_str(),
+               vertices.size(), triangles.size(), (float)triangles.size() / (float)f_count, seconds_since(start));
+        stage.count("faces_out_" + simplify_ratio, triangles.size());
+        if (max_error > 0) {
+            reference.report(scene.mesh, max_error);
+        }
+    });
+
+    scene.Release();
+    simplified = true;
+}
+
+// Simplify the textured mesh to several levels of detail in one pass.
+// Texture atlas is reused, texture coordinates are interpolated by the attribute-preserving decimation.
+// Returns paths of textured scenes for every ratio (empty if failed)
+std::vector<fs::path> OpenMVS::simplify_textured_mesh(std::vector<double> const & ratios,
+                                                      fs::path const & textured_mesh_path,
+                                                      double const aggressiveness = 7.0)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<fs::path> paths;
+    // Load textured refined mesh
+    scene.Load(textured_mesh_path.string());
+    if (scene.IsEmpty() || (scene.mesh.faceTexcoords.size() != scene.mesh.faces.size() * 3)) {
+        scene.Release();
+        return paths;
+    }
+    std::cout << "11. Simplify the textured mesh " << std::endl;
+    TraceStage stage("Simplify textured mesh");
+    ulong v_count = scene.mesh.vertices.size();
+    ulong f_count = scene.mesh.faces.size();
+    MVS::Mesh::VertexArr & scene_vertices = scene.mesh.vertices;
+    MVS::Mesh::FaceArr & scene_faces = scene.mesh.faces;
+    MVS::Mesh::TexCoordArr & scene_texcoords = scene.mesh.faceTexcoords;
+    stage.count("vertices_in", v_count);
+    stage.count("faces_in", f_count);
+
+    // Push vertices, triangles and their texture coordinates to temporary mesh for simplifying
+    ReferenceMesh reference;
+    if (max_error > 0) {
+        reference.assign(scene.mesh);
+    }
+    MeshSimplify mesh(v_count, f_count);
+    mesh.engine = simplify_engine;
+    mesh.max_error = max_error;
+    fill_simplify_mesh<MVS::Mesh::VertexArr, MeshSimplify::Vertex>(scene_vertices, mesh.vertices);
+    fill_simplify_mesh<MVS::Mesh::FaceArr, MeshSimplify::Triangle>(scene_faces, mesh.triangles);
+    fill_simplify_texcoords<MVS::Mesh::TexCoordArr>(scene_texcoords, mesh.triangles, mesh.uvs);
+    mesh.texcoords = true;
+
+    std::vector<ulong> target_counts;
+    for (auto ratio : ratios) {
+        target_counts.push_back(calc_target_faces_count(mesh.vertices, mesh.triangles, ratio));
+    }
+
+    // Every level is saved with its ratio in filename, the same way as texture_mesh() names its output
+    paths.resize(ratios.size());
+    if (compare_engines && !target_counts.empty()) {
+        compare_simplify_engines(mesh, *std::min_element(target_counts.begin(), target_counts.end()), aggressiveness);
+    }
+    // The finest level is reached by partitioned decimation, the coarser ones continue from it
+    if (parallel_simplify && !target_counts.empty()) {
+        mesh.simplify_mesh_parallel(*std::max_element(target_counts.begin(), target_counts.end()), aggressiveness, true);
+    }
+    mesh.simplify_mesh_lod(target_counts, aggressiveness, true,
+        [&](ulong const level, std::vector<MeshSimplify::Vertex> const & vertices,
+            std::vector<MeshSimplify::Triangle> const & triangles, std::vector<MeshSimplify::UV> const & uvs)
+    {
+        fill_scene_mesh<MeshSimplify::Vertex, MVS::Mesh::VertexArr, MVS::Mesh::Vertex>(vertices, scene_vertices);
+        fill_scene_mesh<MeshSimplify::Triangle, MVS::Mesh::FaceArr, MVS::Mesh::Face>(triangles, scene_faces);
+        fill_scene_texcoords<MVS::Mesh::TexCoordArr, MVS::Mesh::TexCoord>(uvs, scene_texcoords);
+        std::string simplify_ratio = ratio_to_string(ratios[level]);
+        paths[level] = reconstruction_dir / ("texture_" + common_distance_param + "_" + simplify_ratio + ".mvs");
+        scene.Save(paths[level].string());
+        printf("Textured %s: %zu vertices, %zu triangles (%f reduction; %.4f sec)\n", simplify_ratio.c_str(),
+               vertices.size(), triangles.size(), (float)triangles.size() / (float)f_count, seconds_since(start));
+        stage.count("faces_out_" + simplify_ratio, triangles.size());
+        if (max_error > 0) {
+            reference.report(scene.mesh, max_error);
+        }
+    });
+    scene.Release();
+    return paths;
+}
+
 // ----------- 6. Texture the mesh -----------
 fs::path OpenMVS::texture_mesh() {
     std::cout << "12. Texture the remeshed model " << std::endl;
+    TraceStage stage("Texture mesh");
     // Prepare args
     std::string input_file_arg;
     // Input file depends on parameter 'simplify_ratio' from simplify_mesh(...) {...}
@@ -224,16 +807,20 @@ fs::path OpenMVS::texture_mesh() {
     std::string texture(mesh_texture_path.string() + working_dir + input_file_arg + output_file_arg + params);
     // If texture failed we can try again with another mesh
     // Success is determined by god. Do not simplify mesh at all or leave more faces in simplified mesh.
-    if (system(texture.c_str())) {
+    if (run_traced(texture, cancel_flag)) {
         std::cerr << "Can't texture mesh. Increase it's face amount!" << std::endl;
         success_on_previous_step = true;
         return fs::path();
     }
-    return reconstruction_dir / ("texture_" + common_distance_param + "_" + common_simplify_ratio_param + ".mvs");
+    fs::path textured_path = reconstruction_dir / ("texture_" + common_distance_param + "_" +
+                                                   common_simplify_ratio_param + ".mvs");
+    stage.file("textured_scene", textured_path);
+    return textured_path;
 }
 
 // ----------- 7. Centering the mesh -----------
 void OpenMVS::centering_textured_mesh(fs::path const & textured_mesh_path) {
+    TraceStage stage("Center textured mesh");
     TD_TIMER_START();
     //  Load scene
     scene.Load(textured_mesh_path.string());
@@ -255,12 +842,61 @@ void OpenMVS::centering_textured_mesh(fs::path const & textured_mesh_path) {
         it->z -= centroid.z;
     }
     // Save final mesh
-    scene.mesh.Save(reconstruction_dir.parent_path().parent_path().string() +
-                            "/texture_" + common_distance_param + "_" + common_simplify_ratio_param + "centered.obj");
+    fs::path centered_path = reconstruction_dir.parent_path().parent_path() /
+                             ("texture_" + common_distance_param + "_" + common_simplify_ratio_param + "centered.obj");
+    scene.mesh.Save(centered_path.string());
+    stage.count("vertices", scene.mesh.vertices.size());
+    stage.count("faces", scene.mesh.faces.size());
+    stage.file("mesh", centered_path);
     printf("Textured mesh has centered: %s\n", TD_TIMER_GET_FMT().c_str());
+    if (tiled_output) {
+        tile_textured_mesh();
+    }
     scene.Release();
 }
 
+// ----------- 8. Split the textured mesh into streamable tiles -----------
+void OpenMVS::tile_textured_mesh() {
+    std::cout << "14. Tile the textured mesh " << std::endl;
+    TraceStage stage("Tile textured mesh");
+    fs::path tiles_dir = reconstruction_dir.parent_path().parent_path() /
+                         ("tiles_" + common_distance_param + "_" + common_simplify_ratio_param);
+    Tileset tileset(scene.mesh, tiles_dir, 50000, 8);
+    if (!tileset.build()) {
+        std::cerr << "Can't tile the textured mesh!" << std::endl;
+    }
+    stage.file("tiles", tiles_dir);
+}
+
+// Simplified meshes take texture of the refined one. If refined mesh isn't textured
+// every simplified mesh is textured separately
+void OpenMVS::simplify_and_texture(std::vector<double> const & ratios, fs::path const & textured_path) {
+    std::vector<fs::path> paths;
+    if (!textured_path.empty()) {
+        paths = simplify_textured_mesh(ratios, textured_path);
+    }
+    if (!paths.empty()) {
+        for (ulong i = 0; i < ratios.size(); ++i) {
+            common_simplify_ratio_param = ratio_to_string(ratios[i]);
+            centering_textured_mesh(paths[i]);
+        }
+    } else {
+        if (ratios.size() > 1) {
+            simplify_mesh_lod(ratios);
+        }
+        for (auto ratio : ratios) {
+            if (ratios.size() == 1) {
+                if (proceed()) simplify_mesh(ratio);
+            }
+            common_simplify_ratio_param = ratio_to_string(ratio);
+            fs::path path;
+            if (proceed() && simplified) path = texture_mesh();
+            if (proceed() && simplified && !path.empty()) centering_textured_mesh(path);
+        }
+    }
+    common_simplify_ratio_param = "";
+}
+
 // Command line interface. Working for two steps: Mesh Simplifying and Mesh Reconstruction
 // flag - bool value for "to do"/ "not to do" simplify.
 // ratio - double value for:
@@ -274,7 +910,10 @@ int dialog(std::string const & question, std::string const & suggestion, bool &
     // Check desire of simplifying or reconstruction mesh
     while ((answer != "yes") && (answer != "no")) {
         std::cout << "Type 'yes' or 'no': " << std::endl;
-        std::cin >> answer;
+        // Closed input is 'no'
+        if (!(std::cin >> answer)) {
+            answer = "no";
+        }
     }
     if (answer == "yes") {
         simplify = true;
@@ -282,7 +921,10 @@ int dialog(std::string const & question, std::string const & suggestion, bool &
         while (1) {
             // Read double
             std::cout << suggestion << std::endl;
-            std::cin >> x;
+            if (!(std::cin >> x)) {
+                value = 0.0;
+                return 0;
+            }
             value = atof(x.c_str());
             // Check constrains
             if ((min < value) && (value < max)) {
@@ -297,36 +939,58 @@ int dialog(std::string const & question, std::string const & suggestion, bool &
 }
 
 
+// Answer of the question handler, console dialog without it
+bool OpenMVS::ask(std::string const & text, std::string const & suggestion, double const min, double const max,
+                  double & value) const
+{
+    if (question_handler) {
+        return question_handler(text, suggestion, min, max, value);
+    }
+    bool yes = false;
+    return dialog(text, suggestion, yes, value, min, max) && yes;
+}
+
 // ----------- pipeline -----------
 void OpenMVS::build_model_from_sparse_point_cloud() {
-    if (success_on_previous_step) convert_from_nvm_to_mvs(); else return;
-    if (success_on_previous_step) densify_point_cloud(); else return;
-    if (success_on_previous_step) remove_nan_points();  else return;
+    TraceStage stage("OpenMVS");
+    if (proceed()) convert_from_nvm_to_mvs(); else return;
+    if (proceed() && roi_cropping) crop_to_object();
+    if (proceed() && view_selection) select_views();
+    if (proceed()) densify_point_cloud(); else return;
+    if (proceed()) remove_nan_points();  else return;
     double distance = 7.0;
     double simplify_ratio = 0.0;
-    fs::path path;
     // Try to build mesh from dense point cloud.
     while (true) {
         // Mesh is built with parameter 'distance'
-        if (success_on_previous_step) reconstruct_mesh(distance); else return;
+        if (proceed()) reconstruct_mesh(distance); else return;
         // Then it is refined
-        if (success_on_previous_step) refining_mesh(); else return;
+        if (proceed()) refining_mesh(); else return;
+        // Texture is computed once for the refined mesh
+        common_simplify_ratio_param = "";
+        fs::path textured_path;
+        if (proceed()) textured_path = texture_mesh();
+        if (proceed() && !textured_path.empty()) centering_textured_mesh(textured_path);
+        // Levels of detail are decimated in one pass
+        if (proceed() && !lod_ratios.empty()) {
+            simplify_and_texture(lod_ratios, textured_path);
+        } else if (proceed() && (max_error > 0)) {
+            // Without ratios the mesh is decimated until the error bound
+            simplify_and_texture(std::vector<double>(1, 0.0), textured_path);
+        }
         bool start_simplify = false;
         while (true) {
             // Mesh can be simplified. Default it is not simplified.
             if (start_simplify) {
-                if (success_on_previous_step) simplify_mesh(simplify_ratio);
+                if (proceed()) simplify_and_texture(std::vector<double>(1, simplify_ratio), textured_path);
             }
-            // Mesh texture and centering
-            if (success_on_previous_step && simplified) path = texture_mesh();
-            if (success_on_previous_step && simplified) centering_textured_mesh(path);
-
             if (!automatic_execution) {
                 // Offering to user simplify mesh and retexture it with some parameter
                 std::string question("Would you like to simplify mesh with another param: (yes, no)");
                 std::string suggestion(
                         "Please input param from 0.1 to 1. For example 0.2 will decimate 80% of triangles:");
-                if (!dialog(question, suggestion, start_simplify, simplify_ratio, 0.1, 1))
+                start_simplify = ask(question, suggestion, 0.1, 1, simplify_ratio);
+                if (!start_simplify)
                     break;
             } else {
                 break;
@@ -336,7 +1000,8 @@ void OpenMVS::build_model_from_sparse_point_cloud() {
             // Offering to user completely reconstruct mesh with some parameter
             std::string question("Would you like to reconstruct mesh with another param: (yes, no)");
             std::string suggestion("Now param value is 7.0. Please input param from 0.1 to 15:");
-            if (!dialog(question, suggestion, start_simplify, distance, 0.1, 15))
+            start_simplify = ask(question, suggestion, 0.1, 15, distance);
+            if (!start_simplify)
                 break;
         } else {
             break;
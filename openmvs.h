@@ -5,7 +5,13 @@
 #ifndef RECONSTRUCTION_OPENMVS_H
 #define RECONSTRUCTION_OPENMVS_H
 
+#include <atomic>
+#include <functional>
 #include <OpenMVS/MVS.h>
+#include "compact_simplify_mesh.h"
+#include "region_of_interest.h"
+#include "resource_planner.h"
+#include "simplify_mesh.h"
 #include "utils.h"
 
 // OpenMVS pipeline (https://github.com/cdcseacave/openMVS/wiki/Usage)
@@ -15,9 +21,14 @@
 //
 // 0. Convert colmap NVM format to OpenMVS MVS format (https://github.com/cdcseacave/openMVS/wiki/Interface)
 //           (Using MVS interface).
+//    Optionally the scene is cropped to the object: sparse and dense points outside the box of object
+//           silhouettes are removed (see region_of_interest.h),
+//    and pruned to a minimal subset of views for densifying and texturing (see view_selection.h).
 //
 // 1. Sparse point cloud densifying (http://www.connellybarnes.com/work/publications/2011_patchmatch_cacm.pdf)
 //           (PatchMatch: A Randomized Correspondence Algorithm for Structural Image Editing C. Barnes et al. 2009).
+//    Resolution level of densifying and refinement is the highest one which fits RAM budget
+//           (see resource_planner.h).
 //
 // 2. Remove NAN points after densifying (https://github.com/cdcseacave/openMVS/wiki/Interface)
 //           (Using MVS interface).
@@ -33,6 +44,8 @@
 //
 // 5. Resize the mesh (https://github.com/sp4cerat/Fast-Quadric-Mesh-Simplification)
 //           (Using only Simplify.h).
+//    Refined mesh is textured once. Simplified meshes keep its atlas: texture coordinates
+//    are interpolated during decimation, so trying another ratio doesn't run TextureMesh again.
 //
 // 6. Texture the mesh (https://pdfs.semanticscholar.org/c8e6/eefd01b17489d38c355cf21dd492cbd02dab.pdf)
 //           (Let There Be Color! - Large-Scale Texturing of 3D Reconstructions M. Waechter et al. 2014).
@@ -40,8 +53,19 @@
 // 7. Centering the mesh (https://github.com/cdcseacave/openMVS/wiki/Interface)
 //           (Using MVS interface).
 //
+// 8. Split the mesh into octree of streamable tiles (https://github.com/CesiumGS/3d-tiles)
+//           (Optional. Coarse parent tiles are made by MeshSimplify, see tileset.h).
+//
+
+// Input mesh of error-bounded simplification (see openmvs.cpp)
+struct ReferenceMesh;
 
 class OpenMVS {
+public:
+    // Question to the user in interactive mode: false for 'no', otherwise value in (min, max)
+    typedef std::function<bool(std::string const & question, std::string const & suggestion,
+                               double const min, double const max, double & value)> Question;
+private:
     fs::path reconstruction_dir;
     fs::path interface_mvs_path;
     fs::path densify_path;
@@ -52,12 +76,40 @@ class OpenMVS {
     bool success_on_previous_step = true;
     bool simplified = true;
     bool automatic_execution = true;
+    bool tiled_output = false;
     std::string common_distance_param;
     std::string common_simplify_ratio_param;
+    std::vector<double> lod_ratios;
+    double ram_budget_mb = 0;
+    ulong dense_points_count = 0;
+    ResourcePlanner planner;
+    MeshSimplify::Engine simplify_engine = MeshSimplify::THRESHOLD;
+    bool compare_engines = false;
+    bool parallel_simplify = false;
+    bool compact_layout = false;
+    bool view_selection = false;
+    bool roi_cropping = false;
+    RegionOfInterest roi;
+    double max_error = 0;
+    std::atomic<bool> const * cancel_flag = nullptr;
+    Question question_handler;
+
+    // Previous step succeeded and the pipeline isn't cancelled
+    bool proceed() const;
+
+    // Answer of the question handler, console dialog without it
+    bool ask(std::string const & text, std::string const & suggestion, double const min, double const max,
+             double & value) const;
 
     // 0. Convert colmap NVM format to OpenMVS MVS format.
     void convert_from_nvm_to_mvs();
 
+    // 0. Crop sparse points of the scene to the box of the object
+    void crop_to_object();
+
+    // 0. Prune the scene to the views needed for densifying and texturing
+    void select_views();
+
     // 1. Sparse pointcloud densifying
     void densify_point_cloud();
 
@@ -73,19 +125,99 @@ class OpenMVS {
     // 5. Simplify the mesh
     void simplify_mesh(double ratio, double aggressiveness);
 
+    // 5. Vertex clustering brings huge mesh of the loaded scene close to the target in linear time
+    void pre_decimate_mesh(ulong const target_count);
+
+    // 5. Load refined mesh for simplification to these ratios. Without error bound a huge mesh is clustered
+    //    close to the finest target from its PLY file, so it's never loaded whole.
+    //    Counts of the refined mesh and target faces count of every ratio are returned
+    bool load_refined_mesh(std::vector<double> const & ratios, ulong & v_count, ulong & f_count,
+                           std::vector<ulong> & target_counts);
+
+    // 5. Scene of the refined mesh without loading it: views of the interface scene and this mesh
+    bool load_views_with_mesh(CompactMeshSimplify::Point const * points, ulong const v_count,
+                              CompactMeshSimplify::Face const * faces, ulong const f_count);
+
+    // 5. Simplify mesh of the loaded scene in compact layout (32-bit indices, struct of arrays).
+    //    Out-of-core: working arrays are memory mapped scratch files
+    void simplify_mesh_compact(ulong const target_count, double const aggressiveness, bool const out_of_core);
+
+    // 5. Simplify refined mesh of the PLY file in compact layout on scratch files, the mesh is never loaded whole.
+    //    The result is the mesh of the scene (false if the file can't be read in place)
+    bool simplify_ply_out_of_core(fs::path const & ply_path, ulong const target_count, double const aggressiveness,
+                                  ReferenceMesh & reference);
+
+    // 5. Simplify the mesh to several levels of detail in one pass
+    void simplify_mesh_lod(std::vector<double> const & ratios, double const aggressiveness);
+
+    // 5. Simplify the textured mesh to several levels of detail, texture is kept
+    std::vector<fs::path> simplify_textured_mesh(std::vector<double> const & ratios,
+                                                 fs::path const & textured_mesh_path,
+                                                 double const aggressiveness);
+
     // 6. Texture the mesh
     fs::path texture_mesh();
 
+    // 5-7. Simplified meshes with texture and centering
+    void simplify_and_texture(std::vector<double> const & ratios, fs::path const & textured_path);
+
     // 7. Centering the mesh
     void centering_textured_mesh(fs::path const & textured_mesh_path);
+
+    // 8. Split the centered textured mesh into streamable tiles
+    void tile_textured_mesh();
 public:
     bool get_status() const;
 
+    // Simplify ratios of levels of detail built after mesh refinement (empty - no levels)
+    void set_lod_ratios(std::vector<double> const & ratios);
+
+    // RAM budget for resolution planning of densifying and refinement in MB (0 - 75% of physical memory)
+    void set_ram_budget(double const budget_mb);
+
+    // Collapse engine of MeshSimplify. If compare is set, runtime of both engines is reported before simplifying.
+    // If parallel is set, mesh is decimated by spatial partitions concurrently (see simplify_mesh_parallel)
+    void set_simplify_engine(MeshSimplify::Engine const engine, bool const compare, bool const parallel);
+
+    // Geometry-only simplification uses CompactMeshSimplify (threshold engine, several times less memory).
+    // Levels of detail and textured meshes still use MeshSimplify.
+    // Compact layout is also chosen if MeshSimplify doesn't fit in RAM budget and the default serial threshold
+    // engine is set (other engines, partitioned decimation and comparison are kept), and if even compact arrays
+    // don't fit, they are memory mapped scratch files in reconstruction directory (out-of-core): the refined
+    // mesh is read into them from its PLY file without loading the scene mesh, and the reference copy of
+    // error-bounded simplification is a scratch file too. Levels of detail and textured meshes are loaded whole
+    void set_compact_layout(bool const compact);
+
+    // Collapses stop at this quadric error (about distance to the input surface, in scene units; 0 - no bound).
+    // Simplified meshes are measured against the input and their Hausdorff and RMS deviation is reported.
+    // Without levels of detail the refined mesh is simplified until the bound, no questions are asked
+    void set_max_error(double const error);
+
+    // Scene converted from NVM keeps only selected views (coverage, baseline, resolution): redundant views of
+    // dense captures aren't densified and textured. The whole scene is kept as scene_all.mvs
+    void set_view_selection(bool const selection);
+
+    // Sparse points, then dense points outside the box of object silhouettes are removed, so depth maps,
+    // dense cloud and mesh don't cover the background
+    void set_roi_cropping(bool const cropping);
+
+    // Write tileset of the final textured mesh
+    void set_tiled_output(bool const tiles);
+
+    // Running tool is terminated and no further step is started once the flag is set
+    void set_cancel_flag(std::atomic<bool> const * flag);
+
+    // Questions of interactive mode (not automatic execution) go to the handler instead of console
+    void set_question_handler(Question const & handler);
+
     // constructor
-    explicit OpenMVS(fs::path const & dir, bool set_automatic_execution);
+    explicit OpenMVS(fs::path const & dir, bool set_automatic_execution, fs::path const & openmvs_bin);
 
     // pipeline
     void build_model_from_sparse_point_cloud();
 };
 
+// Simplify ratio in names of simplified scenes, textures and traces: "0.50", "0.05", "0.125" (6 decimals at most)
+std::string ratio_to_string(double ratio);
+
 #endif //RECONSTRUCTION_OPENMVS_H
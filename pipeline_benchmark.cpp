@@ -0,0 +1,209 @@
+//
+// Created by user on 10/18/26.
+//
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <omp.h>
+#include "reconstruction.h"
+#include "synthetic_scene.h"
+
+// End-to-end throughput benchmark of the pipeline on synthetic scenes with known ground truth.
+//
+// For every image count a textured object is rendered from a ring of that many cameras (see synthetic_scene.h)
+// and the images go through the whole pipeline: image processing, COLMAP SfM and OpenMVS for sequential and
+// exhaustive matching. Reported as JSON for every count: time, CPU time and peak memory of every stage,
+// accuracy of registered poses and deviation of the refined mesh from the object (in object radii) for
+// both runs. Scaling of every stage over image counts is the exponent of time (and memory) ~ images^k,
+// least squares on log-log. Chrome trace of every count is written next to its results.
+//
+// Using: ./PipelineBenchmark output_dir [image_counts, default '12,24,48'] [full_path_colmap] [full_path_openmvs]
+
+static std::vector<ulong> const IMAGE_COUNTS = {12, 24, 48};
+
+// Stage measurements of one image count
+struct Sample {
+    ulong images;
+    double seconds;
+    double memory_mb;
+};
+
+// Exponent k of value ~ images^k (least squares on log-log), 0 if less than 2 usable samples
+double scaling_exponent(std::vector<Sample> const & samples, bool const memory) {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    ulong n = 0;
+    for (auto const & sample : samples) {
+        double value = memory ? sample.memory_mb : sample.seconds;
+        if (value <= 0) {
+            continue;
+        }
+        double x = log(double(sample.images)), y = log(value);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        ++n;
+    }
+    double denominator = n * sxx - sx * sx;
+    return ((n < 2) || (std::abs(denominator) < 1e-12)) ? 0 : (n * sxy - sx * sy) / denominator;
+}
+
+// Refined mesh of the run (SfM frame, before simplification and centering), empty if there is none
+fs::path refined_mesh_path(fs::path const & reconstruction_dir) {
+    if (!fs::is_directory(reconstruction_dir)) {
+        return fs::path();
+    }
+    std::string const prefix = "dense_mesh_", suffix = "_refine.ply";
+    for (auto & entry : fs::directory_iterator(reconstruction_dir)) {
+        std::string name = entry.path().filename().string();
+        if ((name.size() > prefix.size() + suffix.size()) && (name.compare(0, prefix.size(), prefix) == 0) &&
+            (name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)) {
+            return entry.path();
+        }
+    }
+    return fs::path();
+}
+
+// Pose and surface accuracy of one run against the scene, JSON object
+std::string run_accuracy(SyntheticScene const & scene, fs::path const & run_dir) {
+    char buffer[1024];
+    fs::path reconstruction_dir = run_dir / "dense/images";
+    std::vector<SyntheticScene::Camera> cameras;
+    SyntheticScene::PoseAccuracy poses;
+    if (!read_nvm_cameras(reconstruction_dir / "model.nvm", cameras) || !scene.compare_poses(cameras, poses)) {
+        snprintf(buffer, sizeof(buffer), "{\"registered\": %lu, \"images\": %zu}", poses.registered,
+                 scene.get_cameras().size());
+        return buffer;
+    }
+    snprintf(buffer, sizeof(buffer), "{\"registered\": %lu, \"images\": %lu, \"rotation_mean_deg\": %.4f, "
+             "\"rotation_max_deg\": %.4f, \"position_mean\": %.5f, \"position_max\": %.5f", poses.registered,
+             poses.images, poses.rotation_mean_deg, poses.rotation_max_deg, poses.position_mean, poses.position_max);
+    std::string text = buffer;
+    Mesh mesh;
+    fs::path mesh_path = refined_mesh_path(reconstruction_dir);
+    if (!mesh_path.empty() && load_ply(mesh_path, mesh)) {
+        MeshDeviation::Report accuracy, completeness;
+        scene.compare_surface(mesh, poses.alignment, accuracy, completeness);
+        snprintf(buffer, sizeof(buffer), ", \"mesh\": %s, \"faces\": %zu, "
+                 "\"accuracy\": {\"hausdorff\": %g, \"rms\": %g, \"mean\": %g}, "
+                 "\"completeness\": {\"hausdorff\": %g, \"rms\": %g, \"mean\": %g}",
+                 json_string(mesh_path.filename().string()).c_str(), mesh.faces.size(), accuracy.hausdorff,
+                 accuracy.rms, accuracy.mean, completeness.hausdorff, completeness.rms, completeness.mean);
+        text += buffer;
+    }
+    return text + "}";
+}
+
+int main(int args, char * argv[]) {
+    if (args < 2) {
+        std::cout << "Using example:\n $./PipelineBenchmark output_dir(reqiued) "
+                "image_counts(optional, comma separated, default '12,24,48') "
+                "full_path_colmap(optional, default '/usr/local/bin') "
+                "full_path_openmvs(optional, default '/usr/local/bin/OpenMVS')" << std::endl;
+        return 0;
+    }
+    fs::path output_dir = fs::absolute(argv[1]);
+    fs::create_directories(output_dir);
+    std::vector<ulong> counts;
+    if (args > 2) {
+        std::stringstream stream(argv[2]);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            ulong count = strtoul(item.c_str(), nullptr, 10);
+            if (count >= 3) {
+                counts.push_back(count);
+            }
+        }
+    }
+    if (counts.empty()) {
+        counts = IMAGE_COUNTS;
+    }
+
+    // Measurements of every stage path over image counts, in order of the first appearance
+    std::vector<std::string> stage_order;
+    std::map<std::string, std::vector<Sample>> scaling;
+    std::string text = "{\n  \"threads\": " + std::to_string(omp_get_max_threads()) + ",\n  \"scenes\": [";
+    char buffer[1024];
+    for (ulong i = 0; i < counts.size(); ++i) {
+        ulong images = counts[i];
+        fs::path scene_dir = output_dir / ("ring_" + std::to_string(images));
+        fs::path images_dir = scene_dir / "images";
+        fs::remove_all(scene_dir);
+
+        SyntheticScene scene(images);
+        auto start = std::chrono::steady_clock::now();
+        if (!scene.write(images_dir, scene_dir / "ground_truth")) {
+            std::cerr << "Can't write synthetic scene to " << scene_dir << std::endl;
+            return 1;
+        }
+        double render_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "Scene of %lu images rendered in %.1f sec\n", images, render_seconds);
+
+        ReconstructionConfig config;
+        config.images_dir = images_dir;
+        config.colmap_bin = (args > 3) ? fs::path(argv[3]) : local_path::COLMAP_BIN;
+        config.openmvs_bin = (args > 4) ? fs::path(argv[4]) : local_path::OPENMVS_BIN;
+        ReconstructionPipeline pipeline(config);
+        std::vector<Trace::Stage> stages;
+        pipeline.on_metrics = [&stages](Trace::Stage const & stage) {
+            stages.push_back(stage);
+        };
+        bool success = pipeline.run();
+        pipeline.write_trace();
+
+        snprintf(buffer, sizeof(buffer), "%s\n    {\"images\": %lu, \"faces\": %zu, \"render_seconds\": %.3f, "
+                 "\"success\": %s,\n     \"stages\": [", i ? "," : "", images, scene.get_mesh().faces.size(),
+                 render_seconds, success ? "true" : "false");
+        text += buffer;
+        double total_seconds = 0, total_memory = 0;
+        for (ulong s = 0; s < stages.size(); ++s) {
+            Trace::Stage const & stage = stages[s];
+            double memory = std::max(stage.peak_memory_mb, stage.external_peak_memory_mb);
+            snprintf(buffer, sizeof(buffer), "%s\n       {\"stage\": %s, \"depth\": %d, \"wall_seconds\": %.3f, "
+                     "\"cpu_seconds\": %.3f, \"peak_memory_mb\": %.1f, \"external_peak_memory_mb\": %.1f}",
+                     s ? "," : "", json_string(stage.path).c_str(), stage.depth, stage.wall_seconds,
+                     stage.cpu_seconds, stage.peak_memory_mb, stage.external_peak_memory_mb);
+            text += buffer;
+            if (stage.depth == 0) {
+                total_seconds += stage.wall_seconds;
+                total_memory = std::max(total_memory, memory);
+            }
+            if (scaling.find(stage.path) == scaling.end()) {
+                stage_order.push_back(stage.path);
+            }
+            // Stages repeated in a run (e.g. levels of detail) are summed
+            std::vector<Sample> & samples = scaling[stage.path];
+            if (!samples.empty() && (samples.back().images == images)) {
+                samples.back().seconds += stage.wall_seconds;
+                samples.back().memory_mb = std::max(samples.back().memory_mb, memory);
+            } else {
+                samples.push_back({images, stage.wall_seconds, memory});
+            }
+        }
+        snprintf(buffer, sizeof(buffer), "\n     ],\n     \"total_seconds\": %.3f, \"peak_memory_mb\": %.1f",
+                 total_seconds, total_memory);
+        text += buffer;
+        // Accuracy of both runs against the ground truth
+        fs::path result_dir = pipeline.result_dir();
+        text += ",\n     \"sequential\": " + run_accuracy(scene, result_dir / local_path::SEQUENTIAL_PATH);
+        text += ",\n     \"exhaustive\": " + run_accuracy(scene, result_dir / local_path::EXHAUSTIVE_PATH) + "}";
+        fprintf(stderr, "Scene of %lu images reconstructed in %.1f sec\n", images, total_seconds);
+    }
+    text += "\n  ],\n  \"scaling\": [";
+    for (ulong s = 0; s < stage_order.size(); ++s) {
+        std::vector<Sample> const & samples = scaling[stage_order[s]];
+        snprintf(buffer, sizeof(buffer), "%s\n    {\"stage\": %s, \"scenes\": %zu, \"time_exponent\": %.3f, "
+                 "\"memory_exponent\": %.3f}", s ? "," : "", json_string(stage_order[s]).c_str(), samples.size(),
+                 scaling_exponent(samples, false), scaling_exponent(samples, true));
+        text += buffer;
+    }
+    text += "\n  ]\n}\n";
+
+    fs::path report = output_dir / "pipeline_benchmark.json";
+    std::ofstream(report.string()) << text;
+    std::cout << "Report: " << report.string() << std::endl;
+    return 0;
+}
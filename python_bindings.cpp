@@ -0,0 +1,480 @@
+//
+// Created by user on 10/18/26.
+//
+// Python.h goes first: it sets feature macros for the system headers
+#include <Python.h>
+#include <cstring>
+#include <exception>
+#include <string>
+#include "compact_simplify_mesh.h"
+#include "image_processing.h"
+#include "reconstruction.h"
+#include "simplify_mesh.h"
+
+// Python module "reconstruction": native stages for Python tooling (Python 3, CPython buffer protocol)
+//
+// Arrays are shared through the buffer protocol (NumPy arrays, memoryviews): kernels work on the memory of
+// the caller, nothing is copied in either direction. Arrays must be C-contiguous and writable. Every call
+// releases the GIL, so Python threads process images, simplify meshes and run pipelines in parallel:
+//
+//    import reconstruction
+//    reconstruction.remove_background(image, mask)   # image HxWx3 uint8 (BGR of cv2), mask HxW uint8 or None
+//    v, f = reconstruction.simplify_mesh(vertices, faces, target_faces)   # float32 Nx3, (u)int32 Mx3
+//    vertices, faces = vertices[:v], faces[:f]       # result is at the beginning of the arrays (views, no copy)
+//
+//    pipeline = reconstruction.Pipeline("/data/capture1", matching="adaptive", lod_ratios=[0.5, 0.1],
+//                                       on_progress=lambda stage, fraction, finished: print(stage, fraction))
+//    worker = threading.Thread(target=pipeline.run)
+//    ...
+//    pipeline.cancel()
+//
+// remove_background is the object detection of image processing without scaling and writing the image.
+// simplify_mesh engines: "compact" (default) decimates the arrays in place, "threshold" and "queue" (with
+// optional "-parallel" suffix) keep quadrics next to every vertex, so they work on their own copy and
+// write the result back to the arrays. Pipeline takes the keyword arguments of daemon jobs (see job_daemon.h),
+// tool paths and reconstruction_bin (Reconstruction executable run by local match workers), and always runs in
+// automatic mode.
+
+// Shared by all threads: background removal keeps no state
+static ImageProcessing image_processing;
+
+// Item formats of the buffer protocol without byte order prefix (native little-endian only)
+static char const * item_format(Py_buffer const & view) {
+    char const * format = view.format ? view.format : "B";
+    if ((format[0] == '@') || (format[0] == '=') || (format[0] == '<')) {
+        ++format;
+    }
+    return format;
+}
+
+// Writable C-contiguous buffer of ndim dimensions with items of one of the formats and the size.
+// Shape of -1 is any. Python error is set if the object doesn't fit
+static bool get_buffer(PyObject * object, char const * name, char const * formats, Py_ssize_t const item_size,
+                       int const ndim, Py_ssize_t const * shape, Py_buffer & view) {
+    if (PyObject_GetBuffer(object, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) != 0) {
+        return false;
+    }
+    char const * format = item_format(view);
+    bool valid = (view.itemsize == item_size) && (strlen(format) == 1) && strchr(formats, format[0]) &&
+                 (view.ndim == ndim);
+    for (int i = 0; valid && (i < ndim); ++i) {
+        valid = (shape[i] < 0) || (view.shape[i] == shape[i]);
+    }
+    if (!valid) {
+        PyErr_Format(PyExc_ValueError, "%s: expected %d-dimensional array of %zd-byte '%s' items", name, ndim,
+                     item_size, formats);
+        PyBuffer_Release(&view);
+        return false;
+    }
+    return true;
+}
+
+// ----------- Image processing -----------
+
+static PyObject * remove_background(PyObject *, PyObject * args, PyObject * kwargs) {
+    static char const * keywords[] = {"image", "mask", nullptr};
+    PyObject * image_object = nullptr;
+    PyObject * mask_object = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", const_cast<char **>(keywords),
+                                     &image_object, &mask_object)) {
+        return nullptr;
+    }
+    Py_buffer image_view, mask_view;
+    Py_ssize_t const image_shape[] = {-1, -1, 3};
+    if (!get_buffer(image_object, "image", "B", 1, 3, image_shape, image_view)) {
+        return nullptr;
+    }
+    bool const with_mask = mask_object != Py_None;
+    Py_ssize_t const mask_shape[] = {image_view.shape[0], image_view.shape[1]};
+    if (with_mask && !get_buffer(mask_object, "mask", "B", 1, 2, mask_shape, mask_view)) {
+        PyBuffer_Release(&image_view);
+        return nullptr;
+    }
+    int const rows = int(image_view.shape[0]), cols = int(image_view.shape[1]);
+    std::string error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        // Headers over the caller's memory
+        cv::Mat image(rows, cols, CV_8UC3, image_view.buf);
+        cv::Mat mask = image_processing.remove_background(image);
+        if (with_mask) {
+            cv::Mat mask_8u(rows, cols, CV_8U, mask_view.buf);
+            mask.convertTo(mask_8u, CV_8U);
+        }
+    } catch (std::exception const & e) {
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&image_view);
+    if (with_mask) {
+        PyBuffer_Release(&mask_view);
+    }
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+// ----------- Mesh simplification -----------
+
+// MeshSimplify on a copy of the arrays, the result is written back to their beginning
+static void simplify_copy(float * vertices, ulong & v_count, uint32_t * faces, ulong & f_count,
+                          ulong const target_count, double const aggressiveness, double const max_error,
+                          MeshSimplify::Engine const engine, bool const parallel) {
+    MeshSimplify mesh(v_count, f_count);
+    mesh.engine = engine;
+    mesh.max_error = max_error;
+    mesh.vertices.resize(v_count);
+    for (ulong i = 0; i < v_count; ++i) {
+        mesh.vertices[i].update(vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2]);
+    }
+    mesh.triangles.resize(f_count);
+    for (ulong i = 0; i < f_count; ++i) {
+        mesh.triangles[i].update(faces[3 * i], faces[3 * i + 1], faces[3 * i + 2]);
+    }
+    if (parallel) {
+        mesh.simplify_mesh_parallel(target_count, aggressiveness, false);
+    } else {
+        mesh.simplify_mesh(target_count, aggressiveness, false);
+    }
+    v_count = mesh.vertices.size();
+    for (ulong i = 0; i < v_count; ++i) {
+        vertices[3 * i] = float(mesh.vertices[i].p.x);
+        vertices[3 * i + 1] = float(mesh.vertices[i].p.y);
+        vertices[3 * i + 2] = float(mesh.vertices[i].p.z);
+    }
+    f_count = mesh.triangles.size();
+    for (ulong i = 0; i < f_count; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            faces[3 * i + j] = uint32_t(mesh.triangles[i].v[j]);
+        }
+    }
+}
+
+static PyObject * simplify_mesh(PyObject *, PyObject * args, PyObject * kwargs) {
+    static char const * keywords[] = {"vertices", "faces", "target_faces", "aggressiveness", "max_error", "engine",
+                                      nullptr};
+    PyObject * vertices_object = nullptr;
+    PyObject * faces_object = nullptr;
+    unsigned long target_count = 0;
+    double aggressiveness = 7.0;
+    double max_error = 0;
+    char const * engine_name = "compact";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOk|dds", const_cast<char **>(keywords), &vertices_object,
+                                     &faces_object, &target_count, &aggressiveness, &max_error, &engine_name)) {
+        return nullptr;
+    }
+    // Engine names of the pipeline config, comparison of engines is only a pipeline report
+    ReconstructionConfig engine_config;
+    std::string error;
+    if (!set_config_option(engine_config, "engine", engine_name, error) ||
+        (engine_config.simplify_engine == "compare")) {
+        PyErr_Format(PyExc_ValueError, "unknown engine '%s'", engine_name);
+        return nullptr;
+    }
+    std::string const & engine = engine_config.simplify_engine;
+    Py_buffer vertices_view, faces_view;
+    Py_ssize_t const shape[] = {-1, 3};
+    if (!get_buffer(vertices_object, "vertices", "f", 4, 2, shape, vertices_view)) {
+        return nullptr;
+    }
+    if (!get_buffer(faces_object, "faces", "iI", 4, 2, shape, faces_view)) {
+        PyBuffer_Release(&vertices_view);
+        return nullptr;
+    }
+    float * vertices = static_cast<float *>(vertices_view.buf);
+    uint32_t * faces = static_cast<uint32_t *>(faces_view.buf);
+    ulong v_count = ulong(vertices_view.shape[0]), f_count = ulong(faces_view.shape[0]);
+    bool valid = true;
+    Py_BEGIN_ALLOW_THREADS
+    // Negative indices of int32 faces are out of range as well
+    for (ulong i = 0; valid && (i < 3 * f_count); ++i) {
+        valid = faces[i] < v_count;
+    }
+    try {
+        if (valid && (engine == "compact")) {
+            static_assert(sizeof(CompactMeshSimplify::Point) == 3 * sizeof(float), "vertex layout");
+            static_assert(sizeof(CompactMeshSimplify::Face) == 3 * sizeof(uint32_t), "face layout");
+            CompactMeshSimplify mesh(0, 0);
+            mesh.max_error = max_error;
+            mesh.attach(reinterpret_cast<CompactMeshSimplify::Point *>(vertices), v_count,
+                        reinterpret_cast<CompactMeshSimplify::Face *>(faces), f_count);
+            mesh.simplify_mesh(target_count, aggressiveness, false);
+            v_count = mesh.points.size();
+            f_count = mesh.faces.size();
+        } else if (valid) {
+            simplify_copy(vertices, v_count, faces, f_count, target_count, aggressiveness, max_error,
+                          (engine == "threshold") ? MeshSimplify::THRESHOLD : MeshSimplify::PRIORITY_QUEUE,
+                          engine_config.parallel_simplify);
+        }
+    } catch (std::exception const & e) {
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&vertices_view);
+    PyBuffer_Release(&faces_view);
+    if (!valid) {
+        PyErr_SetString(PyExc_IndexError, "faces: vertex index out of range");
+        return nullptr;
+    }
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    return Py_BuildValue("(kk)", v_count, f_count);
+}
+
+// ----------- Pipeline -----------
+
+struct PipelineObject {
+    PyObject_HEAD
+    ReconstructionPipeline * pipeline;
+    PyObject * on_progress;
+    // Guarded by the GIL
+    bool running;
+};
+
+static PyTypeObject pipeline_type = {PyVarObject_HEAD_INIT(nullptr, 0) "reconstruction.Pipeline"};
+
+static void pipeline_dealloc(PipelineObject * self) {
+    delete self->pipeline;
+    Py_XDECREF(self->on_progress);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject *>(self));
+}
+
+// Pipeline(images_dir, **params): params of daemon jobs and on_progress(stage, fraction, finished)
+static int pipeline_init(PipelineObject * self, PyObject * args, PyObject * kwargs) {
+    static char const * keywords[] = {"images_dir", "colmap_bin", "openmvs_bin", "reconstruction_bin", "matching",
+                                      "lod_ratios", "tiles", "ram_budget", "engine", "max_error", "vocab_tree",
+                                      "match_workers",
+                                      "cpu_features", "view_selection", "roi_cropping", "time_budget",
+                                      "max_image_side", "adaptive_threshold", "on_progress", nullptr};
+    if (self->running) {
+        PyErr_SetString(PyExc_RuntimeError, "pipeline is running");
+        return -1;
+    }
+    ReconstructionConfig config;
+    char const * images_dir = nullptr;
+    char const * colmap_bin = local_path::COLMAP_BIN.c_str();
+    char const * openmvs_bin = local_path::OPENMVS_BIN.c_str();
+    // Executable of local match workers: this process is Python
+    char const * reconstruction_bin = local_path::RECONSTRUCTION_BIN.c_str();
+    char const * matching = "both";
+    PyObject * lod_ratios = Py_None;
+    int tiles = 0, cpu_features = 0, view_selection = 0, roi_cropping = 0;
+    char const * engine = "threshold";
+    char const * vocab_tree = "";
+    unsigned long match_workers = 0;
+    int max_image_side = 1920;
+    double adaptive_threshold = config.adaptive_threshold;
+    PyObject * on_progress = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|$ssssOpdsdskpppdidO", const_cast<char **>(keywords),
+                                     &images_dir, &colmap_bin, &openmvs_bin, &reconstruction_bin, &matching,
+                                     &lod_ratios, &tiles, &config.ram_budget_mb, &engine, &config.max_error, &vocab_tree, &match_workers,
+                                     &cpu_features, &view_selection, &roi_cropping, &config.time_budget_s,
+                                     &max_image_side, &adaptive_threshold, &on_progress)) {
+        return -1;
+    }
+    // Names and values are checked as options of the command line
+    std::string error;
+    char threshold[32];
+    snprintf(threshold, sizeof(threshold), "%.17g", adaptive_threshold);
+    if (!set_config_option(config, "matching", matching, error) ||
+        !set_config_option(config, "engine", engine, error) ||
+        !set_config_option(config, "adaptive_threshold", threshold, error)) {
+        PyErr_SetString(PyExc_ValueError, error.c_str());
+        return -1;
+    }
+    if ((on_progress != Py_None) && !PyCallable_Check(on_progress)) {
+        PyErr_SetString(PyExc_TypeError, "on_progress must be callable");
+        return -1;
+    }
+    if (lod_ratios != Py_None) {
+        PyObject * sequence = PySequence_Fast(lod_ratios, "lod_ratios must be a sequence");
+        if (!sequence) {
+            return -1;
+        }
+        std::string ratios;
+        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(sequence); ++i) {
+            double ratio = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(sequence, i));
+            if (PyErr_Occurred()) {
+                Py_DECREF(sequence);
+                return -1;
+            }
+            char item[32];
+            snprintf(item, sizeof(item), "%.17g", ratio);
+            ratios += (i == 0 ? "" : ",") + std::string(item);
+        }
+        Py_DECREF(sequence);
+        // Checked as lod_ratios option of the command line
+        if (!set_config_option(config, "lod_ratios", ratios, error)) {
+            PyErr_SetString(PyExc_ValueError, error.c_str());
+            return -1;
+        }
+    }
+    // The same as command line arguments of Reconstruction
+    config.images_dir = fs::path(images_dir);
+    config.colmap_bin = fs::path(colmap_bin);
+    config.openmvs_bin = fs::path(openmvs_bin);
+    config.reconstruction_bin = fs::path(reconstruction_bin);
+    config.tiled_output = tiles;
+    if (vocab_tree[0]) {
+        config.vocab_tree = fs::path(vocab_tree);
+    }
+    config.match_workers = match_workers;
+    config.cpu_features = cpu_features;
+    config.view_selection = view_selection;
+    config.roi_cropping = roi_cropping;
+    config.time_budget_s = std::max(0.0, config.time_budget_s);
+    config.max_image_side = std::max(640, max_image_side);
+    std::string const conflicts = config_conflicts(config);
+    if (!conflicts.empty()) {
+        PyErr_SetString(PyExc_ValueError, conflicts.c_str());
+        return -1;
+    }
+
+    delete self->pipeline;
+    self->pipeline = new ReconstructionPipeline(config);
+    Py_XDECREF(self->on_progress);
+    self->on_progress = nullptr;
+    if (on_progress != Py_None) {
+        Py_INCREF(on_progress);
+        self->on_progress = on_progress;
+        // Called on the thread of run(), which doesn't hold the GIL
+        self->pipeline->on_progress = [self](ReconstructionPipeline::Progress const & progress) {
+            PyGILState_STATE state = PyGILState_Ensure();
+            PyObject * result = PyObject_CallFunction(self->on_progress, "sdO", progress.stage.c_str(),
+                                                      progress.fraction, progress.finished ? Py_True : Py_False);
+            if (result) {
+                Py_DECREF(result);
+            } else {
+                // Exception of the callback doesn't stop the pipeline, it is printed
+                PyErr_WriteUnraisable(self->on_progress);
+            }
+            PyGILState_Release(state);
+        };
+    }
+    return 0;
+}
+
+static bool check_pipeline(PipelineObject * self) {
+    if (!self->pipeline) {
+        PyErr_SetString(PyExc_RuntimeError, "pipeline is not initialized");
+        return false;
+    }
+    return true;
+}
+
+// Whole pipeline on the calling thread, without the GIL. False if no run gave a model or it was cancelled
+static PyObject * pipeline_run(PipelineObject * self, PyObject *) {
+    if (!check_pipeline(self)) {
+        return nullptr;
+    }
+    if (self->running) {
+        PyErr_SetString(PyExc_RuntimeError, "pipeline is running");
+        return nullptr;
+    }
+    self->running = true;
+    bool success = false;
+    std::string error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        success = self->pipeline->run();
+    } catch (std::exception const & e) {
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    self->running = false;
+    if (!error.empty()) {
+        PyErr_SetString(PyExc_RuntimeError, error.c_str());
+        return nullptr;
+    }
+    return PyBool_FromLong(success);
+}
+
+// Safe from any thread: the running tool is terminated, no further stage starts
+static PyObject * pipeline_cancel(PipelineObject * self, PyObject *) {
+    if (!check_pipeline(self)) {
+        return nullptr;
+    }
+    self->pipeline->cancel();
+    Py_RETURN_NONE;
+}
+
+static PyObject * pipeline_cancelled(PipelineObject * self, PyObject *) {
+    if (!check_pipeline(self)) {
+        return nullptr;
+    }
+    return PyBool_FromLong(self->pipeline->cancelled());
+}
+
+// Results and trace are written here (known after image processing)
+static PyObject * pipeline_result_dir(PipelineObject * self, PyObject *) {
+    if (!check_pipeline(self)) {
+        return nullptr;
+    }
+    return PyUnicode_FromString(self->pipeline->result_dir().c_str());
+}
+
+// Chrome/Perfetto trace and summary JSON into result directory
+static PyObject * pipeline_write_trace(PipelineObject * self, PyObject *) {
+    if (!check_pipeline(self)) {
+        return nullptr;
+    }
+    return PyBool_FromLong(self->pipeline->write_trace());
+}
+
+static PyMethodDef pipeline_methods[] = {
+        {"run", reinterpret_cast<PyCFunction>(pipeline_run), METH_NOARGS,
+                "Whole pipeline on the calling thread (the GIL is released). False if no run gave a model"},
+        {"cancel", reinterpret_cast<PyCFunction>(pipeline_cancel), METH_NOARGS,
+                "Terminate the running tool, no further stage starts. Safe from any thread"},
+        {"cancelled", reinterpret_cast<PyCFunction>(pipeline_cancelled), METH_NOARGS, "Cancel was requested"},
+        {"result_dir", reinterpret_cast<PyCFunction>(pipeline_result_dir), METH_NOARGS,
+                "Directory of results and trace (known after image processing)"},
+        {"write_trace", reinterpret_cast<PyCFunction>(pipeline_write_trace), METH_NOARGS,
+                "Chrome/Perfetto trace and summary JSON into result directory"},
+        {nullptr, nullptr, 0, nullptr}
+};
+
+// ----------- Module -----------
+
+static PyMethodDef module_methods[] = {
+        {"remove_background", reinterpret_cast<PyCFunction>(remove_background), METH_VARARGS | METH_KEYWORDS,
+                "remove_background(image, mask=None): fill background of HxWx3 uint8 image with black in place, "
+                "object mask (255 - object) into HxW uint8 mask"},
+        {"simplify_mesh", reinterpret_cast<PyCFunction>(simplify_mesh), METH_VARARGS | METH_KEYWORDS,
+                "simplify_mesh(vertices, faces, target_faces, aggressiveness=7.0, max_error=0.0, engine='compact'): "
+                "decimate float32 Nx3 vertices and int32 Mx3 faces in place, (vertices, faces) counts of the result "
+                "at the beginning of the arrays"},
+        {nullptr, nullptr, 0, nullptr}
+};
+
+static PyModuleDef module_definition = {PyModuleDef_HEAD_INIT, "reconstruction",
+                                        "Native stages of the reconstruction pipeline on shared buffers", -1,
+                                        module_methods};
+
+PyMODINIT_FUNC PyInit_reconstruction() {
+    pipeline_type.tp_basicsize = sizeof(PipelineObject);
+    pipeline_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    pipeline_type.tp_doc = "Pipeline(images_dir, **params): reconstruction pipeline with daemon job params";
+    pipeline_type.tp_new = PyType_GenericNew;
+    pipeline_type.tp_init = reinterpret_cast<initproc>(pipeline_init);
+    pipeline_type.tp_dealloc = reinterpret_cast<destructor>(pipeline_dealloc);
+    pipeline_type.tp_methods = pipeline_methods;
+    if (PyType_Ready(&pipeline_type) < 0) {
+        return nullptr;
+    }
+    PyObject * module = PyModule_Create(&module_definition);
+    if (!module) {
+        return nullptr;
+    }
+    Py_INCREF(&pipeline_type);
+    if (PyModule_AddObject(module, "Pipeline", reinterpret_cast<PyObject *>(&pipeline_type)) < 0) {
+        Py_DECREF(&pipeline_type);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
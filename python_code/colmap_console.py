@@ -1,5 +1,6 @@
-from multiprocessing import Process
+from concurrent.futures import ThreadPoolExecutor
 from shutil import copyfile
+import threading
 import os
 import subprocess
 import sys
@@ -8,11 +9,14 @@ import argparse
 import time
 import cv2
 import numpy as np
+import reconstruction
 
 # Compiling from sources:
 # 1) OpenMVS (https://github.com/cdcseacave/openMVS/wiki/Building)
 # 2) COLMAP (https://colmap.github.io/install.html#build-from-source)
-# 3) PyMesh (https://github.com/qnzhou/PyMesh#build)
+# 3) PyMesh (https://github.com/qnzhou/PyMesh#build), only to load and save meshes
+# 4) Python module "reconstruction" of this repository (CMake target "reconstruction", Python 3):
+#    background removal and mesh simplification run natively on the NumPy arrays of this script
 
 # For OpenMVS and others using:
 # 1) Eigen 3.2.10 (3.3._ doesn't works)
@@ -39,47 +43,7 @@ class Colors:
 
 
 def print_header(some_str):
-    print Colors.HEADER + some_str + Colors.ENDC
-
-
-# Object detection and filling background with black pixels (http://www.codepasta.com/site/vision/segmentation/)
-def get_sobel(color_channel):
-    sobel_dx = cv2.Sobel(color_channel, cv2.CV_16S, 1, 0, borderType=cv2.BORDER_REPLICATE)  # OX gradient
-    sobel_dy = cv2.Sobel(color_channel, cv2.CV_16S, 0, 1, borderType=cv2.BORDER_REPLICATE)  # OY gradient
-    sobel = np.hypot(sobel_dx, sobel_dy)  # get the magnitude of gradients combined
-    return sobel
-
-
-def find_significant_contours(sobel_8u):
-    # The thing to understand here is "heirarchical" contours.
-    # What that means is, any contour (c1) enclosed inside another contour (c2) is treated as a "child" of c2.
-    # And contours can be nested to more than one level (So the structure is like a tree).
-    # OpenCV returns the tree as a flat array though; with each tuple containing the index to the parent contour.
-    image, contours, heirarchy = cv2.findContours(sobel_8u, cv2.RETR_TREE, cv2.CHAIN_APPROX_SIMPLE)
-
-    # Find level 1 contours
-    level1 = []
-    for i, tupl in enumerate(heirarchy[0]):
-        # Each array is in format (Next, Prev, First child, Parent)
-        # Filter the ones without parent
-        if tupl[3] == -1:
-            tupl = np.insert(tupl, 0, [i])
-            level1.append(tupl)
-
-    # From among them, find the contours with large surface area.
-    # Next we remove any contour that doesn't take up at least 5% of the image in area.
-    significant = []
-    # If contour isn't covering 5% of total area of image then it probably is too small
-    too_small = sobel_8u.size * 5 / 100
-    for tupl in level1:
-        contour = contours[tupl[0]]
-        area = cv2.contourArea(contour)
-        if area > too_small:
-            # cv2.drawContours(img, [contour], 0, (0, 255, 0), 2, cv2.LINE_AA, maxLevel=1)
-            significant.append([contour, area])
-
-    significant.sort(key=lambda x: x[1])
-    return [x[0] for x in significant]
+    print(Colors.HEADER + some_str + Colors.ENDC)
 
 
 def scale_image(img):
@@ -104,61 +68,25 @@ def scale_image(img):
     return img
 
 
+# Object detection and filling background with black pixels (http://www.codepasta.com/site/vision/segmentation/)
 def object_detection(path, write_path):
-    img = cv2.imread(path)
-    img = scale_image(img)
-
-    # STEP 1. Edge detection
-    blurred = cv2.GaussianBlur(img, (9, 9), 0)  # Remove noise
-    # Edge operator
-    # Since we are dealing with color images,
-    # the edge detction needs to be run on each color channel and then they need to be combined.
-    # The way I am doing that is by finding the max intesity from among the R, G and B edges.
-    # I've tried using average of the R,G,B edges, however max seems to give better results.
-    sobel = np.max(
-        np.array([get_sobel(blurred[:, :, 0]), get_sobel(blurred[:, :, 1]), get_sobel(blurred[:, :, 2])]), axis=0
-    )
-
-    # STEP 2. Noise removing
-    # Noise reduction trick, from http://sourceforge.net/p/octave/image/ci/default/tree/inst/edge.m#l182
-    mean = np.mean(sobel)
-
-    # Zero any values less than mean. This reduces a lot of noise.
-    sobel[sobel <= mean] = 0
-    sobel[sobel > 255] = 255
-
-    sobel_8u = np.asarray(sobel, np.uint8)
-
-    # STEP 3. Contour detection
-    significant = find_significant_contours(sobel_8u)
-
-    # STEP 4. Background removing by creating a mask to fill the contours.
-    # Mask
-    mask = sobel.copy()
-    mask[mask > 0] = 0
-    cv2.fillPoly(mask, significant, 255)
-
-    # Invert mask
-    mask = np.logical_not(mask)
-
-    # Finally remove the background
-    img[mask] = 0
+    img = np.ascontiguousarray(scale_image(cv2.imread(path)))
+    # Sobel edges, significant contours and the mask are computed natively on the array, in place
+    reconstruction.remove_background(img)
 
     fname = path.split('/')[-1]
-
-    # cv2.imshow("Original", np.hstack([img, im]))
-    # cv2.waitKey(0)
     cv2.imwrite(write_path + fname, img)
-    print (path)
+    print(path)
 
 
 def image_processing(write_path, process):
     image_path = get_parent_dir(get_parent_dir(write_path))
     if process:
-        for filename in sorted(os.listdir(image_path)):
-            if ".jpg" in filename.lower():
-                curr_image = os.path.join(os.path.abspath(image_path), filename)
-                object_detection(curr_image, write_path + "/")
+        images = [os.path.join(os.path.abspath(image_path), filename)
+                  for filename in sorted(os.listdir(image_path)) if ".jpg" in filename.lower()]
+        # Native calls release the GIL: images are processed by threads in parallel
+        with ThreadPoolExecutor() as executor:
+            list(executor.map(lambda image: object_detection(image, write_path + "/"), images))
 
 
 # Arguments parsing and create directory tree
@@ -206,12 +134,12 @@ def create_dir_structure(input_dir):
 def check_process_ending(process):
     stdout, stderr = process.communicate()
     if process.returncode != 0:
-        print Colors.FAIL + stdout + Colors.ENDC
-        print "3D reconstruction failed!"
-        print Colors.FAIL + stderr + Colors.ENDC
+        print(Colors.FAIL + str(stdout) + Colors.ENDC)
+        print("3D reconstruction failed!")
+        print(Colors.FAIL + str(stderr) + Colors.ENDC)
         sys.exit(-1)
     else:
-        print Colors.OKBLUE + "Success" + Colors.ENDC
+        print(Colors.OKBLUE + "Success" + Colors.ENDC)
 
 
 def start_process(args):
@@ -411,7 +339,11 @@ def remeshing_and_texture(reconstruction_dir):
         print("Trying to resize mesh and texture. Current edge collapse threshold " + str(length) + ".")
         start = time.time()
         mesh = pymesh.load_mesh(reconstruction_dir + "/scene_dense_mesh_refine.ply")
-        mesh, info = pymesh.collapse_short_edges(mesh, rel_threshold=float(length))
+        vertices = np.ascontiguousarray(mesh.vertices, np.float32)
+        faces = np.ascontiguousarray(mesh.faces, np.uint32)
+        # Edges about length times longer leave 1 / length^2 of the faces. Arrays are decimated in place
+        vertices_count, faces_count = reconstruction.simplify_mesh(vertices, faces, int(len(faces) / length ** 2))
+        mesh = pymesh.form_mesh(vertices[:vertices_count], faces[:faces_count])
         if len(mesh.vertices) > 1000 and length < 4:
             pymesh.save_mesh(reconstruction_dir + "/remesh_" + str(length) + ".ply", mesh)
             end = time.time()
@@ -464,14 +396,14 @@ image_processing(workingDir, True)  # change dir to dir with processed images (i
 extract_features(workingDir)
 
 curr_time = time.time()
-p = Process(target=sfm_mvs_pipeline, args=(workingDir, 1,))
-p.start()
-p.join()
+t = threading.Thread(target=sfm_mvs_pipeline, args=(workingDir, 1,))
+t.start()
+t.join()
 end_time = time.time()
 print("--- %s seconds ---" % round((time.time() - start_time), 2))
 
-p1 = Process(target=sfm_mvs_pipeline, args=(workingDir, 0,))
-p1.start()
-p1.join()
+t1 = threading.Thread(target=sfm_mvs_pipeline, args=(workingDir, 0,))
+t1.start()
+t1.join()
 print("---%s seconds ---" % round((time.time() - start_time - (end_time - curr_time)), 2))
 
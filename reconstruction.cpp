@@ -0,0 +1,357 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <sstream>
+#include "image_processing.h"
+#include "coarse_to_fine.h"
+#include "colmap.h"
+#include "sift_extractor.h"
+#include "reconstruction.h"
+
+// Main steps of one run (COLMAP 5 and OpenMVS 7 without simplification) for progress estimation
+static ulong const RUN_STEPS = 12;
+
+ReconstructionPipeline::ReconstructionPipeline(ReconstructionConfig const & config) :
+        config(config), cancel_flag(false)
+{
+    // Escalation of adaptive run adds matching and sparse reconstruction, progress is capped until the end
+    bool const single_run = config.adaptive || config.coarse_to_fine;
+    expected_steps = 1 + RUN_STEPS * (single_run ? 1 : (config.sequential ? 1 : 0) + (config.exhaustive ? 1 : 0));
+    // Image processing and steps of COLMAP and OpenMVS (depth 2 under run) are the main steps
+    pipeline_trace.on_begin = [this](Trace::Stage const & stage) {
+        if (on_progress) {
+            Progress progress;
+            progress.stage = stage.path;
+            progress.fraction = std::min(0.99, (double)finished_steps / expected_steps);
+            on_progress(progress);
+        }
+    };
+    pipeline_trace.on_end = [this](Trace::Stage const & stage) {
+        if ((stage.depth == 2) || ((stage.depth == 0) && (stage.name == "Image processing"))) {
+            ++finished_steps;
+        }
+        if (on_progress) {
+            Progress progress;
+            progress.stage = stage.path;
+            progress.finished = true;
+            progress.fraction = std::min(0.99, (double)finished_steps / expected_steps);
+            on_progress(progress);
+        }
+        if (on_metrics) {
+            on_metrics(stage);
+        }
+    };
+}
+
+// Whole string is a number
+static bool parse_number(std::string const & text, double & number) {
+    char * end = nullptr;
+    number = strtod(text.c_str(), &end);
+    return !text.empty() && (*end == 0) && std::isfinite(number);
+}
+
+// Option of the command line and of daemon jobs into config, false with error if it isn't valid
+bool set_config_option(ReconstructionConfig & config, std::string const & name, std::string const & value,
+                       std::string & error)
+{
+    double number = 0;
+    bool const is_number = parse_number(value, number);
+    bool const is_flag = (value == "0") || (value == "1");
+    bool valid = true;
+    if (name == "lod_ratios") {
+        // Comma separated simplify ratios of levels of detail: "0.5,0.2,0.05".
+        // Every level names its output files by the ratio, so two ratios can't have the same name
+        config.lod_ratios.clear();
+        std::set<std::string> names;
+        std::stringstream stream(value);
+        std::string item;
+        while (valid && std::getline(stream, item, ',')) {
+            double ratio = 0;
+            valid = parse_number(item, ratio) && (0 < ratio) && (ratio < 1) &&
+                    names.insert(ratio_to_string(ratio)).second;
+            config.lod_ratios.push_back(ratio);
+        }
+    } else if ((name == "tiles") || (name == "cpu_features") || (name == "view_selection") ||
+               (name == "roi_cropping")) {
+        valid = is_flag;
+        bool & flag = (name == "tiles") ? config.tiled_output : (name == "cpu_features") ? config.cpu_features :
+                      (name == "view_selection") ? config.view_selection : config.roi_cropping;
+        flag = value == "1";
+    } else if ((name == "ram_budget") || (name == "max_error") || (name == "time_budget")) {
+        valid = is_number && (number >= 0);
+        double & option = (name == "ram_budget") ? config.ram_budget_mb :
+                          (name == "max_error") ? config.max_error : config.time_budget_s;
+        option = number;
+    } else if (name == "max_image_side") {
+        // Smaller images don't give SfM enough features
+        valid = is_number && (number >= 640) && (number <= 65536) && (number == std::floor(number));
+        config.max_image_side = (int)number;
+    } else if (name == "match_workers") {
+        valid = is_number && (number >= 0) && (number <= 4096) && (number == std::floor(number));
+        config.match_workers = (ulong)number;
+    } else if (name == "adaptive_threshold") {
+        // Quality score of the sequential model is in [0, 1], 1 escalates unless the model is perfect
+        valid = is_number && (number > 0) && (number <= 1);
+        config.adaptive_threshold = number;
+    } else if (name == "vocab_tree") {
+        config.vocab_tree = value;
+    } else if (name == "engine") {
+        // "-parallel" partitions the MeshSimplify engines, compact layout is serial only
+        std::string const suffix = "-parallel";
+        bool parallel = (value.size() > suffix.size()) &&
+                        (value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0);
+        std::string const engine = parallel ? value.substr(0, value.size() - suffix.size()) : value;
+        valid = (engine == "threshold") || (engine == "queue") || (engine == "compare") ||
+                ((engine == "compact") && !parallel);
+        config.simplify_engine = engine;
+        config.parallel_simplify = parallel;
+    } else if (name == "matching") {
+        // Both runs are whole reconstructions, adaptive one carries only the better sparse model to OpenMVS
+        valid = (value == "both") || (value == "sequential") || (value == "exhaustive") || (value == "adaptive") ||
+                (value == "coarse_to_fine");
+        config.adaptive = value == "adaptive";
+        config.coarse_to_fine = value == "coarse_to_fine";
+        config.sequential = value != "exhaustive";
+        config.exhaustive = value != "sequential";
+    } else {
+        error = "unknown option " + name;
+        return false;
+    }
+    if (!valid) {
+        error = "invalid " + name + " '" + value + "'";
+    }
+    return valid;
+}
+
+// Options the chosen runs can't use, empty if there are none
+std::string config_conflicts(ReconstructionConfig const & config) {
+    std::string options;
+    auto add = [&options](bool const set, std::string const & option) {
+        if (set) {
+            options += (options.empty() ? "" : ", ") + option;
+        }
+    };
+    if (config.coarse_to_fine) {
+        add(config.cpu_features, "cpu_features");
+        add(!config.vocab_tree.empty(), "vocab_tree");
+        add(config.match_workers > 0, "match_workers");
+    }
+    return options.empty() ? options : "coarse_to_fine matching can't be combined with " + options;
+}
+
+void ReconstructionPipeline::cancel() {
+    cancel_flag = true;
+}
+
+bool ReconstructionPipeline::cancelled() const {
+    return cancel_flag;
+}
+
+Trace const & ReconstructionPipeline::trace() const {
+    return pipeline_trace;
+}
+
+// Results and trace of the pipeline are written here (known after image processing)
+fs::path ReconstructionPipeline::result_dir() const {
+    return working_dir.parent_path();
+}
+
+bool ReconstructionPipeline::write_trace() const {
+    if (working_dir.empty()) {
+        return false;
+    }
+    return pipeline_trace.write(result_dir() / "trace.json", result_dir() / "trace_summary.json");
+}
+
+// OpenMVS for the NVM model of COLMAP
+bool ReconstructionPipeline::run_mvs(fs::path const & path_to_nvm_model) {
+    OpenMVS mvs(path_to_nvm_model, config.automatic, config.openmvs_bin);
+    mvs.set_cancel_flag(&cancel_flag);
+    mvs.set_question_handler(on_question);
+    mvs.set_lod_ratios(config.lod_ratios);
+    mvs.set_tiled_output(config.tiled_output);
+    mvs.set_ram_budget(config.ram_budget_mb);
+    mvs.set_view_selection(config.view_selection);
+    mvs.set_roi_cropping(config.roi_cropping);
+    // "compare" simplifies with priority queue and reports runtime of both engines
+    std::string const & engine = config.simplify_engine;
+    bool threshold = (engine == "threshold") || (engine == "compact");
+    mvs.set_simplify_engine(threshold ? MeshSimplify::THRESHOLD : MeshSimplify::PRIORITY_QUEUE,
+                            engine == "compare", config.parallel_simplify);
+    // "compact" is the threshold engine in compact memory layout
+    mvs.set_compact_layout(engine == "compact");
+    mvs.set_max_error(config.max_error);
+    mvs.build_model_from_sparse_point_cloud();
+    if (!mvs.get_status()) {
+        std::cerr << (cancelled() ? "Reconstruction cancelled!" : "Reconstruction field!") << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Image processing, with feature extraction of every processed image if it is in-process
+void ReconstructionPipeline::process_images() {
+    fs::path images_dir = config.images_dir;
+    ImageProcessing processing(images_dir);
+    processing.set_max_side(config.max_image_side);
+    working_dir = processing.get_working_dir();
+    features_in_database = false;
+    if (!config.cpu_features) {
+        processing.start();
+        return;
+    }
+    // Processed images go to extraction threads while the next ones are processed
+    SiftExtractor extractor(working_dir / local_path::DATABASE_PATH, config.colmap_bin, 0, 8192);
+    bool started = extractor.start();
+    if (started) {
+        processing.set_image_handler([&extractor](std::string const & name, cv::Mat const & image) {
+            extractor.submit(name, image);
+        });
+    } else {
+        std::cerr << "Can't create features database, features are extracted by COLMAP" << std::endl;
+    }
+    processing.start();
+    if (started) {
+        TraceStage stage("Feature extraction");
+        features_in_database = extractor.finish();
+        if (!features_in_database) {
+            // COLMAP extractor would keep features of the images already stored
+            fs::remove(working_dir / local_path::DATABASE_PATH);
+        }
+        stage.count("images", extractor.get_images());
+        stage.count("keypoints", extractor.get_keypoints());
+        stage.file("database", working_dir / local_path::DATABASE_PATH);
+    }
+}
+
+// COLMAP and OpenMVS for one kind of matching
+bool ReconstructionPipeline::run_matching(bool const sequential) {
+    TraceStage stage(sequential ? "Sequential run" : "Exhaustive run");
+    TD_TIMER_START();
+    // Run SfM with sequential or exhaustive matching
+    Colmap colmap(working_dir.string(), config.colmap_bin.string());
+    colmap.set_cancel_flag(&cancel_flag);
+    colmap.set_vocab_tree(config.vocab_tree);
+    colmap.set_match_workers(config.match_workers, config.reconstruction_bin);
+    colmap.set_features_in_database(features_in_database);
+    fs::path const path_to_nvm_model = colmap.sfm(sequential);
+    if (path_to_nvm_model.empty()) {
+        std::cerr << "Reconstruction field!" << std::endl;
+        return false;
+    }
+    if (!run_mvs(path_to_nvm_model)) {
+        return false;
+    }
+    printf("Reconstruction consumed: %s\n", TD_TIMER_GET_FMT().c_str());
+    return true;
+}
+
+// Sequential SfM, exhaustive SfM if it isn't good enough, then OpenMVS for the better model
+bool ReconstructionPipeline::run_adaptive() {
+    TraceStage stage("Adaptive run");
+    TD_TIMER_START();
+    Colmap colmap(working_dir.string(), config.colmap_bin.string());
+    colmap.set_cancel_flag(&cancel_flag);
+    colmap.set_vocab_tree(config.vocab_tree);
+    colmap.set_match_workers(config.match_workers, config.reconstruction_bin);
+    colmap.set_features_in_database(features_in_database);
+    fs::path path_to_nvm_model;
+    {
+        TraceStage colmap_stage("COLMAP");
+        colmap.sparse_model(true);
+        Colmap::ModelQuality quality = colmap.model_quality(true);
+        printf("Sequential model: %lu of %lu images, reprojection error %.3f px, track length %.2f, score %.3f\n",
+               quality.registered, quality.images, quality.reprojection_error, quality.track_length, quality.score);
+        colmap_stage.count("sequential_score", quality.score);
+        colmap_stage.count("sequential_registered", quality.registered);
+        bool sequential = true;
+        if (!cancelled() && (quality.score < config.adaptive_threshold)) {
+            std::cout << "Sequential model is below " << config.adaptive_threshold << ", escalate to " <<
+                      (config.vocab_tree.empty() ? "exhaustive" : "retrieval") << " matching" << std::endl;
+            colmap.sparse_model(false);
+            Colmap::ModelQuality escalated = colmap.model_quality(false);
+            printf("%s model: %lu of %lu images, reprojection error %.3f px, track length %.2f, score %.3f\n",
+                   config.vocab_tree.empty() ? "Exhaustive" : "Retrieval", escalated.registered, escalated.images,
+                   escalated.reprojection_error, escalated.track_length, escalated.score);
+            colmap_stage.count("escalated_score", escalated.score);
+            colmap_stage.count("escalated_registered", escalated.registered);
+            sequential = escalated.score <= quality.score;
+        }
+        colmap_stage.count("sequential_chosen", sequential ? 1 : 0);
+        if (!cancelled()) {
+            path_to_nvm_model = colmap.dense_model(sequential);
+        }
+    }
+    if (path_to_nvm_model.empty()) {
+        std::cerr << (cancelled() ? "Reconstruction cancelled!" : "Reconstruction field!") << std::endl;
+        return false;
+    }
+    if (!run_mvs(path_to_nvm_model)) {
+        return false;
+    }
+    printf("Reconstruction consumed: %s\n", TD_TIMER_GET_FMT().c_str());
+    return true;
+}
+
+// Coarse-to-fine SfM, then OpenMVS at its resolution
+bool ReconstructionPipeline::run_coarse_to_fine() {
+    TraceStage stage("Coarse-to-fine run");
+    TD_TIMER_START();
+    fs::path path_to_nvm_model;
+    {
+        TraceStage colmap_stage("COLMAP");
+        CoarseToFine sfm(working_dir, config.colmap_bin);
+        sfm.set_cancel_flag(&cancel_flag);
+        sfm.set_sequential(config.sequential && !config.exhaustive);
+        sfm.set_time_budget(config.time_budget_s, config.ram_budget_mb);
+        path_to_nvm_model = sfm.run();
+    }
+    if (path_to_nvm_model.empty()) {
+        std::cerr << (cancelled() ? "Reconstruction cancelled!" : "Reconstruction field!") << std::endl;
+        return false;
+    }
+    if (!run_mvs(path_to_nvm_model)) {
+        return false;
+    }
+    printf("Reconstruction consumed: %s\n", TD_TIMER_GET_FMT().c_str());
+    return true;
+}
+
+// Whole pipeline on the calling thread. False if no run gave a model, pipeline was cancelled or options conflict
+bool ReconstructionPipeline::run() {
+    std::string const conflicts = config_conflicts(config);
+    if (!conflicts.empty()) {
+        std::cerr << conflicts << std::endl;
+        return false;
+    }
+    // Stages of this thread go to the trace of the pipeline
+    Trace * previous_trace = Trace::make_current(&pipeline_trace);
+    finished_steps = 0;
+    bool success = false;
+    if (!cancelled()) {
+        process_images();
+    }
+    bool const single_run = config.adaptive || config.coarse_to_fine;
+    if (!cancelled() && config.coarse_to_fine) {
+        success = run_coarse_to_fine();
+    } else if (!cancelled() && config.adaptive) {
+        success = run_adaptive();
+    }
+    if (!cancelled() && !single_run && config.sequential) {
+        success = run_matching(true) || success;
+    }
+    if (!cancelled() && !single_run && config.exhaustive) {
+        success = run_matching(false) || success;
+    }
+    Trace::make_current(previous_trace);
+    if (on_progress && success && !cancelled()) {
+        Progress progress;
+        progress.finished = true;
+        progress.fraction = 1;
+        on_progress(progress);
+    }
+    return success && !cancelled();
+}
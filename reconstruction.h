@@ -0,0 +1,148 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_RECONSTRUCTION_H
+#define RECONSTRUCTION_RECONSTRUCTION_H
+
+#include <atomic>
+#include <functional>
+#include "openmvs.h"
+#include "tracing.h"
+#include "utils.h"
+
+// Reconstruction pipeline as a library
+//
+// The same stages as the Reconstruction executable: image processing, then COLMAP SfM and OpenMVS for
+// sequential and for exhaustive matching. Every pipeline has its own typed config, trace, callbacks and
+// cancel flag, so a service can run several of them in one process, each on its own thread:
+//
+//    ReconstructionConfig config;
+//    config.images_dir = "/data/capture1";
+//    ReconstructionPipeline pipeline(config);
+//    pipeline.on_progress = [](ReconstructionPipeline::Progress const & p) { ... };
+//    std::thread worker([&pipeline] { pipeline.run(); });
+//    ...
+//    pipeline.cancel();   // from any thread: the running tool is terminated, no further stage starts
+//
+// Cancellation is cooperative: in-process stages (NaN removal, simplification, tiling) finish first.
+// Stages still print their log to stdout. Memory and CPU time of stages are of the whole process, concurrent
+// pipelines must have different images directories (results are written next to the images).
+
+struct ReconstructionConfig {
+    fs::path images_dir;
+    fs::path colmap_bin = local_path::COLMAP_BIN;
+    fs::path openmvs_bin = local_path::OPENMVS_BIN;
+    // Runs of SfM matching, each one is a whole reconstruction
+    bool sequential = true;
+    bool exhaustive = true;
+    // One run instead: sequential sparse model first, exhaustive (or retrieval) matching only if its quality
+    // score is below the threshold (see Colmap::ModelQuality). Only the better sparse model goes to OpenMVS
+    bool adaptive = false;
+    double adaptive_threshold = 0.8;
+    // One run instead: poses on downscaled images, refined at the resolution which fits the time budget
+    // (see coarse_to_fine.h). Coarse matching is sequential if only sequential is set, exhaustive otherwise
+    bool coarse_to_fine = false;
+    // Seconds of coarse-to-fine SfM and densifying (0 - the processed resolution)
+    double time_budget_s = 0;
+    // Larger side of processed images, coarse-to-fine run chooses its resolution up to it
+    int max_image_side = 1920;
+    // COLMAP vocabulary tree: retrieval-based matching instead of exhaustive one (large image sets)
+    fs::path vocab_tree;
+    // Exhaustive matching sharded over this many local worker processes (0 - exhaustive_matcher)
+    ulong match_workers = 0;
+    // Reconstruction executable, local match workers run it in --match-worker mode
+    fs::path reconstruction_bin = local_path::RECONSTRUCTION_BIN;
+    // In-process SIFT on CPU while images are processed, instead of COLMAP extractor on GPU (see sift_extractor.h)
+    bool cpu_features = false;
+    // Densify and texture only a minimal subset of views chosen on the sparse model (see view_selection.h)
+    bool view_selection = false;
+    // Sparse and dense points are cropped to the box of object silhouettes (see region_of_interest.h)
+    bool roi_cropping = false;
+    // If not set, questions about simplify ratio and distance are asked (see on_question)
+    bool automatic = true;
+    // Simplify ratios of levels of detail (see OpenMVS::set_lod_ratios)
+    std::vector<double> lod_ratios;
+    bool tiled_output = false;
+    // 0 - 75% of physical memory
+    double ram_budget_mb = 0;
+    // "threshold", "queue", "compact" or "compare" (priority queue, runtime of both engines is reported)
+    std::string simplify_engine = "threshold";
+    // Spatial partitions are decimated concurrently ("-parallel" suffix of engine option, not with "compact")
+    bool parallel_simplify = false;
+    // Error-bounded simplification (0 - off, see OpenMVS::set_max_error)
+    double max_error = 0;
+};
+
+// Option of the command line and of daemon jobs into config: lod_ratios, tiles, ram_budget, engine, max_error,
+// matching, adaptive_threshold, vocab_tree, match_workers, cpu_features, view_selection, roi_cropping,
+// time_budget, max_image_side.
+// False with error if the option is unknown or its value isn't valid
+bool set_config_option(ReconstructionConfig & config, std::string const & name, std::string const & value,
+                       std::string & error);
+
+// Options the chosen runs can't use, empty if there are none. Coarse-to-fine run extracts and matches features
+// at its own resolutions by COLMAP: in-process features, retrieval and sharded matching would be ignored
+std::string config_conflicts(ReconstructionConfig const & config);
+
+class ReconstructionPipeline {
+public:
+    struct Progress {
+        // Path of the stage: "Sequential run / OpenMVS / Densify point cloud"
+        std::string stage;
+        bool finished = false;
+        // Estimated part of the whole pipeline done, from the main steps finished
+        double fraction = 0;
+    };
+
+    // Called on the thread of run() when a stage begins and ends
+    std::function<void(Progress const &)> on_progress;
+    // Measurements of every finished stage (time, memory, counts, external tools)
+    std::function<void(Trace::Stage const &)> on_metrics;
+    // Answers of interactive mode, console dialog if not set
+    OpenMVS::Question on_question;
+
+    explicit ReconstructionPipeline(ReconstructionConfig const & config);
+
+    // Whole pipeline on the calling thread. False if no run gave a model, pipeline was cancelled
+    // or options conflict (see config_conflicts)
+    bool run();
+
+    // Safe from any thread
+    void cancel();
+
+    bool cancelled() const;
+
+    Trace const & trace() const;
+
+    // Results and trace of the pipeline are written here (known after image processing)
+    fs::path result_dir() const;
+
+    // Chrome/Perfetto trace and summary JSON into result directory
+    bool write_trace() const;
+private:
+    ReconstructionConfig config;
+    Trace pipeline_trace;
+    std::atomic<bool> cancel_flag;
+    fs::path working_dir;
+    bool features_in_database = false;
+    ulong expected_steps = 1;
+    ulong finished_steps = 0;
+
+    // Image processing, with feature extraction of every processed image if it is in-process
+    void process_images();
+
+    // COLMAP and OpenMVS for one kind of matching
+    bool run_matching(bool const sequential);
+
+    // Sequential SfM, exhaustive SfM if it isn't good enough, then OpenMVS for the better model
+    bool run_adaptive();
+
+    // Coarse-to-fine SfM, then OpenMVS at its resolution
+    bool run_coarse_to_fine();
+
+    // OpenMVS for the NVM model of COLMAP
+    bool run_mvs(fs::path const & path_to_nvm_model);
+};
+
+#endif //RECONSTRUCTION_RECONSTRUCTION_H
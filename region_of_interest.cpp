@@ -0,0 +1,215 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <cmath>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "region_of_interest.h"
+
+// Silhouettes are tested in cells of this size: edges of the mask are blurred by JPEG and undistortion
+static int const MASK_CELL = 8;
+// Mean gray value of a cell on the silhouette (background is black)
+static double const MIN_FOREGROUND = 2.0;
+// Box extent between these quantiles of object points along every axis
+static double const QUANTILE = 0.005;
+// Border around the extent, part of the size
+static double const BORDER = 0.1;
+// Points farther from the median than this multiple of 95% quantile distance don't affect the axes
+static double const OUTLIER_DISTANCE = 2.0;
+// Less object points don't give a box
+static ulong const MIN_OBJECT_POINTS = 20;
+
+// Box of sparse points on the silhouettes (images are read relative to working_dir). Not valid if too
+// few points are on them
+RegionOfInterest RegionOfInterest::from_silhouettes(MVS::Scene & scene, fs::path const & working_dir,
+                                                    ulong & object_points) {
+    RegionOfInterest roi;
+    object_points = 0;
+    MVS::PointCloud const & cloud = scene.pointcloud;
+    ulong const points = std::min(cloud.points.size(), cloud.pointViews.size());
+    ulong const n = scene.images.size();
+    // Points of every view
+    std::vector<std::vector<uint32_t>> view_points(n);
+    for (ulong p = 0; p < points; ++p) {
+        for (auto v : cloud.pointViews[p]) {
+            if (v < n) {
+                view_points[v].push_back(uint32_t(p));
+            }
+        }
+    }
+
+    // Votes of the views: on the silhouette or not
+    std::vector<ulong> seen(points, 0), inside(points, 0);
+    #pragma omp parallel for schedule(dynamic)
+    for (long v = 0; v < (long)n; ++v) {
+        MVS::Image & image = scene.images[v];
+        if (!image.IsValid() || view_points[v].empty()) {
+            continue;
+        }
+        fs::path image_path(image.name);
+        if (image_path.is_relative()) {
+            image_path = working_dir / image_path;
+        }
+        cv::Mat gray = cv::imread(image_path.string(), cv::IMREAD_GRAYSCALE);
+        if (gray.empty()) {
+            continue;
+        }
+        if ((image.width != (unsigned)gray.cols) || (image.height != (unsigned)gray.rows)) {
+            image.width = gray.cols;
+            image.height = gray.rows;
+        }
+        image.UpdateCamera(scene.platforms);
+        cv::Mat cells;
+        cv::resize(gray, cells, cv::Size((gray.cols + MASK_CELL - 1) / MASK_CELL,
+                                         (gray.rows + MASK_CELL - 1) / MASK_CELL), 0, 0, cv::INTER_AREA);
+        double const scale_x = double(cells.cols) / gray.cols, scale_y = double(cells.rows) / gray.rows;
+        for (auto p : view_points[v]) {
+            auto const & point = cloud.points[p];
+            Point2 pixel = image.camera.ProjectPointP(Point3(point.x, point.y, point.z));
+            int x = int(std::floor(pixel.x * scale_x)), y = int(std::floor(pixel.y * scale_y));
+            bool on_silhouette = (x >= 0) && (y >= 0) && (x < cells.cols) && (y < cells.rows) &&
+                                 (cells.at<unsigned char>(y, x) >= MIN_FOREGROUND);
+            #pragma omp atomic
+            ++seen[p];
+            if (on_silhouette) {
+                #pragma omp atomic
+                ++inside[p];
+            }
+        }
+    }
+
+    std::vector<Eigen::Vector3d> object;
+    for (ulong p = 0; p < points; ++p) {
+        auto const & point = cloud.points[p];
+        if (seen[p] && (2 * inside[p] >= seen[p]) &&
+            !(std::isnan(point.x) || std::isnan(point.y) || std::isnan(point.z))) {
+            object.push_back(Eigen::Vector3d(point.x, point.y, point.z));
+        }
+    }
+    object_points = object.size();
+    if (object.size() < MIN_OBJECT_POINTS) {
+        return roi;
+    }
+
+    // Far outliers are dropped first: they would turn the principal axes
+    Eigen::Vector3d median;
+    std::vector<double> values(object.size());
+    for (int axis = 0; axis < 3; ++axis) {
+        for (ulong i = 0; i < object.size(); ++i) {
+            values[i] = object[i][axis];
+        }
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        median[axis] = values[values.size() / 2];
+    }
+    for (ulong i = 0; i < object.size(); ++i) {
+        values[i] = (object[i] - median).norm();
+    }
+    ulong const quantile_95 = ulong(0.95 * (object.size() - 1));
+    std::nth_element(values.begin(), values.begin() + quantile_95, values.end());
+    double const max_distance = OUTLIER_DISTANCE * values[quantile_95];
+    object.erase(std::remove_if(object.begin(), object.end(), [&](Eigen::Vector3d const & point) {
+        return (point - median).norm() > max_distance;
+    }), object.end());
+
+    // Principal axes of the object points
+    Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+    for (auto const & point : object) {
+        mean += point;
+    }
+    mean /= double(object.size());
+    Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+    for (auto const & point : object) {
+        covariance += (point - mean) * (point - mean).transpose();
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance / double(object.size()));
+    roi.axes = solver.eigenvectors();
+    // Extent along every axis between the quantiles, with the border
+    std::vector<double> coordinates(object.size());
+    ulong const low = ulong(QUANTILE * (object.size() - 1)), high = object.size() - 1 - low;
+    Eigen::Vector3d local_center;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (ulong i = 0; i < object.size(); ++i) {
+            coordinates[i] = roi.axes.col(axis).dot(object[i] - mean);
+        }
+        std::nth_element(coordinates.begin(), coordinates.begin() + low, coordinates.end());
+        double min_value = coordinates[low];
+        std::nth_element(coordinates.begin(), coordinates.begin() + high, coordinates.end());
+        double max_value = coordinates[high];
+        local_center[axis] = (min_value + max_value) / 2;
+        roi.half_size[axis] = (max_value - min_value) * (0.5 + BORDER);
+    }
+    roi.center = mean + roi.axes * local_center;
+    roi.valid = roi.half_size.minCoeff() > 0;
+    return roi;
+}
+
+bool RegionOfInterest::is_valid() const {
+    return valid;
+}
+
+bool RegionOfInterest::contains(double const x, double const y, double const z) const {
+    Eigen::Vector3d local = axes.transpose() * (Eigen::Vector3d(x, y, z) - center);
+    // NaN coordinates are outside: comparisons are false
+    return (std::abs(local[0]) <= half_size[0]) && (std::abs(local[1]) <= half_size[1]) &&
+           (std::abs(local[2]) <= half_size[2]);
+}
+
+// Points outside the box (and NaN points) are removed with their views, weights, colors and normals.
+// Number of removed points
+ulong RegionOfInterest::crop(MVS::PointCloud & cloud) const {
+    ulong const points = cloud.points.size();
+    bool const views = cloud.pointViews.size() == points;
+    bool const weights = cloud.pointWeights.size() == points;
+    bool const colors = cloud.colors.size() == points;
+    bool const normals = cloud.normals.size() == points;
+    ulong kept = 0;
+    for (ulong p = 0; p < points; ++p) {
+        auto const & point = cloud.points[p];
+        if (!contains(point.x, point.y, point.z)) {
+            continue;
+        }
+        if (kept != p) {
+            cloud.points[kept] = cloud.points[p];
+            if (views) {
+                cloud.pointViews[kept] = cloud.pointViews[p];
+            }
+            if (weights) {
+                cloud.pointWeights[kept] = cloud.pointWeights[p];
+            }
+            if (colors) {
+                cloud.colors[kept] = cloud.colors[p];
+            }
+            if (normals) {
+                cloud.normals[kept] = cloud.normals[p];
+            }
+        }
+        ++kept;
+    }
+    cloud.points.Resize(kept);
+    if (views) {
+        cloud.pointViews.Resize(kept);
+    }
+    if (weights) {
+        cloud.pointWeights.Resize(kept);
+    }
+    if (colors) {
+        cloud.colors.Resize(kept);
+    }
+    if (normals) {
+        cloud.normals.Resize(kept);
+    }
+    return points - kept;
+}
+
+double RegionOfInterest::volume() const {
+    return valid ? 8 * half_size[0] * half_size[1] * half_size[2] : 0;
+}
+
+Eigen::Vector3d RegionOfInterest::get_center() const {
+    return center;
+}
+
+Eigen::Vector3d RegionOfInterest::get_size() const {
+    return 2 * half_size;
+}
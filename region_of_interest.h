@@ -0,0 +1,53 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_REGION_OF_INTEREST_H
+#define RECONSTRUCTION_REGION_OF_INTEREST_H
+
+#include <Eigen/Dense>
+#include <OpenMVS/MVS.h>
+#include "utils.h"
+
+// Region of interest of the reconstruction: oriented box around the object.
+//
+// Image processing fills the background of every image with black, so the undistorted images of the scene
+// are silhouettes of the object. Every sparse point is projected into the views which see it: it belongs to
+// the object if it falls on the silhouette (non-black 8x8 cell, tolerant to JPEG and undistortion) in at least
+// half of them. The box is aligned with principal axes of the object points (far outliers dropped), its extent
+// is between 0.5% and 99.5% quantiles along every axis (outliers of matching don't inflate it) with 10% border.
+//
+// OpenMVS doesn't take the box itself, so the scene is cropped in process:
+//    sparse points outside the box are removed before DensifyPointCloud, depth range of every depth map is taken
+//    from the sparse points it sees, so depth maps don't cover the background;
+//    dense points outside the box are removed before ReconstructMesh, so tetrahedralisation, the mesh
+//    and its refinement only cover the object.
+
+class RegionOfInterest {
+    Eigen::Vector3d center = Eigen::Vector3d::Zero();
+    // Columns are the axes of the box
+    Eigen::Matrix3d axes = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d half_size = Eigen::Vector3d::Zero();
+    bool valid = false;
+public:
+    // Box of sparse points on the silhouettes (images are read relative to working_dir). Not valid if too
+    // few points are on them
+    static RegionOfInterest from_silhouettes(MVS::Scene & scene, fs::path const & working_dir,
+                                             ulong & object_points);
+
+    bool is_valid() const;
+
+    bool contains(double const x, double const y, double const z) const;
+
+    // Points outside the box (and NaN points) are removed with their views, weights, colors and normals.
+    // Number of removed points
+    ulong crop(MVS::PointCloud & cloud) const;
+
+    double volume() const;
+
+    Eigen::Vector3d get_center() const;
+
+    Eigen::Vector3d get_size() const;
+};
+
+#endif //RECONSTRUCTION_REGION_OF_INTEREST_H
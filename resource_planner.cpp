@@ -0,0 +1,126 @@
+//
+// Created by user on 10/18/26.
+//
+#include <fstream>
+#include <unistd.h>
+#include <opencv2/highgui/highgui.hpp>
+#include "resource_planner.h"
+
+// DensifyPointCloud: depth (4), normal (12), confidence (4) and gray image (4) bytes per pixel
+static double const DENSIFY_BYTES_PER_PIXEL = 24.0;
+// Dense point: position, color, normal, weight and about 3 views
+static double const DENSE_POINT_BYTES = 48.0;
+// Fraction of processed pixels which become dense points (after fusion of ~3 views)
+static double const DENSE_POINTS_PER_PIXEL = 0.15;
+static double const DENSIFY_SECONDS_PER_MEGAPIXEL = 0.9;
+// RefineMesh: gray image, gradients and projections bytes per pixel
+static double const REFINE_BYTES_PER_PIXEL = 20.0;
+static double const REFINE_BYTES_PER_FACE = 220.0;
+static double const REFINE_SECONDS_PER_MEGAPIXEL = 0.35;
+static double const REFINE_SECONDS_PER_MEGAFACE = 40.0;
+// Process itself, libraries and scene
+static double const BASE_MEMORY_MB = 300.0;
+
+double physical_memory_mb() {
+    return (double)sysconf(_SC_PHYS_PAGES) * (double)sysconf(_SC_PAGE_SIZE) / (1024.0 * 1024.0);
+}
+
+ResourcePlanner::ResourcePlanner(ulong const images_count, double const image_pixels, ulong const sparse_points,
+                                 double const ram_budget_mb) :
+        images_count(images_count), image_pixels(image_pixels), sparse_points(sparse_points),
+        ram_budget_mb(ram_budget_mb > 0 ? ram_budget_mb : 0.75 * physical_memory_mb())
+{}
+
+// Statistics are taken from sparse scene: images, their size, sparse points
+ResourcePlanner ResourcePlanner::from_scene(MVS::Scene const & scene, fs::path const & working_dir,
+                                            double const ram_budget_mb)
+{
+    ulong images_count = 0;
+    double image_pixels = 0;
+    for (auto const & image : scene.images) {
+        if (!image.IsValid()) {
+            continue;
+        }
+        ++images_count;
+        double pixels = (double)image.width * image.height;
+        if ((pixels == 0) && (image_pixels == 0)) {
+            // Size isn't stored in scene: images are scaled the same way, so read the first one
+            fs::path image_path(image.name);
+            if (image_path.is_relative()) {
+                image_path = working_dir / image_path;
+            }
+            cv::Mat img = cv::imread(image_path.string());
+            pixels = (double)img.rows * img.cols;
+        }
+        image_pixels = std::max(image_pixels, pixels);
+    }
+    return ResourcePlanner(images_count, image_pixels, scene.pointcloud.points.size(), ram_budget_mb);
+}
+
+// Dense points per processed pixel depends on how well the scene is covered by sparse points
+double ResourcePlanner::density_factor() const {
+    if (images_count == 0) {
+        return 1.0;
+    }
+    // About 1000 sparse points per image is usual for textured object captures
+    double points_per_image = (double)sparse_points / images_count;
+    return std::min(2.0, std::max(0.5, points_per_image / 1000.0));
+}
+
+ResourcePlanner::Estimate ResourcePlanner::estimate_densify(unsigned const level) const {
+    Estimate estimate;
+    estimate.resolution_level = level;
+    double pixels = images_count * image_pixels / double(1 << (2 * level));
+    double dense_points = pixels * DENSE_POINTS_PER_PIXEL * density_factor();
+    estimate.memory_mb = BASE_MEMORY_MB +
+            (pixels * DENSIFY_BYTES_PER_PIXEL + dense_points * DENSE_POINT_BYTES) / (1024.0 * 1024.0);
+    estimate.seconds = pixels / 1e6 * DENSIFY_SECONDS_PER_MEGAPIXEL;
+    return estimate;
+}
+
+ResourcePlanner::Estimate ResourcePlanner::estimate_refine(unsigned const level, ulong const mesh_faces) const {
+    Estimate estimate;
+    estimate.resolution_level = level;
+    double pixels = images_count * image_pixels / double(1 << (2 * level));
+    estimate.memory_mb = BASE_MEMORY_MB +
+            (pixels * REFINE_BYTES_PER_PIXEL + mesh_faces * REFINE_BYTES_PER_FACE) / (1024.0 * 1024.0);
+    estimate.seconds = pixels / 1e6 * REFINE_SECONDS_PER_MEGAPIXEL + mesh_faces / 1e6 * REFINE_SECONDS_PER_MEGAFACE;
+    return estimate;
+}
+
+// Highest resolution (lowest level) which fits RAM budget
+ResourcePlanner::Estimate ResourcePlanner::plan_densify() const {
+    for (unsigned level = 0; level < MAX_RESOLUTION_LEVEL; ++level) {
+        Estimate estimate = estimate_densify(level);
+        if (estimate.memory_mb <= ram_budget_mb) {
+            return estimate;
+        }
+    }
+    return estimate_densify(MAX_RESOLUTION_LEVEL);
+}
+
+ResourcePlanner::Estimate ResourcePlanner::plan_refine(ulong const mesh_faces) const {
+    for (unsigned level = 0; level < MAX_RESOLUTION_LEVEL; ++level) {
+        Estimate estimate = estimate_refine(level, mesh_faces);
+        if (estimate.memory_mb <= ram_budget_mb) {
+            return estimate;
+        }
+    }
+    return estimate_refine(MAX_RESOLUTION_LEVEL, mesh_faces);
+}
+
+double ResourcePlanner::get_ram_budget() const {
+    return ram_budget_mb;
+}
+
+// Faces count from header of PLY mesh (0 if can't be read)
+ulong ply_faces_count(fs::path const & path) {
+    std::ifstream ply(path.string(), std::ios::binary);
+    std::string line;
+    while (std::getline(ply, line) && (line.compare(0, 10, "end_header") != 0)) {
+        if (line.compare(0, 13, "element face ") == 0) {
+            return std::stoul(line.substr(13));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_RESOURCE_PLANNER_H
+#define RECONSTRUCTION_RESOURCE_PLANNER_H
+
+#include <OpenMVS/MVS.h>
+#include "utils.h"
+
+// Memory and runtime planner for DensifyPointCloud and RefineMesh.
+//
+// Both tools are run with '--resolution-level L': images are downscaled by 2^L before processing.
+// Estimates are linear models of the processed pixels:
+//    pixels = images_count * image_pixels / 4^L
+// DensifyPointCloud keeps depth, normal and confidence maps of every image until fusion
+// and builds dense cloud with points proportional to pixels (scaled by sparse point density).
+// RefineMesh keeps every image with its gradients and the mesh with per face data.
+// Constants are rough calibration values (8 threads, 2017 OpenMVS): the estimate is logged
+// next to the measured peak of every run, so they can be tuned.
+
+class ResourcePlanner {
+public:
+    struct Estimate {
+        unsigned resolution_level = 0;
+        double memory_mb = 0;
+        double seconds = 0;
+    };
+private:
+    ulong images_count = 0;
+    double image_pixels = 0;
+    ulong sparse_points = 0;
+    double ram_budget_mb = 0;
+
+    // Dense points per processed pixel depends on how well the scene is covered by sparse points
+    double density_factor() const;
+public:
+    static unsigned const MAX_RESOLUTION_LEVEL = 3;
+
+    // ram_budget_mb == 0: 75% of physical memory
+    ResourcePlanner(ulong const images_count, double const image_pixels, ulong const sparse_points,
+                    double const ram_budget_mb);
+
+    // Statistics are taken from sparse scene: images, their size, sparse points
+    static ResourcePlanner from_scene(MVS::Scene const & scene, fs::path const & working_dir, double const ram_budget_mb);
+
+    Estimate estimate_densify(unsigned const level) const;
+
+    Estimate estimate_refine(unsigned const level, ulong const mesh_faces) const;
+
+    // Highest resolution (lowest level) which fits RAM budget
+    Estimate plan_densify() const;
+
+    Estimate plan_refine(ulong const mesh_faces) const;
+
+    double get_ram_budget() const;
+};
+
+// Physical memory of the machine
+double physical_memory_mb();
+
+// Faces count from header of PLY mesh (0 if can't be read)
+ulong ply_faces_count(fs::path const & path);
+
+#endif //RECONSTRUCTION_RESOURCE_PLANNER_H
@@ -0,0 +1,365 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sqlite3.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include "sharded_matching.h"
+#include "tracing.h"
+
+// Local workers are started again this many times for shards of dead workers
+static int const WORKER_RESTARTS = 2;
+// Image blocks are not larger than blocks of exhaustive_matcher
+static ulong const MAX_BLOCK_SIZE = 50;
+// Workers touch their claim this often while matching the shard
+static int const HEARTBEAT_SECONDS = 10;
+// Claim without heartbeat for this long belongs to a lost worker (on any node)
+static double const CLAIM_TIMEOUT_SECONDS = 120;
+
+static std::string host_name() {
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+    return host;
+}
+
+// Shard directories in order
+static std::vector<fs::path> shard_dirs(fs::path const & shards_dir) {
+    std::vector<fs::path> dirs;
+    std::error_code error;
+    for (auto const & entry : fs::directory_iterator(shards_dir, error)) {
+        if (fs::exists(entry.path() / "pairs.txt")) {
+            dirs.push_back(entry.path());
+        }
+    }
+    std::sort(dirs.begin(), dirs.end());
+    return dirs;
+}
+
+// Names of images of features database in order of their ids
+static bool database_images(fs::path const & database, std::vector<std::string> & images) {
+    sqlite3 * db = nullptr;
+    if (sqlite3_open_v2(database.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        return false;
+    }
+    sqlite3_stmt * statement = nullptr;
+    bool success = sqlite3_prepare_v2(db, "SELECT name FROM images ORDER BY image_id", -1, &statement,
+                                      nullptr) == SQLITE_OK;
+    while (success && (sqlite3_step(statement) == SQLITE_ROW)) {
+        images.push_back(reinterpret_cast<char const *>(sqlite3_column_text(statement, 0)));
+    }
+    sqlite3_finalize(statement);
+    sqlite3_close(db);
+    return success;
+}
+
+// Features database (it receives the matches), Reconstruction executable of local workers,
+// local workers (0 - half of CPUs)
+ShardedMatching::ShardedMatching(fs::path const & database, fs::path const & shards_dir,
+                                 fs::path const & matches_importer, fs::path const & worker_executable,
+                                 ulong const workers) :
+        database(fs::absolute(database)), shards_dir(fs::absolute(shards_dir)), matches_importer(matches_importer),
+        worker_executable(worker_executable),
+        workers(workers ? workers : std::max(1U, std::thread::hardware_concurrency() / 2)) {}
+
+void ShardedMatching::set_cancel_flag(std::atomic<bool> const * flag) {
+    cancel_flag = flag;
+}
+
+// Shards of image pairs, blocks of images are small enough for a few shards per worker
+ulong ShardedMatching::split(std::vector<std::string> const & images, ulong & pairs) const {
+    fs::remove_all(shards_dir);
+    fs::create_directories(shards_dir / "workers");
+    std::ofstream((shards_dir / "database").string()) << database.string() << "\n";
+    // k blocks give k(k+1)/2 shards: at least 4 per worker
+    ulong const n = images.size();
+    ulong blocks = 1;
+    while ((blocks * (blocks + 1) / 2 < 4 * workers) && (blocks < n)) {
+        ++blocks;
+    }
+    ulong block_size = std::max(1UL, std::min(MAX_BLOCK_SIZE, (n + blocks - 1) / blocks));
+    blocks = (n + block_size - 1) / block_size;
+    ulong shards = 0;
+    pairs = 0;
+    for (ulong a = 0; a < blocks; ++a) {
+        for (ulong b = a; b < blocks; ++b) {
+            std::string list;
+            for (ulong i = a * block_size; i < std::min(n, (a + 1) * block_size); ++i) {
+                for (ulong j = std::max(i + 1, b * block_size); j < std::min(n, (b + 1) * block_size); ++j) {
+                    list += images[i] + " " + images[j] + "\n";
+                    ++pairs;
+                }
+            }
+            if (list.empty()) {
+                continue;
+            }
+            char name[16];
+            snprintf(name, sizeof(name), "%06lu", shards++);
+            fs::create_directory(shards_dir / name);
+            std::ofstream((shards_dir / name / "pairs.txt").string()) << list;
+        }
+    }
+    return shards;
+}
+
+// Claims of dead local workers and claims without heartbeat are removed, number of shards left without claim.
+// Heartbeat is a change of modification time seen by this clock, clocks of other nodes don't matter
+ulong ShardedMatching::release_stale_claims() {
+    std::string const host = host_name();
+    auto const now = std::chrono::steady_clock::now();
+    ulong free_shards = 0;
+    for (auto const & shard : shard_dirs(shards_dir)) {
+        if (fs::exists(shard / "done")) {
+            continue;
+        }
+        std::ifstream claim((shard / "claim").string());
+        std::string owner;
+        long pid = 0;
+        if (!(claim >> owner >> pid)) {
+            ++free_shards;
+            continue;
+        }
+        bool stale = (owner == host) && (kill(pid_t(pid), 0) != 0) && (errno == ESRCH);
+        std::error_code error;
+        auto modified = fs::last_write_time(shard / "claim", error);
+        Lease & lease = leases[shard.string()];
+        if (error || (lease.modified != modified) || (lease.owner != owner + " " + std::to_string(pid))) {
+            lease.modified = modified;
+            lease.owner = owner + " " + std::to_string(pid);
+            lease.seen = now;
+        } else if (std::chrono::duration<double>(now - lease.seen).count() > CLAIM_TIMEOUT_SECONDS) {
+            std::cerr << "Sharded matching: worker " << lease.owner << " lost shard " << shard.filename() << std::endl;
+            stale = true;
+        }
+        if (stale) {
+            fs::remove(shard / "claim");
+            leases.erase(shard.string());
+            ++free_shards;
+        }
+    }
+    return free_shards;
+}
+
+// Matches of worker databases of done shards into the database
+bool ShardedMatching::merge() const {
+    std::set<std::string> worker_databases;
+    for (auto const & shard : shard_dirs(shards_dir)) {
+        std::ifstream done((shard / "done").string());
+        std::string path;
+        if (std::getline(done, path) && !path.empty()) {
+            worker_databases.insert(path);
+        }
+    }
+    sqlite3 * db = nullptr;
+    if (sqlite3_open(database.c_str(), &db) != SQLITE_OK) {
+        std::cerr << "Can't open " << database << ": " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close(db);
+        return false;
+    }
+    // Worker databases are copies of the features database: image ids and pair ids are the same
+    bool success = true;
+    for (auto const & path : worker_databases) {
+        std::string quoted;
+        for (char c : path) {
+            quoted += (c == '\'') ? std::string("''") : std::string(1, c);
+        }
+        std::string sql = "ATTACH DATABASE '" + quoted + "' AS shard; BEGIN; "
+                "INSERT OR REPLACE INTO matches SELECT * FROM shard.matches; "
+                "INSERT OR REPLACE INTO two_view_geometries SELECT * FROM shard.two_view_geometries; "
+                "COMMIT; DETACH DATABASE shard;";
+        char * message = nullptr;
+        if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &message) != SQLITE_OK) {
+            std::cerr << "Can't merge matches of " << path << ": " << (message ? message : "") << std::endl;
+            sqlite3_free(message);
+            sqlite3_exec(db, "ROLLBACK; DETACH DATABASE shard;", nullptr, nullptr, nullptr);
+            success = false;
+            break;
+        }
+    }
+    sqlite3_close(db);
+    // Worker databases are whole copies of features, they are removed once merged
+    if (success) {
+        fs::remove_all(shards_dir);
+    }
+    return success;
+}
+
+// Split, match by workers and merge. False if any shard failed or matching was cancelled
+bool ShardedMatching::run() {
+    std::vector<std::string> images;
+    if (!database_images(database, images) || (images.size() < 2)) {
+        std::cerr << "Sharded matching: no images in " << database << std::endl;
+        return false;
+    }
+    ulong pairs = 0;
+    ulong const shards = split(images, pairs);
+    ulong const threads = std::max(1UL, (ulong)std::thread::hardware_concurrency() / workers);
+    Trace::current().count("images", images.size());
+    Trace::current().count("pairs", pairs);
+    Trace::current().count("shards", shards);
+    Trace::current().count("workers", workers);
+    printf("Sharded matching: %lu pairs of %lu images in %lu shards, %lu local workers of %lu threads.\n"
+           "Other nodes may help: ./Reconstruction --match-worker %s\n", pairs, images.size(), shards, workers,
+           threads, shards_dir.c_str());
+
+    // Local workers run the executable in worker mode, as other nodes do: the forked copy of this process
+    // (its threads and locks) only execs. Arguments are prepared before fork
+    std::vector<std::string> args = {worker_executable.string(), "--match-worker", shards_dir.string(),
+                                     matches_importer.parent_path().string(), std::to_string(threads)};
+    std::vector<char *> argv;
+    for (auto & arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    std::map<pid_t, std::chrono::steady_clock::time_point> running;
+    auto start_workers = [&]() {
+        for (ulong i = 0; i < workers; ++i) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                // Own process group: cancel stops matches_importer of the worker too
+                setpgid(0, 0);
+                execv(argv[0], argv.data());
+                _exit(127);
+            }
+            if (pid < 0) {
+                perror("Can't start match worker");
+            }
+            if (pid > 0) {
+                setpgid(pid, pid);
+                running[pid] = std::chrono::steady_clock::now();
+            }
+        }
+    };
+    auto reap_workers = [&](bool const block) {
+        for (auto it = running.begin(); it != running.end();) {
+            int status = 0;
+            struct rusage usage;
+            if (wait4(it->first, &status, block ? 0 : WNOHANG, &usage) != it->first) {
+                ++it;
+                continue;
+            }
+            Trace::External run;
+            run.command = "match worker " + std::to_string(it->first);
+            run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - it->second).count();
+            run.cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+                              usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+            // ru_maxrss is in kilobytes on Linux
+            run.peak_memory_mb = usage.ru_maxrss / 1024.0;
+            run.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            Trace::current().external(run);
+            it = running.erase(it);
+        }
+    };
+
+    start_workers();
+    int restarts = 0;
+    bool success = true;
+    while (true) {
+        reap_workers(false);
+        std::vector<fs::path> dirs = shard_dirs(shards_dir);
+        ulong done = std::count_if(dirs.begin(), dirs.end(), [](fs::path const & shard) {
+            return fs::exists(shard / "done");
+        });
+        if (done == shards) {
+            break;
+        }
+        if (cancel_flag && cancel_flag->load()) {
+            for (auto const & worker : running) {
+                kill(-worker.first, SIGTERM);
+            }
+            success = false;
+            break;
+        }
+        // Shards of dead local workers and of lost remote workers are free again, live remote workers may
+        // still hold the others
+        if ((release_stale_claims() > 0) && running.empty()) {
+            if (restarts++ == WORKER_RESTARTS) {
+                std::cerr << "Sharded matching: " << shards - done << " shards failed" << std::endl;
+                success = false;
+                break;
+            }
+            start_workers();
+        }
+        usleep(200000);
+    }
+    reap_workers(true);
+    return success && merge();
+}
+
+// Worker: takes and matches shards until none is left. Matching threads: 0 - all CPUs. Exit code of the process
+int run_match_worker(fs::path const & shards_path, fs::path const & matches_importer, ulong const threads) {
+    // Coordinator attaches the databases named in "done" files from its own working directory
+    fs::path const shards_dir = fs::absolute(shards_path);
+    std::string const host = host_name();
+    std::string const id = host + "-" + std::to_string(getpid());
+    std::ifstream source_file((shards_dir / "database").string());
+    std::string source;
+    if (!std::getline(source_file, source) || !fs::exists(source)) {
+        std::cerr << "Match worker: no features database in " << shards_dir << std::endl;
+        return 1;
+    }
+    fs::path const worker_database = shards_dir / "workers" / (id + ".db");
+    bool copied = false;
+    ulong matched = 0;
+    // Passes over the shards while some were taken: claims given back meanwhile are taken by the next pass
+    bool claimed = true;
+    while (claimed) {
+        claimed = false;
+        for (auto const & shard : shard_dirs(shards_dir)) {
+            if (fs::exists(shard / "done")) {
+                continue;
+            }
+            int fd = open((shard / "claim").c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd < 0) {
+                continue;
+            }
+            std::string owner = host + " " + std::to_string(getpid()) + "\n";
+            bool written = write(fd, owner.data(), owner.size()) == (ssize_t)owner.size();
+            close(fd);
+            claimed = true;
+            if (!copied) {
+                copied = written && fs::copy_file(source, worker_database, fs::copy_options::overwrite_existing);
+            }
+            std::string command(matches_importer.string() + " --database_path " + worker_database.string() +
+                                " --match_list_path " + (shard / "pairs.txt").string() + " --match_type pairs" +
+                                " --SiftMatching.num_threads " + (threads ? std::to_string(threads) : "-1"));
+            // Heartbeat: modification time of the claim is renewed while the shard is matched
+            std::atomic<bool> matching(true);
+            fs::path const claim = shard / "claim";
+            std::thread heartbeat([&matching, &claim]() {
+                for (int tick = 1; matching; ++tick) {
+                    usleep(200000);
+                    if (tick % (HEARTBEAT_SECONDS * 5) == 0) {
+                        utimensat(AT_FDCWD, claim.c_str(), nullptr, 0);
+                    }
+                }
+            });
+            int status = copied ? run_traced(command) : -1;
+            matching = false;
+            heartbeat.join();
+            if (status) {
+                fs::remove(shard / "claim");
+                std::cerr << "Match worker " << id << ": shard " << shard.filename() << " failed" << std::endl;
+                return 1;
+            }
+            // "done" names the database with the matches of the shard, it appears complete
+            fs::path written_done = shard / ("done." + id);
+            std::ofstream((written_done).string()) << worker_database.string() << "\n";
+            fs::rename(written_done, shard / "done");
+            ++matched;
+        }
+    }
+    printf("Match worker %s: %lu shards matched\n", id.c_str(), matched);
+    return 0;
+}
@@ -0,0 +1,69 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_SHARDED_MATCHING_H
+#define RECONSTRUCTION_SHARDED_MATCHING_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "utils.h"
+
+// Sharded exhaustive matching over worker processes, on this node or on nodes sharing the filesystem
+//
+// Images of the features database are split into blocks and every pair of blocks is a shard: a list of image
+// pairs ("shards/<k>/pairs.txt") for COLMAP matches_importer. Workers take shards by creating "shards/<k>/claim"
+// exclusively, match them into their own copy of the features database ("shards/workers/<host>-<pid>.db")
+// and mark them "done". When every shard is done, matches and two-view geometries of worker databases are
+// merged into the database, so mapper reads it as after exhaustive_matcher.
+//
+// The coordinator starts local workers and waits for the shards. Local workers are the Reconstruction
+// executable started the same way as on other nodes, which can help with
+//    ./Reconstruction --match-worker shards_dir [full_path_colmap] [threads]
+// Workers renew modification time of their claims while matching. Claims of local workers that died, and
+// claims of any worker without heartbeat for 2 minutes (lost node), are taken back and local workers are
+// started again for them (twice at most).
+
+class ShardedMatching {
+    fs::path database;
+    fs::path shards_dir;
+    fs::path matches_importer;
+    fs::path worker_executable;
+    ulong workers;
+    std::atomic<bool> const * cancel_flag = nullptr;
+    // Last heartbeat of every claim: modification time and owner, when they were seen changing
+    struct Lease {
+        fs::file_time_type modified;
+        std::string owner;
+        std::chrono::steady_clock::time_point seen;
+    };
+    std::map<std::string, Lease> leases;
+
+    // Shards of image pairs, blocks of images are small enough for a few shards per worker
+    ulong split(std::vector<std::string> const & images, ulong & pairs) const;
+
+    // Claims of dead local workers and claims without heartbeat are removed, number of shards left without claim
+    ulong release_stale_claims();
+
+    // Matches of worker databases of done shards into the database
+    bool merge() const;
+public:
+    // Features database (it receives the matches), Reconstruction executable of local workers,
+    // local workers (0 - half of CPUs)
+    ShardedMatching(fs::path const & database, fs::path const & shards_dir, fs::path const & matches_importer,
+                    fs::path const & worker_executable, ulong const workers);
+
+    // Workers are stopped and matching fails once the flag is set
+    void set_cancel_flag(std::atomic<bool> const * flag);
+
+    // Split, match by workers and merge. False if any shard failed or matching was cancelled
+    bool run();
+};
+
+// Worker: takes and matches shards until none is left. Matching threads: 0 - all CPUs. Exit code of the process
+int run_match_worker(fs::path const & shards_dir, fs::path const & matches_importer, ulong const threads = 0);
+
+#endif //RECONSTRUCTION_SHARDED_MATCHING_H
@@ -0,0 +1,208 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <sqlite3.h>
+#include <opencv2/features2d.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#if (CV_VERSION_MAJOR < 4) || ((CV_VERSION_MAJOR == 4) && (CV_VERSION_MINOR < 4))
+#include <opencv2/xfeatures2d.hpp>
+#endif
+#include "sift_extractor.h"
+#include "tracing.h"
+
+// COLMAP camera model SIMPLE_RADIAL: f, cx, cy, k
+static int const SIMPLE_RADIAL = 2;
+
+// Statement with bound values, row id of the inserted row
+static bool execute(sqlite3 * db, char const * sql, std::function<void(sqlite3_stmt *)> const & bind,
+                    long * row_id = nullptr) {
+    sqlite3_stmt * statement = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &statement, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    if (bind) {
+        bind(statement);
+    }
+    bool success = sqlite3_step(statement) == SQLITE_DONE;
+    sqlite3_finalize(statement);
+    if (success && row_id) {
+        *row_id = (long)sqlite3_last_insert_rowid(db);
+    }
+    return success;
+}
+
+// Threads: 0 - all CPUs but one (image processing goes on meanwhile)
+SiftExtractor::SiftExtractor(fs::path const & database, fs::path const & colmap_bin, ulong const threads,
+                             int const max_features) :
+        database_path(database), database_creator_path(colmap_bin / "database_creator"),
+        threads(threads ? threads : std::max(1U, std::thread::hardware_concurrency() - 1)),
+        max_features(max_features) {}
+
+SiftExtractor::~SiftExtractor() {
+    finish();
+}
+
+// New database and worker threads, false if the database can't be created
+bool SiftExtractor::start() {
+    fs::remove(database_path);
+    std::string database_creator(database_creator_path.string() + " --database_path " + database_path.string());
+    std::cout << "Run: " << database_creator << std::endl;
+    if (run_traced(database_creator) || (sqlite3_open(database_path.c_str(), &database) != SQLITE_OK)) {
+        sqlite3_close(database);
+        database = nullptr;
+        return false;
+    }
+    finishing = false;
+    for (ulong i = 0; i < threads; ++i) {
+        workers.emplace_back(&SiftExtractor::work, this);
+    }
+    return true;
+}
+
+// Image (BGR) is queued for extraction, waits while the queue is full. Pixels are shared, not copied
+void SiftExtractor::submit(std::string const & name, cv::Mat const & image) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    // Decoded images are large: two per thread are waiting at most
+    queue_changed.wait(lock, [this] { return queue.size() < 2 * threads; });
+    queue.push_back(std::make_pair(name, image));
+    queue_changed.notify_all();
+}
+
+// Thread of the pool: extracts queued images until finish
+void SiftExtractor::work() {
+    while (true) {
+        std::pair<std::string, cv::Mat> item;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_changed.wait(lock, [this] { return finishing || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            item = queue.front();
+            queue.pop_front();
+            queue_changed.notify_all();
+        }
+        if (!extract(item.first, item.second)) {
+            std::cerr << "Can't extract features of " << item.first << std::endl;
+            ++failed;
+        }
+    }
+}
+
+bool SiftExtractor::extract(std::string const & name, cv::Mat const & image) {
+    cv::Mat gray;
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+#if (CV_VERSION_MAJOR < 4) || ((CV_VERSION_MAJOR == 4) && (CV_VERSION_MINOR < 4))
+    cv::Ptr<cv::xfeatures2d::SIFT> sift = cv::xfeatures2d::SIFT::create(max_features);
+#else
+    cv::Ptr<cv::SIFT> sift = cv::SIFT::create(max_features);
+#endif
+    std::vector<cv::KeyPoint> found;
+    cv::Mat descriptors;
+    sift->detectAndCompute(gray, cv::Mat(), found, descriptors);
+    std::vector<float> points(found.size() * 4);
+    std::vector<unsigned char> bytes(found.size() * 128);
+    for (ulong i = 0; i < found.size(); ++i) {
+        // COLMAP: center of the upper left pixel is (0.5, 0.5), scale is sigma (OpenCV size is its double)
+        points[i * 4] = found[i].pt.x + 0.5f;
+        points[i * 4 + 1] = found[i].pt.y + 0.5f;
+        points[i * 4 + 2] = found[i].size / 2;
+        points[i * 4 + 3] = float(found[i].angle * M_PI / 180);
+        // RootSIFT: L1 normalized square roots (unit L2 norm), stored as bytes of 512 x value
+        float const * descriptor = descriptors.ptr<float>(int(i));
+        double sum = 0;
+        for (int k = 0; k < 128; ++k) {
+            sum += std::abs(descriptor[k]);
+        }
+        for (int k = 0; k < 128; ++k) {
+            double value = (sum > 0) ? std::sqrt(std::abs(descriptor[k]) / sum) : 0;
+            bytes[i * 128 + k] = (unsigned char)std::min(255.0, std::round(512 * value));
+        }
+    }
+    if (!store(name, image.cols, image.rows, points, bytes)) {
+        return false;
+    }
+    ++images;
+    keypoints += found.size();
+    return true;
+}
+
+// Camera, image, keypoints and descriptors of the image in one transaction
+bool SiftExtractor::store(std::string const & name, int const width, int const height,
+                          std::vector<float> const & points, std::vector<unsigned char> const & descriptors) {
+    std::lock_guard<std::mutex> lock(database_mutex);
+    if (!database || !execute(database, "BEGIN", nullptr)) {
+        return false;
+    }
+    auto size = std::make_pair(width, height);
+    auto known = cameras.find(size);
+    long camera_id = (known != cameras.end()) ? known->second : 0;
+    bool success = true;
+    if (known == cameras.end()) {
+        // COLMAP default focal length without EXIF, principal point in the center
+        double params[4] = {1.2 * std::max(width, height), width / 2.0, height / 2.0, 0};
+        success = execute(database, "INSERT INTO cameras(model, width, height, params, prior_focal_length) "
+                                    "VALUES(?, ?, ?, ?, 0)", [&](sqlite3_stmt * statement) {
+            sqlite3_bind_int(statement, 1, SIMPLE_RADIAL);
+            sqlite3_bind_int(statement, 2, width);
+            sqlite3_bind_int(statement, 3, height);
+            sqlite3_bind_blob(statement, 4, params, sizeof(params), SQLITE_TRANSIENT);
+        }, &camera_id);
+    }
+    long image_id = 0;
+    success = success && execute(database, "INSERT INTO images(name, camera_id) VALUES(?, ?)",
+                                 [&](sqlite3_stmt * statement) {
+        sqlite3_bind_text(statement, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(statement, 2, camera_id);
+    }, &image_id);
+    ulong rows = points.size() / 4;
+    success = success && execute(database, "INSERT INTO keypoints(image_id, rows, cols, data) VALUES(?, ?, 4, ?)",
+                                 [&](sqlite3_stmt * statement) {
+        sqlite3_bind_int64(statement, 1, image_id);
+        sqlite3_bind_int64(statement, 2, rows);
+        sqlite3_bind_blob(statement, 3, points.data(), int(points.size() * sizeof(float)), SQLITE_TRANSIENT);
+    });
+    success = success && execute(database, "INSERT INTO descriptors(image_id, rows, cols, data) VALUES(?, ?, 128, ?)",
+                                 [&](sqlite3_stmt * statement) {
+        sqlite3_bind_int64(statement, 1, image_id);
+        sqlite3_bind_int64(statement, 2, rows);
+        sqlite3_bind_blob(statement, 3, descriptors.data(), int(descriptors.size()), SQLITE_TRANSIENT);
+    });
+    success = success && execute(database, "COMMIT", nullptr);
+    if (!success) {
+        std::cerr << "Can't store features of " << name << ": " << sqlite3_errmsg(database) << std::endl;
+        execute(database, "ROLLBACK", nullptr);
+        return false;
+    }
+    cameras[size] = camera_id;
+    return true;
+}
+
+// Waits for queued images and closes the database. False if any image failed
+bool SiftExtractor::finish() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        finishing = true;
+    }
+    queue_changed.notify_all();
+    for (auto & worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    if (database) {
+        sqlite3_close(database);
+        database = nullptr;
+    }
+    return failed == 0;
+}
+
+ulong SiftExtractor::get_images() const {
+    return images;
+}
+
+ulong SiftExtractor::get_keypoints() const {
+    return keypoints;
+}
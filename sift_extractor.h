@@ -0,0 +1,76 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_SIFT_EXTRACTOR_H
+#define RECONSTRUCTION_SIFT_EXTRACTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "utils.h"
+
+struct sqlite3;
+
+// In-process SIFT feature extraction on CPU, overlapped with image processing
+//
+// Every image is submitted as soon as object detection has written it, with its pixels already decoded.
+// Worker threads compute SIFT (OpenCV) and write keypoints and descriptors straight into COLMAP database,
+// so matching starts right after the last image without COLMAP feature_extractor (which needs GPU as it is run).
+// The database is created by COLMAP database_creator (schema of the installed version); images of one size
+// share a SIMPLE_RADIAL camera, as "--ImageReader.single_camera 1" gives, focal length is COLMAP default
+// (1.2 x larger side). Keypoints are x, y, scale and orientation in COLMAP pixel convention, descriptors
+// are RootSIFT bytes as COLMAP stores them. The queue of images is bounded: submit waits while it is full.
+
+class SiftExtractor {
+    fs::path database_path;
+    fs::path database_creator_path;
+    sqlite3 * database = nullptr;
+    std::mutex database_mutex;
+    // Camera of every image size
+    std::map<std::pair<int, int>, long> cameras;
+    ulong threads;
+    int max_features;
+    std::deque<std::pair<std::string, cv::Mat>> queue;
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+    bool finishing = false;
+    std::vector<std::thread> workers;
+    std::atomic<ulong> images{0};
+    std::atomic<ulong> keypoints{0};
+    std::atomic<ulong> failed{0};
+
+    // Thread of the pool: extracts queued images until finish
+    void work();
+
+    bool extract(std::string const & name, cv::Mat const & image);
+
+    // Camera, image, keypoints and descriptors of the image in one transaction
+    bool store(std::string const & name, int const width, int const height, std::vector<float> const & points,
+               std::vector<unsigned char> const & descriptors);
+public:
+    // Threads: 0 - all CPUs but one (image processing goes on meanwhile)
+    SiftExtractor(fs::path const & database, fs::path const & colmap_bin, ulong const threads, int const max_features);
+
+    ~SiftExtractor();
+
+    // New database and worker threads, false if the database can't be created
+    bool start();
+
+    // Image (BGR) is queued for extraction, waits while the queue is full
+    void submit(std::string const & name, cv::Mat const & image);
+
+    // Waits for queued images and closes the database. False if any image failed
+    bool finish();
+
+    ulong get_images() const;
+
+    ulong get_keypoints() const;
+};
+
+#endif //RECONSTRUCTION_SIFT_EXTRACTOR_H
@@ -0,0 +1,144 @@
+//
+// Created by user on 10/18/26.
+//
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <omp.h>
+#include "simplify_mesh.h"
+#include "compact_simplify_mesh.h"
+#include "mesh_deviation.h"
+#include "vertex_clustering.h"
+#include "synthetic_scene.h"
+#include "tracing.h"
+
+// Benchmark and quality harness of mesh simplification, apart from reconstruction.
+//
+// Every mesh (binary PLY files from command line, or generated bumpy icospheres of graded sizes)
+// is simplified by every engine and layout at every target ratio and aggressiveness. For each run
+// wall time, peak memory, reached faces count and deviation from the input (Hausdorff, RMS, mean)
+// are written as JSON, so engines and layouts can be compared between commits.
+//
+// Using: ./SimplifyBenchmark output.json (or - for stdout) [mesh.ply ...]
+
+static double const RATIOS[] = {0.5, 0.1, 0.02};
+static double const AGGRESSIVENESS[] = {5, 7};
+// Subdivision levels of generated icospheres: 20k, 82k, 328k and 1.3M faces
+static int const ICOSPHERE_LEVELS[] = {5, 6, 7, 8};
+
+// CompactMeshSimplify in place on a copy of the mesh, optionally after vertex clustering to 4 x target
+void simplify_compact(Mesh const & input, Mesh & output, ulong const target, double const aggressiveness,
+                      bool const clustering)
+{
+    output.points = input.points;
+    output.faces = input.faces;
+    if (clustering) {
+        VertexClustering pre(target * 4);
+        if (pre.cluster(reinterpret_cast<float const *>(input.points.data()), input.points.size(),
+                        reinterpret_cast<uint32_t const *>(input.faces.data()), input.faces.size())) {
+            output.points.swap(pre.points);
+            output.faces.swap(pre.faces);
+        }
+    }
+    CompactMeshSimplify mesh(0, 0);
+    mesh.attach(output.points.data(), output.points.size(), output.faces.data(), output.faces.size());
+    mesh.simplify_mesh(target, aggressiveness, false);
+    output.points.resize(mesh.points.size());
+    output.faces.resize(mesh.faces.size());
+}
+
+struct Config {
+    char const * name;
+    std::function<void(Mesh const &, Mesh &, ulong, double)> run;
+    // Vertex clustering is only worth it for much larger input than target
+    bool clustering;
+};
+
+int main(int args, char * argv[]) {
+    if (args < 2) {
+        std::cout << "Using example:\n $./SimplifyBenchmark output.json (or - for stdout) "
+                "[binary PLY meshes (optional, default generated icospheres of 20k to 1.3M faces)]" << std::endl;
+        return 0;
+    }
+    std::vector<Mesh> meshes;
+    for (int i = 2; i < args; ++i) {
+        Mesh mesh;
+        if (load_ply(argv[i], mesh)) {
+            meshes.push_back(std::move(mesh));
+        }
+    }
+    if (args == 2) {
+        for (int level : ICOSPHERE_LEVELS) {
+            meshes.push_back(make_icosphere(level));
+        }
+    }
+    std::vector<Config> configs = {
+        {"threshold", [](Mesh const & in, Mesh & out, ulong target, double aggr) {
+            simplify_aos(in, out, target, aggr, MeshSimplify::THRESHOLD, false); }, false},
+        {"queue", [](Mesh const & in, Mesh & out, ulong target, double aggr) {
+            simplify_aos(in, out, target, aggr, MeshSimplify::PRIORITY_QUEUE, false); }, false},
+        {"threshold-parallel", [](Mesh const & in, Mesh & out, ulong target, double aggr) {
+            simplify_aos(in, out, target, aggr, MeshSimplify::THRESHOLD, true); }, false},
+        {"queue-parallel", [](Mesh const & in, Mesh & out, ulong target, double aggr) {
+            simplify_aos(in, out, target, aggr, MeshSimplify::PRIORITY_QUEUE, true); }, false},
+        {"compact", [](Mesh const & in, Mesh & out, ulong target, double aggr) {
+            simplify_compact(in, out, target, aggr, false); }, false},
+        {"clustering-compact", [](Mesh const & in, Mesh & out, ulong target, double aggr) {
+            simplify_compact(in, out, target, aggr, true); }, true},
+    };
+
+    std::string text = "{\n  \"threads\": " + std::to_string(omp_get_max_threads()) + ",\n  \"runs\": [";
+    char buffer[1024];
+    bool first = true;
+    for (auto const & mesh : meshes) {
+        for (double ratio : RATIOS) {
+            ulong target = (ulong)round(mesh.faces.size() * ratio);
+            for (double aggressiveness : AGGRESSIVENESS) {
+                for (auto const & config : configs) {
+                    if (config.clustering && (target * 4 >= mesh.faces.size())) {
+                        continue;
+                    }
+                    Mesh output;
+                    double resident = 0, peak = 0;
+                    // Peak resident memory is reset before every run (Linux 4.0+)
+                    bool peak_reset = reset_peak_memory();
+                    memory_mb(resident, peak);
+                    // Memory of the run is its peak above what the process held before (input mesh, earlier runs)
+                    double resident_before = resident;
+                    auto start = std::chrono::steady_clock::now();
+                    config.run(mesh, output, target, aggressiveness);
+                    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    memory_mb(resident, peak);
+                    MeshDeviation::Report deviation = mesh_deviation(
+                            reinterpret_cast<float const *>(mesh.points.data()), mesh.points.size(),
+                            reinterpret_cast<uint32_t const *>(mesh.faces.data()), mesh.faces.size(),
+                            reinterpret_cast<float const *>(output.points.data()), output.points.size(),
+                            reinterpret_cast<uint32_t const *>(output.faces.data()), output.faces.size());
+                    snprintf(buffer, sizeof(buffer),
+                             "%s\n    {\"mesh\": %s, \"input_faces\": %zu, \"input_vertices\": %zu, "
+                             "\"engine\": \"%s\", \"ratio\": %g, \"aggressiveness\": %g, \"target\": %lu, "
+                             "\"faces\": %zu, \"vertices\": %zu, \"seconds\": %.4f, \"peak_memory_mb\": %.1f, "
+                             "\"peak_memory_exact\": %s, \"hausdorff\": %g, \"rms\": %g, \"mean\": %g}",
+                             first ? "" : ",", json_string(mesh.name).c_str(), mesh.faces.size(),
+                             mesh.points.size(), config.name, ratio, aggressiveness, target, output.faces.size(),
+                             output.points.size(), seconds, peak - resident_before, peak_reset ? "true" : "false",
+                             deviation.hausdorff, deviation.rms, deviation.mean);
+                    text += buffer;
+                    first = false;
+                    fprintf(stderr, "%s %s ratio %g aggressiveness %g: %zu faces, %.3f sec\n", mesh.name.c_str(),
+                            config.name, ratio, aggressiveness, output.faces.size(), seconds);
+                }
+            }
+        }
+    }
+    text += "\n  ]\n}\n";
+
+    if (std::string(argv[1]) == "-") {
+        std::cout << text;
+    } else {
+        std::ofstream(argv[1]) << text;
+    }
+    return 0;
+}
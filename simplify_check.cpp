@@ -0,0 +1,159 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <omp.h>
+#include "simplify_mesh.h"
+#include "mesh_deviation.h"
+#include "synthetic_scene.h"
+
+// Consistency checks of mesh simplification on generated bumpy icospheres, exit code 1 if any of them fails.
+//
+// 1. Batch and scalar edge errors: EdgeErrorBatch gives bit-identical errors to MeshSimplify::edge_error for
+//    the plane quadrics of every edge, also for border edges and singular quadrics (fallback to end points).
+// 2. Threshold and priority queue engines: both reach the target within FACES_TOLERANCE faces, and the
+//    Hausdorff deviation of the queue from the input is within DEVIATION_FACTOR and DEVIATION_MARGIN of the
+//    threshold one.
+// 3. Serial and partitioned decimation (simplify_mesh_parallel) of both engines: the same, with at least
+//    MIN_THREADS threads so that partitions are used on any machine.
+//
+// Using: ./SimplifyCheck (ctest runs it as simplify_check)
+
+// Subdivision levels of the meshes: 82k faces (partitioned decimation falls back to serial) and 328k faces
+static int const ICOSPHERE_LEVELS[] = {6, 7};
+// Partitions are decimated concurrently with at least this many threads, also on a single core
+static int const MIN_THREADS = 4;
+static double const RATIOS[] = {0.1, 0.02};
+static double const AGGRESSIVENESS = 7;
+// Faces count may end below the target: a collapse removes one or two faces
+static long const FACES_TOLERANCE = 2;
+// Hausdorff deviation of an engine may exceed the serial threshold one by this factor of it plus the absolute
+// margin (object radius is about 1)
+static double const DEVIATION_FACTOR = 1.5;
+static double const DEVIATION_MARGIN = 0.002;
+
+// Vertices with plane quadrics of their faces, as update_mesh of MeshSimplify computes them
+static void plane_quadrics(Mesh const & mesh, std::vector<vec3f> & points, std::vector<SymmetricMatrix> & quadrics) {
+    points.clear();
+    for (auto const & p : mesh.points) {
+        points.push_back(vec3f(p.x, p.y, p.z));
+    }
+    quadrics.assign(points.size(), SymmetricMatrix(0.0));
+    for (auto const & f : mesh.faces) {
+        vec3f p0 = points[f.v[0]], n;
+        n.cross(points[f.v[1]] - p0, points[f.v[2]] - p0);
+        n.normalize();
+        SymmetricMatrix q(n.x, n.y, n.z, -n.dot(p0));
+        for (int j = 0; j < 3; ++j) {
+            quadrics[f.v[j]] = quadrics[f.v[j]] + q;
+        }
+    }
+}
+
+// 1. Errors of all edges by batches and one by one. Every 7th edge is border and every 11th has the quadric of
+//    a single plane (det = 0 up to rounding), so the fallback of end points and middle is taken too
+static bool check_edge_errors(Mesh const & mesh) {
+    std::vector<vec3f> points;
+    std::vector<SymmetricMatrix> quadrics;
+    plane_quadrics(mesh, points, quadrics);
+    EdgeErrorBatch batch;
+    std::vector<double> scalar;
+    ulong edges = 0, mismatches = 0, fallbacks = 0;
+    auto compare = [&]() {
+        batch.evaluate();
+        for (int i = 0; i < batch.size(); ++i) {
+            if (memcmp(&batch.error[i], &scalar[i], sizeof(double)) != 0) {
+                if (mismatches == 0) {
+                    printf("  edge error mismatch: batch %.17g, scalar %.17g\n", batch.error[i], scalar[i]);
+                }
+                ++mismatches;
+            }
+        }
+        edges += batch.size();
+        batch.clear();
+        scalar.clear();
+    };
+    for (auto const & f : mesh.faces) {
+        for (int j = 0; j < 3; ++j) {
+            uint32_t v1 = f.v[j], v2 = f.v[(j + 1) % 3];
+            bool border = (edges + scalar.size()) % 7 == 0;
+            bool singular = (edges + scalar.size()) % 11 == 0;
+            vec3f p0 = points[f.v[0]], n;
+            n.cross(points[f.v[1]] - p0, points[f.v[2]] - p0);
+            n.normalize();
+            SymmetricMatrix plane(n.x, n.y, n.z, -n.dot(p0));
+            SymmetricMatrix q1 = singular ? plane : quadrics[v1];
+            SymmetricMatrix q2 = singular ? plane : quadrics[v2];
+            vec3f p;
+            scalar.push_back(MeshSimplify::edge_error(q1 + q2, points[v1], points[v2], border, p));
+            batch.add(q1, q2, points[v1], points[v2], border);
+            fallbacks += border || singular;
+            if (batch.full()) {
+                compare();
+            }
+        }
+    }
+    compare();
+    printf("%s: %lu edges (%lu border or single plane), %lu batch errors differ from scalar ones\n",
+           mesh.name.c_str(), edges, fallbacks, mismatches);
+    return mismatches == 0;
+}
+
+// Hausdorff deviation of the simplified mesh from the input
+static double hausdorff(Mesh const & input, Mesh const & output) {
+    return mesh_deviation(reinterpret_cast<float const *>(input.points.data()), input.points.size(),
+                          reinterpret_cast<uint32_t const *>(input.faces.data()), input.faces.size(),
+                          reinterpret_cast<float const *>(output.points.data()), output.points.size(),
+                          reinterpret_cast<uint32_t const *>(output.faces.data()), output.faces.size()).hausdorff;
+}
+
+// 2, 3. Every engine and mode against serial threshold engine
+static bool check_engines(Mesh const & mesh, double const ratio) {
+    struct Run {
+        char const * name;
+        MeshSimplify::Engine engine;
+        bool parallel;
+    };
+    Run const runs[] = {{"threshold", MeshSimplify::THRESHOLD, false},
+                        {"queue", MeshSimplify::PRIORITY_QUEUE, false},
+                        {"threshold-parallel", MeshSimplify::THRESHOLD, true},
+                        {"queue-parallel", MeshSimplify::PRIORITY_QUEUE, true}};
+    ulong target = (ulong)round(mesh.faces.size() * ratio);
+    double reference = 0;
+    bool passed = true;
+    for (auto const & run : runs) {
+        Mesh output;
+        simplify_aos(mesh, output, target, AGGRESSIVENESS, run.engine, run.parallel);
+        double deviation = hausdorff(mesh, output);
+        if (&run == runs) {
+            reference = deviation;
+        }
+        long missed = (long)target - (long)output.faces.size();
+        bool faces_ok = (missed >= 0) && (missed <= FACES_TOLERANCE);
+        bool deviation_ok = deviation <= reference * DEVIATION_FACTOR + DEVIATION_MARGIN;
+        printf("%s ratio %g %-18s: %zu faces (target %lu), Hausdorff %.5f%s%s\n", mesh.name.c_str(), ratio,
+               run.name, output.faces.size(), target, deviation, faces_ok ? "" : " FACES MISMATCH",
+               deviation_ok ? "" : " DEVIATION ABOVE TOLERANCE");
+        passed = passed && faces_ok && deviation_ok;
+    }
+    return passed;
+}
+
+int main() {
+    omp_set_num_threads(std::max(MIN_THREADS, omp_get_max_threads()));
+    printf("Threads: %d\n", omp_get_max_threads());
+    bool passed = true;
+    for (int level : ICOSPHERE_LEVELS) {
+        Mesh mesh = make_icosphere(level);
+        passed = check_edge_errors(mesh) && passed;
+        for (double ratio : RATIOS) {
+            passed = check_engines(mesh, ratio) && passed;
+        }
+    }
+    printf("%s\n", passed ? "All checks passed" : "Checks FAILED");
+    return passed ? 0 : 1;
+}
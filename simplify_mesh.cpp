@@ -14,6 +14,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <unordered_map>
+#include <omp.h>
 //#include <float.h> //FLT_EPSILON, DBL_EPSILON
 
 #include "simplify_mesh.h"
@@ -25,6 +28,14 @@
 //                 5..8 are good numbers
 //                 more iterations yield higher quality
 void MeshSimplify::simplify_mesh(ulong const target_count, double const agressiveness = 7, bool const verbose = false) {
+    run_engine(target_count, agressiveness, verbose);
+
+    // clean up mesh
+    compact_mesh();
+}
+
+// Decimation by the selected engine, deleted triangles stay in arrays
+void MeshSimplify::run_engine(ulong const target_count, double const agressiveness, bool const verbose) {
     // init
     for (int i = 0; i < triangles.size(); ++i) {
         triangles[i].deleted = 0;
@@ -32,10 +43,224 @@ void MeshSimplify::simplify_mesh(ulong const target_count, double const agressiv
 
     // main iteration loop
     int deleted_triangles = 0;
+    heap.clear();
+    stamps.clear();
+    if (engine == PRIORITY_QUEUE) {
+        decimate_queue(target_count, verbose, deleted_triangles);
+    } else {
+        decimate(target_count, agressiveness, verbose, 0, deleted_triangles);
+    }
+    heap = std::vector<Collapse>();
+    stamps = std::vector<unsigned>();
+}
+
+// Parallel simplification
+//
+// Mesh is cut into a grid of partitions by triangle centroids. Partitions are decimated concurrently
+// with proportional share of the target, vertices shared by several partitions are locked.
+// Second pass uses the grid shifted by half a cell, so former partition borders are simplified too.
+// The last serial pass reaches target exactly and simplifies corners where partitions meet.
+void MeshSimplify::simplify_mesh_parallel(ulong const target_count, double const agressiveness, bool const verbose) {
+    int threads = omp_get_max_threads();
+    if ((threads > 1) && (triangles.size() > 100000) && (target_count < triangles.size())) {
+        // Several partitions per thread to balance the load
+        int grid = std::max(2, (int)ceil(cbrt(4.0 * threads)));
+        // First pass leaves room for the shifted one, partitions of the second one stop slightly above target
+        ulong targets[2] = {target_count + (triangles.size() - target_count) / 8, target_count + target_count / 50};
+        for (int pass = 0; pass < 2; ++pass) {
+            decimate_partitions(targets[pass], agressiveness, grid, pass == 1);
+            if (verbose) {
+                printf("partition pass %d - triangles %zu (%d threads)\n", pass, triangles.size(), threads);
+            }
+        }
+        for (int i = 0; i < vertices.size(); ++i) {
+            vertices[i].locked = 0;
+        }
+    }
+    simplify_mesh(target_count, agressiveness, verbose);
+}
+
+// One pass of partitioned decimation. Shifted grid has one more cell per axis
+void MeshSimplify::decimate_partitions(ulong const target_count, double const agressiveness,
+                                       int const grid, bool const shifted)
+{
+    // Grid over bounding box
+    vec3f min(1e300, 1e300, 1e300), max(-1e300, -1e300, -1e300);
+    for (int i = 0; i < vertices.size(); ++i) {
+        vec3f const & p = vertices[i].p;
+        min = vec3f(fmin(min.x, p.x), fmin(min.y, p.y), fmin(min.z, p.z));
+        max = vec3f(fmax(max.x, p.x), fmax(max.y, p.y), fmax(max.z, p.z));
+    }
+    vec3f cell = (max - min) / grid;
+    cell = vec3f(fmax(cell.x, 1e-12), fmax(cell.y, 1e-12), fmax(cell.z, 1e-12));
+    vec3f offset = shifted ? cell * 0.5 : vec3f(0, 0, 0);
+    int cells = grid + (shifted ? 1 : 0);
+    auto axis = [cells](double const x) {
+        return std::min(cells - 1, std::max(0, (int)floor(x)));
+    };
+
+    // Triangles of every partition. Vertex used by several partitions is locked
+    std::vector<std::vector<ulong>> partitions(cells * cells * cells);
+    std::vector<int> vertex_partition(vertices.size(), -1);
+    std::vector<char> locked(vertices.size(), 0);
+    for (ulong i = 0; i < triangles.size(); ++i) {
+        Triangle const & t = triangles[i];
+        vec3f c = (vertices[t.v[0]].p + vertices[t.v[1]].p + vertices[t.v[2]].p) / 3.0;
+        vec3f g = (c - min + offset) / cell;
+        int id = (axis(g.z) * cells + axis(g.y)) * cells + axis(g.x);
+        partitions[id].push_back(i);
+        for (int j = 0; j < 3; ++j) {
+            int & owner = vertex_partition[t.v[j]];
+            if (owner < 0) {
+                owner = id;
+            } else if (owner != id) {
+                locked[t.v[j]] = 1;
+            }
+        }
+    }
+
+    // Partitions are decimated concurrently. Every one writes positions of its own unlocked vertices only
+    double ratio = (double)target_count / triangles.size();
+    std::vector<std::vector<Triangle>> results(partitions.size());
+    std::vector<std::vector<UV>> results_uvs(partitions.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < (int)partitions.size(); ++c) {
+        std::vector<ulong> const & partition = partitions[c];
+        if (partition.empty()) {
+            continue;
+        }
+        MeshSimplify sub(partition.size(), partition.size());
+        sub.engine = engine;
+        sub.texcoords = texcoords;
+        sub.max_error = max_error;
+        std::unordered_map<ulong, ulong> local;
+        std::vector<ulong> global;
+        for (auto id : partition) {
+            Triangle t = triangles[id];
+            for (int j = 0; j < 3; ++j) {
+                auto it = local.find(t.v[j]);
+                if (it == local.end()) {
+                    it = local.insert(std::make_pair(t.v[j], (ulong)global.size())).first;
+                    global.push_back(t.v[j]);
+                    Vertex v;
+                    v.p = vertices[t.v[j]].p;
+                    v.locked = locked[t.v[j]];
+                    sub.vertices.push_back(v);
+                }
+                t.v[j] = it->second;
+            }
+            sub.triangles.push_back(t);
+            if (texcoords) {
+                sub.uvs.insert(sub.uvs.end(), uvs.begin() + 3 * id, uvs.begin() + 3 * id + 3);
+            }
+        }
+        sub.run_engine((ulong)round(partition.size() * ratio), agressiveness, false);
+
+        std::vector<Vertex> sub_vertices;
+        std::vector<ulong> origin;
+        sub.snapshot(sub_vertices, results[c], results_uvs[c], &origin);
+        for (ulong i = 0; i < sub_vertices.size(); ++i) {
+            ulong id = global[origin[i]];
+            if (!locked[id]) {
+                vertices[id].p = sub_vertices[i].p;
+            }
+        }
+        for (auto & t : results[c]) {
+            for (int j = 0; j < 3; ++j) {
+                t.v[j] = global[origin[t.v[j]]];
+            }
+        }
+    }
+
+    // Stitch partitions back, vertices keep their global indices
+    ulong count = 0;
+    for (auto const & result : results) {
+        count += result.size();
+    }
+    std::vector<Triangle> stitched;
+    stitched.reserve(count);
+    for (auto & result : results) {
+        stitched.insert(stitched.end(), result.begin(), result.end());
+        result = std::vector<Triangle>();
+    }
+    triangles.swap(stitched);
+    if (texcoords) {
+        std::vector<UV> stitched_uvs;
+        stitched_uvs.reserve(count * 3);
+        for (auto & result : results_uvs) {
+            stitched_uvs.insert(stitched_uvs.end(), result.begin(), result.end());
+            result = std::vector<UV>();
+        }
+        uvs.swap(stitched_uvs);
+    }
+    for (int i = 0; i < vertices.size(); ++i) {
+        vertices[i].locked = locked[i];
+    }
+}
+
+// Progressive simplification: one decimation pass, snapshot at every target
+//
+// target_counts : target nr. of triangles for every level of detail (any order)
+// agressiveness : the same as for simplify_mesh(...)
+// on_level      : receives index of level in target_counts and compacted copy of mesh
+void MeshSimplify::simplify_mesh_lod(std::vector<ulong> const & target_counts, double const agressiveness,
+                                     bool const verbose, LevelCallback const & on_level)
+{
+    // init
+    for (int i = 0; i < triangles.size(); ++i) {
+        triangles[i].deleted = 0;
+    }
+
+    // Visit levels from the finest to the coarsest one
+    std::vector<ulong> order(target_counts.size());
+    for (ulong i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&target_counts](ulong a, ulong b) {
+        return target_counts[a] > target_counts[b];
+    });
+
+    // Every level continues decimation from the previous one
+    int deleted_triangles = 0;
+    int iteration = 0;
+    std::vector<Vertex> level_vertices;
+    std::vector<Triangle> level_triangles;
+    std::vector<UV> level_uvs;
+    heap.clear();
+    stamps.clear();
+    for (auto level : order) {
+        if (engine == PRIORITY_QUEUE) {
+            decimate_queue(target_counts[level], verbose, deleted_triangles);
+        } else {
+            iteration = decimate(target_counts[level], agressiveness, verbose, iteration, deleted_triangles);
+        }
+        snapshot(level_vertices, level_triangles, level_uvs);
+        on_level(level, level_vertices, level_triangles, level_uvs);
+    }
+    heap = std::vector<Collapse>();
+    stamps = std::vector<unsigned>();
+
+    // clean up mesh
+    compact_mesh();
+}
+
+// Threshold driven decimation loop. Starts from first_iteration and returns the next one
+int MeshSimplify::decimate(ulong const target_count, double const agressiveness, bool const verbose,
+                           int const first_iteration, int & deleted_triangles)
+{
     std::vector<int> deleted0, deleted1;
-    unsigned long triangle_count = triangles.size();
+    // Initial count: alive triangles plus the ones deleted by previous calls
+    unsigned long triangle_count = deleted_triangles;
+    for (int i = 0; i < triangles.size(); ++i) {
+        if (!triangles[i].deleted) {
+            ++triangle_count;
+        }
+    }
 
-    for (int iteration = 0; iteration < 100; ++iteration) {
+    int iteration = first_iteration;
+    // triangles deleted by the previous iteration
+    int iteration_deleted = 1;
+    for (; iteration < 100; ++iteration) {
         if (triangle_count - deleted_triangles <= target_count) {
             break;
         }
@@ -53,6 +278,14 @@ void MeshSimplify::simplify_mesh(ulong const target_count, double const agressiv
         // The following numbers works well for most models.
         // If it does not, try to adjust the 3 parameters
         double threshold = 0.000000001 * pow(double(iteration + 3), agressiveness);
+        // error bound reached and nothing is collapsed below it anymore ? Then break
+        if ((max_error > 0) && (threshold >= max_error * max_error)) {
+            if (iteration_deleted == 0) {
+                break;
+            }
+            threshold = max_error * max_error;
+        }
+        iteration_deleted = 0;
         // target number of triangles reached ? Then break
         if ((verbose) && (iteration % 5 == 0)) {
             printf("iteration %d - triangles %lu threshold %g\n", iteration, triangle_count - deleted_triangles, threshold);
@@ -83,48 +316,195 @@ void MeshSimplify::simplify_mesh(ulong const target_count, double const agressiv
                     // Compute vertex to collapse to
                     vec3f p;
                     calculate_error(i0, i1, p);
-                    deleted0.resize(v0.tcount); // normals temporarily
-                    deleted1.resize(v1.tcount); // normals temporarily
-
-                    // don't remove if flipped
-                    if (flipped(p, i1, v0, v1, deleted0)) {
-                        continue;
-                    }
-                    if (flipped(p, i0, v1, v0, deleted1)) {
+                    int deleted_before = deleted_triangles;
+                    if (!try_collapse(i0, i1, p, 3, deleted0, deleted1, deleted_triangles)) {
                         continue;
                     }
+                    iteration_deleted += deleted_triangles - deleted_before;
+                    break;
+                }
+            }
+            // done?
+            if (triangle_count - deleted_triangles <= target_count) {
+                break;
+            }
+        }
+    }
+    return iteration;
+}
+
+// Collapse edge (i0, i1) to p if no triangle flips and at most max_removed triangles are removed
+bool MeshSimplify::try_collapse(int const i0, int const i1, vec3f const & p, int const max_removed,
+                                std::vector<int> & deleted0, std::vector<int> & deleted1, int & deleted_triangles)
+{
+    Vertex & v0 = vertices[i0];
+    Vertex & v1 = vertices[i1];
+    // locked vertices are shared with other partitions
+    if (v0.locked || v1.locked) {
+        return false;
+    }
+    deleted0.resize(v0.tcount); // normals temporarily
+    deleted1.resize(v1.tcount); // normals temporarily
+
+    // don't remove if flipped
+    if (flipped(p, i1, v0, v1, deleted0)) {
+        return false;
+    }
+    if (flipped(p, i0, v1, v0, deleted1)) {
+        return false;
+    }
+    // triangles of the edge are removed
+    if (max_removed < 3) {
+        int removed = 0;
+        for (int k = 0; k < v0.tcount; ++k) {
+            if (deleted0[k] && !triangles[refs[v0.tstart + k].tid].deleted) {
+                ++removed;
+            }
+        }
+        if (removed > max_removed) {
+            return false;
+        }
+    }
 
-                    // not flipped, so remove edge
-                    v0.p = p;
-                    v0.q = v1.q + v0.q;
-                    unsigned long tstart = refs.size();
+    // interpolate texture coordinates while corners are at their old positions
+    if (texcoords) {
+        update_texcoords(v0, v1, p, deleted0, deleted1);
+    }
 
-                    update_triangles(i0, v0, deleted0, deleted_triangles);
-                    update_triangles(i0, v1, deleted1, deleted_triangles);
+    // not flipped, so remove edge
+    v0.p = p;
+    v0.q = v1.q + v0.q;
+    unsigned long tstart = refs.size();
 
-                    unsigned long tcount = refs.size() - tstart;
+    update_triangles(i0, v0, deleted0, deleted_triangles);
+    update_triangles(i0, v1, deleted1, deleted_triangles);
 
-                    if (tcount <= v0.tcount) {
-                        // save ram
-                        if (tcount) {//
-                            memcpy(&refs[v0.tstart], &refs[tstart], tcount * sizeof(Ref));
-                        }
-                    } else {
-                        // append
-                        v0.tstart = tstart;
-                    }
-                    v0.tcount = tcount;
+    unsigned long tcount = refs.size() - tstart;
+
+    if (tcount <= v0.tcount) {
+        // save ram
+        if (tcount) {//
+            memcpy(&refs[v0.tstart], &refs[tstart], tcount * sizeof(Ref));
+        }
+    } else {
+        // append
+        v0.tstart = tstart;
+    }
+    v0.tcount = tcount;
+    return true;
+}
+
+// Edge collapse candidate from vertex i0 to i1 with its current error
+void MeshSimplify::push_collapse(int const i0, int const i1, double const error) {
+    Collapse c;
+    c.error = error;
+    c.v0 = i0;
+    c.v1 = i1;
+    c.stamp = stamps[i0] + stamps[i1];
+    heap.push_back(c);
+    std::push_heap(heap.begin(), heap.end());
+}
+
+// Queue all edges of alive triangles. Edge errors of triangles are always up to date
+void MeshSimplify::build_queue() {
+    heap.clear();
+    stamps.resize(vertices.size(), 0);
+    for (int i = 0; i < triangles.size(); ++i) {
+        Triangle & t = triangles[i];
+        if (t.deleted) {
+            continue;
+        }
+        for (int j = 0; j < 3; ++j) {
+            // Interior edge is shared by two triangles: queue it once. Border edges are unique
+            if ((t.v[j] > t.v[(j + 1) % 3]) && !(vertices[t.v[j]].border && vertices[t.v[(j + 1) % 3]].border)) {
+                continue;
+            }
+            Collapse c;
+            c.error = t.err[j];
+            c.v0 = t.v[j];
+            c.v1 = t.v[(j + 1) % 3];
+            c.stamp = stamps[c.v0] + stamps[c.v1];
+            heap.push_back(c);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end());
+}
+
+// Priority queue driven decimation: the cheapest edge is collapsed first.
+// Queue entries are invalidated lazily: collapse changes stamps of both its vertices.
+// Rejected (flipped) edges are queued again when queue runs out, as long as it gives new collapses.
+void MeshSimplify::decimate_queue(ulong const target_count, bool const verbose, int & deleted_triangles) {
+    std::vector<int> deleted0, deleted1;
+    unsigned long triangle_count = deleted_triangles;
+    for (int i = 0; i < triangles.size(); ++i) {
+        if (!triangles[i].deleted) {
+            ++triangle_count;
+        }
+    }
+    if (stamps.empty()) {
+        update_mesh(0);
+        build_queue();
+    }
+
+    ulong collapses = 0;
+    bool collapsed_since_build = true;
+    // Interior collapse removes 2 triangles. If only such ones are left, target may be passed by one
+    int slack = 0;
+    while (triangle_count - deleted_triangles > target_count) {
+        if (heap.empty()) {
+            if (!collapsed_since_build) {
+                if (slack) {
                     break;
                 }
+                slack = 1;
             }
-            // done?
-            if (triangle_count - deleted_triangles <= target_count) {
-                break;
+            // Compact triangles and references, then queue all edges again
+            update_mesh(1);
+            build_queue();
+            collapsed_since_build = false;
+            continue;
+        }
+        std::pop_heap(heap.begin(), heap.end());
+        Collapse c = heap.back();
+        heap.pop_back();
+        if (stamps[c.v0] + stamps[c.v1] != c.stamp) {
+            continue;
+        }
+        // the cheapest collapse is above the error bound
+        if ((max_error > 0) && (c.error > max_error * max_error)) {
+            break;
+        }
+        if (vertices[c.v0].border != vertices[c.v1].border) {
+            continue;
+        }
+        vec3f p;
+        calculate_error(c.v0, c.v1, p);
+        int max_removed = int(triangle_count - deleted_triangles - target_count) + slack;
+        if (!try_collapse(c.v0, c.v1, p, max_removed, deleted0, deleted1, deleted_triangles)) {
+            continue;
+        }
+        ++stamps[c.v0];
+        ++stamps[c.v1];
+        collapsed_since_build = true;
+
+        // Edges around the surviving vertex have new errors
+        Vertex & v0 = vertices[c.v0];
+        for (int k = 0; k < v0.tcount; ++k) {
+            Ref & r = refs[v0.tstart + k];
+            Triangle & t = triangles[r.tid];
+            if (t.deleted) {
+                continue;
             }
+            // Every neighbour of closed fan follows the vertex in exactly one triangle
+            push_collapse(c.v0, t.v[(r.tvertex + 1) % 3], t.err[r.tvertex]);
+            if (v0.border) {
+                push_collapse(t.v[(r.tvertex + 2) % 3], c.v0, t.err[(r.tvertex + 2) % 3]);
+            }
+        }
+        if (verbose && (++collapses % 100000 == 0)) {
+            printf("collapses %lu - triangles %lu queue %zu\n", collapses, triangle_count - deleted_triangles, heap.size());
         }
     }
-    // clean up mesh
-    compact_mesh();
 }
 
 // Check if a triangle flips when this edge is removed
@@ -166,7 +546,9 @@ bool MeshSimplify::flipped(vec3f const & p, int const i1, Vertex const & v0, Ver
 
 // Update triangle connections and edge error after a edge is collapsed
 void MeshSimplify::update_triangles(int const i0, Vertex const & v, std::vector<int> const & deleted, int & deleted_triangles) {
-    vec3f p;
+    // Edges of updated triangles are evaluated together, quadrics don't change meanwhile
+    std::vector<ulong> & updated = updated_triangles;
+    updated.clear();
     for (int k = 0; k < v.tcount; ++k) {
         Ref & r = refs[v.tstart + k];
         Triangle & t = triangles[r.tid];
@@ -180,82 +562,130 @@ void MeshSimplify::update_triangles(int const i0, Vertex const & v, std::vector<
         }
         t.v[r.tvertex] = i0;
         t.dirty = 1;
-        t.err[0] = calculate_error(t.v[0], t.v[1], p);
-        t.err[1] = calculate_error(t.v[1], t.v[2], p);
-        t.err[2] = calculate_error(t.v[2], t.v[0], p);
-        t.err[3] = fmin(t.err[0], fmin(t.err[1], t.err[2]));
+        updated.push_back(r.tid);
         refs.push_back(r);
     }
+    for (ulong first = 0; first < updated.size(); first += EdgeErrorBatch::SIZE / 3) {
+        ulong last = std::min<ulong>(first + EdgeErrorBatch::SIZE / 3, updated.size());
+        edge_batch.clear();
+        for (ulong i = first; i < last; ++i) {
+            add_edges(edge_batch, triangles[updated[i]]);
+        }
+        edge_batch.evaluate();
+        for (ulong i = first; i < last; ++i) {
+            set_edge_errors(triangles[updated[i]], edge_batch, 3 * (i - first));
+        }
+    }
 }
 
-// compact triangles, compute edge error and build reference list
-void MeshSimplify::update_mesh(int const iteration) {
-    if (iteration > 0) { // compact triangles
-        int dst = 0;
+// Three edges of triangle to the batch
+void MeshSimplify::add_edges(EdgeErrorBatch & batch, Triangle const & t) const {
+    for (int j = 0; j < 3; ++j) {
+        Vertex const & v1 = vertices[t.v[j]];
+        Vertex const & v2 = vertices[t.v[(j + 1) % 3]];
+        batch.add(v1.q, v2.q, v1.p, v2.p, v1.border & v2.border);
+    }
+}
 
-        for (int i = 0; i < triangles.size(); ++i) {
-            if (!triangles[i].deleted) {
-                triangles[dst++] = triangles[i];
-            }
-        }
-        triangles.resize(dst);
+// Errors of triangle edges added to the batch at first
+void MeshSimplify::set_edge_errors(Triangle & t, EdgeErrorBatch const & batch, int const first) {
+    for (int j = 0; j < 3; ++j) {
+        t.err[j] = batch.error[first + j];
     }
-    //
-    // Init Quadrics by Plane & Edge Errors
-    //
-    // required at the beginning ( iteration == 0 )
-    // recomputing during the simplification is not required,
-    // but mostly improves the result for closed meshes
-    //
-    if (iteration == 0) {
-        for (int i = 0; i < vertices.size(); ++i) {
-            vertices[i].q = SymmetricMatrix(0.0);
-        }
+    t.err[3] = fmin(t.err[0], fmin(t.err[1], t.err[2]));
+}
 
-        for (int i = 0; i < triangles.size(); ++i) {
-            Triangle & t = triangles[i];
-            vec3f n, p[3];
+// Texture coordinates at barycentric coordinates w of triangle with corners uv
+static MeshSimplify::UV interpolate(MeshSimplify::UV const * uv, vec3f const & w) {
+    MeshSimplify::UV result;
+    result.u = float(uv[0].u * w.x + uv[1].u * w.y + uv[2].u * w.z);
+    result.v = float(uv[0].v * w.x + uv[1].v * w.y + uv[2].v * w.z);
+    return result;
+}
 
-            for (int j = 0; j < 3; ++j) {
-                p[j] = vertices[t.v[j]].p;
+// Texture coordinates of the collapsed corners at new position p.
+// Inside a chart texture coordinates are continuous: p is evaluated once in the triangle around the edge
+// which contains it best. On texture seams (border) every triangle interpolates its own corner.
+void MeshSimplify::update_texcoords(Vertex const & v0, Vertex const & v1, vec3f const & p,
+                                    std::vector<int> const & deleted0, std::vector<int> const & deleted1)
+{
+    UV uv_p;
+    if (!v0.border) {
+        double best = -1;
+        for (int side = 0; side < 2; ++side) {
+            Vertex const & v = side ? v1 : v0;
+            for (int k = 0; k < v.tcount; ++k) {
+                Triangle const & t = triangles[refs[v.tstart + k].tid];
+                if (t.deleted) {
+                    continue;
+                }
+                vec3f const & a = vertices[t.v[0]].p, & b = vertices[t.v[1]].p, & c = vertices[t.v[2]].p;
+                vec3f w = barycentric(p, a, b, c);
+                vec3f d = a * w.x + b * w.y + c * w.z - p;
+                if ((best < 0) || (d.dot(d) < best)) {
+                    best = d.dot(d);
+                    uv_p = interpolate(&uvs[3 * refs[v.tstart + k].tid], w);
+                }
             }
-
-            n.cross(p[1] - p[0], p[2] - p[0]);
-            n.normalize();
-            t.n = n;
-
-            for (int j = 0; j < 3; ++j) {
-                vertices[t.v[j]].q += SymmetricMatrix(n.x, n.y, n.z, -n.dot(p[0]));
+        }
+    }
+    for (int side = 0; side < 2; ++side) {
+        Vertex const & v = side ? v1 : v0;
+        std::vector<int> const & deleted = side ? deleted1 : deleted0;
+        for (int k = 0; k < v.tcount; ++k) {
+            Ref & r = refs[v.tstart + k];
+            Triangle & t = triangles[r.tid];
+            if (t.deleted || deleted[k]) {
+                continue;
+            }
+            if (v0.border) {
+                vec3f w = barycentric(p, vertices[t.v[0]].p, vertices[t.v[1]].p, vertices[t.v[2]].p);
+                uvs[3 * r.tid + r.tvertex] = interpolate(&uvs[3 * r.tid], w);
+            } else {
+                uvs[3 * r.tid + r.tvertex] = uv_p;
             }
         }
+    }
+}
 
-        for (int i = 0; i < triangles.size(); ++i) {
-            // Calc Edge Error
-            Triangle & t = triangles[i];
-            vec3f p;
+// compact triangles, compute edge error and build reference list.
+// Passes are parallel: over triangles when they write triangles, over vertices when they write vertices
+void MeshSimplify::update_mesh(int const iteration) {
+    if (iteration > 0) { // compact triangles
+        int dst = 0;
 
-            for (int j = 0; j < 3; ++j) {
-                t.err[j] = calculate_error(t.v[j], t.v[(j + 1) % 3], p);
+        for (int i = 0; i < triangles.size(); ++i) {
+            if (!triangles[i].deleted) {
+                if (texcoords) {
+                    std::copy(uvs.begin() + 3 * i, uvs.begin() + 3 * i + 3, uvs.begin() + 3 * dst);
+                }
+                triangles[dst++] = triangles[i];
             }
-            t.err[3] = fmin(t.err[0], fmin(t.err[1], t.err[2]));
         }
+        triangles.resize(dst);
+        uvs.resize(texcoords ? 3 * dst : 0);
     }
-
-    // Init Reference ID list
-    for (int i = 0; i < vertices.size(); ++i) {
-        vertices[i].tstart  =0;
+    int const t_count = triangles.size();
+    int const v_count = vertices.size();
+
+    // Init Reference ID list: corners are counted and scattered to ranges of their vertices,
+    // then every range is sorted by triangle, so the order doesn't depend on threads
+    #pragma omp parallel for
+    for (int i = 0; i < v_count; ++i) {
+        vertices[i].tstart = 0;
         vertices[i].tcount = 0;
     }
-    for (int i = 0; i < triangles.size(); ++i) {
-        Triangle & t = triangles[i];
+    #pragma omp parallel for
+    for (int i = 0; i < t_count; ++i) {
         for (int j = 0; j < 3; ++j) {
-            ++vertices[t.v[j]].tcount;
+            #pragma omp atomic
+            ++vertices[triangles[i].v[j]].tcount;
         }
     }
 
     ulong tstart = 0;
 
-    for (int i = 0; i < vertices.size(); ++i) {
+    for (int i = 0; i < v_count; ++i) {
         Vertex & v = vertices[i];
         v.tstart = tstart;
         tstart += v.tcount;
@@ -264,52 +694,164 @@ void MeshSimplify::update_mesh(int const iteration) {
 
     // Write References
     refs.resize(triangles.size() * 3);
-    for (int i = 0; i < triangles.size(); ++i) {
-        Triangle & t = triangles[i];
+    #pragma omp parallel for
+    for (int i = 0; i < t_count; ++i) {
         for (int j = 0; j < 3; ++j) {
-            Vertex & v = vertices[t.v[j]];
-            refs[v.tstart + v.tcount].tid = i;
-            refs[v.tstart + v.tcount].tvertex = j;
-            ++v.tcount;
+            Vertex & v = vertices[triangles[i].v[j]];
+            ulong slot;
+            #pragma omp atomic capture
+            slot = v.tcount++;
+            refs[v.tstart + slot].tid = i;
+            refs[v.tstart + slot].tvertex = j;
         }
     }
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for (int i = 0; i < v_count; ++i) {
+        Vertex const & v = vertices[i];
+        std::sort(refs.begin() + v.tstart, refs.begin() + v.tstart + v.tcount, [](Ref const & a, Ref const & b) {
+            return (a.tid < b.tid) || ((a.tid == b.tid) && (a.tvertex < b.tvertex));
+        });
+    }
 
-    // Identify boundary : vertices[].border=0,1
+    //
+    // Init Quadrics by Plane & Edge Errors
+    //
+    // required at the beginning ( iteration == 0 )
+    // recomputing during the simplification is not required,
+    // but mostly improves the result for closed meshes
+    //
     if (iteration == 0) {
-        std::vector<int> vcount, vids;
+        #pragma omp parallel for
+        for (int i = 0; i < t_count; ++i) {
+            Triangle & t = triangles[i];
+            vec3f n;
+            n.cross(vertices[t.v[1]].p - vertices[t.v[0]].p, vertices[t.v[2]].p - vertices[t.v[0]].p);
+            n.normalize();
+            t.n = n;
+        }
 
-        for (int i = 0; i < vertices.size(); ++i) {
+        // Quadric of vertex is the sum of planes of its triangles, in order of triangles
+        #pragma omp parallel for schedule(dynamic, 4096)
+        for (int i = 0; i < v_count; ++i) {
+            Vertex & v = vertices[i];
+            v.q = SymmetricMatrix(0.0);
+            for (int k = 0; k < v.tcount; ++k) {
+                Triangle const & t = triangles[refs[v.tstart + k].tid];
+                v.q += SymmetricMatrix(t.n.x, t.n.y, t.n.z, -t.n.dot(vertices[t.v[0]].p));
+            }
+        }
+
+        // Calc Edge Error, by batches of triangles
+        int const batch_triangles = EdgeErrorBatch::SIZE / 3;
+        #pragma omp parallel
+        {
+            EdgeErrorBatch batch;
+            #pragma omp for
+            for (int first = 0; first < t_count; first += batch_triangles) {
+                int last = std::min(first + batch_triangles, t_count);
+                batch.clear();
+                for (int i = first; i < last; ++i) {
+                    add_edges(batch, triangles[i]);
+                }
+                batch.evaluate();
+                for (int i = first; i < last; ++i) {
+                    set_edge_errors(triangles[i], batch, 3 * (i - first));
+                }
+            }
+        }
+    }
+
+    // Identify boundary : vertices[].border=0,1
+    if (iteration == 0) {
+        #pragma omp parallel for
+        for (int i = 0; i < v_count; ++i) {
             vertices[i].border = 0;
         }
 
-        for (int i = 0; i < vertices.size(); ++i) {
-            Vertex & v = vertices[i];
-            vcount.clear();
-            vids.clear();
-            for (int j = 0; j < v.tcount; ++j) {
-                int k = refs[v.tstart + j].tid;
-                Triangle & t = triangles[k];
-                for (int k = 0; k < 3; ++k) {
-                    int ofs = 0,id = t.v[k];
-                    while (ofs < vcount.size()) {
-                        if (vids[ofs] == id) {
-                            break;
+        // Edge of only one triangle is border, both its vertices are marked.
+        // Edge is counted once, by its smaller vertex: neighbours of the fan are sorted and equal ones counted
+        #pragma omp parallel
+        {
+            std::vector<ulong> neighbours;
+            #pragma omp for schedule(dynamic, 4096)
+            for (int i = 0; i < v_count; ++i) {
+                Vertex const & v = vertices[i];
+                neighbours.clear();
+                for (int k = 0; k < v.tcount; ++k) {
+                    Ref const & r = refs[v.tstart + k];
+                    Triangle const & t = triangles[r.tid];
+                    for (int j = 1; j < 3; ++j) {
+                        ulong id = t.v[(r.tvertex + j) % 3];
+                        if (id > i) {
+                            neighbours.push_back(id);
                         }
-                        ++ofs;
                     }
-                    if (ofs == vcount.size()) {
-                        vcount.push_back(1);
-                        vids.push_back(id);
-                    } else {
-                        ++vcount[ofs];
+                }
+                std::sort(neighbours.begin(), neighbours.end());
+                for (ulong j = 0; j < neighbours.size();) {
+                    ulong next = j + 1;
+                    while ((next < neighbours.size()) && (neighbours[next] == neighbours[j])) {
+                        ++next;
+                    }
+                    if (next - j == 1) {
+                        #pragma omp atomic write
+                        vertices[i].border = 1;
+                        #pragma omp atomic write
+                        vertices[neighbours[j]].border = 1;
+                    }
+                    j = next;
+                }
+            }
+        }
+
+        // Texture seams: corners of one vertex have different texture coordinates. Keep them as border
+        if (texcoords) {
+            #pragma omp parallel for
+            for (int i = 0; i < v_count; ++i) {
+                Vertex & v = vertices[i];
+                for (int j = 1; j < v.tcount; ++j) {
+                    UV const & uv0 = uvs[3 * refs[v.tstart].tid + refs[v.tstart].tvertex];
+                    UV const & uv1 = uvs[3 * refs[v.tstart + j].tid + refs[v.tstart + j].tvertex];
+                    if ((fabs(uv0.u - uv1.u) > 1e-6) || (fabs(uv0.v - uv1.v) > 1e-6)) {
+                        v.border = 1;
+                        break;
                     }
                 }
             }
-            for (int j = 0; j < vcount.size(); ++j) {
-                if (vcount[j] == 1) {
-                    vertices[vids[j]].border = 1;
+        }
+    }
+}
+
+// Compacted copy of current mesh. Working arrays stay untouched
+void MeshSimplify::snapshot(std::vector<Vertex> & out_vertices, std::vector<Triangle> & out_triangles,
+                            std::vector<UV> & out_uvs, std::vector<ulong> * origin) const
+{
+    std::vector<ulong> remap(vertices.size(), ulong(-1));
+    out_vertices.clear();
+    out_triangles.clear();
+    out_uvs.clear();
+    if (origin) {
+        origin->clear();
+    }
+    for (int i = 0; i < triangles.size(); ++i) {
+        if (triangles[i].deleted) {
+            continue;
+        }
+        Triangle t = triangles[i];
+        for (int j = 0; j < 3; ++j) {
+            ulong & id = remap[t.v[j]];
+            if (id == ulong(-1)) {
+                id = out_vertices.size();
+                out_vertices.push_back(vertices[t.v[j]]);
+                if (origin) {
+                    origin->push_back(t.v[j]);
                 }
             }
+            t.v[j] = id;
+        }
+        out_triangles.push_back(t);
+        if (texcoords) {
+            out_uvs.insert(out_uvs.end(), uvs.begin() + 3 * i, uvs.begin() + 3 * i + 3);
         }
     }
 }
@@ -323,6 +865,9 @@ void MeshSimplify::compact_mesh() {
     for (int i = 0; i < triangles.size(); ++i) {
         if (!triangles[i].deleted) {
             Triangle & t = triangles[i];
+            if (texcoords) {
+                std::copy(uvs.begin() + 3 * i, uvs.begin() + 3 * i + 3, uvs.begin() + 3 * dst);
+            }
             triangles[dst++] = t;
             for (int j = 0; j < 3; ++j) {
                 vertices[t.v[j]].tcount = 1;
@@ -330,6 +875,7 @@ void MeshSimplify::compact_mesh() {
         }
     }
     triangles.resize(dst);
+    uvs.resize(texcoords ? 3 * dst : 0);
     dst = 0;
     for (int i = 0; i < vertices.size(); ++i) {
         if (vertices[i].tcount) {
@@ -353,11 +899,64 @@ double MeshSimplify::vertex_error(SymmetricMatrix const & q, double const x, dou
              + (2 * q[5] * y * z) + (2 * q[6] * y) + (q[7] * z * z) + (2 * q[8] * z) + q[9];
 }
 
+// Determinant of 3x3 matrix, in the same order of operations as SymmetricMatrix::det
+static inline double det3(double const a11, double const a12, double const a13,
+                          double const a21, double const a22, double const a23,
+                          double const a31, double const a32, double const a33)
+{
+    return a11*a22*a33 + a13*a21*a32 + a12*a23*a31 - a13*a22*a31 - a11*a23*a32 - a12*a21*a33;
+}
+
+// Error between vertex and i-th quadric of the batch, the same as vertex_error
+static inline double quadric_error(double const q[][EdgeErrorBatch::SIZE], int const i,
+                                   double const x, double const y, double const z)
+{
+    return   (q[0][i] * x * x) + (2 * q[1][i] * x * y) + (2 * q[2][i] * x * z) + (2 * q[3][i] * x)
+             + (q[4][i] * y * y) + (2 * q[5][i] * y * z) + (2 * q[6][i] * y) + (q[7][i] * z * z)
+             + (2 * q[8][i] * z) + q[9][i];
+}
+
+// Compute error of every added edge.
+// Doubles fill only two SSE2 lanes of the default x86-64 target: AVX2 version is chosen at runtime if available
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+void EdgeErrorBatch::evaluate() {
+    // Optimal points of all edges by SIMD lanes. Lanes with det = 0 compute garbage here, it's replaced below
+    double det[SIZE];
+    #pragma omp simd
+    for (int i = 0; i < count; ++i) {
+        det[i] = det3(q[0][i], q[1][i], q[2][i], q[1][i], q[4][i], q[5][i], q[2][i], q[5][i], q[7][i]);
+        // one division: -1 / det is exactly -(1 / det)
+        double inverse = 1 / det[i];
+        double x = -inverse * det3(q[1][i], q[2][i], q[3][i], q[4][i], q[5][i], q[6][i], q[5][i], q[7][i], q[8][i]);
+        double y =  inverse * det3(q[0][i], q[2][i], q[3][i], q[1][i], q[5][i], q[6][i], q[2][i], q[7][i], q[8][i]);
+        double z = -inverse * det3(q[0][i], q[1][i], q[3][i], q[1][i], q[4][i], q[6][i], q[2][i], q[5][i], q[8][i]);
+        error[i] = quadric_error(q, i, x, y, z);
+    }
+    // det = 0 or border -> the best of end points and middle. Such edges are rare, they are computed one by one
+    for (int i = 0; i < count; ++i) {
+        if ((det[i] != 0) && (!border[i])) {
+            continue;
+        }
+        double error1 = quadric_error(q, i, a[0][i], a[1][i], a[2][i]);
+        double error2 = quadric_error(q, i, b[0][i], b[1][i], b[2][i]);
+        double error3 = quadric_error(q, i, (a[0][i] + b[0][i]) / 2, (a[1][i] + b[1][i]) / 2, (a[2][i] + b[2][i]) / 2);
+        error[i] = fmin(error1, fmin(error2, error3));
+    }
+}
+
 // Error for one edge
 double MeshSimplify::calculate_error(int const id_v1, int const id_v2, vec3f & p_result) {
+    return edge_error(vertices[id_v1].q + vertices[id_v2].q, vertices[id_v1].p, vertices[id_v2].p,
+                      vertices[id_v1].border & vertices[id_v2].border, p_result);
+}
+
+// Error of edge p1-p2 with summed quadric q of its vertices, both are border if border is set
+double MeshSimplify::edge_error(SymmetricMatrix q, vec3f const & p1, vec3f const & p2, bool const border,
+                                vec3f & p_result)
+{
     // compute interpolated vertex
-    SymmetricMatrix q = vertices[id_v1].q + vertices[id_v2].q;
-    bool border = vertices[id_v1].border & vertices[id_v2].border;
     double error = 0;
     double det = q.det(0, 1, 2, 1, 4, 5, 2, 5, 7);
     if ((det != 0) && (!border)) {
@@ -369,8 +968,6 @@ double MeshSimplify::calculate_error(int const id_v1, int const id_v2, vec3f & p
         error = vertex_error(q, p_result.x, p_result.y, p_result.z);
     } else {
         // det = 0 -> try to find best result
-        vec3f p1 = vertices[id_v1].p;
-        vec3f p2 = vertices[id_v2].p;
         vec3f p3 = (p1 + p2) / 2;
         double error1 = vertex_error(q, p1.x, p1.y, p1.z);
         double error2 = vertex_error(q, p2.x, p2.y, p2.z);
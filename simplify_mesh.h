@@ -6,6 +6,7 @@
 #define RECONSTRUCTION_REFINE_MESH_H
 
 #include <tuple>
+#include <functional>
 #include <math.h>
 #include <vector>
 
@@ -135,6 +136,69 @@ public:
 
 typedef unsigned long ulong;
 
+// Barycentric coordinates of p projected to triangle (a, b, c), clamped to the triangle
+inline vec3f barycentric(vec3f const & p, vec3f const & a, vec3f const & b, vec3f const & c) {
+    vec3f v0 = b - a, v1 = c - a, v2 = p - a;
+    double d00 = v0.dot(v0), d01 = v0.dot(v1), d11 = v1.dot(v1);
+    double d20 = v2.dot(v0), d21 = v2.dot(v1);
+    double denom = d00 * d11 - d01 * d01;
+    if (fabs(denom) < 1e-20) {
+        return vec3f(1.0 / 3, 1.0 / 3, 1.0 / 3);
+    }
+    double v = (d11 * d20 - d01 * d21) / denom;
+    double w = (d00 * d21 - d01 * d20) / denom;
+    double u = 1.0 - v - w;
+    // Clamp to triangle and renormalize
+    u = fmax(u, 0.0); v = fmax(v, 0.0); w = fmax(w, 0.0);
+    double sum = u + v + w;
+    return vec3f(u / sum, v / sum, w / sum);
+}
+
+// Errors of many edges at once (the same values as MeshSimplify::calculate_error).
+// Quadrics and end points of edges are gathered into arrays by component, then all edges are
+// evaluated by one loop without branches: SIMD lanes compute both optimal and fallback (det == 0 or border)
+// errors and select one of them
+class EdgeErrorBatch {
+public:
+    static int const SIZE = 96;
+private:
+    double q[10][SIZE];
+    double a[3][SIZE];
+    double b[3][SIZE];
+    unsigned char border[SIZE];
+    int count = 0;
+public:
+    double error[SIZE];
+
+    int size() const {
+        return count;
+    }
+
+    bool full() const {
+        return count == SIZE;
+    }
+
+    void clear() {
+        count = 0;
+    }
+
+    // Edge between vertices with quadrics q1, q2 at p1, p2. Both are border if is_border is set
+    void add(SymmetricMatrix const & q1, SymmetricMatrix const & q2, vec3f const & p1, vec3f const & p2,
+             bool const is_border)
+    {
+        for (int k = 0; k < 10; ++k) {
+            q[k][count] = q1[k] + q2[k];
+        }
+        a[0][count] = p1.x; a[1][count] = p1.y; a[2][count] = p1.z;
+        b[0][count] = p2.x; b[1][count] = p2.y; b[2][count] = p2.z;
+        border[count] = is_border;
+        ++count;
+    }
+
+    // Compute error of every added edge
+    void evaluate();
+};
+
 class MeshSimplify {
 public:
     struct Triangle {
@@ -157,11 +221,17 @@ public:
         };
     };
 
+    // Texture coordinates of triangle corner
+    struct UV {
+        float u = 0, v = 0;
+    };
+
     struct Vertex {
         vec3f p = vec3f(0, 0, 0);
         ulong tstart = 0, tcount = 0;
         SymmetricMatrix q;
         int border = 0;
+        int locked = 0; // shared by partitions of parallel simplification, never collapsed
 
         // Constructor and method
         Vertex() {};
@@ -176,6 +246,24 @@ public:
             return std::make_tuple(p.x, p.y, p.z);
         };
     };
+    //
+    // Collapse engines
+    //
+    // THRESHOLD      : sweeps all triangles with growing error threshold, up to 100 iterations
+    // PRIORITY_QUEUE : heap of edge collapses ordered by error, lazily invalidated by vertex stamps.
+    //                  Touches only neighbourhood of every collapse and stops exactly at target count
+    //                  (one less if only two-triangle collapses are left)
+    //
+    enum Engine { THRESHOLD, PRIORITY_QUEUE };
+    Engine engine = THRESHOLD;
+
+    //
+    // Error-bounded mode: edges with quadric error above max_error^2 are not collapsed (0 - off),
+    // simplification stops there even if target count isn't reached.
+    // Quadric error is the sum of squared distances to planes around the edge, so the bound is conservative
+    //
+    double max_error = 0;
+
     //
     // Main simplification function
     //
@@ -185,30 +273,147 @@ public:
     //                 more iterations yield higher quality
     void simplify_mesh(ulong const target_count, double const agressiveness, bool const verbose);
 
+    //
+    // Parallel simplification: spatial partitions are decimated concurrently with locked shared vertices,
+    // then with shifted partitions. The last serial pass reaches target_count
+    //
+    void simplify_mesh_parallel(ulong const target_count, double const agressiveness, bool const verbose);
+
+    //
+    // Levels of detail from one decimation pass
+    //
+    // target_counts : target nr. of triangles for every level
+    // on_level      : called once per level with its index in target_counts and compacted mesh
+    //                 (uvs of its corners are empty without texcoords)
+    //
+    typedef std::function<void(ulong const level, std::vector<Vertex> const & vertices,
+                               std::vector<Triangle> const & triangles,
+                               std::vector<UV> const & uvs)> LevelCallback;
+    void simplify_mesh_lod(std::vector<ulong> const & target_counts, double const agressiveness,
+                           bool const verbose, LevelCallback const & on_level);
+
+    //
+    // Error of edge p1-p2 with summed quadric q of its vertices and the point it collapses to,
+    // both vertices are border if border is set (EdgeErrorBatch gives the same errors)
+    //
+    static double edge_error(SymmetricMatrix q, vec3f const & p1, vec3f const & p2, bool const border,
+                             vec3f & p_result);
+
     MeshSimplify (ulong const v_count, ulong const t_count) {
         vertices.reserve(v_count);
         triangles.reserve(t_count);
     }
     std::vector<Triangle> triangles;
     std::vector<Vertex> vertices;
+    // Triangles carry texture coordinates: they are interpolated on collapse and texture seams are kept
+    bool texcoords = false;
+    // Texture coordinates of corners (3 per triangle in order of triangles), allocated only with texcoords
+    std::vector<UV> uvs;
 private:
     struct Ref {
         int tid, tvertex;
     };
     std::vector<Ref> refs;
 
+    // Priority queue engine: candidates are valid while both vertices keep their stamps.
+    // Stamps only grow, so their sum changes whenever any of them changes. 16 bytes per candidate
+    struct Collapse {
+        float error;
+        int v0, v1;
+        unsigned stamp;
+
+        // std heap is max-heap, the cheapest collapse should be on top
+        bool operator<(Collapse const & c) const {
+            return error > c.error;
+        }
+    };
+    std::vector<Collapse> heap;
+    std::vector<unsigned> stamps;
+
+    // Edge errors of triangles touched by a collapse are computed in one batch
+    EdgeErrorBatch edge_batch;
+    std::vector<ulong> updated_triangles;
+
     // Helper functions
-    double vertex_error(SymmetricMatrix const &q, double const x, double const y, double const z);
+    static double vertex_error(SymmetricMatrix const &q, double const x, double const y, double const z);
 
     double calculate_error(int id_v1, int id_v2, vec3f &p_result);
 
+    void add_edges(EdgeErrorBatch &batch, Triangle const &t) const;
+
+    static void set_edge_errors(Triangle &t, EdgeErrorBatch const &batch, int const first);
+
     bool flipped(vec3f const &p, int const i1, Vertex const &v0, Vertex const &v1, std::vector<int> &deleted);
 
     void update_triangles(int const i0, Vertex const &v, std::vector<int> const &deleted, int &deleted_triangles);
 
+    void update_texcoords(Vertex const &v0, Vertex const &v1, vec3f const &p,
+                          std::vector<int> const &deleted0, std::vector<int> const &deleted1);
+
     void update_mesh(int const iteration);
 
+    int decimate(ulong const target_count, double const agressiveness, bool const verbose,
+                 int const first_iteration, int & deleted_triangles);
+
+    bool try_collapse(int const i0, int const i1, vec3f const &p, int const max_removed,
+                      std::vector<int> &deleted0, std::vector<int> &deleted1, int &deleted_triangles);
+
+    void push_collapse(int const i0, int const i1, double const error);
+
+    void build_queue();
+
+    void decimate_queue(ulong const target_count, bool const verbose, int & deleted_triangles);
+
+    void run_engine(ulong const target_count, double const agressiveness, bool const verbose);
+
+    void decimate_partitions(ulong const target_count, double const agressiveness, int const grid, bool const shifted);
+
+    // origin (optional): index of every output vertex in vertices
+    void snapshot(std::vector<Vertex> & out_vertices, std::vector<Triangle> & out_triangles,
+                  std::vector<UV> & out_uvs, std::vector<ulong> * origin = nullptr) const;
+
     void compact_mesh();
 };
 
+// Push scene vertices and triangles to refined_mesh
+template <class L, class R>
+void fill_simplify_mesh(L const & from, std::vector<R> & to) {
+    R tmp; // create Vertex or Triangle
+    for (auto it = from.cbegin(); it != from.cend(); ++it) {
+        tmp.update(it->x, it->y, it->z);
+        to.push_back(tmp); // push vertex or triangle to vector for mesh refinement
+    }
+};
+
+// Push vertices and triangles after mesh refinement to scene back
+template <class L, class R, class Elem>
+void fill_scene_mesh(std::vector<L> const & from, R & to) {
+    to.Reset();
+    for (auto it = from.cbegin(); it != from.cend(); ++it) {
+        float x, y, z;
+        std::tie(x, y, z) = it->get_coord();
+        to.push_back(Elem(x, y, z));
+    }
+};
+
+// Push texture coordinates of scene faces (3 per face) to corners of triangles
+template <class L>
+void fill_simplify_texcoords(L const & from, std::vector<MeshSimplify::Triangle> const & triangles,
+                             std::vector<MeshSimplify::UV> & to) {
+    to.assign(triangles.size() * 3, MeshSimplify::UV());
+    for (ulong i = 0; i < to.size() && i < from.size(); ++i) {
+        to[i].u = from[i].x;
+        to[i].v = from[i].y;
+    }
+};
+
+// Push texture coordinates of corners back to scene faces
+template <class R, class Elem>
+void fill_scene_texcoords(std::vector<MeshSimplify::UV> const & from, R & to) {
+    to.Reset();
+    for (auto it = from.cbegin(); it != from.cend(); ++it) {
+        to.push_back(Elem(it->u, it->v));
+    }
+};
+
 #endif //RECONSTRUCTION_REFINE_MESH_H
@@ -0,0 +1,442 @@
+//
+// Created by user on 10/18/26.
+//
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <opencv2/highgui/highgui.hpp>
+#include "vertex_clustering.h"
+#include "synthetic_scene.h"
+
+// Cameras of the ring: distance from the center of the object (radius ~1) and elevations of odd and even views
+static double const RING_DISTANCE = 3.2;
+static double const RING_ELEVATIONS_DEG[2] = {20, 35};
+static unsigned char const BACKGROUND = 110;
+// Octaves of the texture: from blobs of a third of the object to spots of ~10 pixels in the views
+static double const TEXTURE_FREQUENCIES[] = {3, 7, 15, 31, 63};
+
+// Icosphere subdivided level times with radial bumps, so that simplification has curvature to keep
+Mesh make_icosphere(int const level) {
+    Mesh mesh;
+    mesh.name = "icosphere-" + std::to_string(level);
+    double t = (1 + sqrt(5.0)) / 2;
+    std::vector<vec3f> v = {vec3f(-1, t, 0), vec3f(1, t, 0), vec3f(-1, -t, 0), vec3f(1, -t, 0),
+                            vec3f(0, -1, t), vec3f(0, 1, t), vec3f(0, -1, -t), vec3f(0, 1, -t),
+                            vec3f(t, 0, -1), vec3f(t, 0, 1), vec3f(-t, 0, -1), vec3f(-t, 0, 1)};
+    uint32_t const base[20][3] = {{0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11}, {1, 5, 9}, {5, 11, 4},
+                                  {11, 10, 2}, {10, 7, 6}, {7, 1, 8}, {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8},
+                                  {3, 8, 9}, {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}};
+    for (auto & p : v) {
+        p.normalize();
+    }
+    for (auto const & f : base) {
+        mesh.faces.push_back({{f[0], f[1], f[2]}});
+    }
+    for (int l = 0; l < level; ++l) {
+        // Middle of every edge is created once
+        std::unordered_map<uint64_t, uint32_t> middles;
+        auto middle = [&](uint32_t const a, uint32_t const b) {
+            uint64_t key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+            auto found = middles.find(key);
+            if (found != middles.end()) {
+                return found->second;
+            }
+            vec3f p = (v[a] + v[b]) / 2;
+            p.normalize();
+            v.push_back(p);
+            middles[key] = v.size() - 1;
+            return uint32_t(v.size() - 1);
+        };
+        std::vector<CompactMeshSimplify::Face> faces;
+        faces.reserve(mesh.faces.size() * 4);
+        for (auto const & f : mesh.faces) {
+            uint32_t a = middle(f.v[0], f.v[1]), b = middle(f.v[1], f.v[2]), c = middle(f.v[2], f.v[0]);
+            faces.push_back({{f.v[0], a, c}});
+            faces.push_back({{f.v[1], b, a}});
+            faces.push_back({{f.v[2], c, b}});
+            faces.push_back({{a, b, c}});
+        }
+        mesh.faces.swap(faces);
+    }
+    for (auto const & p : v) {
+        double r = 1 + 0.05 * sin(9 * p.x) * sin(7 * p.y) * sin(5 * p.z);
+        mesh.points.push_back({float(p.x * r), float(p.y * r), float(p.z * r)});
+    }
+    return mesh;
+}
+
+// Binary little endian PLY with float x, y, z and triangles (the same files as vertex clustering reads)
+bool load_ply(fs::path const & path, Mesh & mesh) {
+    PlyLayout layout;
+    if (!read_ply_layout(path, layout)) {
+        std::cerr << "Unsupported PLY " << path << std::endl;
+        return false;
+    }
+    std::ifstream ply(path.string(), std::ios::binary);
+    ply.seekg(layout.data_offset);
+    std::vector<char> record(std::max(layout.v_stride, layout.f_stride));
+    mesh.name = path.filename().string();
+    mesh.points.resize(layout.v_count);
+    for (auto & p : mesh.points) {
+        ply.read(record.data(), layout.v_stride);
+        memcpy(&p.x, record.data() + layout.xyz_offset[0], sizeof(float));
+        memcpy(&p.y, record.data() + layout.xyz_offset[1], sizeof(float));
+        memcpy(&p.z, record.data() + layout.xyz_offset[2], sizeof(float));
+    }
+    mesh.faces.resize(layout.t_count);
+    for (auto & f : mesh.faces) {
+        ply.read(record.data(), layout.f_stride);
+        if (record[0] != 3) {
+            std::cerr << "Faces of " << path << " are not triangles" << std::endl;
+            return false;
+        }
+        memcpy(f.v, record.data() + 1, 3 * sizeof(uint32_t));
+    }
+    return bool(ply);
+}
+
+bool save_ply(fs::path const & path, Mesh const & mesh) {
+    std::ofstream ply(path.string(), std::ios::binary);
+    ply << "ply\nformat binary_little_endian 1.0\nelement vertex " << mesh.points.size() <<
+        "\nproperty float x\nproperty float y\nproperty float z\nelement face " << mesh.faces.size() <<
+        "\nproperty list uchar uint vertex_indices\nend_header\n";
+    ply.write(reinterpret_cast<char const *>(mesh.points.data()),
+              mesh.points.size() * sizeof(CompactMeshSimplify::Point));
+    unsigned char const corners = 3;
+    for (auto const & f : mesh.faces) {
+        ply.write(reinterpret_cast<char const *>(&corners), 1);
+        ply.write(reinterpret_cast<char const *>(f.v), 3 * sizeof(uint32_t));
+    }
+    return bool(ply);
+}
+
+// MeshSimplify on a copy of the mesh
+void simplify_aos(Mesh const & input, Mesh & output, ulong const target, double const aggressiveness,
+                  MeshSimplify::Engine const engine, bool const parallel)
+{
+    MeshSimplify mesh(input.points.size(), input.faces.size());
+    mesh.engine = engine;
+    for (auto const & p : input.points) {
+        MeshSimplify::Vertex v;
+        v.update(p.x, p.y, p.z);
+        mesh.vertices.push_back(v);
+    }
+    for (auto const & f : input.faces) {
+        MeshSimplify::Triangle t;
+        t.update(f.v[0], f.v[1], f.v[2]);
+        mesh.triangles.push_back(t);
+    }
+    if (parallel) {
+        mesh.simplify_mesh_parallel(target, aggressiveness, false);
+    } else {
+        mesh.simplify_mesh(target, aggressiveness, false);
+    }
+    for (auto const & v : mesh.vertices) {
+        output.points.push_back({float(v.p.x), float(v.p.y), float(v.p.z)});
+    }
+    for (auto const & t : mesh.triangles) {
+        output.faces.push_back({{uint32_t(t.v[0]), uint32_t(t.v[1]), uint32_t(t.v[2])}});
+    }
+}
+
+// Pseudo random value in [0, 1] of the lattice point
+static double lattice_value(long const x, long const y, long const z, uint32_t const seed) {
+    uint32_t h = (uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ (uint32_t(z) * 83492791u) ^
+                 (seed * 2654435761u);
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    h ^= h >> 15;
+    return (h & 0xffffff) / double(0xffffff);
+}
+
+// Smooth value noise: values of the lattice interpolated with smoothstep weights
+static double value_noise(Eigen::Vector3d const & p, uint32_t const seed) {
+    long base[3];
+    double w[3];
+    for (int k = 0; k < 3; ++k) {
+        double cell = std::floor(p[k]);
+        base[k] = long(cell);
+        double t = p[k] - cell;
+        w[k] = t * t * (3 - 2 * t);
+    }
+    double value = 0;
+    for (int corner = 0; corner < 8; ++corner) {
+        int dx = corner & 1, dy = (corner >> 1) & 1, dz = (corner >> 2) & 1;
+        double weight = (dx ? w[0] : 1 - w[0]) * (dy ? w[1] : 1 - w[1]) * (dz ? w[2] : 1 - w[2]);
+        value += weight * lattice_value(base[0] + dx, base[1] + dy, base[2] + dz, seed);
+    }
+    return value;
+}
+
+// Color of surface point (BGR, 0..1)
+Eigen::Vector3d SyntheticScene::albedo(Eigen::Vector3d const & p) const {
+    Eigen::Vector3d color;
+    for (int c = 0; c < 3; ++c) {
+        double value = 0, weight = 0, amplitude = 1;
+        uint32_t seed = c * 16;
+        for (double frequency : TEXTURE_FREQUENCIES) {
+            value += amplitude * value_noise(p * frequency, seed++);
+            weight += amplitude;
+            amplitude *= 0.75;
+        }
+        // Sum of octaves is concentrated around 0.5, it is stretched for contrast
+        color[c] = std::min(1.0, std::max(0.05, 0.5 + 2.5 * (value / weight - 0.5)));
+    }
+    return color;
+}
+
+// Object of icosphere level (faces = 20 * 4^level), images on the ring
+SyntheticScene::SyntheticScene(ulong const images, int const level, int const width, int const height) :
+        mesh(make_icosphere(level))
+{
+    Eigen::Vector3d const up(0, 0, 1);
+    for (ulong i = 0; i < images; ++i) {
+        Camera camera;
+        char name[32];
+        snprintf(name, sizeof(name), "view_%03lu.jpg", i);
+        camera.name = name;
+        camera.width = width;
+        camera.height = height;
+        camera.focal = 0.9 * width;
+        camera.cx = width / 2.0;
+        camera.cy = height / 2.0;
+        double azimuth = 2 * M_PI * i / images;
+        double elevation = RING_ELEVATIONS_DEG[i % 2] * M_PI / 180;
+        Eigen::Vector3d center = RING_DISTANCE * Eigen::Vector3d(cos(elevation) * cos(azimuth),
+                                                                 cos(elevation) * sin(azimuth), sin(elevation));
+        // Looking at the origin: rows of rotation are right, down and forward directions
+        Eigen::Vector3d forward = -center.normalized();
+        Eigen::Vector3d right = forward.cross(up).normalized();
+        Eigen::Vector3d down = forward.cross(right);
+        camera.rotation.row(0) = right;
+        camera.rotation.row(1) = down;
+        camera.rotation.row(2) = forward;
+        camera.translation = -camera.rotation * center;
+        cameras.push_back(camera);
+    }
+}
+
+Mesh const & SyntheticScene::get_mesh() const {
+    return mesh;
+}
+
+std::vector<SyntheticScene::Camera> const & SyntheticScene::get_cameras() const {
+    return cameras;
+}
+
+// View of the camera: rows x cols x 3 bytes (BGR)
+void SyntheticScene::render(Camera const & camera, std::vector<unsigned char> & bgr) const {
+    long const width = camera.width, height = camera.height;
+    long const v_count = mesh.points.size(), f_count = mesh.faces.size();
+    // Vertices in the camera frame and their pixel coordinates
+    std::vector<Eigen::Vector3d> local(v_count);
+    std::vector<Eigen::Vector2d> pixel(v_count);
+    #pragma omp parallel for
+    for (long i = 0; i < v_count; ++i) {
+        auto const & p = mesh.points[i];
+        local[i] = camera.rotation * Eigen::Vector3d(p.x, p.y, p.z) + camera.translation;
+        pixel[i] = Eigen::Vector2d(camera.focal * local[i].x() / local[i].z() + camera.cx,
+                                   camera.focal * local[i].y() / local[i].z() + camera.cy);
+    }
+
+    // 1. Nearest face of every pixel (z-buffer). Bands of rows are rasterized in parallel,
+    // every band takes the faces crossing it. Pixel centers are at +0.5 as in COLMAP
+    std::vector<float> depth(width * height, std::numeric_limits<float>::max());
+    std::vector<int32_t> visible(width * height, -1);
+    long const band = 32;
+    long const bands = (height + band - 1) / band;
+    #pragma omp parallel for schedule(dynamic)
+    for (long b = 0; b < bands; ++b) {
+        long const y_begin = b * band, y_end = std::min(height, y_begin + band);
+        for (long f = 0; f < f_count; ++f) {
+            uint32_t const * v = mesh.faces[f].v;
+            if ((local[v[0]].z() < 1e-3) || (local[v[1]].z() < 1e-3) || (local[v[2]].z() < 1e-3)) {
+                continue;
+            }
+            Eigen::Vector2d const & a = pixel[v[0]], & p1 = pixel[v[1]], & p2 = pixel[v[2]];
+            double y_min = std::min(a.y(), std::min(p1.y(), p2.y()));
+            double y_max = std::max(a.y(), std::max(p1.y(), p2.y()));
+            long row_begin = std::max(y_begin, long(std::ceil(y_min - 0.5)));
+            long row_end = std::min(y_end - 1, long(std::floor(y_max - 0.5)));
+            if (row_begin > row_end) {
+                continue;
+            }
+            double x_min = std::min(a.x(), std::min(p1.x(), p2.x()));
+            double x_max = std::max(a.x(), std::max(p1.x(), p2.x()));
+            long col_begin = std::max(0L, long(std::ceil(x_min - 0.5)));
+            long col_end = std::min(width - 1, long(std::floor(x_max - 0.5)));
+            double area = (p1.x() - a.x()) * (p2.y() - a.y()) - (p1.y() - a.y()) * (p2.x() - a.x());
+            if (std::abs(area) < 1e-12) {
+                continue;
+            }
+            double inv_z[3] = {1 / local[v[0]].z(), 1 / local[v[1]].z(), 1 / local[v[2]].z()};
+            for (long y = row_begin; y <= row_end; ++y) {
+                for (long x = col_begin; x <= col_end; ++x) {
+                    double px = x + 0.5, py = y + 0.5;
+                    // Barycentric coordinates from edge functions
+                    double l0 = ((p1.x() - px) * (p2.y() - py) - (p1.y() - py) * (p2.x() - px)) / area;
+                    double l1 = ((p2.x() - px) * (a.y() - py) - (p2.y() - py) * (a.x() - px)) / area;
+                    double l2 = 1 - l0 - l1;
+                    if ((l0 < 0) || (l1 < 0) || (l2 < 0)) {
+                        continue;
+                    }
+                    // Perspective correct depth
+                    float z = float(1 / (l0 * inv_z[0] + l1 * inv_z[1] + l2 * inv_z[2]));
+                    long id = y * width + x;
+                    if (z < depth[id]) {
+                        depth[id] = z;
+                        visible[id] = int32_t(f);
+                    }
+                }
+            }
+        }
+    }
+
+    // 2. Color of the surface point of every pixel: ray of the pixel hits the plane of its face
+    Eigen::Vector3d const light = Eigen::Vector3d(0.3, -0.4, 0.85).normalized();
+    bgr.assign(width * height * 3, BACKGROUND);
+    #pragma omp parallel for
+    for (long y = 0; y < height; ++y) {
+        for (long x = 0; x < width; ++x) {
+            long id = y * width + x;
+            if (visible[id] < 0) {
+                continue;
+            }
+            uint32_t const * v = mesh.faces[visible[id]].v;
+            Eigen::Vector3d normal = (local[v[1]] - local[v[0]]).cross(local[v[2]] - local[v[0]]);
+            Eigen::Vector3d ray((x + 0.5 - camera.cx) / camera.focal, (y + 0.5 - camera.cy) / camera.focal, 1);
+            double along = normal.dot(ray);
+            if (std::abs(along) < 1e-12) {
+                continue;
+            }
+            Eigen::Vector3d point = ray * (normal.dot(local[v[0]]) / along);
+            // The visible side faces the camera, lighting is fixed in the world
+            if (along > 0) {
+                normal = -normal;
+            }
+            Eigen::Vector3d world_point = camera.rotation.transpose() * (point - camera.translation);
+            Eigen::Vector3d world_normal = (camera.rotation.transpose() * normal).normalized();
+            double shade = 0.45 + 0.55 * std::max(0.0, world_normal.dot(light));
+            Eigen::Vector3d color = albedo(world_point) * shade;
+            for (int c = 0; c < 3; ++c) {
+                bgr[id * 3 + c] = (unsigned char)std::lround(255 * color[c]);
+            }
+        }
+    }
+}
+
+// Images into images_dir, cameras.txt and mesh.ply into ground_truth_dir
+bool SyntheticScene::write(fs::path const & images_dir, fs::path const & ground_truth_dir) const {
+    fs::create_directories(images_dir);
+    fs::create_directories(ground_truth_dir);
+    std::ofstream list((ground_truth_dir / "cameras.txt").string());
+    list << "# Pinhole cameras without distortion: x_camera = R(q) * x_world + t\n"
+            "# name width height focal cx cy qw qx qy qz tx ty tz\n";
+    list.precision(17);
+    bool success = true;
+    std::vector<unsigned char> bgr;
+    for (auto const & camera : cameras) {
+        render(camera, bgr);
+        cv::Mat image(camera.height, camera.width, CV_8UC3, bgr.data());
+        success = cv::imwrite((images_dir / camera.name).string(), image) && success;
+        Eigen::Quaterniond q(camera.rotation);
+        list << camera.name << " " << camera.width << " " << camera.height << " " << camera.focal << " " <<
+             camera.cx << " " << camera.cy << " " << q.w() << " " << q.x() << " " << q.y() << " " << q.z() << " " <<
+             camera.translation.x() << " " << camera.translation.y() << " " << camera.translation.z() << "\n";
+    }
+    success = save_ply(ground_truth_dir / "mesh.ply", mesh) && success;
+    return success && bool(list);
+}
+
+// Registered cameras (matched by file name without extension) against the ring. False if less than 3
+bool SyntheticScene::compare_poses(std::vector<Camera> const & reconstructed, PoseAccuracy & accuracy) const {
+    accuracy = PoseAccuracy();
+    accuracy.images = cameras.size();
+    std::map<std::string, Camera const *> truth;
+    for (auto const & camera : cameras) {
+        truth[fs::path(camera.name).stem().string()] = &camera;
+    }
+    std::vector<std::pair<Camera const *, Camera const *>> pairs;
+    for (auto const & camera : reconstructed) {
+        auto found = truth.find(fs::path(camera.name).stem().string());
+        if (found != truth.end()) {
+            pairs.push_back(std::make_pair(&camera, found->second));
+        }
+    }
+    accuracy.registered = pairs.size();
+    if (pairs.size() < 3) {
+        return false;
+    }
+    // Similarity from reconstructed centers to true ones
+    Eigen::Matrix3Xd source(3, pairs.size()), target(3, pairs.size());
+    for (ulong i = 0; i < pairs.size(); ++i) {
+        source.col(i) = pairs[i].first->center();
+        target.col(i) = pairs[i].second->center();
+    }
+    accuracy.alignment = Eigen::umeyama(source, target, true);
+    Eigen::Matrix3d linear = accuracy.alignment.block<3, 3>(0, 0);
+    Eigen::Matrix3d rotation = linear / linear.col(0).norm();
+    for (ulong i = 0; i < pairs.size(); ++i) {
+        Eigen::Vector3d center = linear * source.col(i) + accuracy.alignment.block<3, 1>(0, 3);
+        double position = (center - target.col(i)).norm();
+        // Orientation of reconstructed camera in the true frame
+        Eigen::Matrix3d error = pairs[i].second->rotation * (pairs[i].first->rotation * rotation.transpose()).transpose();
+        double angle = acos(std::min(1.0, std::max(-1.0, (error.trace() - 1) / 2))) * 180 / M_PI;
+        accuracy.rotation_mean_deg += angle / pairs.size();
+        accuracy.rotation_max_deg = std::max(accuracy.rotation_max_deg, angle);
+        accuracy.position_mean += position / pairs.size();
+        accuracy.position_max = std::max(accuracy.position_max, position);
+    }
+    return true;
+}
+
+// Reconstructed mesh is aligned by the alignment of poses and compared to the object
+void SyntheticScene::compare_surface(Mesh const & reconstructed, Eigen::Matrix4d const & alignment,
+                                     MeshDeviation::Report & accuracy, MeshDeviation::Report & completeness) const {
+    accuracy = MeshDeviation::Report();
+    completeness = MeshDeviation::Report();
+    if (reconstructed.faces.empty()) {
+        return;
+    }
+    std::vector<CompactMeshSimplify::Point> aligned(reconstructed.points.size());
+    for (ulong i = 0; i < aligned.size(); ++i) {
+        auto const & p = reconstructed.points[i];
+        Eigen::Vector4d q = alignment * Eigen::Vector4d(p.x, p.y, p.z, 1);
+        aligned[i] = {float(q.x()), float(q.y()), float(q.z())};
+    }
+    auto const * object_vertices = reinterpret_cast<float const *>(mesh.points.data());
+    auto const * object_faces = reinterpret_cast<uint32_t const *>(mesh.faces.data());
+    auto const * aligned_vertices = reinterpret_cast<float const *>(aligned.data());
+    auto const * aligned_faces = reinterpret_cast<uint32_t const *>(reconstructed.faces.data());
+    MeshDeviation object(object_vertices, mesh.points.size(), object_faces, mesh.faces.size());
+    accuracy = object.measure(aligned_vertices, aligned.size(), aligned_faces, reconstructed.faces.size());
+    MeshDeviation surface(aligned_vertices, aligned.size(), aligned_faces, reconstructed.faces.size());
+    completeness = surface.measure(object_vertices, mesh.points.size(), object_faces, mesh.faces.size());
+}
+
+// Cameras of NVM model (COLMAP model converter output): name, focal, rotation quaternion and center
+bool read_nvm_cameras(fs::path const & path, std::vector<SyntheticScene::Camera> & cameras) {
+    std::ifstream nvm(path.string());
+    std::string header;
+    ulong count = 0;
+    nvm >> header >> count;
+    if (!nvm || (header.compare(0, 6, "NVM_V3") != 0)) {
+        return false;
+    }
+    cameras.clear();
+    for (ulong i = 0; i < count; ++i) {
+        SyntheticScene::Camera camera;
+        double qw, qx, qy, qz, cx, cy, cz, radial, zero;
+        nvm >> camera.name >> camera.focal >> qw >> qx >> qy >> qz >> cx >> cy >> cz >> radial >> zero;
+        if (!nvm) {
+            return false;
+        }
+        camera.rotation = Eigen::Quaterniond(qw, qx, qy, qz).normalized().toRotationMatrix();
+        camera.translation = -camera.rotation * Eigen::Vector3d(cx, cy, cz);
+        cameras.push_back(camera);
+    }
+    return true;
+}
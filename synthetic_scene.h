@@ -0,0 +1,100 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_SYNTHETIC_SCENE_H
+#define RECONSTRUCTION_SYNTHETIC_SCENE_H
+
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include "compact_simplify_mesh.h"
+#include "mesh_deviation.h"
+#include "utils.h"
+
+// Triangle mesh of benchmarks: 3 floats per vertex, 3 indices per face
+struct Mesh {
+    std::string name;
+    std::vector<CompactMeshSimplify::Point> points;
+    std::vector<CompactMeshSimplify::Face> faces;
+};
+
+// Icosphere subdivided level times with radial bumps, so that simplification has curvature to keep
+Mesh make_icosphere(int const level);
+
+// Binary little endian PLY with float x, y, z and triangles (the same files as vertex clustering reads)
+bool load_ply(fs::path const & path, Mesh & mesh);
+
+bool save_ply(fs::path const & path, Mesh const & mesh);
+
+// MeshSimplify on a copy of the mesh
+void simplify_aos(Mesh const & input, Mesh & output, ulong const target, double const aggressiveness,
+                  MeshSimplify::Engine const engine, bool const parallel);
+
+// Synthetic scene with known ground truth for end-to-end benchmark of the pipeline
+//
+// Textured object (bumpy icosphere of radius ~1 around the origin) is rendered on CPU from a ring of cameras
+// looking at it, z is up. Color of a surface point is a function of its position (value noise of several
+// octaves) lit by a fixed light, so every view sees the same colors of the same point as SfM and MVS expect.
+// The background is plain, object detection of image processing keeps the object. Cameras are pinhole
+// without distortion in COLMAP convention: x_camera = rotation * x_world + translation, y down, z forward.
+//
+// Reconstructions are compared to the ground truth after similarity alignment of camera centers (SfM has its
+// own scale and frame): rotation and position errors of registered cameras, then deviation of the aligned
+// mesh from the object (accuracy: from the reconstruction to the object, completeness: the opposite).
+
+class SyntheticScene {
+public:
+    struct Camera {
+        std::string name;
+        double focal = 0, cx = 0, cy = 0;
+        int width = 0, height = 0;
+        Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+        Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+
+        Eigen::Vector3d center() const {
+            return -rotation.transpose() * translation;
+        }
+    };
+
+    struct PoseAccuracy {
+        ulong images = 0;
+        ulong registered = 0;
+        double rotation_mean_deg = 0, rotation_max_deg = 0;
+        // Distances between aligned and true centers in object radii
+        double position_mean = 0, position_max = 0;
+        // Reconstruction to ground truth frame: x_true = alignment * x_reconstructed
+        Eigen::Matrix4d alignment = Eigen::Matrix4d::Identity();
+    };
+private:
+    Mesh mesh;
+    std::vector<Camera> cameras;
+
+    // Color of surface point (BGR, 0..1)
+    Eigen::Vector3d albedo(Eigen::Vector3d const & p) const;
+public:
+    // Object of icosphere level (faces = 20 * 4^level), images on the ring
+    SyntheticScene(ulong const images, int const level = 7, int const width = 1920, int const height = 1440);
+
+    Mesh const & get_mesh() const;
+
+    std::vector<Camera> const & get_cameras() const;
+
+    // View of the camera: rows x cols x 3 bytes (BGR)
+    void render(Camera const & camera, std::vector<unsigned char> & bgr) const;
+
+    // Images into images_dir, cameras.txt and mesh.ply into ground_truth_dir
+    bool write(fs::path const & images_dir, fs::path const & ground_truth_dir) const;
+
+    // Registered cameras (matched by file name without extension) against the ring. False if less than 3
+    bool compare_poses(std::vector<Camera> const & reconstructed, PoseAccuracy & accuracy) const;
+
+    // Reconstructed mesh is aligned by the alignment of poses and compared to the object
+    void compare_surface(Mesh const & reconstructed, Eigen::Matrix4d const & alignment,
+                         MeshDeviation::Report & accuracy, MeshDeviation::Report & completeness) const;
+};
+
+// Cameras of NVM model (COLMAP model converter output): name, focal, rotation quaternion and center
+bool read_nvm_cameras(fs::path const & path, std::vector<SyntheticScene::Camera> & cameras);
+
+#endif //RECONSTRUCTION_SYNTHETIC_SCENE_H
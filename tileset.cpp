@@ -0,0 +1,502 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "tileset.h"
+
+// Texels around every chart copied from the atlas, so filtering doesn't bleed other charts in
+static int const CHART_PADDING = 2;
+// glTF constants: chunk types, component types and buffer view targets
+static uint32_t const GLB_MAGIC = 0x46546C67;
+static uint32_t const GLB_JSON = 0x4E4F534A;
+static uint32_t const GLB_BIN = 0x004E4942;
+static int const GL_UNSIGNED_INT = 5125;
+static int const GL_FLOAT = 5126;
+static int const GL_ARRAY_BUFFER = 34962;
+static int const GL_ELEMENT_ARRAY_BUFFER = 34963;
+
+// Vertex of glTF content: vertex of the tile with texture coordinate of a face corner
+struct CornerKey {
+    uint32_t vertex;
+    float u, v;
+
+    bool operator==(CornerKey const & k) const {
+        return vertex == k.vertex && u == k.u && v == k.v;
+    }
+};
+
+struct CornerKeyHash {
+    size_t operator()(CornerKey const & k) const {
+        std::hash<float> h;
+        return (k.vertex * 73856093) ^ (h(k.u) * 19349663) ^ (h(k.v) * 83492791);
+    }
+};
+
+// Root of the set of element i, paths are halved on the way
+static uint32_t find_root(std::vector<uint32_t> & parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Vertex of merged content is identified by bit pattern of its coordinates
+struct VertexKey {
+    float x, y, z;
+
+    bool operator==(VertexKey const & k) const {
+        return x == k.x && y == k.y && z == k.z;
+    }
+};
+
+struct VertexKeyHash {
+    size_t operator()(VertexKey const & k) const {
+        std::hash<float> h;
+        return (h(k.x) * 73856093) ^ (h(k.y) * 19349663) ^ (h(k.z) * 83492791);
+    }
+};
+
+inline vec3f to_vec3f(MVS::Mesh::Vertex const & v) {
+    return vec3f(v.x, v.y, v.z);
+}
+
+Tileset::Tileset(MVS::Mesh const & mesh, fs::path const & output_dir, ulong const max_faces = 50000,
+                 int const max_depth = 8) :
+        mesh(mesh), output_dir(output_dir), max_faces(max_faces), max_depth(max_depth)
+{}
+
+// Distribute faces of node over 8 children
+void Tileset::split(Node & node) {
+    node.faces_count = node.faces.size();
+    node.source_faces = node.faces.size();
+    if ((node.faces.size() <= max_faces) || (node.depth >= max_depth)) {
+        return;
+    }
+    vec3f center = (node.min + node.max) / 2;
+    node.children.resize(8);
+    for (int i = 0; i < 8; ++i) {
+        Node & child = node.children[i];
+        child.id = node.id + "_" + std::to_string(i);
+        child.depth = node.depth + 1;
+        child.min = vec3f((i & 1) ? center.x : node.min.x, (i & 2) ? center.y : node.min.y, (i & 4) ? center.z : node.min.z);
+        child.max = vec3f((i & 1) ? node.max.x : center.x, (i & 2) ? node.max.y : center.y, (i & 4) ? node.max.z : center.z);
+    }
+    for (auto f : node.faces) {
+        MVS::Mesh::Face const & face = mesh.faces[f];
+        vec3f c = (to_vec3f(mesh.vertices[face.x]) + to_vec3f(mesh.vertices[face.y]) +
+                   to_vec3f(mesh.vertices[face.z])) / 3.0;
+        int i = (c.x >= center.x ? 1 : 0) | (c.y >= center.y ? 2 : 0) | (c.z >= center.z ? 4 : 0);
+        node.children[i].faces.push_back(f);
+    }
+    node.faces.clear();
+    node.faces.shrink_to_fit();
+    // Remove empty children and split the others
+    std::vector<Node> children;
+    for (auto & child : node.children) {
+        if (!child.faces.empty()) {
+            children.push_back(std::move(child));
+        }
+    }
+    node.children.swap(children);
+    for (auto & child : node.children) {
+        split(child);
+    }
+}
+
+// Full resolution faces of the source mesh for leaf tile
+void Tileset::extract_leaf(Node & node) {
+    bool textured = mesh.faceTexcoords.size() == mesh.faces.size() * 3;
+    std::unordered_map<uint32_t, uint32_t> remap;
+    Content & content = node.content;
+    for (auto f : node.faces) {
+        MVS::Mesh::Face const & face = mesh.faces[f];
+        uint32_t ids[3] = {face.x, face.y, face.z};
+        for (int k = 0; k < 3; ++k) {
+            auto it = remap.find(ids[k]);
+            if (it == remap.end()) {
+                it = remap.insert(std::make_pair(ids[k], (uint32_t)content.vertices.size())).first;
+                content.vertices.push_back(mesh.vertices[ids[k]]);
+            }
+            ids[k] = it->second;
+            if (textured) {
+                content.texcoords.push_back(mesh.faceTexcoords[f * 3 + k]);
+            }
+        }
+        content.faces.push_back(MVS::Mesh::Face(ids[0], ids[1], ids[2]));
+    }
+    node.faces.clear();
+    node.faces.shrink_to_fit();
+}
+
+// Union of children contents, vertices with equal position are welded
+void Tileset::merge_children(Node & node, Content & merged) {
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> welded;
+    for (auto & child : node.children) {
+        Content & content = child.content;
+        std::vector<uint32_t> remap(content.vertices.size());
+        for (ulong i = 0; i < content.vertices.size(); ++i) {
+            MVS::Mesh::Vertex const & v = content.vertices[i];
+            VertexKey key = {v.x, v.y, v.z};
+            auto it = welded.find(key);
+            if (it == welded.end()) {
+                it = welded.insert(std::make_pair(key, (uint32_t)merged.vertices.size())).first;
+                merged.vertices.push_back(v);
+            }
+            remap[i] = it->second;
+        }
+        for (auto const & face : content.faces) {
+            merged.faces.push_back(MVS::Mesh::Face(remap[face.x], remap[face.y], remap[face.z]));
+        }
+        for (auto const & texcoord : content.texcoords) {
+            merged.texcoords.push_back(texcoord);
+        }
+        // Child is already written, its geometry is not needed anymore
+        content = Content();
+    }
+}
+
+// Simplify content to max_faces faces
+void Tileset::simplify_content(Content const & source, Content & simplified) {
+    if (source.faces.size() <= max_faces) {
+        simplified = source;
+        return;
+    }
+    MeshSimplify mesh(source.vertices.size(), source.faces.size());
+    fill_simplify_mesh<MVS::Mesh::VertexArr, MeshSimplify::Vertex>(source.vertices, mesh.vertices);
+    fill_simplify_mesh<MVS::Mesh::FaceArr, MeshSimplify::Triangle>(source.faces, mesh.triangles);
+    // Texture coordinates are kept by attribute-preserving decimation
+    mesh.texcoords = source.texcoords.size() == source.faces.size() * 3;
+    if (mesh.texcoords) {
+        fill_simplify_texcoords<MVS::Mesh::TexCoordArr>(source.texcoords, mesh.triangles, mesh.uvs);
+    }
+    mesh.simplify_mesh(max_faces, 7.0, false);
+    fill_scene_mesh<MeshSimplify::Vertex, MVS::Mesh::VertexArr, MVS::Mesh::Vertex>(mesh.vertices, simplified.vertices);
+    fill_scene_mesh<MeshSimplify::Triangle, MVS::Mesh::FaceArr, MVS::Mesh::Face>(mesh.triangles, simplified.faces);
+    if (mesh.texcoords) {
+        fill_scene_texcoords<MVS::Mesh::TexCoordArr, MVS::Mesh::TexCoord>(mesh.uvs, simplified.texcoords);
+    }
+}
+
+// Build tile content of node and all its subtree
+void Tileset::build_content(Node & node) {
+    if (node.children.empty()) {
+        extract_leaf(node);
+    } else {
+        for (auto & child : node.children) {
+            Node * subtree = &child;
+            #pragma omp task firstprivate(subtree)
+            build_content(*subtree);
+        }
+        #pragma omp taskwait
+        Content merged;
+        merge_children(node, merged);
+        simplify_content(merged, node.content);
+        // Geometric error of parent: its mean edge length on top of the coarsest child
+        double error = 0, edges = 0;
+        for (auto const & face : node.content.faces) {
+            uint32_t ids[3] = {face.x, face.y, face.z};
+            for (int k = 0; k < 3; ++k) {
+                vec3f d = to_vec3f(node.content.vertices[ids[k]]) - to_vec3f(node.content.vertices[ids[(k + 1) % 3]]);
+                error += sqrt(d.dot(d));
+                ++edges;
+            }
+        }
+        node.geometric_error = edges > 0 ? error / edges : 0;
+        for (auto const & child : node.children) {
+            node.geometric_error += child.geometric_error / node.children.size();
+        }
+    }
+    node.faces_count = node.content.faces.size();
+    double texture_scale = node.source_faces ? std::min(1.0, sqrt((double)node.faces_count / node.source_faces)) : 1;
+    if (node.faces_count) {
+        write_content(node.content, texture_scale, output_dir / "tiles" / (node.id + ".glb"));
+    }
+    // Root is not merged into anything
+    if (node.depth == 0) {
+        node.content = Content();
+    }
+}
+
+// Texture charts of content packed into one image (downscaled by scale), texture coordinates of the image.
+// Chart is a set of faces connected through corners with the same vertex and texture coordinate. Charts are
+// packed into shelves by decreasing height
+cv::Mat Tileset::pack_texture(Content const & content, double const scale, MVS::Mesh::TexCoordArr & texcoords) const {
+    cv::Mat const & atlas = mesh.textureDiffuse;
+    ulong const corners = content.texcoords.size();
+    std::vector<uint32_t> parent(corners);
+    for (ulong c = 0; c < corners; ++c) {
+        parent[c] = uint32_t(c % 3 ? c - 1 : c);
+    }
+    std::unordered_map<CornerKey, uint32_t, CornerKeyHash> first_corner;
+    for (ulong f = 0; f < content.faces.size(); ++f) {
+        MVS::Mesh::Face const & face = content.faces[f];
+        uint32_t ids[3] = {face.x, face.y, face.z};
+        for (int k = 0; k < 3; ++k) {
+            uint32_t c = uint32_t(f * 3 + k);
+            CornerKey key = {ids[k], content.texcoords[c].x, content.texcoords[c].y};
+            auto it = first_corner.insert(std::make_pair(key, c)).first;
+            parent[find_root(parent, c)] = find_root(parent, it->second);
+        }
+    }
+
+    // Pixel rectangle of every chart in the atlas
+    struct Chart {
+        cv::Rect source, target;
+    };
+    std::vector<Chart> charts;
+    std::unordered_map<uint32_t, uint32_t> chart_of_root;
+    std::vector<uint32_t> chart_of_corner(corners);
+    std::vector<cv::Point2f> chart_min, chart_max;
+    for (ulong c = 0; c < corners; ++c) {
+        uint32_t root = find_root(parent, uint32_t(c));
+        auto it = chart_of_root.insert(std::make_pair(root, (uint32_t)charts.size())).first;
+        if (it->second == charts.size()) {
+            charts.push_back(Chart());
+            chart_min.push_back(cv::Point2f(1e30f, 1e30f));
+            chart_max.push_back(cv::Point2f(-1e30f, -1e30f));
+        }
+        uint32_t i = chart_of_corner[c] = it->second;
+        MVS::Mesh::TexCoord const & t = content.texcoords[c];
+        chart_min[i] = cv::Point2f(std::min(chart_min[i].x, t.x), std::min(chart_min[i].y, t.y));
+        chart_max[i] = cv::Point2f(std::max(chart_max[i].x, t.x), std::max(chart_max[i].y, t.y));
+    }
+    int max_width = 1;
+    double area = 0;
+    for (ulong i = 0; i < charts.size(); ++i) {
+        int x0 = std::max(0, int(std::floor(chart_min[i].x * atlas.cols)) - CHART_PADDING);
+        int y0 = std::max(0, int(std::floor(chart_min[i].y * atlas.rows)) - CHART_PADDING);
+        int x1 = std::min(atlas.cols, int(std::ceil(chart_max[i].x * atlas.cols)) + CHART_PADDING);
+        int y1 = std::min(atlas.rows, int(std::ceil(chart_max[i].y * atlas.rows)) + CHART_PADDING);
+        charts[i].source = cv::Rect(x0, y0, std::max(1, x1 - x0), std::max(1, y1 - y0));
+        charts[i].target = cv::Rect(0, 0, std::max(1, int(std::lround(charts[i].source.width * scale))),
+                                    std::max(1, int(std::lround(charts[i].source.height * scale))));
+        max_width = std::max(max_width, charts[i].target.width);
+        area += (double)charts[i].target.width * charts[i].target.height;
+    }
+
+    // Shelves of about square image
+    std::vector<uint32_t> order(charts.size());
+    for (ulong i = 0; i < order.size(); ++i) {
+        order[i] = uint32_t(i);
+    }
+    std::sort(order.begin(), order.end(), [&charts](uint32_t a, uint32_t b) {
+        return charts[a].target.height > charts[b].target.height;
+    });
+    int const width = std::max(max_width, int(std::ceil(std::sqrt(area))));
+    int x = 0, y = 0, shelf_height = 0;
+    for (auto i : order) {
+        cv::Rect & target = charts[i].target;
+        if (x + target.width > width) {
+            x = 0;
+            y += shelf_height;
+            shelf_height = 0;
+        }
+        target.x = x;
+        target.y = y;
+        x += target.width;
+        shelf_height = std::max(shelf_height, target.height);
+    }
+    cv::Mat texture(y + shelf_height, width, atlas.type(), cv::Scalar::all(0));
+    for (auto const & chart : charts) {
+        cv::Mat target = texture(chart.target);
+        if (chart.source.size() == chart.target.size()) {
+            atlas(chart.source).copyTo(target);
+        } else {
+            cv::resize(atlas(chart.source), target, chart.target.size(), 0, 0, cv::INTER_AREA);
+        }
+    }
+
+    // Position in the chart is scaled and moved to its place in the image
+    texcoords.resize(corners);
+    for (ulong c = 0; c < corners; ++c) {
+        Chart const & chart = charts[chart_of_corner[c]];
+        MVS::Mesh::TexCoord const & t = content.texcoords[c];
+        double scale_x = (double)chart.target.width / chart.source.width;
+        double scale_y = (double)chart.target.height / chart.source.height;
+        texcoords[c].x = float((chart.target.x + (t.x * atlas.cols - chart.source.x) * scale_x) / texture.cols);
+        texcoords[c].y = float((chart.target.y + (t.y * atlas.rows - chart.source.y) * scale_y) / texture.rows);
+    }
+    return texture;
+}
+
+// Save content as binary glTF with its own texture
+void Tileset::write_content(Content const & content, double const texture_scale, fs::path const & path) const {
+    bool textured = (content.texcoords.size() == content.faces.size() * 3) && !mesh.textureDiffuse.empty();
+    std::vector<unsigned char> png;
+    MVS::Mesh::TexCoordArr texcoords;
+    if (textured) {
+        cv::imencode(".png", pack_texture(content, texture_scale, texcoords), png);
+    }
+
+    // Texture coordinates are per face corner: vertices are split where they differ
+    std::vector<float> positions, uvs;
+    std::vector<uint32_t> indices;
+    indices.reserve(content.faces.size() * 3);
+    std::unordered_map<CornerKey, uint32_t, CornerKeyHash> corner_vertex;
+    for (ulong f = 0; f < content.faces.size(); ++f) {
+        MVS::Mesh::Face const & face = content.faces[f];
+        uint32_t ids[3] = {face.x, face.y, face.z};
+        for (int k = 0; k < 3; ++k) {
+            CornerKey key = {ids[k], textured ? texcoords[f * 3 + k].x : 0.0f, textured ? texcoords[f * 3 + k].y : 0.0f};
+            auto it = corner_vertex.insert(std::make_pair(key, uint32_t(positions.size() / 3))).first;
+            if (it->second == positions.size() / 3) {
+                MVS::Mesh::Vertex const & v = content.vertices[ids[k]];
+                // z-up of the tileset to y-up of glTF
+                positions.push_back(v.x);
+                positions.push_back(v.z);
+                positions.push_back(-v.y);
+                if (textured) {
+                    uvs.push_back(key.u);
+                    uvs.push_back(key.v);
+                }
+            }
+            indices.push_back(it->second);
+        }
+    }
+    float min[3] = {1e30f, 1e30f, 1e30f}, max[3] = {-1e30f, -1e30f, -1e30f};
+    for (ulong i = 0; i < positions.size(); ++i) {
+        min[i % 3] = std::min(min[i % 3], positions[i]);
+        max[i % 3] = std::max(max[i % 3], positions[i]);
+    }
+
+    // Binary chunk: indices, positions, texture coordinates and PNG, every view at 4-byte boundary
+    std::string bin;
+    auto append = [&bin](void const * data, ulong const size) {
+        ulong offset = bin.size();
+        if (size) {
+            bin.append(static_cast<char const *>(data), size);
+        }
+        bin.resize((bin.size() + 3) & ~ulong(3), '\0');
+        return offset;
+    };
+    ulong const indices_offset = append(indices.data(), indices.size() * sizeof(uint32_t));
+    ulong const positions_offset = append(positions.data(), positions.size() * sizeof(float));
+    ulong const uvs_offset = append(uvs.data(), uvs.size() * sizeof(float));
+    ulong const png_offset = append(png.data(), png.size());
+    ulong const count = positions.size() / 3;
+
+    std::ostringstream json;
+    json << std::setprecision(9);
+    json << "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],"
+         << "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":1" << (textured ? ",\"TEXCOORD_0\":2" : "")
+         << "},\"indices\":0" << (textured ? ",\"material\":0" : "") << "}]}],";
+    if (textured) {
+        // Texture is photographed lighting: it is shown as is
+        json << "\"extensionsUsed\":[\"KHR_materials_unlit\"],"
+             << "\"materials\":[{\"pbrMetallicRoughness\":{\"baseColorTexture\":{\"index\":0},\"metallicFactor\":0},"
+             << "\"extensions\":{\"KHR_materials_unlit\":{}}}],"
+             << "\"samplers\":[{\"magFilter\":9729,\"minFilter\":9729,\"wrapS\":33071,\"wrapT\":33071}],"
+             << "\"textures\":[{\"sampler\":0,\"source\":0}],"
+             << "\"images\":[{\"bufferView\":3,\"mimeType\":\"image/png\"}],";
+    }
+    json << "\"buffers\":[{\"byteLength\":" << bin.size() << "}],\"bufferViews\":["
+         << "{\"buffer\":0,\"byteOffset\":" << indices_offset << ",\"byteLength\":" << indices.size() * sizeof(uint32_t)
+         << ",\"target\":" << GL_ELEMENT_ARRAY_BUFFER << "},"
+         << "{\"buffer\":0,\"byteOffset\":" << positions_offset << ",\"byteLength\":"
+         << positions.size() * sizeof(float) << ",\"target\":" << GL_ARRAY_BUFFER << "}";
+    if (textured) {
+        json << ",{\"buffer\":0,\"byteOffset\":" << uvs_offset << ",\"byteLength\":" << uvs.size() * sizeof(float)
+             << ",\"target\":" << GL_ARRAY_BUFFER << "},"
+             << "{\"buffer\":0,\"byteOffset\":" << png_offset << ",\"byteLength\":" << png.size() << "}";
+    }
+    json << "],\"accessors\":["
+         << "{\"bufferView\":0,\"componentType\":" << GL_UNSIGNED_INT << ",\"count\":" << indices.size()
+         << ",\"type\":\"SCALAR\"},"
+         << "{\"bufferView\":1,\"componentType\":" << GL_FLOAT << ",\"count\":" << count << ",\"type\":\"VEC3\","
+         << "\"min\":[" << min[0] << "," << min[1] << "," << min[2] << "],"
+         << "\"max\":[" << max[0] << "," << max[1] << "," << max[2] << "]}";
+    if (textured) {
+        json << ",{\"bufferView\":2,\"componentType\":" << GL_FLOAT << ",\"count\":" << count << ",\"type\":\"VEC2\"}";
+    }
+    json << "]}";
+    std::string header = json.str();
+    header.resize((header.size() + 3) & ~ulong(3), ' ');
+
+    // GLB: header, JSON chunk and binary chunk
+    uint32_t words[5] = {GLB_MAGIC, 2, uint32_t(12 + 8 + header.size() + 8 + bin.size()),
+                         uint32_t(header.size()), GLB_JSON};
+    uint32_t bin_chunk[2] = {uint32_t(bin.size()), GLB_BIN};
+    std::ofstream out(path.string(), std::ios::binary);
+    out.write(reinterpret_cast<char const *>(words), sizeof(words));
+    out.write(header.data(), header.size());
+    out.write(reinterpret_cast<char const *>(bin_chunk), sizeof(bin_chunk));
+    out.write(bin.data(), bin.size());
+}
+
+// Write node and its children as tileset JSON
+void Tileset::write_node(std::ostream & out, Node const & node, int const indent) const {
+    std::string pad(indent, ' ');
+    vec3f center = (node.min + node.max) / 2;
+    vec3f half = (node.max - node.min) / 2;
+    out << pad << "{\n";
+    out << pad << "  \"boundingVolume\": {\"box\": [" << center.x << ", " << center.y << ", " << center.z << ", "
+        << half.x << ", 0, 0, 0, " << half.y << ", 0, 0, 0, " << half.z << "]},\n";
+    out << pad << "  \"geometricError\": " << node.geometric_error << ",\n";
+    out << pad << "  \"refine\": \"REPLACE\",\n";
+    out << pad << "  \"extras\": {\"faces\": " << node.faces_count << "}";
+    if (node.faces_count) {
+        out << ",\n" << pad << "  \"content\": {\"uri\": \"tiles/" << node.id << ".glb\"}";
+    }
+    if (!node.children.empty()) {
+        out << ",\n" << pad << "  \"children\": [\n";
+        for (ulong i = 0; i < node.children.size(); ++i) {
+            write_node(out, node.children[i], indent + 4);
+            out << (i + 1 < node.children.size() ? ",\n" : "\n");
+        }
+        out << pad << "  ]";
+    }
+    out << "\n" << pad << "}";
+}
+
+// Build octree, write tiles with their textures and tileset.json
+bool Tileset::build() {
+    if (mesh.faces.empty()) {
+        return false;
+    }
+    TD_TIMER_START();
+    fs::create_directories(output_dir / "tiles");
+
+    // Root node is a cube around the mesh
+    vec3f min(1e30, 1e30, 1e30), max(-1e30, -1e30, -1e30);
+    for (auto const & v : mesh.vertices) {
+        min = vec3f(fmin(min.x, v.x), fmin(min.y, v.y), fmin(min.z, v.z));
+        max = vec3f(fmax(max.x, v.x), fmax(max.y, v.y), fmax(max.z, v.z));
+    }
+    vec3f center = (min + max) / 2;
+    double half = fmax(max.x - min.x, fmax(max.y - min.y, max.z - min.z)) / 2;
+    root = Node();
+    root.id = "0";
+    root.min = center - vec3f(half, half, half);
+    root.max = center + vec3f(half, half, half);
+    root.faces.resize(mesh.faces.size());
+    for (ulong f = 0; f < mesh.faces.size(); ++f) {
+        root.faces[f] = f;
+    }
+    split(root);
+
+    // Subtrees are built in parallel
+    #pragma omp parallel
+    {
+        #pragma omp single
+        build_content(root);
+    }
+
+    // Tileset index
+    std::ofstream index((output_dir / "tileset.json").string());
+    // glTF content needs 3D Tiles 1.1
+    index << "{\n  \"asset\": {\"version\": \"1.1\"},\n";
+    index << "  \"geometricError\": " << root.geometric_error * 2 << ",\n";
+    index << "  \"root\":\n";
+    write_node(index, root, 2);
+    index << "\n}\n";
+    printf("Tileset written to %s (%s)\n", output_dir.c_str(), TD_TIMER_GET_FMT().c_str());
+    return true;
+}
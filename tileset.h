@@ -0,0 +1,87 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_TILESET_H
+#define RECONSTRUCTION_TILESET_H
+
+#include <OpenMVS/MVS.h>
+#include <ostream>
+#include "simplify_mesh.h"
+#include "utils.h"
+
+// Spatially tiled, streamable output of the textured mesh (https://github.com/CesiumGS/3d-tiles)
+//
+// 1. Faces are distributed over octree nodes by their centroids.
+//    A node is split while it has more than max_faces faces and depth is less than max_depth.
+// 2. Leaf tiles keep full resolution geometry. Parent tile is the union of its children
+//    simplified with MeshSimplify down to max_faces faces, texture coordinates are interpolated
+//    by the attribute-preserving decimation.
+// 3. Every tile is binary glTF tiles/<id>.glb (3D Tiles 1.1 content) with its own texture: texture charts
+//    of its faces are cut from the atlas and packed into a PNG embedded in the tile. Charts of parent tiles
+//    are downscaled as much as their geometry is, so the texture of a tile is about as large as its share
+//    of the atlas at its level of detail. glTF is y-up, positions are rotated as 3D Tiles expects.
+//    tileset.json describes the hierarchy: bounding boxes, geometric errors, content uri and faces count
+//    (in "extras"), so client downloads only visible tiles with needed detail and only their texels.
+//
+// Subtrees are built in parallel (OpenMP tasks), parent waits for its children.
+
+class Tileset {
+public:
+    // Tile geometry: vertices, faces and 3 texture coordinates per face
+    struct Content {
+        MVS::Mesh::VertexArr vertices;
+        MVS::Mesh::FaceArr faces;
+        MVS::Mesh::TexCoordArr texcoords;
+    };
+private:
+    struct Node {
+        std::string id;
+        int depth = 0;
+        vec3f min = vec3f(0, 0, 0), max = vec3f(0, 0, 0);
+        std::vector<uint32_t> faces;  // faces of the source mesh, released after leaf extraction
+        std::vector<Node> children;
+        Content content;              // released after parent is built
+        ulong faces_count = 0;
+        // Faces of the source mesh in the subtree, texture of the tile is downscaled as much as its geometry
+        ulong source_faces = 0;
+        double geometric_error = 0;
+    };
+
+    MVS::Mesh const & mesh;
+    fs::path output_dir;
+    ulong max_faces;
+    int max_depth;
+    Node root;
+
+    // Distribute faces of node over 8 children
+    void split(Node & node);
+
+    // Build tile content of node and all its subtree
+    void build_content(Node & node);
+
+    // Full resolution faces of the source mesh for leaf tile
+    void extract_leaf(Node & node);
+
+    // Union of children contents, vertices with equal position are welded
+    void merge_children(Node & node, Content & merged);
+
+    // Simplify content to max_faces faces
+    void simplify_content(Content const & source, Content & simplified);
+
+    // Texture charts of content packed into one image (downscaled by scale), texture coordinates of the image
+    cv::Mat pack_texture(Content const & content, double const scale, MVS::Mesh::TexCoordArr & texcoords) const;
+
+    // Save content as binary glTF with its own texture
+    void write_content(Content const & content, double const texture_scale, fs::path const & path) const;
+
+    // Write node and its children as tileset JSON
+    void write_node(std::ostream & out, Node const & node, int const indent) const;
+public:
+    Tileset(MVS::Mesh const & mesh, fs::path const & output_dir, ulong const max_faces, int const max_depth);
+
+    // Build octree, write tiles with their textures and tileset.json
+    bool build();
+};
+
+#endif //RECONSTRUCTION_TILESET_H
@@ -0,0 +1,319 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "tracing.h"
+
+thread_local Trace * Trace::current_trace = nullptr;
+
+Trace::Trace() : origin(std::chrono::steady_clock::now()) {}
+
+// Trace of this process
+Trace & Trace::global() {
+    static Trace trace;
+    return trace;
+}
+
+// Trace of the calling thread: the one made current, otherwise the process trace
+Trace & Trace::current() {
+    return current_trace ? *current_trace : global();
+}
+
+// Stages of the calling thread go to this trace (nullptr - process trace), returns the previous one
+Trace * Trace::make_current(Trace * trace) {
+    Trace * previous = current_trace;
+    current_trace = trace;
+    return previous;
+}
+
+double Trace::now() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+}
+
+// Peak memory since the last reset goes to every open stage, then it is reset
+void Trace::fold_peak_memory() {
+    double resident = 0, peak = 0;
+    memory_mb(resident, peak);
+    for (ulong i : open_stages) {
+        stages[i].peak_memory_mb = std::max(stages[i].peak_memory_mb, peak);
+    }
+    peak_reset = reset_peak_memory();
+}
+
+void Trace::begin(std::string const & name) {
+    fold_peak_memory();
+    Stage stage;
+    stage.name = name;
+    stage.depth = open_stages.size();
+    stage.path = open_stages.empty() ? name : stages[open_stages.back()].path + " / " + name;
+    stage.start = now();
+    stage.cpu_start = cpu_seconds();
+    stages.push_back(stage);
+    open_stages.push_back(stages.size() - 1);
+    if (on_begin) {
+        on_begin(stages.back());
+    }
+}
+
+void Trace::end() {
+    if (open_stages.empty()) {
+        return;
+    }
+    fold_peak_memory();
+    Stage & stage = stages[open_stages.back()];
+    stage.wall_seconds = now() - stage.start;
+    stage.cpu_seconds = cpu_seconds() - stage.cpu_start;
+    stage.open = false;
+    open_stages.pop_back();
+    if (on_end) {
+        on_end(stage);
+    }
+}
+
+// Item count of the innermost open stage (the last value of the key is kept)
+void Trace::count(std::string const & key, double const value) {
+    if (open_stages.empty()) {
+        return;
+    }
+    auto & counts = stages[open_stages.back()].counts;
+    for (auto & item : counts) {
+        if (item.first == key) {
+            item.second = value;
+            return;
+        }
+    }
+    counts.push_back(std::make_pair(key, value));
+}
+
+// Size of file or directory in bytes as "<key>_bytes" count of the innermost open stage (skipped if missing)
+void Trace::file(std::string const & key, fs::path const & path) {
+    std::error_code error;
+    if (fs::exists(path, error)) {
+        count(key + "_bytes", path_bytes(path));
+    }
+}
+
+// External tool run of the innermost open stage, its peak is the peak of tools of every open stage
+void Trace::external(External const & run) {
+    if (open_stages.empty()) {
+        return;
+    }
+    External recorded = run;
+    recorded.start = now() - run.seconds;
+    stages[open_stages.back()].externals.push_back(recorded);
+    for (ulong i : open_stages) {
+        stages[i].external_peak_memory_mb = std::max(stages[i].external_peak_memory_mb, run.peak_memory_mb);
+    }
+}
+
+// Stage fields shared by trace event arguments and summary
+static std::string stage_fields(Trace::Stage const & stage) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "\"wall_seconds\": %.4f, \"cpu_seconds\": %.4f, \"peak_memory_mb\": %.1f, "
+             "\"external_peak_memory_mb\": %.1f", stage.wall_seconds, stage.cpu_seconds, stage.peak_memory_mb,
+             stage.external_peak_memory_mb);
+    std::string fields = std::string(buffer) + ", \"counts\": {";
+    for (ulong i = 0; i < stage.counts.size(); ++i) {
+        snprintf(buffer, sizeof(buffer), "%s%s: %.17g", i ? ", " : "", json_string(stage.counts[i].first).c_str(),
+                 stage.counts[i].second);
+        fields += buffer;
+    }
+    return fields + "}";
+}
+
+static std::string external_fields(Trace::External const & run) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "\"wall_seconds\": %.4f, \"cpu_seconds\": %.4f, \"peak_memory_mb\": %.1f, "
+             "\"status\": %d", run.seconds, run.cpu_seconds, run.peak_memory_mb, run.status);
+    return "\"command\": " + json_string(run.command) + ", " + buffer;
+}
+
+// Chrome trace events (stages on one track, external tools on another) and summary JSON
+bool Trace::write(fs::path const & trace_path, fs::path const & summary_path) const {
+    long pid = getpid();
+    char buffer[256];
+    std::string events = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    snprintf(buffer, sizeof(buffer),
+             "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": 1, \"args\": {\"name\": \"stages\"}},\n"
+             "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": 2, "
+             "\"args\": {\"name\": \"external tools\"}}", pid, pid);
+    events += buffer;
+    double total_wall = 0, total_cpu = 0, total_peak = 0;
+    for (auto const & stage : stages) {
+        if (stage.open) {
+            continue;
+        }
+        snprintf(buffer, sizeof(buffer), ",\n{\"ph\": \"X\", \"cat\": \"stage\", \"pid\": %ld, \"tid\": 1, "
+                 "\"ts\": %.0f, \"dur\": %.0f, \"name\": ", pid, stage.start * 1e6, stage.wall_seconds * 1e6);
+        events += buffer + json_string(stage.name) + ", \"args\": {" + stage_fields(stage) + "}}";
+        // Memory track: peak of the process and of its tools at the end of every stage
+        snprintf(buffer, sizeof(buffer), ",\n{\"ph\": \"C\", \"name\": \"peak memory MB\", \"pid\": %ld, "
+                 "\"ts\": %.0f, \"args\": {\"process\": %.1f, \"external\": %.1f}}", pid,
+                 (stage.start + stage.wall_seconds) * 1e6, stage.peak_memory_mb, stage.external_peak_memory_mb);
+        events += buffer;
+        for (auto const & run : stage.externals) {
+            std::string tool = run.command.substr(0, run.command.find(' '));
+            snprintf(buffer, sizeof(buffer), ",\n{\"ph\": \"X\", \"cat\": \"external\", \"pid\": %ld, \"tid\": 2, "
+                     "\"ts\": %.0f, \"dur\": %.0f, \"name\": ", pid, run.start * 1e6, run.seconds * 1e6);
+            events += buffer + json_string(fs::path(tool).filename().string()) + ", \"args\": {" +
+                      external_fields(run) + "}}";
+        }
+        if (stage.depth == 0) {
+            total_wall += stage.wall_seconds;
+            total_cpu += stage.cpu_seconds;
+            total_peak = std::max(total_peak, std::max(stage.peak_memory_mb, stage.external_peak_memory_mb));
+        }
+    }
+    events += "\n]}\n";
+
+    snprintf(buffer, sizeof(buffer), "{\n  \"wall_seconds\": %.4f,\n  \"cpu_seconds\": %.4f,\n"
+             "  \"peak_memory_mb\": %.1f,\n  \"peak_memory_per_stage\": %s,\n  \"stages\": [",
+             total_wall, total_cpu, total_peak, peak_reset ? "true" : "false");
+    std::string summary = buffer;
+    bool first = true;
+    for (auto const & stage : stages) {
+        if (stage.open) {
+            continue;
+        }
+        snprintf(buffer, sizeof(buffer), "\"depth\": %d, \"start_seconds\": %.4f, ", stage.depth, stage.start);
+        summary += std::string(first ? "" : ",") + "\n    {\"stage\": " + json_string(stage.path) + ", " + buffer +
+                   stage_fields(stage) + ", \"external\": [";
+        for (ulong i = 0; i < stage.externals.size(); ++i) {
+            summary += std::string(i ? ", " : "") + "{" + external_fields(stage.externals[i]) + "}";
+        }
+        summary += "]}";
+        first = false;
+    }
+    summary += "\n  ]\n}\n";
+
+    std::ofstream trace_file(trace_path.string());
+    trace_file << events;
+    std::ofstream summary_file(summary_path.string());
+    summary_file << summary;
+    return bool(trace_file) && bool(summary_file);
+}
+
+// Peak resident memory of the process is reset (Linux 4.0+), false if it can't be
+bool reset_peak_memory() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.close();
+    return bool(clear_refs);
+}
+
+// Resident and peak resident memory of the process in MB
+void memory_mb(double & resident, double & peak) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    resident = peak = 0;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            peak = atof(line.c_str() + 6) / 1024;
+        } else if (line.compare(0, 6, "VmRSS:") == 0) {
+            resident = atof(line.c_str() + 6) / 1024;
+        }
+    }
+}
+
+static double rusage_seconds(struct rusage const & usage) {
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// User and system CPU time of the process and of its waited children
+double cpu_seconds() {
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    return rusage_seconds(self) + rusage_seconds(children);
+}
+
+// Size of file or of all files in directory (0 if missing)
+ulong path_bytes(fs::path const & path) {
+    std::error_code error;
+    if (fs::is_regular_file(path, error)) {
+        return fs::file_size(path, error);
+    }
+    ulong bytes = 0;
+    if (fs::is_directory(path, error)) {
+        for (auto const & entry : fs::recursive_directory_iterator(path, error)) {
+            if (fs::is_regular_file(entry.path(), error)) {
+                bytes += fs::file_size(entry.path(), error);
+            }
+        }
+    }
+    return bytes;
+}
+
+// Quoted JSON string
+std::string json_string(std::string const & text) {
+    std::string result = "\"";
+    for (char c : text) {
+        if ((c == '"') || (c == '\\')) {
+            result += '\\';
+        }
+        result += ((unsigned char)c < 0x20) ? ' ' : c;
+    }
+    return result + "\"";
+}
+
+// Run shell command as system(...) does and measure peak resident memory and wall time of the child.
+// The run is recorded in the current stage of the current trace.
+// If cancel flag is set while the command runs, it is terminated and -1 is returned
+int run_measured(std::string const & command, double & peak_memory_mb, double & seconds,
+                 std::atomic<bool> const * cancel) {
+    auto start = std::chrono::steady_clock::now();
+    peak_memory_mb = 0;
+    seconds = 0;
+    if (cancel && cancel->load()) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", command.c_str(), (char *) nullptr);
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    // Cancellable run is polled: shell execs the tool, so terminating the child stops the tool
+    pid_t waited = 0;
+    bool terminated = false;
+    while (cancel && ((waited = wait4(pid, &status, WNOHANG, &usage)) == 0)) {
+        if (cancel->load() && !terminated) {
+            kill(pid, SIGTERM);
+            terminated = true;
+        }
+        usleep(100000);
+    }
+    if (!cancel) {
+        waited = wait4(pid, &status, 0, &usage);
+    }
+    if (waited < 0) {
+        return -1;
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // ru_maxrss is in kilobytes on Linux
+    peak_memory_mb = usage.ru_maxrss / 1024.0;
+    Trace::External run;
+    run.command = command;
+    run.seconds = seconds;
+    run.cpu_seconds = rusage_seconds(usage);
+    run.peak_memory_mb = peak_memory_mb;
+    run.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    Trace::current().external(run);
+    return terminated ? -1 : status;
+}
+
+// Run shell command as system(...) does, it is only measured in the current trace
+int run_traced(std::string const & command, std::atomic<bool> const * cancel) {
+    double peak_memory_mb = 0, seconds = 0;
+    return run_measured(command, peak_memory_mb, seconds, cancel);
+}
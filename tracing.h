@@ -0,0 +1,150 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_TRACING_H
+#define RECONSTRUCTION_TRACING_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "utils.h"
+
+// Per stage tracing of the pipeline
+//
+// Every stage is a scope (TraceStage) and stages nest: run / COLMAP step / OpenMVS step. For each stage
+// wall time, CPU time (of the process and of external tools it waited for), peak resident memory of the
+// process during the stage, peak of external tools, item counts (images, points, faces) and sizes of
+// input and output files are recorded. External tools run by run_measured are recorded with their
+// command, exit status, time and peak memory.
+//
+// Peak memory is reset at stage boundaries (/proc/self/clear_refs, Linux 4.0+) and folded into all open
+// stages, so nested stages don't hide peaks of outer ones. Without reset it is the process peak so far.
+//
+// The trace is written in Chrome trace event format (chrome://tracing or ui.perfetto.dev) together with
+// a summary JSON. Stages go to the current trace of the thread (the process trace by default), so pipelines
+// on different threads keep their own traces. Peak memory and CPU time are of the whole process.
+
+class Trace {
+public:
+    struct External {
+        std::string command;
+        double start = 0;
+        double seconds = 0;
+        double cpu_seconds = 0;
+        double peak_memory_mb = 0;
+        int status = 0;
+    };
+
+    struct Stage {
+        std::string name;
+        // Names of enclosing stages and this one: "Run / COLMAP / Matching"
+        std::string path;
+        int depth = 0;
+        double start = 0;
+        double wall_seconds = 0;
+        double cpu_seconds = 0;
+        double peak_memory_mb = 0;
+        double external_peak_memory_mb = 0;
+        std::vector<std::pair<std::string, double>> counts;
+        std::vector<External> externals;
+        double cpu_start = 0;
+        bool open = true;
+    };
+private:
+    std::chrono::steady_clock::time_point origin;
+    std::vector<Stage> stages;
+    // Indices of open stages, the innermost is the last
+    std::vector<ulong> open_stages;
+    bool peak_reset = false;
+    static thread_local Trace * current_trace;
+
+    // Seconds since the trace began
+    double now() const;
+
+    // Peak memory since the last reset goes to every open stage, then it is reset
+    void fold_peak_memory();
+public:
+    // Observers of the stages: called when stage begins and when it ends with its measurements
+    std::function<void(Stage const &)> on_begin;
+    std::function<void(Stage const &)> on_end;
+
+    Trace();
+
+    // Trace of this process
+    static Trace & global();
+
+    // Trace of the calling thread: the one made current, otherwise the process trace
+    static Trace & current();
+
+    // Stages of the calling thread go to this trace (nullptr - process trace), returns the previous one
+    static Trace * make_current(Trace * trace);
+
+    void begin(std::string const & name);
+
+    void end();
+
+    // Item count of the innermost open stage (the last value of the key is kept)
+    void count(std::string const & key, double const value);
+
+    // Size of file or directory in bytes as "<key>_bytes" count of the innermost open stage (skipped if missing)
+    void file(std::string const & key, fs::path const & path);
+
+    // External tool run of the innermost open stage
+    void external(External const & run);
+
+    // Chrome trace events and summary JSON
+    bool write(fs::path const & trace_path, fs::path const & summary_path) const;
+};
+
+// Stage of the current trace for the lifetime of the scope
+class TraceStage {
+public:
+    explicit TraceStage(std::string const & name) {
+        Trace::current().begin(name);
+    }
+
+    ~TraceStage() {
+        Trace::current().end();
+    }
+
+    TraceStage(TraceStage const &) = delete;
+    TraceStage & operator=(TraceStage const &) = delete;
+
+    void count(std::string const & key, double const value) {
+        Trace::current().count(key, value);
+    }
+
+    void file(std::string const & key, fs::path const & path) {
+        Trace::current().file(key, path);
+    }
+};
+
+// Peak resident memory of the process is reset (Linux 4.0+), false if it can't be
+bool reset_peak_memory();
+
+// Resident and peak resident memory of the process in MB
+void memory_mb(double & resident, double & peak);
+
+// User and system CPU time of the process and of its waited children
+double cpu_seconds();
+
+// Size of file or of all files in directory (0 if missing)
+ulong path_bytes(fs::path const & path);
+
+// Quoted JSON string
+std::string json_string(std::string const & text);
+
+// Run shell command as system(...) does and measure peak resident memory and wall time of the child.
+// The run is recorded in the current stage of the current trace.
+// If cancel flag is set while the command runs, it is terminated and -1 is returned
+int run_measured(std::string const & command, double & peak_memory_mb, double & seconds,
+                 std::atomic<bool> const * cancel = nullptr);
+
+// Run shell command as system(...) does, it is only measured in the current trace
+int run_traced(std::string const & command, std::atomic<bool> const * cancel = nullptr);
+
+#endif //RECONSTRUCTION_TRACING_H
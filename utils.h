@@ -14,9 +14,11 @@ namespace local_path {
     static fs::path WORKING_PATH = "/result";
     static fs::path SEQUENTIAL_PATH = "/sequential_matching";
     static fs::path EXHAUSTIVE_PATH = "/exhaustive_matching";
+    static fs::path COARSE_TO_FINE_PATH = "/coarse_to_fine";
     static fs::path DATABASE_PATH = "/database.db";
     static fs::path OPENMVS_BIN = "/usr/local/bin/OpenMVS";
     static fs::path COLMAP_BIN = "/usr/local/bin";
+    static fs::path RECONSTRUCTION_BIN = "/usr/local/bin/Reconstruction";
 }
 
 #endif //RECONSTRUCTION_UTILS_H
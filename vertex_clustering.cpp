@@ -0,0 +1,399 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+#include "vertex_clustering.h"
+
+// Cells per axis are limited by 21 bits of the cell key
+static uint64_t const MAX_CELLS_PER_AXIS = (1 << 21) - 1;
+// Occupied cells per surface area of one cell (averaged over orientations of the surface)
+static double const CELLS_PER_AREA = 1.5;
+// Per thread cache of cluster sums
+static uint32_t const CACHE_SIZE = 4096;
+static uint32_t const NO_CLUSTER = uint32_t(-1);
+
+// Sums of cluster: plane quadric (10), positions of vertices (3) and their count
+struct ClusterSum {
+    double v[14];
+};
+
+// Recently used clusters of one thread. Evicted and remaining sums are added to shared ones atomically
+class ClusterCache {
+    std::vector<uint32_t> ids;
+    std::vector<ClusterSum> sums;
+    std::vector<ClusterSum> & shared;
+
+    void flush(uint32_t const slot) {
+        if (ids[slot] == NO_CLUSTER) {
+            return;
+        }
+        ClusterSum & target = shared[ids[slot]];
+        for (int k = 0; k < 14; ++k) {
+            #pragma omp atomic
+            target.v[k] += sums[slot].v[k];
+        }
+        ids[slot] = NO_CLUSTER;
+    }
+public:
+    explicit ClusterCache(std::vector<ClusterSum> & shared) :
+            ids(CACHE_SIZE, NO_CLUSTER), sums(CACHE_SIZE), shared(shared)
+    {}
+
+    ~ClusterCache() {
+        for (uint32_t slot = 0; slot < CACHE_SIZE; ++slot) {
+            flush(slot);
+        }
+    }
+
+    // Sum of cluster to add to
+    ClusterSum & at(uint32_t const cluster) {
+        uint32_t slot = cluster % CACHE_SIZE;
+        if (ids[slot] != cluster) {
+            flush(slot);
+            ids[slot] = cluster;
+            std::fill(sums[slot].v, sums[slot].v + 14, 0.0);
+        }
+        return sums[slot];
+    }
+};
+
+VertexClustering::VertexClustering(ulong const target_faces) :
+        target_faces(target_faces)
+{}
+
+// In memory mesh: 3 floats per vertex, 3 indices per face
+bool VertexClustering::cluster(float const * vertices, ulong const v_count, uint32_t const * triangles,
+                               ulong const t_count)
+{
+    return cluster(v_count, [vertices](ulong const i) {
+        return vec3f(vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]);
+    }, t_count, [triangles](ulong const i, uint32_t ids[3]) {
+        ids[0] = triangles[i * 3];
+        ids[1] = triangles[i * 3 + 1];
+        ids[2] = triangles[i * 3 + 2];
+    });
+}
+
+template <class VertexAt, class FaceAt>
+bool VertexClustering::cluster(ulong const v_count, VertexAt const & vertex_at, ulong const t_count,
+                               FaceAt const & face_at)
+{
+    points.clear();
+    faces.clear();
+    if ((v_count == 0) || (t_count <= target_faces)) {
+        return false;
+    }
+    long const vertices_count = v_count;
+    long const faces_count = t_count;
+
+    // 1. Bounding box and surface area give the cell size
+    double min_x = 1e300, min_y = 1e300, min_z = 1e300, max_x = -1e300, max_y = -1e300, max_z = -1e300;
+    #pragma omp parallel for reduction(min: min_x, min_y, min_z) reduction(max: max_x, max_y, max_z)
+    for (long i = 0; i < vertices_count; ++i) {
+        vec3f p = vertex_at(i);
+        min_x = std::min(min_x, p.x); min_y = std::min(min_y, p.y); min_z = std::min(min_z, p.z);
+        max_x = std::max(max_x, p.x); max_y = std::max(max_y, p.y); max_z = std::max(max_z, p.z);
+    }
+    double area = 0;
+    #pragma omp parallel for reduction(+: area)
+    for (long i = 0; i < faces_count; ++i) {
+        uint32_t ids[3];
+        face_at(i, ids);
+        vec3f p0 = vertex_at(ids[0]), n;
+        n.cross(vertex_at(ids[1]) - p0, vertex_at(ids[2]) - p0);
+        area += sqrt(n.dot(n)) / 2;
+    }
+    vec3f const origin(min_x, min_y, min_z);
+    double extent = std::max(max_x - min_x, std::max(max_y - min_y, max_z - min_z));
+    double cell = sqrt(CELLS_PER_AREA * area / std::max(1.0, target_faces / 2.0));
+    cell = std::max(cell, extent / MAX_CELLS_PER_AXIS);
+    if (!(cell > 0)) {
+        return false;
+    }
+
+    // 2. Cell key of every vertex, clusters are occupied cells
+    std::vector<uint64_t> keys(v_count);
+    #pragma omp parallel for
+    for (long i = 0; i < vertices_count; ++i) {
+        vec3f g = (vertex_at(i) - origin) / cell;
+        uint64_t x = std::min(MAX_CELLS_PER_AXIS, (uint64_t)std::max(0.0, g.x));
+        uint64_t y = std::min(MAX_CELLS_PER_AXIS, (uint64_t)std::max(0.0, g.y));
+        uint64_t z = std::min(MAX_CELLS_PER_AXIS, (uint64_t)std::max(0.0, g.z));
+        keys[i] = (x << 42) | (y << 21) | z;
+    }
+    std::vector<uint32_t> vertex_cluster(v_count);
+    std::vector<uint64_t> cluster_keys;
+    {
+        std::unordered_map<uint64_t, uint32_t> clusters;
+        clusters.reserve(target_faces);
+        for (ulong i = 0; i < v_count; ++i) {
+            auto it = clusters.insert(std::make_pair(keys[i], (uint32_t)cluster_keys.size())).first;
+            if (it->second == cluster_keys.size()) {
+                cluster_keys.push_back(keys[i]);
+            }
+            vertex_cluster[i] = it->second;
+        }
+    }
+    keys = std::vector<uint64_t>();
+
+    // 3. Sums of clusters: positions of vertices, plane quadrics of faces. Faces of three clusters survive
+    std::vector<ClusterSum> sums(cluster_keys.size());
+    for (auto & sum : sums) {
+        std::fill(sum.v, sum.v + 14, 0.0);
+    }
+    std::vector<std::vector<CompactMeshSimplify::Face>> kept(omp_get_max_threads());
+    #pragma omp parallel
+    {
+        ClusterCache cache(sums);
+        #pragma omp for schedule(static)
+        for (long i = 0; i < vertices_count; ++i) {
+            ClusterSum & sum = cache.at(vertex_cluster[i]);
+            vec3f p = vertex_at(i);
+            sum.v[10] += p.x;
+            sum.v[11] += p.y;
+            sum.v[12] += p.z;
+            sum.v[13] += 1;
+        }
+        std::vector<CompactMeshSimplify::Face> & out = kept[omp_get_thread_num()];
+        #pragma omp for schedule(static)
+        for (long i = 0; i < faces_count; ++i) {
+            uint32_t ids[3];
+            face_at(i, ids);
+            vec3f p0 = vertex_at(ids[0]), n;
+            n.cross(vertex_at(ids[1]) - p0, vertex_at(ids[2]) - p0);
+            double length = sqrt(n.dot(n));
+            if (length > 0) {
+                // Quadric is weighted by area of the face
+                n = n / length;
+                SymmetricMatrix q(n.x, n.y, n.z, -n.dot(p0));
+                for (int j = 0; j < 3; ++j) {
+                    ClusterSum & sum = cache.at(vertex_cluster[ids[j]]);
+                    for (int k = 0; k < 10; ++k) {
+                        sum.v[k] += q[k] * length / 2;
+                    }
+                }
+            }
+            CompactMeshSimplify::Face face = {{vertex_cluster[ids[0]], vertex_cluster[ids[1]], vertex_cluster[ids[2]]}};
+            if ((face.v[0] != face.v[1]) && (face.v[1] != face.v[2]) && (face.v[2] != face.v[0])) {
+                // Smallest cluster first, orientation is kept
+                while ((face.v[0] > face.v[1]) || (face.v[0] > face.v[2])) {
+                    uint32_t first = face.v[0];
+                    face.v[0] = face.v[1];
+                    face.v[1] = face.v[2];
+                    face.v[2] = first;
+                }
+                out.push_back(face);
+            }
+        }
+    }
+    vertex_cluster = std::vector<uint32_t>();
+
+    // Faces from several original ones are merged
+    for (auto & out : kept) {
+        faces.insert(faces.end(), out.begin(), out.end());
+        out = std::vector<CompactMeshSimplify::Face>();
+    }
+    auto less = [](CompactMeshSimplify::Face const & a, CompactMeshSimplify::Face const & b) {
+        return (a.v[0] != b.v[0]) ? (a.v[0] < b.v[0]) : ((a.v[1] != b.v[1]) ? (a.v[1] < b.v[1]) : (a.v[2] < b.v[2]));
+    };
+    auto equal = [](CompactMeshSimplify::Face const & a, CompactMeshSimplify::Face const & b) {
+        return (a.v[0] == b.v[0]) && (a.v[1] == b.v[1]) && (a.v[2] == b.v[2]);
+    };
+    std::sort(faces.begin(), faces.end(), less);
+    faces.erase(std::unique(faces.begin(), faces.end(), equal), faces.end());
+
+    // 4. Representatives of clusters used by faces
+    std::vector<uint32_t> remap(cluster_keys.size(), NO_CLUSTER);
+    for (auto const & face : faces) {
+        for (int j = 0; j < 3; ++j) {
+            remap[face.v[j]] = 0;
+        }
+    }
+    uint32_t used = 0;
+    for (auto & id : remap) {
+        if (id != NO_CLUSTER) {
+            id = used++;
+        }
+    }
+    points.resize(used);
+    long const clusters_count = cluster_keys.size();
+    #pragma omp parallel for
+    for (long c = 0; c < clusters_count; ++c) {
+        if (remap[c] == NO_CLUSTER) {
+            continue;
+        }
+        double const * s = sums[c].v;
+        vec3f p = vec3f(s[10], s[11], s[12]) / s[13];
+        SymmetricMatrix q(s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8], s[9]);
+        double det = q.det(0, 1, 2, 1, 4, 5, 2, 5, 7);
+        if (det != 0) {
+            vec3f optimal(-1 / det * q.det(1, 2, 3, 4, 5, 6, 5, 7, 8),
+                           1 / det * q.det(0, 2, 3, 1, 5, 6, 2, 7, 8),
+                          -1 / det * q.det(0, 1, 3, 1, 4, 6, 2, 5, 8));
+            // Optimal point is used if it stays within the cell (with half cell margin)
+            uint64_t key = cluster_keys[c];
+            vec3f low = origin + vec3f(double(key >> 42), double((key >> 21) & MAX_CELLS_PER_AXIS),
+                                       double(key & MAX_CELLS_PER_AXIS)) * cell;
+            vec3f g = (optimal - low) / cell;
+            if ((g.x > -0.5) && (g.x < 1.5) && (g.y > -0.5) && (g.y < 1.5) && (g.z > -0.5) && (g.z < 1.5)) {
+                p = optimal;
+            }
+        }
+        CompactMeshSimplify::Point & point = points[remap[c]];
+        point.x = p.x;
+        point.y = p.y;
+        point.z = p.z;
+    }
+    #pragma omp parallel for
+    for (long i = 0; i < (long)faces.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            faces[i].v[j] = remap[faces[i].v[j]];
+        }
+    }
+    printf("Vertex clustering: %lu -> %zu faces, %zu clusters (cell %g)\n", t_count, faces.size(), points.size(), cell);
+    return !faces.empty();
+}
+
+// Layout of binary little endian PLY with float x, y, z vertices and triangle lists (false if unsupported)
+bool read_ply_layout(fs::path const & path, PlyLayout & layout) {
+    // Header: vertex record layout and face list types
+    std::ifstream ply(path.string(), std::ios::binary);
+    std::string line, element;
+    layout = PlyLayout();
+    int xyz_found = 0;
+    bool binary = false, face_list = false, face_other = false;
+    auto type_size = [](std::string const & type) -> ulong {
+        if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+        if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+        if (type == "int" || type == "uint" || type == "float" || type == "int32" || type == "uint32" ||
+            type == "float32") return 4;
+        if (type == "double" || type == "float64") return 8;
+        return 0;
+    };
+    while (std::getline(ply, line) && (line.compare(0, 10, "end_header") != 0)) {
+        std::istringstream words(line);
+        std::string word, type, name;
+        words >> word;
+        if (word == "format") {
+            words >> type;
+            binary = type == "binary_little_endian";
+        } else if (word == "element") {
+            words >> element;
+            if (element == "vertex") {
+                words >> layout.v_count;
+            } else if (element == "face") {
+                words >> layout.t_count;
+            } else {
+                return false;
+            }
+        } else if ((word == "property") && (element == "vertex")) {
+            words >> type >> name;
+            char const * axes[3] = {"x", "y", "z"};
+            for (int k = 0; k < 3; ++k) {
+                if ((name == axes[k]) && (type_size(type) == 4) && (type[0] == 'f')) {
+                    layout.xyz_offset[k] = layout.v_stride;
+                    ++xyz_found;
+                }
+            }
+            layout.v_stride += type_size(type);
+        } else if ((word == "property") && (element == "face")) {
+            std::string count_type, index_type;
+            words >> type >> count_type >> index_type;
+            face_list = (type == "list") && (type_size(count_type) == 1) && (type_size(index_type) == 4) &&
+                        (index_type[0] != 'f');
+            face_other = face_other || (type != "list");
+        }
+    }
+    if (!ply || !binary || (xyz_found != 3) || !face_list || face_other) {
+        return false;
+    }
+    layout.data_offset = ply.tellg();
+    return true;
+}
+
+// Supported PLY file mapped read-only
+MappedPly::MappedPly(fs::path const & path) {
+    if (!read_ply_layout(path, layout)) {
+        return;
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    ulong const file_size = info.st_size;
+    if (layout.data_offset + layout.v_count * layout.v_stride + layout.t_count * layout.f_stride > file_size) {
+        close(fd);
+        return;
+    }
+    void * data = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return;
+    }
+    mapped = data;
+    size = file_size;
+    vertices = (char const *)mapped + layout.data_offset;
+    triangles = vertices + layout.v_count * layout.v_stride;
+    madvise(mapped, size, MADV_SEQUENTIAL);
+}
+
+MappedPly::~MappedPly() {
+    if (mapped) {
+        munmap(mapped, size);
+    }
+}
+
+// Faces which aren't triangles
+ulong MappedPly::polygons_count() const {
+    long polygons = 0;
+    #pragma omp parallel for reduction(+: polygons)
+    for (long i = 0; i < (long)layout.t_count; ++i) {
+        if (triangles[i * layout.f_stride] != 3) {
+            ++polygons;
+        }
+    }
+    return polygons;
+}
+
+void MappedPly::vertex(ulong const i, float xyz[3]) const {
+    for (int k = 0; k < 3; ++k) {
+        memcpy(xyz + k, vertices + i * layout.v_stride + layout.xyz_offset[k], sizeof(float));
+    }
+}
+
+void MappedPly::face(ulong const i, uint32_t ids[3]) const {
+    memcpy(ids, triangles + i * layout.f_stride + 1, 3 * sizeof(uint32_t));
+}
+
+// Binary little endian PLY with float x, y, z vertices and triangles, read through memory mapping
+bool VertexClustering::cluster_ply(fs::path const & path) {
+    MappedPly ply(path);
+    if (!ply.is_open()) {
+        std::cerr << "Vertex clustering: unsupported PLY " << path << std::endl;
+        return false;
+    }
+    // Only triangles are supported: every face record has the same size
+    ulong polygons = ply.polygons_count();
+    if (polygons > 0) {
+        std::cerr << "Vertex clustering: " << polygons << " faces of " << path << " are not triangles" << std::endl;
+        return false;
+    }
+    return cluster(ply.layout.v_count, [&ply](ulong const i) {
+        float xyz[3];
+        ply.vertex(i, xyz);
+        return vec3f(xyz[0], xyz[1], xyz[2]);
+    }, ply.layout.t_count, [&ply](ulong const i, uint32_t ids[3]) {
+        ply.face(i, ids);
+    });
+}
@@ -0,0 +1,81 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_VERTEX_CLUSTERING_H
+#define RECONSTRUCTION_VERTEX_CLUSTERING_H
+
+#include "compact_simplify_mesh.h"
+#include "utils.h"
+
+// Vertex clustering pre-decimation of huge meshes
+// (Rossignac & Borrel 1993 grid clustering, representatives by Lindstrom 2000 "Out-of-core simplification").
+//
+// 1. Cell size is chosen from surface area, so that about target_faces / 2 cells are occupied.
+// 2. Every vertex goes to the cell of its position; cells with vertices are clusters.
+// 3. Plane quadric of every face is added to clusters of its corners. Face survives if its corners
+//    are in three different clusters. Duplicated faces are removed.
+// 4. Representative of cluster minimizes its quadric; if it is singular or leaves the cell, the mean of
+//    cluster vertices is used.
+//
+// All passes are linear and parallel. Sums are accumulated in per thread caches of clusters flushed
+// with atomics, faces are only read once in order: binary PLY files are memory mapped, so the input mesh
+// doesn't need to fit in RAM. The result is a manageable intermediate mesh for the precise QEM pass.
+
+// Binary little endian PLY with float x, y, z vertices and triangle lists (uchar count, 32-bit indices):
+// vertex records of v_stride bytes start at data_offset, face records of f_stride bytes follow them
+struct PlyLayout {
+    ulong v_count = 0, t_count = 0;
+    ulong v_stride = 0, f_stride = 1 + 3 * sizeof(uint32_t);
+    ulong xyz_offset[3] = {0, 0, 0};
+    ulong data_offset = 0;
+};
+
+// Layout of supported PLY file (false if it isn't one)
+bool read_ply_layout(fs::path const & path, PlyLayout & layout);
+
+// Supported PLY file mapped read-only: records are read in place, pages are loaded and dropped by the system,
+// so the mesh doesn't need to fit in RAM
+class MappedPly {
+    void * mapped = nullptr;
+    ulong size = 0;
+    char const * vertices = nullptr;
+    char const * triangles = nullptr;
+public:
+    PlyLayout layout;
+
+    explicit MappedPly(fs::path const & path);
+    ~MappedPly();
+    MappedPly(MappedPly const &) = delete;
+    MappedPly & operator=(MappedPly const &) = delete;
+
+    // File is supported and mapped
+    bool is_open() const { return mapped != nullptr; }
+
+    // Faces which aren't triangles (records of other sizes can't be read in place)
+    ulong polygons_count() const;
+
+    void vertex(ulong const i, float xyz[3]) const;
+    void face(ulong const i, uint32_t ids[3]) const;
+};
+
+class VertexClustering {
+public:
+    std::vector<CompactMeshSimplify::Point> points;
+    std::vector<CompactMeshSimplify::Face> faces;
+
+    explicit VertexClustering(ulong const target_faces);
+
+    // In memory mesh: 3 floats per vertex, 3 indices per face
+    bool cluster(float const * vertices, ulong const v_count, uint32_t const * triangles, ulong const t_count);
+
+    // Binary little endian PLY with float x, y, z vertices and triangles, read through memory mapping
+    bool cluster_ply(fs::path const & path);
+private:
+    ulong target_faces;
+
+    template <class VertexAt, class FaceAt>
+    bool cluster(ulong const v_count, VertexAt const & vertex_at, ulong const t_count, FaceAt const & face_at);
+};
+
+#endif //RECONSTRUCTION_VERTEX_CLUSTERING_H
@@ -0,0 +1,256 @@
+//
+// Created by user on 10/18/26.
+//
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include "view_selection.h"
+
+// Every point is covered by this many selected views (or by all views which see it)
+static ulong const MIN_COVERAGE = 3;
+// Selection stops when this part of points is covered: the last points need views of their own
+static double const COVERED_POINTS = 0.95;
+// Depth map neighbours of every selected view
+static ulong const MIN_NEIGHBOURS = 2;
+// Shared points with a good angle which make two views neighbours
+static ulong const MIN_SHARED_POINTS = 10;
+// Triangulation angle good for depth estimation, degrees
+static double const MIN_ANGLE = 3.0;
+static double const MAX_ANGLE = 45.0;
+// Views without good angles are still selected if nothing else covers their points
+static double const MIN_BASELINE_FACTOR = 0.25;
+
+ViewSelection::ViewSelection(MVS::Scene & scene) : scene(scene) {}
+
+// Visibility, baseline and resolution of every view
+void ViewSelection::score_views() {
+    ulong const n = scene.images.size();
+    ulong const points = scene.pointcloud.points.size();
+    double max_pixels = 0;
+    for (auto & image : scene.images) {
+        if (image.IsValid()) {
+            image.UpdateCamera(scene.platforms);
+            max_pixels = std::max(max_pixels, (double)image.width * image.height);
+        }
+    }
+    resolution.assign(n, 1.0);
+    for (ulong v = 0; v < n; ++v) {
+        double pixels = (double)scene.images[v].width * scene.images[v].height;
+        if ((max_pixels > 0) && (pixels > 0)) {
+            resolution[v] = std::sqrt(pixels / max_pixels);
+        }
+    }
+
+    point_views.assign(points, std::vector<uint32_t>());
+    view_points.assign(n, std::vector<uint32_t>());
+    for (ulong p = 0; p < std::min(points, (ulong)scene.pointcloud.pointViews.size()); ++p) {
+        for (auto v : scene.pointcloud.pointViews[p]) {
+            if ((v < n) && scene.images[v].IsValid()) {
+                point_views[p].push_back(v);
+                view_points[v].push_back(uint32_t(p));
+            }
+        }
+    }
+
+    // Triangulation angle of every shared point of every pair of views
+    std::vector<ulong> observations(n, 0), good_observations(n, 0);
+    std::unordered_map<uint64_t, ulong> good_shared;
+    double const min_cos = std::cos(MAX_ANGLE * M_PI / 180), max_cos = std::cos(MIN_ANGLE * M_PI / 180);
+    for (ulong p = 0; p < points; ++p) {
+        auto const & point = scene.pointcloud.points[p];
+        std::vector<uint32_t> const & views = point_views[p];
+        for (ulong i = 0; i < views.size(); ++i) {
+            auto const & a = scene.images[views[i]].camera.C;
+            double ax = point.x - a.x, ay = point.y - a.y, az = point.z - a.z;
+            double a_norm = std::sqrt(ax * ax + ay * ay + az * az);
+            for (ulong j = i + 1; j < views.size(); ++j) {
+                auto const & b = scene.images[views[j]].camera.C;
+                double bx = point.x - b.x, by = point.y - b.y, bz = point.z - b.z;
+                double norm = a_norm * std::sqrt(bx * bx + by * by + bz * bz);
+                double cos_angle = (norm > 0) ? (ax * bx + ay * by + az * bz) / norm : 1.0;
+                ++observations[views[i]];
+                ++observations[views[j]];
+                if ((cos_angle >= min_cos) && (cos_angle <= max_cos)) {
+                    ++good_observations[views[i]];
+                    ++good_observations[views[j]];
+                    ++good_shared[(uint64_t)std::min(views[i], views[j]) * n + std::max(views[i], views[j])];
+                }
+            }
+        }
+    }
+    baseline.assign(n, 0.0);
+    for (ulong v = 0; v < n; ++v) {
+        baseline[v] = observations[v] ? (double)good_observations[v] / observations[v] : 0.0;
+    }
+    neighbours.assign(n, std::vector<std::pair<ulong, uint32_t>>());
+    for (auto const & pair : good_shared) {
+        if (pair.second >= MIN_SHARED_POINTS) {
+            uint32_t a = uint32_t(pair.first / n), b = uint32_t(pair.first % n);
+            neighbours[a].push_back(std::make_pair(pair.second, b));
+            neighbours[b].push_back(std::make_pair(pair.second, a));
+        }
+    }
+    for (auto & list : neighbours) {
+        std::sort(list.rbegin(), list.rend());
+    }
+}
+
+// Greedy multi-cover of sparse points, then neighbours of the selected views
+std::vector<bool> ViewSelection::select() const {
+    ulong const n = scene.images.size();
+    // Selected views still needed by every point (points of one view can't be densified, they need none)
+    std::vector<ulong> deficit(point_views.size(), 0);
+    ulong uncovered = 0;
+    for (ulong p = 0; p < point_views.size(); ++p) {
+        if (point_views[p].size() >= 2) {
+            deficit[p] = std::min(MIN_COVERAGE, (ulong)point_views[p].size());
+            ++uncovered;
+        }
+    }
+    ulong const allowed_uncovered = ulong((1 - COVERED_POINTS) * uncovered);
+    auto score = [&](ulong const v) {
+        ulong coverage = 0;
+        for (auto p : view_points[v]) {
+            coverage += deficit[p] ? 1 : 0;
+        }
+        double baseline_factor = MIN_BASELINE_FACTOR + (1 - MIN_BASELINE_FACTOR) * baseline[v];
+        return coverage * baseline_factor * resolution[v];
+    };
+
+    // Scores only drop: a view whose updated score is still the best one is selected
+    std::vector<bool> selected(n, false);
+    std::priority_queue<std::pair<double, ulong>> candidates;
+    for (ulong v = 0; v < n; ++v) {
+        if (!view_points[v].empty()) {
+            candidates.push(std::make_pair(score(v), v));
+        }
+    }
+    while (!candidates.empty() && (uncovered > allowed_uncovered)) {
+        ulong v = candidates.top().second;
+        candidates.pop();
+        double current = score(v);
+        if (current <= 0) {
+            continue;
+        }
+        if (!candidates.empty() && (current < candidates.top().first)) {
+            candidates.push(std::make_pair(current, v));
+            continue;
+        }
+        selected[v] = true;
+        for (auto p : view_points[v]) {
+            if (deficit[p] && !--deficit[p]) {
+                --uncovered;
+            }
+        }
+    }
+
+    // Depth maps need neighbours: the best ones are added to views which have too few of them
+    std::deque<ulong> pending;
+    for (ulong v = 0; v < n; ++v) {
+        if (selected[v]) {
+            pending.push_back(v);
+        }
+    }
+    while (!pending.empty()) {
+        ulong v = pending.front();
+        pending.pop_front();
+        ulong count = std::count_if(neighbours[v].begin(), neighbours[v].end(),
+                                    [&selected](std::pair<ulong, uint32_t> const & neighbour) {
+            return selected[neighbour.second];
+        });
+        for (auto const & neighbour : neighbours[v]) {
+            if (count >= MIN_NEIGHBOURS) {
+                break;
+            }
+            if (!selected[neighbour.second]) {
+                selected[neighbour.second] = true;
+                pending.push_back(neighbour.second);
+                ++count;
+            }
+        }
+    }
+    return selected;
+}
+
+// Only selected views and points seen by 2 of them are left in the scene
+void ViewSelection::prune(std::vector<bool> const & selected, Result & result) {
+    // New index of every selected view
+    std::vector<uint32_t> index(scene.images.size(), NO_ID);
+    ulong kept = 0;
+    for (ulong v = 0; v < scene.images.size(); ++v) {
+        if (!selected[v]) {
+            continue;
+        }
+        index[v] = uint32_t(kept);
+        if (kept != v) {
+            scene.images[kept] = scene.images[v];
+        }
+        // Neighbours are chosen again by DensifyPointCloud
+        scene.images[kept].neighbors.Release();
+        ++kept;
+    }
+    scene.images.Resize(kept);
+    result.selected = kept;
+
+    MVS::PointCloud & cloud = scene.pointcloud;
+    ulong const points = std::min(cloud.points.size(), cloud.pointViews.size());
+    bool const colors = cloud.colors.size() == cloud.points.size();
+    bool const normals = cloud.normals.size() == cloud.points.size();
+    kept = 0;
+    for (ulong p = 0; p < points; ++p) {
+        MVS::PointCloud::ViewArr & views = cloud.pointViews[p];
+        ulong count = 0;
+        for (ulong i = 0; i < views.size(); ++i) {
+            if ((views[i] < index.size()) && (index[views[i]] != NO_ID)) {
+                views[count++] = index[views[i]];
+            }
+        }
+        if (count < 2) {
+            continue;
+        }
+        views.Resize(count);
+        if (kept != p) {
+            cloud.points[kept] = cloud.points[p];
+            cloud.pointViews[kept] = views;
+            if (colors) {
+                cloud.colors[kept] = cloud.colors[p];
+            }
+            if (normals) {
+                cloud.normals[kept] = cloud.normals[p];
+            }
+        }
+        ++kept;
+    }
+    cloud.points.Resize(kept);
+    cloud.pointViews.Resize(kept);
+    if (colors) {
+        cloud.colors.Resize(kept);
+    }
+    if (normals) {
+        cloud.normals.Resize(kept);
+    }
+    // Weights are per view of every point, sparse scenes of the interface don't have them
+    cloud.pointWeights.Release();
+    result.points_kept = kept;
+}
+
+// Scene is pruned to the selected views. Result counts views and points before and after
+ViewSelection::Result ViewSelection::run() {
+    Result result;
+    for (auto const & image : scene.images) {
+        result.views += image.IsValid() ? 1 : 0;
+    }
+    result.points = scene.pointcloud.points.size();
+    score_views();
+    std::vector<bool> selected = select();
+    // Without visibility of sparse points every registered view is kept
+    if (std::find(selected.begin(), selected.end(), true) == selected.end()) {
+        for (ulong v = 0; v < scene.images.size(); ++v) {
+            selected[v] = scene.images[v].IsValid();
+        }
+    }
+    prune(selected, result);
+    return result;
+}
@@ -0,0 +1,58 @@
+//
+// Created by user on 10/18/26.
+//
+
+#ifndef RECONSTRUCTION_VIEW_SELECTION_H
+#define RECONSTRUCTION_VIEW_SELECTION_H
+
+#include <OpenMVS/MVS.h>
+#include "utils.h"
+
+// View selection on the sparse scene before DensifyPointCloud and TextureMesh.
+//
+// Dense captures have many redundant views: every one of them gets a depth map and is a texture candidate.
+// A minimal subset of views is chosen greedily, as weighted set multi-cover of sparse points:
+//    score(view) = new coverage * baseline * resolution
+// New coverage is the number of sparse points it sees which are seen by less than 3 selected views
+// (fewer if fewer views see them at all). Baseline is the part of its shared points with the other views
+// whose triangulation angle is good for depth estimation (3..45 degrees), resolution is its linear size
+// relative to the largest view. Coverage only drops as views are selected, so scores are evaluated lazily.
+// Selection stops when 95% of points are covered: the rest would keep views which add little else.
+// Then every selected view gets at least 2 selected neighbours (views sharing 10 points with a good angle),
+// they are depth map neighbours of DensifyPointCloud: the best unselected neighbours are added.
+// Unregistered views and sparse points seen by less than 2 selected views are removed from the scene.
+
+class ViewSelection {
+public:
+    struct Result {
+        ulong views = 0;
+        ulong selected = 0;
+        ulong points = 0;
+        ulong points_kept = 0;
+    };
+private:
+    MVS::Scene & scene;
+    // Views of every point, only valid (registered) views
+    std::vector<std::vector<uint32_t>> point_views;
+    std::vector<std::vector<uint32_t>> view_points;
+    std::vector<double> baseline;
+    std::vector<double> resolution;
+    // Neighbours of every view with their shared points of a good angle, the best first
+    std::vector<std::vector<std::pair<ulong, uint32_t>>> neighbours;
+
+    // Visibility, baseline and resolution of every view
+    void score_views();
+
+    // Greedy multi-cover of sparse points, then neighbours of the selected views
+    std::vector<bool> select() const;
+
+    // Only selected views and points seen by 2 of them are left in the scene
+    void prune(std::vector<bool> const & selected, Result & result);
+public:
+    explicit ViewSelection(MVS::Scene & scene);
+
+    // Scene is pruned to the selected views. Result counts views and points before and after
+    Result run();
+};
+
+#endif //RECONSTRUCTION_VIEW_SELECTION_H